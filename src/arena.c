@@ -0,0 +1,173 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * arena.c -- memory arenas freed all at once.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file arena.c
+ * Memory arenas freed all at once.
+ *
+ * An arena allocates memory from a list of large chunks by bumping a position
+ * in the newest chunk. Each allocation is preceded by a header with its size
+ * so it can be reallocated. Freeing or growing the most recent allocation is
+ * done in place, which handles the common pattern of a buffer being doubled
+ * repeatedly. Other frees do nothing, and the memory is only returned when
+ * the whole arena is freed. */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include "librsync.h"
+#include "util.h"
+#include "trace.h"
+
+/** Minimum size of arena chunks. */
+#define RS_ARENA_CHUNK (64 * 1024)
+
+/** Alignment of arena allocations. */
+#define RS_ARENA_ALIGN 16
+
+/** Size of the header before each allocation. */
+#define RS_ARENA_HDR RS_ARENA_ALIGN
+
+/** Round \p n up to the allocation alignment. */
+#define rs_arena_round(n) (((n) + RS_ARENA_ALIGN - 1) & ~(size_t)(RS_ARENA_ALIGN - 1))
+
+typedef struct rs_arena_chunk {
+    struct rs_arena_chunk *next;        /**< The next older chunk. */
+    size_t size;                /**< The size of data[]. */
+    size_t pos;                 /**< The used size of data[]. */
+    size_t last;                /**< The offset of the last allocation. */
+    char pad[RS_ARENA_ALIGN - 4 * sizeof(size_t) % RS_ARENA_ALIGN];
+    unsigned char data[];
+} rs_arena_chunk_t;
+
+struct rs_arena {
+    rs_allocator_t allocator;   /**< The allocator for this arena. */
+    size_t limit;               /**< The maximum bytes to use or 0. */
+    size_t used;                /**< The bytes used by all chunks. */
+    rs_arena_chunk_t *chunks;   /**< The newest chunk. */
+};
+
+/** Get the size of an allocation from its header. */
+static inline size_t *rs_arena_hdr(void *ptr)
+{
+    return (size_t *)((unsigned char *)ptr - RS_ARENA_HDR);
+}
+
+/** Check if \p ptr is the last allocation in the newest chunk. */
+static inline int rs_arena_is_last(rs_arena_t *arena, void *ptr)
+{
+    rs_arena_chunk_t *c = arena->chunks;
+
+    return c && (unsigned char *)ptr == c->data + c->last + RS_ARENA_HDR;
+}
+
+static void *rs_arena_alloc(void *ctx, size_t size)
+{
+    rs_arena_t *arena = ctx;
+    rs_arena_chunk_t *c = arena->chunks;
+    size_t need = RS_ARENA_HDR + rs_arena_round(size), csize;
+    unsigned char *p;
+
+    if (!c || c->size - c->pos < need) {
+        /* Start a new chunk, big enough for this allocation. */
+        csize = need > RS_ARENA_CHUNK ? need : RS_ARENA_CHUNK;
+        if (arena->limit && arena->used + sizeof(*c) + csize > arena->limit)
+            return NULL;
+        if (!(c = rs_alloc_with(NULL, sizeof(*c) + csize, "arena chunk")))
+            return NULL;
+        arena->used += sizeof(*c) + csize;
+        c->next = arena->chunks;
+        c->size = csize;
+        c->pos = c->last = 0;
+        arena->chunks = c;
+    }
+    p = c->data + c->pos;
+    *(size_t *)p = size;
+    c->last = c->pos;
+    c->pos += need;
+    return p + RS_ARENA_HDR;
+}
+
+static void *rs_arena_realloc(void *ctx, void *ptr, size_t size)
+{
+    rs_arena_t *arena = ctx;
+    rs_arena_chunk_t *c = arena->chunks;
+    size_t old;
+    void *p;
+
+    if (!ptr)
+        return rs_arena_alloc(ctx, size);
+    old = *rs_arena_hdr(ptr);
+    /* Grow or shrink the last allocation in place if it fits. */
+    if (rs_arena_is_last(arena, ptr)
+        && c->size - c->last >= RS_ARENA_HDR + rs_arena_round(size)) {
+        *rs_arena_hdr(ptr) = size;
+        c->pos = c->last + RS_ARENA_HDR + rs_arena_round(size);
+        return ptr;
+    }
+    if (size <= old) {
+        *rs_arena_hdr(ptr) = size;
+        return ptr;
+    }
+    if (!(p = rs_arena_alloc(ctx, size)))
+        return NULL;
+    memcpy(p, ptr, old);
+    return p;
+}
+
+static void rs_arena_dealloc(void *ctx, void *ptr)
+{
+    rs_arena_t *arena = ctx;
+
+    /* Only the last allocation can be given back. */
+    if (rs_arena_is_last(arena, ptr))
+        arena->chunks->pos = arena->chunks->last;
+}
+
+rs_arena_t *rs_arena_new(size_t limit)
+{
+    rs_arena_t *arena = rs_alloc_struct(rs_arena_t);
+
+    arena->allocator.alloc = rs_arena_alloc;
+    arena->allocator.realloc = rs_arena_realloc;
+    arena->allocator.free = rs_arena_dealloc;
+    arena->allocator.ctx = arena;
+    arena->limit = limit;
+    return arena;
+}
+
+const rs_allocator_t *rs_arena_allocator(rs_arena_t *arena)
+{
+    return &arena->allocator;
+}
+
+size_t rs_arena_used(rs_arena_t const *arena)
+{
+    return arena->used;
+}
+
+void rs_arena_free(rs_arena_t *arena)
+{
+    rs_arena_chunk_t *c, *next;
+
+    for (c = arena->chunks; c; c = next) {
+        next = c->next;
+        rs_free(c);
+    }
+    rs_free(arena);
+}
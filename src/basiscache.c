@@ -0,0 +1,377 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * basiscache.c -- a bounded LRU cache of basis file extents.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "librsync.h"
+#include "basiscache.h"
+#include "uring.h"
+#include "trace.h"
+#include "util.h"
+
+/** A cached extent of the basis file. */
+typedef struct rs_basis_extent {
+    rs_long_t pos;              /**< Basis position of the first byte. */
+    size_t len;                 /**< Length of the cached data. */
+    rs_byte_t *buf;             /**< The cached data. */
+    unsigned long used;         /**< LRU stamp of the last use. */
+    int pending;                /**< If an async read is still in flight. */
+    int fresh;                  /**< If prefetched and not used yet. */
+} rs_basis_extent_t;
+
+struct rs_basis_cache {
+    size_t size;                /**< Maximum total size of cached data. */
+    size_t used;                /**< Current total size of cached data. */
+    size_t extent_max;          /**< Maximum size of a single extent. */
+    unsigned long clock;        /**< LRU clock incremented on every use. */
+    int count;                  /**< Number of cached extents. */
+    int alloc;                  /**< Allocated size of the extents array. */
+    rs_basis_extent_t *extents; /**< The cached extents. */
+    rs_uring_t *uring;          /**< Async reader, or NULL if disabled. */
+    int fd;                     /**< The basis file descriptor for uring. */
+    size_t ahead;               /**< Size of pending and fresh extents. */
+    int refill;                 /**< If prefetching should be done. */
+    /* Statistics. */
+    rs_long_t hits, misses, reads, read_bytes;
+};
+
+/** Create a new basis cache holding at most \p size bytes.
+ *
+ * Individual extents are limited to a quarter of the cache size so that the
+ * cache can always hold several extents. */
+rs_basis_cache_t *rs_basis_cache_new(size_t size)
+{
+    rs_basis_cache_t *cache = rs_alloc_struct(rs_basis_cache_t);
+
+    cache->size = size;
+    cache->extent_max = size / 4;
+    return cache;
+}
+
+void rs_basis_cache_free(rs_basis_cache_t *cache)
+{
+    int i;
+
+    rs_trace("basis cache hits=" FMT_LONG " misses=" FMT_LONG " reads="
+             FMT_LONG " read_bytes=" FMT_LONG, cache->hits, cache->misses,
+             cache->reads, cache->read_bytes);
+    /* Free the uring first to wait for pending reads into the extents. */
+    if (cache->uring)
+        rs_uring_free(cache->uring);
+    for (i = 0; i < cache->count; i++)
+        rs_free(cache->extents[i].buf);
+    rs_free(cache->extents);
+    rs_bzero(cache, sizeof(*cache));
+    rs_free(cache);
+}
+
+/** Get the maximum size of a single cached extent.
+ *
+ * Copies at least this big should bypass the cache. */
+size_t rs_basis_cache_extent_max(rs_basis_cache_t const *cache)
+{
+    return cache->extent_max;
+}
+
+/* Get the extent containing pos, including pending extents. */
+static rs_basis_extent_t *rs_basis_cache_get(rs_basis_cache_t *cache,
+                                             rs_long_t pos)
+{
+    int i;
+
+    for (i = 0; i < cache->count; i++) {
+        rs_basis_extent_t *e = &cache->extents[i];
+
+        if (e->pos <= pos && pos < e->pos + (rs_long_t)e->len)
+            return e;
+    }
+    return NULL;
+}
+
+/** Find cached data at a basis position.
+ *
+ * \param pos The basis position to look for.
+ *
+ * \param len On input the amount of data wanted, updated to the amount of
+ * cached data available at \p pos which is never more than the input value.
+ *
+ * \return A pointer to the cached data, or NULL if \p pos is not cached or
+ * is still being read. */
+void *rs_basis_cache_find(rs_basis_cache_t *cache, rs_long_t pos, size_t *len)
+{
+    rs_basis_extent_t *e = rs_basis_cache_get(cache, pos);
+    size_t off;
+
+    if (!e || e->pending) {
+        cache->misses++;
+        cache->refill = 1;
+        return NULL;
+    }
+    off = (size_t)(pos - e->pos);
+    if (*len > e->len - off)
+        *len = e->len - off;
+    if (e->fresh) {
+        /* Starting to use a prefetched extent, so prefetch more. */
+        e->fresh = 0;
+        cache->ahead -= e->len;
+        cache->refill = 1;
+    }
+    e->used = ++cache->clock;
+    cache->hits++;
+    return e->buf + off;
+}
+
+/* Remove the extent at index i. */
+static void rs_basis_cache_remove(rs_basis_cache_t *cache, int i)
+{
+    rs_basis_extent_t *e = &cache->extents[i];
+
+    cache->used -= e->len;
+    if (e->fresh)
+        cache->ahead -= e->len;
+    rs_free(e->buf);
+    *e = cache->extents[--cache->count];
+}
+
+/* Wait for one asynchronous read to complete and update its extent. */
+static int rs_basis_cache_complete(rs_basis_cache_t *cache)
+{
+    rs_basis_extent_t *e;
+    void *data;
+    int i, res;
+
+    if (rs_uring_wait(cache->uring, &data, &res) < 0) {
+        rs_error("waiting for basis reads failed");
+        return -1;
+    }
+    for (i = 0; i < cache->count && cache->extents[i].buf != data; i++) ;
+    assert(i < cache->count);
+    e = &cache->extents[i];
+    e->pending = 0;
+    cache->reads++;
+    if (res <= 0) {
+        /* Leave failed reads for the synchronous copy_cb to report. */
+        rs_trace("async basis read at offset " FMT_LONG " failed: %d", e->pos,
+                 res);
+        rs_basis_cache_remove(cache, i);
+        return 0;
+    }
+    cache->read_bytes += res;
+    if ((size_t)res < e->len) {
+        /* A short read at the end of the basis. */
+        cache->used -= e->len - (size_t)res;
+        if (e->fresh)
+            cache->ahead -= e->len - (size_t)res;
+        e->len = (size_t)res;
+        e->buf = rs_realloc(e->buf, e->len, "basis cache extent");
+    }
+    return 0;
+}
+
+/* Evict least recently used extents until there is room for len bytes.
+ *
+ * Extents with reads in flight cannot be evicted, so if there is nothing else
+ * this waits for a read to finish to keep the cache within its size.
+ * Prefetched extents that have not been used yet are only evicted if there is
+ * nothing else. */
+static void rs_basis_cache_evict(rs_basis_cache_t *cache, size_t len)
+{
+    while (cache->used + len > cache->size) {
+        int i, lru = -1, pending = 0;
+
+        for (i = 0; i < cache->count; i++) {
+            rs_basis_extent_t *e = &cache->extents[i];
+
+            if (e->pending) {
+                pending = 1;
+                continue;
+            }
+            if (lru < 0 || e->fresh < cache->extents[lru].fresh
+                || (e->fresh == cache->extents[lru].fresh
+                    && e->used < cache->extents[lru].used))
+                lru = i;
+        }
+        if (lru < 0) {
+            if (pending && rs_basis_cache_complete(cache) == 0)
+                continue;
+            return;
+        }
+        rs_trace("evicting extent " FMT_SIZE " bytes at offset " FMT_LONG,
+                 cache->extents[lru].len, cache->extents[lru].pos);
+        rs_basis_cache_remove(cache, lru);
+    }
+}
+
+/* Add a new extent to the cache. */
+static rs_basis_extent_t *rs_basis_cache_add(rs_basis_cache_t *cache,
+                                             rs_long_t pos, size_t len,
+                                             rs_byte_t *buf)
+{
+    rs_basis_extent_t *e;
+
+    if (cache->count == cache->alloc) {
+        cache->alloc = cache->alloc ? 2 * cache->alloc : 8;
+        cache->extents =
+            rs_realloc(cache->extents, cache->alloc * sizeof(*cache->extents),
+                       "basis cache extents");
+    }
+    e = &cache->extents[cache->count++];
+    e->pos = pos;
+    e->len = len;
+    e->buf = buf;
+    e->used = ++cache->clock;
+    e->pending = e->fresh = 0;
+    cache->used += len;
+    return e;
+}
+
+/** Read an extent of the basis into the cache.
+ *
+ * This reads up to \p len bytes at \p pos using \p copy_cb, calling it
+ * repeatedly until at least \p need bytes have been read. Reading less than
+ * \p len bytes is fine if the callback returns a short read after the first
+ * \p need bytes, which happens at the end of the basis.
+ *
+ * \param len The size of the extent to read. It is truncated to
+ * rs_basis_cache_extent_max().
+ *
+ * \param need The amount of data that must be read, which must not be more
+ * than \p len.
+ *
+ * \return RS_DONE if the extent was read, or the error returned by \p copy_cb
+ * if fewer than \p need bytes could be read. */
+rs_result rs_basis_cache_read(rs_basis_cache_t *cache, rs_copy_cb *copy_cb,
+                              void *copy_arg, rs_long_t pos, size_t len,
+                              size_t need)
+{
+    rs_result result;
+    rs_byte_t *buf;
+    size_t got = 0;
+
+    if (len > cache->extent_max)
+        len = cache->extent_max;
+    assert(0 < need && need <= len);
+    buf = rs_alloc(len, "basis cache extent");
+    while (got < need) {
+        size_t n = len - got;
+        void *ptr = buf + got;
+
+        result = copy_cb(copy_arg, pos + (rs_long_t)got, &n, &ptr);
+        if (result != RS_DONE) {
+            rs_free(buf);
+            return result;
+        }
+        assert(n <= len - got);
+        if (ptr != buf + got)
+            memcpy(buf + got, ptr, n);
+        got += n;
+        cache->reads++;
+        cache->read_bytes += (rs_long_t)n;
+        /* A zero length read would loop forever, so treat it as eof. */
+        if (!n && got < need) {
+            rs_free(buf);
+            return RS_INPUT_ENDED;
+        }
+    }
+    rs_trace("cached " FMT_SIZE " bytes from basis at offset " FMT_LONG, got,
+             pos);
+    if (got < len)
+        buf = rs_realloc(buf, got, "basis cache extent");
+    rs_basis_cache_evict(cache, got);
+    rs_basis_cache_add(cache, pos, got, buf);
+    return RS_DONE;
+}
+
+/** Enable asynchronous reads into the cache.
+ *
+ * This uses io_uring to read from \p fd with up to \p depth reads in flight.
+ *
+ * \return RS_DONE if asynchronous reads were enabled, or RS_UNIMPLEMENTED if
+ * they are not supported. */
+rs_result rs_basis_cache_async(rs_basis_cache_t *cache, int fd, int depth)
+{
+    if (cache->uring)
+        rs_uring_free(cache->uring);
+    cache->uring = depth > 0 ? rs_uring_new((unsigned)depth) : NULL;
+    cache->fd = fd;
+    return cache->uring ? RS_DONE : RS_UNIMPLEMENTED;
+}
+
+/** Check if prefetching should be done.
+ *
+ * This is true when asynchronous reads are enabled and the cache has missed
+ * or started using a prefetched extent since the last check. */
+int rs_basis_cache_refill(rs_basis_cache_t *cache)
+{
+    int refill = cache->refill;
+
+    cache->refill = 0;
+    return cache->uring && refill;
+}
+
+/** Check if there is data cached or being read at \p pos. */
+int rs_basis_cache_contains(rs_basis_cache_t *cache, rs_long_t pos)
+{
+    return rs_basis_cache_get(cache, pos) != NULL;
+}
+
+/** Start an asynchronous read of a basis extent into the cache.
+ *
+ * Prefetching is limited to half the cache size and the maximum number of
+ * reads in flight.
+ *
+ * \return RS_DONE if the read was started, or RS_BLOCKED if no more reads can
+ * be started now. */
+rs_result rs_basis_cache_prefetch(rs_basis_cache_t *cache, rs_long_t pos,
+                                  size_t len)
+{
+    rs_basis_extent_t *e;
+    rs_byte_t *buf;
+
+    if (len > cache->extent_max)
+        len = cache->extent_max;
+    if (!cache->uring || cache->ahead + len > cache->size / 2)
+        return RS_BLOCKED;
+    rs_basis_cache_evict(cache, len);
+    if (cache->used + len > cache->size)
+        return RS_BLOCKED;
+    buf = rs_alloc(len, "basis cache extent");
+    if (rs_uring_read(cache->uring, cache->fd, buf, len, pos, buf) < 0) {
+        rs_free(buf);
+        return RS_BLOCKED;
+    }
+    rs_trace("prefetching " FMT_SIZE " bytes from basis at offset " FMT_LONG,
+             len, pos);
+    e = rs_basis_cache_add(cache, pos, len, buf);
+    e->pending = e->fresh = 1;
+    cache->ahead += len;
+    return RS_DONE;
+}
+
+/** Wait until any asynchronous read of data at \p pos has completed. */
+void rs_basis_cache_wait(rs_basis_cache_t *cache, rs_long_t pos)
+{
+    rs_basis_extent_t *e;
+
+    while ((e = rs_basis_cache_get(cache, pos)) && e->pending)
+        if (rs_basis_cache_complete(cache) < 0)
+            return;
+}
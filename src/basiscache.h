@@ -0,0 +1,75 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * basiscache.h -- a bounded LRU cache of basis file extents.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file basiscache.h
+ * A bounded LRU cache of basis file extents used by patch.
+ *
+ * Patch reads the basis file through a ::rs_copy_cb for every COPY command.
+ * Deltas frequently contain many small COPY commands that are adjacent or
+ * near each other in the basis, and each becoming an independent small read
+ * is slow on spinning disks and network filesystems. The cache lets patch
+ * read larger extents covering several COPY commands at once, and serves
+ * following COPY commands from memory.
+ *
+ * The total size of the cached extents is bounded by the size the cache was
+ * created with. Extents are never larger than rs_basis_cache_extent_max(), and
+ * the least recently used extents are evicted to make room for new ones.
+ *
+ * Optionally the cache can prefetch extents with asynchronous reads, keeping
+ * several reads in flight at once. Extents being read are not returned by
+ * rs_basis_cache_find() until rs_basis_cache_wait() has waited for them. */
+#ifndef BASISCACHE_H
+#  define BASISCACHE_H
+
+#  include <stddef.h>
+#  include "librsync.h"
+
+/** Minimum size of a read into the cache.
+ *
+ * Small reads are rounded up to this size so following COPY commands in the
+ * same part of the basis can be served from the cache. */
+#  define RS_BASIS_CACHE_MIN_READ (64 * 1024)
+
+/** Maximum gap between COPY commands that can be merged into one read. */
+#  define RS_BASIS_CACHE_MAX_GAP (64 * 1024)
+
+/** The default cache size used by rs_patch_file(). */
+#  define RS_BASIS_CACHE_DEFAULT (4 * 1024 * 1024)
+
+/** The default number of asynchronous reads in flight for rs_patch_file(). */
+#  define RS_BASIS_CACHE_DEPTH 8
+
+typedef struct rs_basis_cache rs_basis_cache_t;
+
+rs_basis_cache_t *rs_basis_cache_new(size_t size);
+void rs_basis_cache_free(rs_basis_cache_t *cache);
+size_t rs_basis_cache_extent_max(rs_basis_cache_t const *cache);
+void *rs_basis_cache_find(rs_basis_cache_t *cache, rs_long_t pos,
+                          size_t *len);
+rs_result rs_basis_cache_read(rs_basis_cache_t *cache, rs_copy_cb *copy_cb,
+                              void *copy_arg, rs_long_t pos, size_t len,
+                              size_t need);
+rs_result rs_basis_cache_async(rs_basis_cache_t *cache, int fd, int depth);
+int rs_basis_cache_refill(rs_basis_cache_t *cache);
+int rs_basis_cache_contains(rs_basis_cache_t *cache, rs_long_t pos);
+rs_result rs_basis_cache_prefetch(rs_basis_cache_t *cache, rs_long_t pos,
+                                  size_t len);
+void rs_basis_cache_wait(rs_basis_cache_t *cache, rs_long_t pos);
+
+#endif                          /* !BASISCACHE_H */
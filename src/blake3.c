@@ -0,0 +1,544 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file blake3.c
+ * The BLAKE3 hash.
+ *
+ * This follows the BLAKE3 reference implementation, hashing the input as a
+ * binary tree of 1KB chunks. Whole chunks that can't be the last chunk are
+ * hashed in batches, and with SSE2 four chunks are hashed at once with each
+ * in its own lane, or eight with AVX2 if the CPU supports it. Only the unkeyed
+ * hash is implemented.
+ *
+ * \sa https://github.com/BLAKE3-team/BLAKE3 */
+
+#include "config.h"
+#include <string.h>
+#include "blake3.h"
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+/* AVX2 is used if the CPU supports it when compiled with GCC or clang. */
+#if defined(__GNUC__) && defined(__x86_64__)
+#  define BLAKE3_AVX2
+#  include <immintrin.h>
+#endif
+
+#define BLOCK_LEN 64
+#define CHUNK_LEN RS_BLAKE3_CHUNK_LEN
+
+/** The maximum number of whole chunks hashed at once. */
+#define BATCH_LEN 16
+
+enum {
+    CHUNK_START = 1,
+    CHUNK_END = 2,
+    PARENT = 4,
+    ROOT = 8,
+};
+
+static const uint32_t IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+/** The message word order for each round. */
+static const uint8_t SCHEDULE[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+/** The input to the final compression that gives a node's output. */
+typedef struct output {
+    uint32_t cv[8];
+    uint32_t m[16];
+    uint32_t len;
+    uint64_t counter;
+    uint32_t flags;
+} output_t;
+
+static inline uint32_t load32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+        (uint32_t)p[3] << 24;
+}
+
+static inline void store32(uint8_t *p, uint32_t w)
+{
+    p[0] = (uint8_t)w;
+    p[1] = (uint8_t)(w >> 8);
+    p[2] = (uint8_t)(w >> 16);
+    p[3] = (uint8_t)(w >> 24);
+}
+
+static inline void load_block(uint32_t m[16], const uint8_t *block)
+{
+    int i;
+
+    for (i = 0; i < 16; i++)
+        m[i] = load32(block + 4 * i);
+}
+
+#define ROTR(w, c) ((w) >> (c) | (w) << (32 - (c)))
+
+#define G(a, b, c, d, x, y) do {\
+    v[a] += v[b] + (x); v[d] = ROTR(v[d] ^ v[a], 16);\
+    v[c] += v[d]; v[b] = ROTR(v[b] ^ v[c], 12);\
+    v[a] += v[b] + (y); v[d] = ROTR(v[d] ^ v[a], 8);\
+    v[c] += v[d]; v[b] = ROTR(v[b] ^ v[c], 7);\
+} while (0)
+
+/* The rounds are expanded with constant indexes so the state can be kept in
+   registers, using g for the G function. */
+#define ROUND(g, r) do {\
+    g(0, 4, 8, 12, m[SCHEDULE[r][0]], m[SCHEDULE[r][1]]);\
+    g(1, 5, 9, 13, m[SCHEDULE[r][2]], m[SCHEDULE[r][3]]);\
+    g(2, 6, 10, 14, m[SCHEDULE[r][4]], m[SCHEDULE[r][5]]);\
+    g(3, 7, 11, 15, m[SCHEDULE[r][6]], m[SCHEDULE[r][7]]);\
+    g(0, 5, 10, 15, m[SCHEDULE[r][8]], m[SCHEDULE[r][9]]);\
+    g(1, 6, 11, 12, m[SCHEDULE[r][10]], m[SCHEDULE[r][11]]);\
+    g(2, 7, 8, 13, m[SCHEDULE[r][12]], m[SCHEDULE[r][13]]);\
+    g(3, 4, 9, 14, m[SCHEDULE[r][14]], m[SCHEDULE[r][15]]);\
+} while (0)
+
+#define ROUNDS(g) do {\
+    ROUND(g, 0); ROUND(g, 1); ROUND(g, 2); ROUND(g, 3);\
+    ROUND(g, 4); ROUND(g, 5); ROUND(g, 6);\
+} while (0)
+
+/** Compress a block, giving the 16 word extended output in out. */
+static void compress(uint32_t out[16], const uint32_t cv[8],
+                     const uint32_t m[16], uint32_t len, uint64_t counter,
+                     uint32_t flags)
+{
+    uint32_t v[16];
+    int i;
+
+    for (i = 0; i < 8; i++)
+        v[i] = cv[i];
+    for (i = 0; i < 4; i++)
+        v[i + 8] = IV[i];
+    v[12] = (uint32_t)counter;
+    v[13] = (uint32_t)(counter >> 32);
+    v[14] = len;
+    v[15] = flags;
+    ROUNDS(G);
+    for (i = 0; i < 8; i++) {
+        out[i] = v[i] ^ v[i + 8];
+        out[i + 8] = v[i + 8] ^ cv[i];
+    }
+}
+
+/** Compress a block into the chaining value cv. */
+static void compress_cv(uint32_t cv[8], const uint32_t m[16], uint32_t len,
+                        uint64_t counter, uint32_t flags)
+{
+    uint32_t v[16];
+    int i;
+
+    for (i = 0; i < 8; i++)
+        v[i] = cv[i];
+    for (i = 0; i < 4; i++)
+        v[i + 8] = IV[i];
+    v[12] = (uint32_t)counter;
+    v[13] = (uint32_t)(counter >> 32);
+    v[14] = len;
+    v[15] = flags;
+    ROUNDS(G);
+    for (i = 0; i < 8; i++)
+        cv[i] = v[i] ^ v[i + 8];
+}
+
+static void output_cv(const output_t *o, uint32_t cv[8])
+{
+    memcpy(cv, o->cv, sizeof o->cv);
+    compress_cv(cv, o->m, o->len, o->counter, o->flags);
+}
+
+static void parent_output(output_t *o, const uint32_t left[8],
+                          const uint32_t right[8])
+{
+    memcpy(o->cv, IV, sizeof o->cv);
+    memcpy(o->m, left, 8 * sizeof *o->m);
+    memcpy(o->m + 8, right, 8 * sizeof *o->m);
+    o->len = BLOCK_LEN;
+    o->counter = 0;
+    o->flags = PARENT;
+}
+
+/** Hash a whole chunk that is not the root into its chaining value. */
+static void hash_chunk(const uint8_t *in, uint64_t counter, uint32_t cv[8])
+{
+    uint32_t m[16];
+    int b;
+
+    memcpy(cv, IV, sizeof IV);
+    for (b = 0; b < CHUNK_LEN / BLOCK_LEN; b++) {
+        load_block(m, in + b * BLOCK_LEN);
+        compress_cv(cv, m, BLOCK_LEN, counter,
+                    (b == 0 ? CHUNK_START : 0) |
+                    (b == CHUNK_LEN / BLOCK_LEN - 1 ? CHUNK_END : 0));
+    }
+}
+
+#ifdef __SSE2__
+#  define ADD4(a, b) _mm_add_epi32(a, b)
+#  define XOR4(a, b) _mm_xor_si128(a, b)
+#  define ROTR4(w, c) _mm_or_si128(_mm_srli_epi32(w, c), _mm_slli_epi32(w, 32 - (c)))
+
+#  define G4(a, b, c, d, x, y) do {\
+    v[a] = ADD4(ADD4(v[a], v[b]), x); v[d] = ROTR4(XOR4(v[d], v[a]), 16);\
+    v[c] = ADD4(v[c], v[d]); v[b] = ROTR4(XOR4(v[b], v[c]), 12);\
+    v[a] = ADD4(ADD4(v[a], v[b]), y); v[d] = ROTR4(XOR4(v[d], v[a]), 8);\
+    v[c] = ADD4(v[c], v[d]); v[b] = ROTR4(XOR4(v[b], v[c]), 7);\
+} while (0)
+
+/** Transpose 4 rows of 4 words into 4 columns. */
+static inline void transpose4(__m128i r[4])
+{
+    __m128i t0 = _mm_unpacklo_epi32(r[0], r[1]);
+    __m128i t1 = _mm_unpacklo_epi32(r[2], r[3]);
+    __m128i t2 = _mm_unpackhi_epi32(r[0], r[1]);
+    __m128i t3 = _mm_unpackhi_epi32(r[2], r[3]);
+
+    r[0] = _mm_unpacklo_epi64(t0, t1);
+    r[1] = _mm_unpackhi_epi64(t0, t1);
+    r[2] = _mm_unpacklo_epi64(t2, t3);
+    r[3] = _mm_unpackhi_epi64(t2, t3);
+}
+
+/** Hash 4 consecutive whole chunks at once, one in each SSE2 lane. */
+static void hash_chunks4(const uint8_t *in, uint64_t counter,
+                         uint32_t cvs[4][8])
+{
+    __m128i h[8], v[16], m[16];
+    int b, i, k;
+
+    for (i = 0; i < 8; i++)
+        h[i] = _mm_set1_epi32((int)IV[i]);
+    for (b = 0; b < CHUNK_LEN / BLOCK_LEN; b++) {
+        /* Lane i of m[j] is word j of the block in chunk i. */
+        for (k = 0; k < 4; k++) {
+            for (i = 0; i < 4; i++)
+                m[4 * k + i] =
+                    _mm_loadu_si128((const __m128i *)(in + i * CHUNK_LEN +
+                                                      b * BLOCK_LEN + 16 * k));
+            transpose4(m + 4 * k);
+        }
+        for (i = 0; i < 8; i++)
+            v[i] = h[i];
+        for (i = 0; i < 4; i++)
+            v[i + 8] = _mm_set1_epi32((int)IV[i]);
+        v[12] = _mm_set_epi32((int)(uint32_t)(counter + 3),
+                              (int)(uint32_t)(counter + 2),
+                              (int)(uint32_t)(counter + 1),
+                              (int)(uint32_t)counter);
+        v[13] = _mm_set_epi32((int)(uint32_t)((counter + 3) >> 32),
+                              (int)(uint32_t)((counter + 2) >> 32),
+                              (int)(uint32_t)((counter + 1) >> 32),
+                              (int)(uint32_t)(counter >> 32));
+        v[14] = _mm_set1_epi32(BLOCK_LEN);
+        v[15] = _mm_set1_epi32((b == 0 ? CHUNK_START : 0) |
+                               (b == CHUNK_LEN / BLOCK_LEN - 1 ? CHUNK_END : 0));
+        ROUNDS(G4);
+        for (i = 0; i < 8; i++)
+            h[i] = XOR4(v[i], v[i + 8]);
+    }
+    transpose4(h);
+    transpose4(h + 4);
+    for (i = 0; i < 4; i++) {
+        _mm_storeu_si128((__m128i *)cvs[i], h[i]);
+        _mm_storeu_si128((__m128i *)(cvs[i] + 4), h[i + 4]);
+    }
+}
+#endif                          /* __SSE2__ */
+
+#ifdef BLAKE3_AVX2
+#  define ADD8(a, b) _mm256_add_epi32(a, b)
+#  define XOR8(a, b) _mm256_xor_si256(a, b)
+#  define ROTR8(w, c) _mm256_or_si256(_mm256_srli_epi32(w, c), _mm256_slli_epi32(w, 32 - (c)))
+/* Rotates by whole bytes are done with byte shuffles. */
+#  define ROTR8_BYTES(w, mask) _mm256_shuffle_epi8(w, mask)
+
+#  define G8(a, b, c, d, x, y) do {\
+    v[a] = ADD8(ADD8(v[a], v[b]), x); v[d] = ROTR8_BYTES(XOR8(v[d], v[a]), rot16);\
+    v[c] = ADD8(v[c], v[d]); v[b] = ROTR8(XOR8(v[b], v[c]), 12);\
+    v[a] = ADD8(ADD8(v[a], v[b]), y); v[d] = ROTR8_BYTES(XOR8(v[d], v[a]), rot8);\
+    v[c] = ADD8(v[c], v[d]); v[b] = ROTR8(XOR8(v[b], v[c]), 7);\
+} while (0)
+
+/** Transpose 8 rows of 8 words into 8 columns. */
+__attribute__((target("avx2")))
+static inline void transpose8(__m256i r[8])
+{
+    __m256i t[8], u[8];
+    int i;
+
+    for (i = 0; i < 8; i += 2) {
+        t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+        t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+    }
+    for (i = 0; i < 8; i += 4) {
+        u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+        u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+        u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+        u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+    }
+    for (i = 0; i < 4; i++) {
+        r[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+        r[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+    }
+}
+
+/** Hash 8 consecutive whole chunks at once, one in each AVX2 lane. */
+__attribute__((target("avx2")))
+static void hash_chunks8(const uint8_t *in, uint64_t counter,
+                         uint32_t cvs[8][8])
+{
+    const __m256i rot16 =
+        _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                         2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rot8 =
+        _mm256_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12,
+                         1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+    __m256i h[8], v[16], m[16], ctr_lo, ctr_hi;
+    int b, i, k;
+
+    ctr_lo = _mm256_setr_epi32((int)(uint32_t)counter,
+                               (int)(uint32_t)(counter + 1),
+                               (int)(uint32_t)(counter + 2),
+                               (int)(uint32_t)(counter + 3),
+                               (int)(uint32_t)(counter + 4),
+                               (int)(uint32_t)(counter + 5),
+                               (int)(uint32_t)(counter + 6),
+                               (int)(uint32_t)(counter + 7));
+    ctr_hi = _mm256_setr_epi32((int)(uint32_t)(counter >> 32),
+                               (int)(uint32_t)((counter + 1) >> 32),
+                               (int)(uint32_t)((counter + 2) >> 32),
+                               (int)(uint32_t)((counter + 3) >> 32),
+                               (int)(uint32_t)((counter + 4) >> 32),
+                               (int)(uint32_t)((counter + 5) >> 32),
+                               (int)(uint32_t)((counter + 6) >> 32),
+                               (int)(uint32_t)((counter + 7) >> 32));
+    for (i = 0; i < 8; i++)
+        h[i] = _mm256_set1_epi32((int)IV[i]);
+    for (b = 0; b < CHUNK_LEN / BLOCK_LEN; b++) {
+        /* Lane i of m[j] is word j of the block in chunk i. */
+        for (k = 0; k < 2; k++) {
+            for (i = 0; i < 8; i++)
+                m[8 * k + i] =
+                    _mm256_loadu_si256((const __m256i *)(in + i * CHUNK_LEN +
+                                                         b * BLOCK_LEN +
+                                                         32 * k));
+            transpose8(m + 8 * k);
+        }
+        for (i = 0; i < 8; i++)
+            v[i] = h[i];
+        for (i = 0; i < 4; i++)
+            v[i + 8] = _mm256_set1_epi32((int)IV[i]);
+        v[12] = ctr_lo;
+        v[13] = ctr_hi;
+        v[14] = _mm256_set1_epi32(BLOCK_LEN);
+        v[15] = _mm256_set1_epi32((b == 0 ? CHUNK_START : 0) |
+                                  (b == CHUNK_LEN / BLOCK_LEN - 1 ? CHUNK_END : 0));
+        ROUNDS(G8);
+        for (i = 0; i < 8; i++)
+            h[i] = XOR8(v[i], v[i + 8]);
+    }
+    transpose8(h);
+    for (i = 0; i < 8; i++)
+        _mm256_storeu_si256((__m256i *)cvs[i], h[i]);
+}
+#endif                          /* BLAKE3_AVX2 */
+
+/** Hash n consecutive whole chunks into their chaining values. */
+static void hash_chunks(const uint8_t *in, size_t n, uint64_t counter,
+                        uint32_t cvs[][8])
+{
+#ifdef BLAKE3_AVX2
+    if (n >= 8 && __builtin_cpu_supports("avx2"))
+        for (; n >= 8; n -= 8, in += 8 * CHUNK_LEN, counter += 8, cvs += 8)
+            hash_chunks8(in, counter, cvs);
+#endif
+#ifdef __SSE2__
+    for (; n >= 4; n -= 4, in += 4 * CHUNK_LEN, counter += 4, cvs += 4)
+        hash_chunks4(in, counter, cvs);
+#endif
+    for (; n; n--, in += CHUNK_LEN, counter++, cvs++)
+        hash_chunk(in, counter, *cvs);
+}
+
+/** Add a finished chunk's chaining value to the tree.
+ *
+ * This merges completed subtrees, which is only done when more input follows
+ * the chunk, so none of them can be the root. The number of subtrees to merge
+ * is the number of trailing zero bits in the total chunk count. */
+static void add_chunk_cv(rs_blake3_t *ctx, uint32_t cv[8], uint64_t total)
+{
+    output_t o;
+
+    while (!(total & 1)) {
+        parent_output(&o, ctx->stack[--ctx->stack_len], cv);
+        output_cv(&o, cv);
+        total >>= 1;
+    }
+    memcpy(ctx->stack[ctx->stack_len++], cv, 8 * sizeof *cv);
+}
+
+static inline size_t chunk_len(rs_blake3_t const *ctx)
+{
+    return (size_t)ctx->blocks_compressed * BLOCK_LEN + (size_t)ctx->buf_len;
+}
+
+static void chunk_reset(rs_blake3_t *ctx, uint64_t counter)
+{
+    memcpy(ctx->cv, IV, sizeof IV);
+    ctx->chunk_counter = counter;
+    ctx->buf_len = 0;
+    ctx->blocks_compressed = 0;
+}
+
+static void chunk_output(rs_blake3_t const *ctx, output_t *o)
+{
+    uint8_t block[BLOCK_LEN];
+
+    memcpy(block, ctx->buf, (size_t)ctx->buf_len);
+    memset(block + ctx->buf_len, 0, (size_t)(BLOCK_LEN - ctx->buf_len));
+    memcpy(o->cv, ctx->cv, sizeof o->cv);
+    load_block(o->m, block);
+    o->len = (uint32_t)ctx->buf_len;
+    o->counter = ctx->chunk_counter;
+    o->flags = (ctx->blocks_compressed ? 0 : CHUNK_START) | CHUNK_END;
+}
+
+/** Add input to the current chunk, returning how much fitted.
+ *
+ * The last block is kept in buf until more input follows it, because the
+ * chunk's last block is compressed with different flags. */
+static size_t chunk_update(rs_blake3_t *ctx, const uint8_t *in, size_t n)
+{
+    size_t len = CHUNK_LEN - chunk_len(ctx), take;
+    uint32_t m[16];
+
+    if (n > len)
+        n = len;
+    len = n;
+    while (n) {
+        if (ctx->buf_len == BLOCK_LEN) {
+            load_block(m, ctx->buf);
+            compress_cv(ctx->cv, m, BLOCK_LEN, ctx->chunk_counter,
+                        ctx->blocks_compressed ? 0 : CHUNK_START);
+            ctx->blocks_compressed++;
+            ctx->buf_len = 0;
+        }
+        take = (size_t)(BLOCK_LEN - ctx->buf_len);
+        if (take > n)
+            take = n;
+        memcpy(ctx->buf + ctx->buf_len, in, take);
+        ctx->buf_len += (int)take;
+        in += take;
+        n -= take;
+    }
+    return len;
+}
+
+void rs_blake3_begin(rs_blake3_t *ctx)
+{
+    chunk_reset(ctx, 0);
+    ctx->stack_len = 0;
+}
+
+void rs_blake3_update(rs_blake3_t *ctx, void const *in_void, size_t n)
+{
+    const uint8_t *in = in_void;
+    uint32_t cvs[BATCH_LEN][8];
+    output_t o;
+    size_t i, k;
+
+    while (n) {
+        /* A full chunk with more input after it can't be the root. */
+        if (chunk_len(ctx) == CHUNK_LEN) {
+            chunk_output(ctx, &o);
+            output_cv(&o, cvs[0]);
+            add_chunk_cv(ctx, cvs[0], ctx->chunk_counter + 1);
+            chunk_reset(ctx, ctx->chunk_counter + 1);
+        }
+        /* Hash whole chunks in batches, leaving the last one buffered. */
+        if (!chunk_len(ctx) && n > CHUNK_LEN) {
+            k = (n - 1) / CHUNK_LEN;
+            if (k > BATCH_LEN)
+                k = BATCH_LEN;
+            hash_chunks(in, k, ctx->chunk_counter, cvs);
+            for (i = 0; i < k; i++)
+                add_chunk_cv(ctx, cvs[i], ctx->chunk_counter + i + 1);
+            chunk_reset(ctx, ctx->chunk_counter + k);
+            in += k * CHUNK_LEN;
+            n -= k * CHUNK_LEN;
+            continue;
+        }
+        k = chunk_update(ctx, in, n);
+        in += k;
+        n -= k;
+    }
+}
+
+void rs_blake3_result(rs_blake3_t const *ctx, unsigned char *out,
+                      size_t out_len)
+{
+    uint32_t cv[8], v[16];
+    uint64_t counter;
+    output_t o;
+    size_t i, len;
+    int n;
+
+    chunk_output(ctx, &o);
+    for (n = ctx->stack_len; n--;) {
+        output_cv(&o, cv);
+        parent_output(&o, ctx->stack[n], cv);
+    }
+    for (counter = 0; out_len; counter++) {
+        compress(v, o.cv, o.m, o.len, counter, o.flags | ROOT);
+        len = out_len < 64 ? out_len : 64;
+        for (i = 0; i + 4 <= len; i += 4)
+            store32(out + i, v[i / 4]);
+        if (i < len) {
+            uint8_t word[4];
+
+            store32(word, v[i / 4]);
+            memcpy(out + i, word, len - i);
+        }
+        out += len;
+        out_len -= len;
+    }
+}
+
+/** Calculate the BLAKE3 hash of a buffer. */
+void rs_blake3(unsigned char *out, size_t out_len, void const *in, size_t n)
+{
+    rs_blake3_t ctx;
+
+    rs_blake3_begin(&ctx);
+    rs_blake3_update(&ctx, in, n);
+    rs_blake3_result(&ctx, out, out_len);
+}
@@ -0,0 +1,54 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file blake3.h
+ * The BLAKE3 hash. */
+#ifndef BLAKE3_H
+#  define BLAKE3_H
+
+#  include <stddef.h>
+#  include <stdint.h>
+
+/** The default BLAKE3 hash length. */
+#  define RS_BLAKE3_OUT_LEN 32
+
+/** The length of the chunks that are the leaves of the BLAKE3 tree. */
+#  define RS_BLAKE3_CHUNK_LEN 1024
+
+/** The maximum depth of the tree of chunks for 2^64 bytes. */
+#  define RS_BLAKE3_MAX_DEPTH 54
+
+/** Internal state while computing a BLAKE3 hash. */
+typedef struct rs_blake3 {
+    uint32_t cv[8];             /**< The current chunk's chaining value. */
+    uint64_t chunk_counter;     /**< The current chunk's index. */
+    uint8_t buf[64];            /**< The current chunk's unhashed block. */
+    int buf_len;                /**< The length of the block in buf. */
+    int blocks_compressed;      /**< Blocks hashed in the current chunk. */
+    int stack_len;              /**< The number of chaining values stacked. */
+    uint32_t stack[RS_BLAKE3_MAX_DEPTH][8];     /**< Subtree values. */
+} rs_blake3_t;
+
+void rs_blake3_begin(rs_blake3_t *ctx);
+void rs_blake3_update(rs_blake3_t *ctx, void const *in, size_t n);
+void rs_blake3_result(rs_blake3_t const *ctx, unsigned char *out,
+                      size_t out_len);
+void rs_blake3(unsigned char *out, size_t out_len, void const *in, size_t n);
+
+#endif                          /* !BLAKE3_H */
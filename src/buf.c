@@ -30,6 +30,13 @@
  * appropriate input and output FILEs. A dynamically allocated buffer of
  * configurable size is used as an intermediary.
  *
+ * There is also an alternative ::rs_fdbuf backend that bypasses stdio and
+ * does IO directly on the file descriptors with read() and write(), using
+ * large page-aligned buffers. It hints to the kernel that the file is read
+ * sequentially and that data already read or written won't be needed again,
+ * so processing huge files doesn't push everything else out of the page
+ * cache. It can also use O_DIRECT to bypass the page cache entirely.
+ *
  * \todo Perhaps be more efficient by filling the buffer on every call even if
  * not yet completely empty. Check that it's really our buffer, and shuffle
  * remaining data down to the front.
@@ -46,6 +53,10 @@
 #include "job.h"
 #include "trace.h"
 #include "util.h"
+#ifdef HAVE_PREAD
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
 
 struct rs_filebuf {
     FILE *f;
@@ -65,9 +76,9 @@ rs_filebuf_t *rs_filebuf_new(FILE *f, size_t buf_len)
 
 void rs_filebuf_free(rs_filebuf_t *fb)
 {
-    free(fb->buf);
+    rs_free(fb->buf);
     rs_bzero(fb, sizeof *fb);
-    free(fb);
+    rs_free(fb);
 }
 
 /* If the stream has no more data available, read some from F into BUF, and let
@@ -154,3 +165,215 @@ rs_result rs_outfilebuf_drain(rs_job_t *job, rs_buffers_t *buf, void *opaque)
     }
     return RS_DONE;
 }
+
+#ifdef HAVE_PREAD
+
+/** Alignment of fd buffers and O_DIRECT IO. */
+#  define RS_FDBUF_ALIGN 4096
+
+/** Minimum fd buffer size, so IO is done in large chunks. */
+#  define RS_FDBUF_MIN (256 * 1024)
+
+struct rs_fdbuf {
+    int fd;
+    rs_byte_t *buf;
+    size_t buf_len;
+    int direct;                 /**< If O_DIRECT is enabled. */
+    rs_long_t pos;              /**< File offset of the next IO, or -1. */
+};
+
+/** Give the kernel a hint about how we use a file region.
+ *
+ * This is only a hint, so errors like ESPIPE for pipes are ignored. */
+static void rs_fdbuf_advise(rs_fdbuf_t *fb, rs_long_t off, rs_long_t len,
+                            int advice)
+{
+#  ifdef HAVE_POSIX_FADVISE
+    if (fb->pos >= 0 && len >= 0)
+        posix_fadvise(fb->fd, (off_t)off, (off_t)len, advice);
+#  endif
+}
+
+/** Turn O_DIRECT on or off for the file.
+ *
+ * \return Zero if it worked. */
+static int rs_fdbuf_set_direct(rs_fdbuf_t *fb, int direct)
+{
+#  ifdef O_DIRECT
+    int flags = fcntl(fb->fd, F_GETFL);
+
+    if (flags != -1
+        && fcntl(fb->fd, F_SETFL,
+                 direct ? flags | O_DIRECT : flags & ~O_DIRECT) != -1) {
+        fb->direct = direct;
+        return 0;
+    }
+#  endif
+    return -1;
+}
+
+rs_fdbuf_t *rs_fdbuf_new(int fd, size_t buf_len, rs_fileio_mode mode)
+{
+    rs_fdbuf_t *fb = rs_alloc_struct(rs_fdbuf_t);
+    void *buf;
+
+    /* Use large buffers that are a multiple of the alignment. */
+    if (buf_len < RS_FDBUF_MIN)
+        buf_len = RS_FDBUF_MIN;
+    buf_len = (buf_len + RS_FDBUF_ALIGN - 1) & ~(size_t)(RS_FDBUF_ALIGN - 1);
+    if (posix_memalign(&buf, RS_FDBUF_ALIGN, buf_len)) {
+        rs_fatal("can't allocate " FMT_SIZE " byte aligned file buffer",
+                 buf_len);
+    }
+    fb->fd = fd;
+    fb->buf = buf;
+    fb->buf_len = buf_len;
+    fb->pos = (rs_long_t)lseek(fd, 0, SEEK_CUR);
+#  ifdef HAVE_POSIX_FADVISE
+    rs_fdbuf_advise(fb, 0, 0, POSIX_FADV_SEQUENTIAL);
+#  endif
+    if (mode == RS_FILEIO_DIRECT && rs_fdbuf_set_direct(fb, 1))
+        rs_trace("O_DIRECT not supported on fd%d, using the page cache", fd);
+    return fb;
+}
+
+void rs_fdbuf_free(rs_fdbuf_t *fb)
+{
+    if (fb->direct)
+        rs_fdbuf_set_direct(fb, 0);
+    /* The aligned buffer is from posix_memalign(), not the allocator. */
+    free(fb->buf);
+    rs_bzero(fb, sizeof *fb);
+    rs_free(fb);
+}
+
+rs_result rs_infdbuf_fill(rs_job_t *job, rs_buffers_t *buf, void *opaque)
+{
+    rs_fdbuf_t *fb = (rs_fdbuf_t *)opaque;
+    ssize_t len;
+
+    if (buf->eof_in || buf->avail_in)
+        return RS_DONE;
+    do {
+        len = read(fb->fd, fb->buf, fb->buf_len);
+        /* Reads from unaligned offsets fail with O_DIRECT. */
+        if (len < 0 && errno == EINVAL && fb->direct
+            && !rs_fdbuf_set_direct(fb, 0))
+            continue;
+    } while (len < 0 && errno == EINTR);
+    if (len < 0) {
+        rs_error("error filling buf from fd%d: %s", fb->fd, strerror(errno));
+        return RS_IO_ERROR;
+    } else if (len == 0) {
+        rs_trace("seen end of file on input");
+        buf->eof_in = 1;
+        return RS_DONE;
+    }
+#  ifdef HAVE_POSIX_FADVISE
+    /* We have our own copy of the data, so drop it from the page cache. */
+    rs_fdbuf_advise(fb, fb->pos, len, POSIX_FADV_DONTNEED);
+#  endif
+    if (fb->pos >= 0)
+        fb->pos += len;
+    buf->avail_in = (size_t)len;
+    buf->next_in = (char *)fb->buf;
+    job->stats.in_bytes += len;
+    return RS_DONE;
+}
+
+/** Write out the first \p len bytes of the buffer. */
+static rs_result rs_fdbuf_write(rs_job_t *job, rs_fdbuf_t *fb, size_t len)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    /* Writes of partial blocks fail with O_DIRECT. */
+    if (fb->direct && len % RS_FDBUF_ALIGN)
+        rs_fdbuf_set_direct(fb, 0);
+    while (done < len) {
+        n = write(fb->fd, fb->buf + done, len - done);
+        if (n < 0 && errno == EINVAL && fb->direct
+            && !rs_fdbuf_set_direct(fb, 0))
+            continue;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            rs_error("error draining buf to fd%d: %s", fb->fd,
+                     strerror(errno));
+            return RS_IO_ERROR;
+        }
+        done += (size_t)n;
+    }
+#  ifdef HAVE_POSIX_FADVISE
+    /* Dirty pages can't be dropped until they are written back, which
+       DONTNEED starts, so also retry the previous buffer's worth. */
+    if (fb->pos >= (rs_long_t)fb->buf_len)
+        rs_fdbuf_advise(fb, fb->pos - (rs_long_t)fb->buf_len,
+                        (rs_long_t)(fb->buf_len + len), POSIX_FADV_DONTNEED);
+    else
+        rs_fdbuf_advise(fb, 0, fb->pos + (rs_long_t)len, POSIX_FADV_DONTNEED);
+#  endif
+    if (fb->pos >= 0)
+        fb->pos += len;
+    job->stats.out_bytes += len;
+    return RS_DONE;
+}
+
+rs_result rs_outfdbuf_drain(rs_job_t *job, rs_buffers_t *buf, void *opaque)
+{
+    rs_fdbuf_t *fb = (rs_fdbuf_t *)opaque;
+    rs_result result;
+
+    if (buf->next_out == NULL) {
+        assert(buf->avail_out == 0);
+        buf->next_out = (char *)fb->buf;
+        buf->avail_out = fb->buf_len;
+        return RS_DONE;
+    }
+    /* Only write full buffers, rs_outfdbuf_flush() writes the rest. */
+    if (buf->avail_out)
+        return RS_DONE;
+    if ((result = rs_fdbuf_write(job, fb, fb->buf_len)) != RS_DONE)
+        return result;
+    buf->next_out = (char *)fb->buf;
+    buf->avail_out = fb->buf_len;
+    return RS_DONE;
+}
+
+rs_result rs_outfdbuf_flush(rs_job_t *job, rs_buffers_t *buf, void *opaque)
+{
+    rs_fdbuf_t *fb = (rs_fdbuf_t *)opaque;
+    size_t present;
+    rs_result result;
+
+    if (buf->next_out == NULL)
+        return RS_DONE;
+    present = (size_t)((rs_byte_t *)buf->next_out - fb->buf);
+    if (present && (result = rs_fdbuf_write(job, fb, present)) != RS_DONE)
+        return result;
+    buf->next_out = (char *)fb->buf;
+    buf->avail_out = fb->buf_len;
+    return RS_DONE;
+}
+
+rs_result rs_fd_copy_cb(void *arg, rs_long_t pos, size_t *len, void **buf)
+{
+    int fd = *(int *)arg;
+    ssize_t n;
+
+    do {
+        n = pread(fd, *buf, *len, (off_t)pos);
+    } while (n < 0 && errno == EINTR);
+    if (n > 0) {
+        *len = (size_t)n;
+        return RS_DONE;
+    } else if (n < 0) {
+        rs_error("read error: %s", strerror(errno));
+        return RS_IO_ERROR;
+    } else {
+        rs_error("unexpected eof on fd%d", fd);
+        return RS_INPUT_ENDED;
+    }
+}
+
+#endif                          /* HAVE_PREAD */
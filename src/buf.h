@@ -28,3 +28,17 @@ void rs_filebuf_free(rs_filebuf_t *fb);
 rs_result rs_infilebuf_fill(rs_job_t *, rs_buffers_t *buf, void *fb);
 
 rs_result rs_outfilebuf_drain(rs_job_t *, rs_buffers_t *, void *fb);
+
+typedef struct rs_fdbuf rs_fdbuf_t;
+
+rs_fdbuf_t *rs_fdbuf_new(int fd, size_t buf_len, rs_fileio_mode mode);
+
+void rs_fdbuf_free(rs_fdbuf_t *fb);
+
+rs_result rs_infdbuf_fill(rs_job_t *, rs_buffers_t *buf, void *fb);
+
+rs_result rs_outfdbuf_drain(rs_job_t *, rs_buffers_t *buf, void *fb);
+
+rs_result rs_outfdbuf_flush(rs_job_t *, rs_buffers_t *buf, void *fb);
+
+rs_result rs_fd_copy_cb(void *arg, rs_long_t pos, size_t *len, void **buf);
@@ -0,0 +1,50 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * cdc -- content-defined chunking.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file cdc.h
+ * Content-defined chunking.
+ *
+ * This finds chunk boundaries using FastCDC normalized chunking with a Gear
+ * hash. The boundaries depend only on the data just before them, so inserting
+ * or deleting data only moves the boundaries near the change, and matching
+ * data splits into the same chunks wherever it is. */
+#ifndef CDC_H
+#  define CDC_H
+
+#  include <stddef.h>
+#  include <stdint.h>
+
+/** The Gear hash value for each byte value. */
+extern const uint64_t rs_cdc_gear[256];
+
+/** Get the minimum chunk length for an average chunk length. */
+static inline size_t rs_cdc_min_len(size_t avg_len)
+{
+    return avg_len / 4;
+}
+
+/** Get the maximum chunk length for an average chunk length. */
+static inline size_t rs_cdc_max_len(size_t avg_len)
+{
+    return avg_len * 4;
+}
+
+size_t rs_cdc_cut(const unsigned char *buf, size_t len, size_t avg_len);
+
+#endif                          /* !CDC_H */
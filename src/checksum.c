@@ -24,23 +24,40 @@
 #include "config.h"
 #include "checksum.h"
 #include "blake2.h"
+#include "blake3.h"
+/* Inline all of xxhash so it adds no exported symbols. */
+#define XXH_INLINE_ALL
+#include "xxhash/xxhash.h"
 
 LIBRSYNC_EXPORT const int RS_MD4_SUM_LENGTH = 16;
 LIBRSYNC_EXPORT const int RS_BLAKE2_SUM_LENGTH = 32;
+LIBRSYNC_EXPORT const int RS_XXH3_SUM_LENGTH = 16;
+LIBRSYNC_EXPORT const int RS_BLAKE3_SUM_LENGTH = 32;
 
-/** A simple 32bit checksum that can be incrementally updated. */
-rs_weak_sum_t rs_calc_weak_sum(weaksum_kind_t kind, void const *buf, size_t len)
+/** A simple 32 or 64 bit checksum that can be incrementally updated. */
+rs_weak_sum64_t rs_calc_weak_sum(weaksum_kind_t kind, void const *buf,
+                                 size_t len)
 {
     if (kind == RS_ROLLSUM) {
         Rollsum sum;
         RollsumInit(&sum);
         RollsumUpdate(&sum, buf, len);
         return RollsumDigest(&sum);
-    } else {
+    } else if (kind == RS_RABINKARP) {
         rabinkarp_t sum;
         rabinkarp_init(&sum);
         rabinkarp_update(&sum, buf, len);
         return rabinkarp_digest(&sum);
+    } else if (kind == RS_CRC32C) {
+        crc32c_t sum;
+        crc32c_init(&sum);
+        crc32c_update(&sum, buf, len);
+        return crc32c_digest(&sum);
+    } else {
+        rabinkarp64_t sum;
+        rabinkarp64_init(&sum);
+        rabinkarp64_update(&sum, buf, len);
+        return rabinkarp64_digest(&sum);
     }
 }
 
@@ -59,6 +76,12 @@ void rs_calc_strong_sum(strongsum_kind_t kind, void const *buf, size_t len,
 {
     if (kind == RS_MD4) {
         rs_mdfour((unsigned char *)sum, buf, len);
+    } else if (kind == RS_XXH3) {
+        /* Use the canonical big-endian form so it's the same everywhere. */
+        XXH128_canonicalFromHash((XXH128_canonical_t *)sum,
+                                 XXH3_128bits(buf, len));
+    } else if (kind == RS_BLAKE3) {
+        rs_blake3((unsigned char *)sum, RS_MAX_STRONG_SUM_LENGTH, buf, len);
     } else {
         blake2b_state ctx;
         blake2b_init(&ctx, RS_MAX_STRONG_SUM_LENGTH);
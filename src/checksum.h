@@ -24,20 +24,30 @@
 #  include "librsync.h"
 #  include "rollsum.h"
 #  include "rabinkarp.h"
+#  include "crc32c.h"
 #  include "hashtable.h"
 
 /** Weaksum implementations. */
 typedef enum {
     RS_ROLLSUM,
     RS_RABINKARP,
+    RS_RABINKARP64,
+    RS_CRC32C,
 } weaksum_kind_t;
 
 /** Strongsum implementations. */
 typedef enum {
     RS_MD4,
     RS_BLAKE2,
+    RS_XXH3,
+    RS_BLAKE3,
 } strongsum_kind_t;
 
+/** An internal weak sum, wide enough for the 64 bit RabinKarp64 weak sums.
+ *
+ * The public ::rs_weak_sum_t stays 32 bits for ABI compatibility. */
+typedef uint64_t rs_weak_sum64_t;
+
 /** Abstract wrapper around weaksum implementations.
  *
  * This is a polymorphic interface to the different rollsum implementations.
@@ -53,71 +63,131 @@ typedef struct weaksum {
     union {
         Rollsum rs;
         rabinkarp_t rk;
+        rabinkarp64_t rk64;
+        crc32c_t crc;
     } sum;
 } weaksum_t;
 
 static inline void weaksum_reset(weaksum_t *sum)
 {
-    if (sum->kind == RS_ROLLSUM)
+    switch (sum->kind) {
+    case RS_ROLLSUM:
         RollsumInit(&sum->sum.rs);
-    else
+        break;
+    case RS_RABINKARP:
         rabinkarp_init(&sum->sum.rk);
+        break;
+    case RS_RABINKARP64:
+        rabinkarp64_init(&sum->sum.rk64);
+        break;
+    case RS_CRC32C:
+        crc32c_init(&sum->sum.crc);
+        break;
+    }
 }
 
 static inline void weaksum_init(weaksum_t *sum, weaksum_kind_t kind)
 {
-    assert(kind == RS_ROLLSUM || kind == RS_RABINKARP);
+    assert(kind == RS_ROLLSUM || kind == RS_RABINKARP
+           || kind == RS_RABINKARP64 || kind == RS_CRC32C);
     sum->kind = kind;
     weaksum_reset(sum);
 }
 
 static inline size_t weaksum_count(weaksum_t *sum)
 {
-    /* We take advantage of sum->sum.rs.count overlaying sum->sum.rk.count. */
+    /* We take advantage of sum->sum.rs.count overlaying the count of all the
+       other weaksums. */
     return sum->sum.rs.count;
 }
 
 static inline void weaksum_update(weaksum_t *sum, const unsigned char *buf,
                                   size_t len)
 {
-    if (sum->kind == RS_ROLLSUM)
+    switch (sum->kind) {
+    case RS_ROLLSUM:
         RollsumUpdate(&sum->sum.rs, buf, len);
-    else
+        break;
+    case RS_RABINKARP:
         rabinkarp_update(&sum->sum.rk, buf, len);
+        break;
+    case RS_RABINKARP64:
+        rabinkarp64_update(&sum->sum.rk64, buf, len);
+        break;
+    case RS_CRC32C:
+        crc32c_update(&sum->sum.crc, buf, len);
+        break;
+    }
 }
 
 static inline void weaksum_rotate(weaksum_t *sum, unsigned char out,
                                   unsigned char in)
 {
-    if (sum->kind == RS_ROLLSUM)
+    switch (sum->kind) {
+    case RS_ROLLSUM:
         RollsumRotate(&sum->sum.rs, out, in);
-    else
+        break;
+    case RS_RABINKARP:
         rabinkarp_rotate(&sum->sum.rk, out, in);
+        break;
+    case RS_RABINKARP64:
+        rabinkarp64_rotate(&sum->sum.rk64, out, in);
+        break;
+    case RS_CRC32C:
+        crc32c_rotate(&sum->sum.crc, out, in);
+        break;
+    }
 }
 
 static inline void weaksum_rollin(weaksum_t *sum, unsigned char in)
 {
-    if (sum->kind == RS_ROLLSUM)
+    switch (sum->kind) {
+    case RS_ROLLSUM:
         RollsumRollin(&sum->sum.rs, in);
-    else
+        break;
+    case RS_RABINKARP:
         rabinkarp_rollin(&sum->sum.rk, in);
+        break;
+    case RS_RABINKARP64:
+        rabinkarp64_rollin(&sum->sum.rk64, in);
+        break;
+    case RS_CRC32C:
+        crc32c_rollin(&sum->sum.crc, in);
+        break;
+    }
 }
 
 static inline void weaksum_rollout(weaksum_t *sum, unsigned char out)
 {
-    if (sum->kind == RS_ROLLSUM)
+    switch (sum->kind) {
+    case RS_ROLLSUM:
         RollsumRollout(&sum->sum.rs, out);
-    else
+        break;
+    case RS_RABINKARP:
         rabinkarp_rollout(&sum->sum.rk, out);
+        break;
+    case RS_RABINKARP64:
+        rabinkarp64_rollout(&sum->sum.rk64, out);
+        break;
+    case RS_CRC32C:
+        crc32c_rollout(&sum->sum.crc, out);
+        break;
+    }
 }
 
-static inline rs_weak_sum_t weaksum_digest(weaksum_t *sum)
+static inline rs_weak_sum64_t weaksum_digest(weaksum_t *sum)
 {
-    if (sum->kind == RS_ROLLSUM)
+    switch (sum->kind) {
+    case RS_ROLLSUM:
         /* We apply mix32() to rollsums before using them for matching. */
         return mix32(RollsumDigest(&sum->sum.rs));
-    else
+    case RS_RABINKARP:
         return rabinkarp_digest(&sum->sum.rk);
+    case RS_CRC32C:
+        return crc32c_digest(&sum->sum.crc);
+    default:
+        return rabinkarp64_digest(&sum->sum.rk64);
+    }
 }
 
 /** Calculate a weaksum.
@@ -126,8 +196,8 @@ static inline rs_weak_sum_t weaksum_digest(weaksum_t *sum)
  * weaksum_digest(). This is because rollsums are stored raw without mix32()
  * applied for backwards-compatibility, but we apply mix32() when adding them
  * into a signature and when getting the digest for calculating deltas. */
-rs_weak_sum_t rs_calc_weak_sum(weaksum_kind_t kind, void const *buf,
-                               size_t len);
+rs_weak_sum64_t rs_calc_weak_sum(weaksum_kind_t kind, void const *buf,
+                                 size_t len);
 
 /** Calculate a strongsum. */
 void rs_calc_strong_sum(strongsum_kind_t kind, void const *buf, size_t len,
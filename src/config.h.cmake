@@ -33,6 +33,9 @@
 /* Define to 1 if you have the <bzlib.h> header file.  */
 #cmakedefine HAVE_BZLIB_H 1
 
+/* Define to 1 if you have the <linux/io_uring.h> header file.  */
+#cmakedefine HAVE_LINUX_IO_URING_H 1
+
 /* Define if your compiler has C99's __func__. */
 #cmakedefine HAVE___FUNC__
 
@@ -60,6 +63,33 @@
 /* Define to 1 if _fileno exists and is declared (ISO C++). */
 #cmakedefine HAVE__FILENO 1
 
+/* Define to 1 if ftruncate exists and is declared (Posix). */
+#cmakedefine HAVE_FTRUNCATE 1
+
+/* Define to 1 if _chsize_s exists and is declared (MSVC). */
+#cmakedefine HAVE__CHSIZE_S 1
+
+/* Define to 1 if pread exists and is declared (Posix). */
+#cmakedefine HAVE_PREAD 1
+
+/* Define to 1 if posix_fadvise exists and is declared (Posix). */
+#cmakedefine HAVE_POSIX_FADVISE 1
+
+/* Define to 1 if pthreads are available. */
+#cmakedefine HAVE_PTHREAD 1
+
+/* Define to 1 if memfd_create exists and is declared (Linux). */
+#cmakedefine HAVE_MEMFD_CREATE 1
+
+/* Define to 1 if clock_gettime exists and is declared (Posix). */
+#cmakedefine HAVE_CLOCK_GETTIME 1
+
+/* Define to 1 if fork exists and is declared (Posix). */
+#cmakedefine HAVE_FORK 1
+
+/* Define to 1 if getrusage exists and is declared (Posix). */
+#cmakedefine HAVE_GETRUSAGE 1
+
 /* Name of package */
 #define PACKAGE "${PROJECT_NAME}"
 
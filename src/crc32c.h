@@ -0,0 +1,120 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * crc32c -- The CRC32C rolling checksum.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef _CRC32C_H_
+#  define _CRC32C_H_
+
+#  include <stddef.h>
+#  include <stdint.h>
+
+/** The CRC32C seed value.
+ *
+ * This is the standard CRC32C initial value, and like the RabinKarp seed it
+ * ensures different length zero blocks have different hashes. The digest is
+ * the standard CRC32C of the bytes in the sum. */
+#  define CRC32C_SEED 0xffffffffU
+
+/** The CRC32C polynomial in bit reflected form. */
+#  define CRC32C_POLY 0x82f63b78U
+
+/** The polynomial x^0 in bit reflected form. */
+#  define CRC32C_X0 0x80000000U
+
+/** The polynomial x^-8 modulo the CRC32C polynomial in bit reflected form.
+ *
+ * Multiplying by this undoes appending a zero byte. */
+#  define CRC32C_XINV8 0xfde39562U
+
+/** The crc32c_t state type.
+ *
+ * The CRC is linear, so rotating a byte out of the sum needs its contribution
+ * after being followed by count bytes. This is looked up in a table of all
+ * 256 byte values that is built for the count on the first rotate. */
+typedef struct _crc32c {
+    size_t count;               /**< Count of bytes included in sum. */
+    uint32_t crc;               /**< The CRC register, without final xor. */
+    uint32_t shift;             /**< The value of x^(8*count) mod poly. */
+    int sse42;                  /**< Whether the crc32 instruction is used. */
+    size_t table_count;         /**< The count for table, or 0 if unset. */
+    uint32_t table[256];        /**< The rotate out values for each byte. */
+} crc32c_t;
+
+/** The table for updating CRC32C a byte at a time. */
+extern const uint32_t crc32c_table[256];
+
+int crc32c_sse42(void);
+uint32_t crc32c_multmodp(uint32_t a, uint32_t b);
+void crc32c_rotate_init(crc32c_t *sum);
+void crc32c_update(crc32c_t *sum, const unsigned char *buf, size_t len);
+
+static inline void crc32c_init(crc32c_t *sum)
+{
+    sum->count = 0;
+    sum->crc = CRC32C_SEED;
+    sum->shift = CRC32C_X0;
+    sum->sse42 = crc32c_sse42();
+    sum->table_count = 0;
+}
+
+/** Append one byte to a CRC register. */
+static inline uint32_t crc32c_byte(uint32_t crc, unsigned char in)
+{
+    return (crc >> 8) ^ crc32c_table[(crc ^ in) & 0xff];
+}
+
+static inline void crc32c_rotate(crc32c_t *sum, unsigned char out,
+                                 unsigned char in)
+{
+    uint32_t crc = sum->crc;
+
+    if (sum->table_count != sum->count)
+        crc32c_rotate_init(sum);
+#  if defined(__GNUC__) && defined(__x86_64__)
+    /* Inline asm avoids needing the whole caller compiled for SSE4.2. */
+    if (sum->sse42)
+        __asm__("crc32b %1, %0":"+r"(crc):"rm"(in));
+    else
+#  endif
+        crc = crc32c_byte(crc, in);
+    sum->crc = crc ^ sum->table[out];
+}
+
+static inline void crc32c_rollin(crc32c_t *sum, unsigned char in)
+{
+    sum->crc = crc32c_byte(sum->crc, in);
+    sum->count++;
+    sum->shift = crc32c_byte(sum->shift, 0);
+}
+
+static inline void crc32c_rollout(crc32c_t *sum, unsigned char out)
+{
+    uint32_t shift = crc32c_multmodp(sum->shift, CRC32C_XINV8);
+
+    /* Remove the seed and out byte at count, then add the seed at count-1. */
+    sum->crc ^= crc32c_multmodp(CRC32C_SEED, sum->shift) ^
+        crc32c_multmodp(CRC32C_SEED ^ crc32c_table[out], shift);
+    sum->count--;
+    sum->shift = shift;
+}
+
+static inline uint32_t crc32c_digest(crc32c_t *sum)
+{
+    return ~sum->crc;
+}
+
+#endif                          /* _CRC32C_H_ */
@@ -86,7 +86,14 @@
  * into the scoop that indicates the point scanned to. As data is scanned,
  * scoop_pos is incremented. As data is processed, it is removed from the scoop
  * and scoop_pos adjusted. Everything gets complicated because the tube can
- * block. When the tube is blocked, no data can be processed. */
+ * block. When the tube is blocked, no data can be processed.
+ *
+ * For CDC signatures there is no weak sum to roll. Instead the chunk
+ * boundaries of the new file are found the same way as for the signature,
+ * which needs up to the maximum chunk length of data, and each chunk's strong
+ * sum is looked up in the signature. Matching data is split into the same
+ * chunks wherever it is in the new file, so only the chunks next to changes
+ * miss. */
 
 #include "config.h"
 #include <assert.h>
@@ -95,14 +102,16 @@
 #include "job.h"
 #include "sumset.h"
 #include "checksum.h"
+#include "cdc.h"
 #include "stream.h"
 #include "emit.h"
 #include "trace.h"
 
 static rs_result rs_delta_s_scan(rs_job_t *job);
 static rs_result rs_delta_s_flush(rs_job_t *job);
+static rs_result rs_delta_s_chunk(rs_job_t *job);
 static rs_result rs_delta_s_end(rs_job_t *job);
-static inline void rs_getinput(rs_job_t *job);
+static inline rs_result rs_getinput(rs_job_t *job);
 static inline int rs_findmatch(rs_job_t *job, rs_long_t *match_pos,
                                size_t *match_len);
 static inline rs_result rs_appendmatch(rs_job_t *job, rs_long_t match_pos,
@@ -112,6 +121,19 @@ static inline rs_result rs_appendflush(rs_job_t *job);
 static inline rs_result rs_processmatch(rs_job_t *job);
 static inline rs_result rs_processmiss(rs_job_t *job);
 
+/** Check the work budget when the scan loop's copy of it runs out.
+ *
+ * The scan loops keep job->budget_left in a local \p budget, because it is
+ * updated for every byte scanned. */
+static inline int rs_delta_budget_check(rs_job_t *job, rs_long_t *budget)
+{
+    job->budget_left = *budget;
+    if (rs_job_budget_check(job))
+        return 1;
+    *budget = job->budget_left;
+    return 0;
+}
+
 /** Get a block of data if possible, and see if it matches.
  *
  * On each call, we try to process all of the input data available on the scoop
@@ -119,13 +141,14 @@ static inline rs_result rs_processmiss(rs_job_t *job);
 static rs_result rs_delta_s_scan(rs_job_t *job)
 {
     const size_t block_len = job->signature->block_len;
-    rs_long_t match_pos;
+    rs_long_t match_pos, budget = job->budget_left;
     size_t match_len;
     rs_result result;
 
     rs_job_check(job);
     /* read the input into the scoop */
-    rs_getinput(job);
+    if ((result = rs_getinput(job)) != RS_DONE)
+        return result;
     /* output any pending output from the tube */
     result = rs_tube_catchup(job);
     /* while output is not blocked and there is a block of data */
@@ -141,8 +164,14 @@ static rs_result rs_delta_s_scan(rs_job_t *job)
             weaksum_rotate(&job->weak_sum, job->scoop_next[job->scoop_pos],
                            job->scoop_next[job->scoop_pos + block_len]);
             result = rs_appendmiss(job, 1);
+            match_len = 1;
         }
+        /* yield if the work budget is spent by the match_len bytes scanned */
+        if ((budget -= (rs_long_t)match_len) <= 0 && result == RS_DONE
+            && rs_delta_budget_check(job, &budget))
+            return RS_RUNNING;
     }
+    job->budget_left = budget;
     /* if we completed OK */
     if (result == RS_DONE) {
         /* if we reached eof, we can flush the last fragment */
@@ -159,13 +188,14 @@ static rs_result rs_delta_s_scan(rs_job_t *job)
 
 static rs_result rs_delta_s_flush(rs_job_t *job)
 {
-    rs_long_t match_pos;
+    rs_long_t match_pos, budget = job->budget_left;
     size_t match_len;
     rs_result result;
 
     rs_job_check(job);
     /* read the input into the scoop */
-    rs_getinput(job);
+    if ((result = rs_getinput(job)) != RS_DONE)
+        return result;
     /* output any pending output */
     result = rs_tube_catchup(job);
     /* while output is not blocked and there is any remaining data */
@@ -181,8 +211,14 @@ static rs_result rs_delta_s_flush(rs_job_t *job)
             rs_trace("block reduced to " FMT_SIZE "",
                      weaksum_count(&job->weak_sum));
             result = rs_appendmiss(job, 1);
+            match_len = 1;
         }
+        /* yield if the work budget is spent by the match_len bytes scanned */
+        if ((budget -= (rs_long_t)match_len) <= 0 && result == RS_DONE
+            && rs_delta_budget_check(job, &budget))
+            return RS_RUNNING;
     }
+    job->budget_left = budget;
     /* if we are not blocked, flush and set end statefn. */
     if (result == RS_DONE) {
         result = rs_appendflush(job);
@@ -194,20 +230,86 @@ static rs_result rs_delta_s_flush(rs_job_t *job)
     return result;
 }
 
+/** Get chunks of data if possible, and see if they match.
+ *
+ * This is used instead of rs_delta_s_scan() and rs_delta_s_flush() for CDC
+ * signatures. */
+static rs_result rs_delta_s_chunk(rs_job_t *job)
+{
+    const size_t avg_len = job->signature->block_len;
+    const size_t max_len = rs_cdc_max_len(avg_len);
+    rs_long_t match_pos, budget = job->budget_left;
+    size_t match_len;
+    rs_result result;
+    int eof;
+
+    rs_job_check(job);
+    /* read the input into the scoop */
+    if ((result = rs_getinput(job)) != RS_DONE)
+        return result;
+    /* output any pending output from the tube */
+    result = rs_tube_catchup(job);
+    eof = job->stream->eof_in;
+    /* while output is not blocked and there is a maximum length chunk of data,
+       or any remaining data at eof */
+    while ((result == RS_DONE)
+           && ((job->scoop_pos + max_len < job->scoop_avail)
+               || (eof && job->scoop_pos < job->scoop_avail))) {
+        /* find the end of this chunk and check if it matches */
+        match_len =
+            rs_cdc_cut(job->scoop_next + job->scoop_pos,
+                       job->scoop_avail - job->scoop_pos, avg_len);
+        match_pos =
+            rs_signature_find_chunk(job->signature,
+                                    job->scoop_next + job->scoop_pos,
+                                    match_len);
+        if (match_pos != -1)
+            result = rs_appendmatch(job, match_pos, match_len);
+        else
+            result = rs_appendmiss(job, match_len);
+        /* yield if the work budget is spent by the match_len bytes scanned */
+        if ((budget -= (rs_long_t)match_len) <= 0 && result == RS_DONE
+            && rs_delta_budget_check(job, &budget))
+            return RS_RUNNING;
+    }
+    job->budget_left = budget;
+    if (result != RS_DONE)
+        return result;
+    /* we are blocked waiting for more data */
+    if (!eof)
+        return RS_BLOCKED;
+    /* at eof, flush and set end statefn. */
+    result = rs_appendflush(job);
+    job->statefn = rs_delta_s_end;
+    if (result == RS_DONE)
+        return RS_RUNNING;
+    return result;
+}
+
 static rs_result rs_delta_s_end(rs_job_t *job)
 {
+    rs_byte_t sum[RS_MAX_STRONG_SUM_LENGTH];
+    int sum_len = job->sum_len;
+
+    /* All the input has been read, so finish with its checksum first. */
+    if (sum_len) {
+        rs_job_sum_final(job, sum);
+        rs_emit_checksum_cmd(job, job->sum_bytes, sum, sum_len);
+        return RS_RUNNING;
+    }
     rs_emit_end_cmd(job);
     return RS_DONE;
 }
 
-static inline void rs_getinput(rs_job_t *job)
+static inline rs_result rs_getinput(rs_job_t *job)
 {
     size_t len;
 
     len = rs_scoop_total_avail(job);
     if (job->scoop_avail < len) {
-        rs_scoop_input(job, len);
+        return rs_scoop_input(job, len);
     }
+    return RS_DONE;
 }
 
 /** find a match at scoop_pos, returning the match_pos and match_len.
@@ -362,6 +464,7 @@ static rs_result rs_delta_s_slack(rs_job_t *job)
         rs_trace("emit slack delta for " FMT_SIZE " available bytes", avail);
         rs_emit_literal_cmd(job, (int)avail);
         rs_tube_copy(job, avail);
+        rs_job_budget_spend(job, avail);
         return RS_RUNNING;
     } else if (rs_job_input_is_ending(job)) {
         job->statefn = rs_delta_s_end;
@@ -374,8 +477,11 @@ static rs_result rs_delta_s_slack(rs_job_t *job)
 static rs_result rs_delta_s_header(rs_job_t *job)
 {
     rs_emit_delta_header(job);
+    if (job->sum_len)
+        rs_emit_checksum_begin_cmd(job, job->sum_len);
     if (job->signature) {
-        job->statefn = rs_delta_s_scan;
+        job->statefn = rs_signature_is_cdc(job->signature) ?
+            rs_delta_s_chunk : rs_delta_s_scan;
     } else {
         rs_trace("no signature provided for delta, using slack deltas");
         job->statefn = rs_delta_s_slack;
@@ -383,11 +489,9 @@ static rs_result rs_delta_s_header(rs_job_t *job)
     return RS_RUNNING;
 }
 
-rs_job_t *rs_delta_begin(rs_signature_t *sig)
+/** Set the signature for a new delta job. */
+static void rs_delta_init(rs_job_t *job, rs_signature_t *sig)
 {
-    rs_job_t *job;
-
-    job = rs_job_new("delta", rs_delta_s_header);
     /* Caller can pass NULL sig or empty sig for "slack deltas". */
     if (sig && sig->count > 0) {
         rs_signature_check(sig);
@@ -396,5 +500,35 @@ rs_job_t *rs_delta_begin(rs_signature_t *sig)
         job->signature = sig;
         weaksum_init(&job->weak_sum, rs_signature_weaksum_kind(sig));
     }
+    job->work_ns = &job->times.scan_ns;
+}
+
+rs_job_t *rs_delta_begin(rs_signature_t *sig)
+{
+    rs_job_t *job;
+
+    job = rs_job_new("delta", rs_delta_s_header);
+    rs_delta_init(job, sig);
     return job;
 }
+
+rs_result rs_delta_reset(rs_job_t *job, rs_signature_t *sig)
+{
+    rs_job_reset(job, "delta", rs_delta_s_header);
+    rs_delta_init(job, sig);
+    return RS_DONE;
+}
+
+rs_result rs_delta_set_checksum(rs_job_t *job, int sum_len)
+{
+    rs_job_check(job);
+    if (sum_len < 0 || sum_len > RS_MAX_STRONG_SUM_LENGTH) {
+        rs_error("invalid checksum length %d", sum_len);
+        return RS_PARAM_ERROR;
+    }
+    if (sum_len)
+        rs_job_sum_begin(job, sum_len, 0);
+    else
+        job->sum_len = 0;
+    return RS_DONE;
+}
@@ -32,9 +32,11 @@
 #include "emit.h"
 #include "job.h"
 #include "netint.h"
+#include "stream.h"
 #include "command.h"
 #include "prototab.h"
 #include "trace.h"
+#include "util.h"
 
 /** Write the magic for the start of a delta. */
 void rs_emit_delta_header(rs_job_t *job)
@@ -71,6 +73,7 @@ void rs_emit_literal_cmd(rs_job_t *job, int len)
     job->stats.lit_cmds++;
     job->stats.lit_bytes += len;
     job->stats.lit_cmdbytes += 1 + param_len;
+    rs_stats_hist_add(job->hists.lit_hist, len);
 }
 
 /** Write a COPY command for given offset and length.
@@ -114,6 +117,29 @@ void rs_emit_copy_cmd(rs_job_t *job, rs_long_t where, rs_long_t len)
     stats->copy_cmds++;
     stats->copy_bytes += len;
     stats->copy_cmdbytes += 1 + where_bytes + len_bytes;
+    rs_stats_hist_add(job->hists.copy_hist, len);
+}
+
+/** Write a CHECKSUM_BEGIN command for a checksum of length \p sum_len. */
+void rs_emit_checksum_begin_cmd(rs_job_t *job, int sum_len)
+{
+    int cmd = RS_OP_CHECKSUM_BEGIN;
+
+    rs_trace("emit CHECKSUM_BEGIN(sum_len=%d), cmd_byte=%#04x", sum_len, cmd);
+    rs_squirt_byte(job, (rs_byte_t)cmd);
+    rs_squirt_netint(job, sum_len, 1);
+}
+
+/** Write a CHECKSUM command for \p len bytes of output with checksum \p sum. */
+void rs_emit_checksum_cmd(rs_job_t *job, rs_long_t len, const rs_byte_t *sum,
+                          int sum_len)
+{
+    int cmd = RS_OP_CHECKSUM;
+
+    rs_trace("emit CHECKSUM(len=" FMT_LONG "), cmd_byte=%#04x", len, cmd);
+    rs_squirt_byte(job, (rs_byte_t)cmd);
+    rs_squirt_netint(job, len, 8);
+    rs_tube_write(job, sum, (size_t)sum_len);
 }
 
 /** Write an END command. */
@@ -45,6 +45,7 @@
 #  include <io.h>
 #endif
 #include "librsync.h"
+#include "fileutil.h"
 #include "trace.h"
 
 /* Use fseeko64, _fseeki64, or fseeko for long files if they exist. */
@@ -149,3 +150,36 @@ rs_result rs_file_copy_cb(void *arg, rs_long_t pos, size_t *len, void **buf)
         return RS_INPUT_ENDED;
     }
 }
+
+rs_result rs_file_seek(FILE *f, rs_long_t pos)
+{
+    if (fseek(f, pos, SEEK_SET)) {
+        rs_error("seek failed: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    return RS_DONE;
+}
+
+rs_result rs_file_truncate(FILE *f, rs_long_t len)
+{
+    if (fflush(f)) {
+        rs_error("flush failed: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+#if defined(HAVE_FTRUNCATE)
+    if (ftruncate(fileno(f), len)) {
+        rs_error("truncate failed: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    return RS_DONE;
+#elif defined(HAVE__CHSIZE_S)
+    if (_chsize_s(fileno(f), len)) {
+        rs_error("truncate failed: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    return RS_DONE;
+#else
+    rs_error("truncating files is not supported on this platform");
+    return RS_UNIMPLEMENTED;
+#endif
+}
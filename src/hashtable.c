@@ -20,7 +20,10 @@
  */
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+#include "librsync.h"
 #include "hashtable.h"
+#include "util.h"
 
 /* Open addressing works best if it can take advantage of memory caches using
    locality for probes of adjacent buckets on collisions. So we pack the keys
@@ -33,18 +36,39 @@
 #define HASHTABLE_LOADFACTOR_NUM 7
 #define HASHTABLE_LOADFACTOR_DEN 10
 
-hashtable_t *_hashtable_new(int size)
+/* Get the allocated table size and its mask bits for a requested size. */
+static unsigned hashtable_size2(int size, unsigned *bits2)
 {
-    hashtable_t *t;
-    unsigned size2, bits2;
+    unsigned size2;
 
     /* Adjust requested size to account for max load factor. */
     size = 1 + size * HASHTABLE_LOADFACTOR_DEN / HASHTABLE_LOADFACTOR_NUM;
     /* Use next power of 2 larger than the requested size and get mask bits. */
-    for (size2 = 2, bits2 = 1; (int)size2 < size; size2 <<= 1, bits2++) ;
-    if (!(t = calloc(1, sizeof(hashtable_t)+ size2 * sizeof(unsigned))))
+    for (size2 = 2, *bits2 = 1; (int)size2 < size; size2 <<= 1, (*bits2)++) ;
+    return size2;
+}
+
+/** Allocate zeroed memory with an allocator. */
+static void *hashtable_calloc(const rs_allocator_t *a, size_t size)
+{
+    void *p;
+
+    if ((p = rs_alloc_with(a, size, "hashtable")))
+        memset(p, 0, size);
+    return p;
+}
+
+hashtable_t *_hashtable_new(int size, const rs_allocator_t *a)
+{
+    hashtable_t *t;
+    unsigned size2, bits2;
+
+    size2 = hashtable_size2(size, &bits2);
+    if (!(t =
+          hashtable_calloc(a, sizeof(hashtable_t) + size2 * sizeof(unsigned))))
         return NULL;
-    if (!(t->etable = calloc(size2, sizeof(void *)))) {
+    t->allocator = a;
+    if (!(t->etable = hashtable_calloc(a, size2 * sizeof(void *)))) {
         _hashtable_free(t);
         return NULL;
     }
@@ -52,26 +76,59 @@ hashtable_t *_hashtable_new(int size)
     t->count = 0;
     t->tmask = size2 - 1;
 #ifndef HASHTABLE_NBLOOM
-    if (!(t->kbloom = calloc((size2 + 7) / 8, sizeof(unsigned char)))) {
+    if (!(t->kbloom = hashtable_calloc(a, (size2 + 7) / 8))) {
         _hashtable_free(t);
         return NULL;
     }
     t->bshift = (unsigned)sizeof(unsigned) * 8 - bits2;
     assert(t->tmask == (unsigned)-1 >> t->bshift);
 #endif
+    _hashtable_stats_init(t);
+    return t;
+}
+
+hashtable_t *_hashtable_reset(hashtable_t *t, int size,
+                              const rs_allocator_t *a)
+{
+    unsigned size2, bits2;
+
+    size2 = hashtable_size2(size, &bits2);
+    if (!t || t->size != (int)size2 || t->allocator != a) {
+        _hashtable_free(t);
+        return _hashtable_new(size, a);
+    }
+    _hashtable_clear(t);
+    return t;
+}
+
+void _hashtable_clear(hashtable_t *t)
+{
+    if (t->count) {
+        memset(t->ktable, 0, t->size * sizeof(unsigned));
+        memset(t->etable, 0, t->size * sizeof(void *));
+#ifndef HASHTABLE_NBLOOM
+        memset(t->kbloom, 0, (t->size + 7) / 8);
+#endif
+        t->count = 0;
+    }
+    _hashtable_stats_init(t);
+}
+
+void _hashtable_stats_init(hashtable_t *t)
+{
 #ifndef HASHTABLE_NSTATS
     t->find_count = t->match_count = t->hashcmp_count = t->entrycmp_count = 0;
+    memset(t->probe_hist, 0, sizeof t->probe_hist);
 #endif
-    return t;
 }
 
 void _hashtable_free(hashtable_t *t)
 {
     if (t) {
-        free(t->etable);
+        rs_free_with(t->allocator, t->etable);
 #ifndef HASHTABLE_NBLOOM
-        free(t->kbloom);
+        rs_free_with(t->allocator, t->kbloom);
 #endif
-        free(t);
+        rs_free_with(t->allocator, t);
     }
 }
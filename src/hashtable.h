@@ -41,9 +41,10 @@
  * same key can be added, and you can use a fancy cmp() function to find
  * particular entries by more than just their key. There is an iterator for
  * iterating through all entries in the hashtable. There are optional
- * NAME_find() find/match/hashcmp/entrycmp stats counters that can be disabled
- * by defining HASHTABLE_NSTATS. There is an optional simple k=1 bloom filter
- * for speed that can be disabled by defining HASHTABLE_NBLOOM.
+ * NAME_find() find/match/hashcmp/entrycmp stats counters and a histogram of
+ * probe lengths that can be disabled by defining HASHTABLE_NSTATS. There is an
+ * optional simple k=1 bloom filter for speed that can be disabled by defining
+ * HASHTABLE_NBLOOM.
  *
  * The types and methods of the hashtable and its contents are specified by
  * using \#define parameters set to their basenames (the prefixes for the *_t
@@ -126,8 +127,14 @@
  * evaluation of expensive match data. It can also access the whole myentry_t
  * object to match against more than just the key. */
 
+struct rs_allocator;
+
+/** The number of buckets in the probe length histogram. */
+#  define HASHTABLE_PROBE_HIST 16
+
 /** The hashtable type. */
 typedef struct hashtable {
+    const struct rs_allocator *allocator;       /**< The memory allocator. */
     int size;                   /**< Size of allocated hashtable. */
     int count;                  /**< Number of entries in hashtable. */
     unsigned tmask;             /**< Mask to get the hashtable index. */
@@ -140,6 +147,10 @@ typedef struct hashtable {
     long match_count;           /**< The count of matches found. */
     long hashcmp_count;         /**< The count of hash compares done. */
     long entrycmp_count;        /**< The count of entry compares done. */
+    /** Bucket i counts the finds that did i hash compares. Finds stopped by
+     * the bloom filter are not counted, and the last bucket also counts
+     * longer probes. */
+    long probe_hist[HASHTABLE_PROBE_HIST];
 #  endif
 #  ifndef HASHTABLE_NBLOOM
     unsigned char *kbloom;      /**< Bloom filter of hash keys with k=1. */
@@ -149,8 +160,12 @@ typedef struct hashtable {
 } hashtable_t;
 
 /* void* implementations for the type-safe static inline wrappers below. */
-hashtable_t *_hashtable_new(int size);
+hashtable_t *_hashtable_new(int size, const struct rs_allocator *a);
+hashtable_t *_hashtable_reset(hashtable_t *t, int size,
+                              const struct rs_allocator *a);
+void _hashtable_clear(hashtable_t *t);
 void _hashtable_free(hashtable_t *t);
+void _hashtable_stats_init(hashtable_t *t);
 
 #  ifndef HASHTABLE_NBLOOM
 static inline void hashtable_setbloom(hashtable_t *t, unsigned const h)
@@ -212,6 +227,8 @@ static inline unsigned nozero(unsigned h)
 #  define MATCH_cmp _JOIN(MATCH, _cmp)  /**< The match cmp(m, e) method. */
 /* The names for all the hashtable methods. */
 #  define NAME_new _JOIN(NAME, _new)
+#  define NAME_reset _JOIN(NAME, _reset)
+#  define NAME_clear _JOIN(NAME, _clear)
 #  define NAME_free _JOIN(NAME, _free)
 #  define NAME_stats_init _JOIN(NAME, _stats_init)
 #  define NAME_add _JOIN(NAME, _add)
@@ -234,11 +251,16 @@ static inline unsigned nozero(unsigned h)
     unsigned i, s, h;\
     for (i = hk & tmask, s = 0; (h = ktable[i]); i = (i + ++s) & tmask)
 
-/* Conditional macro for incrementing stats counters. */
+/* Conditional macros for incrementing stats counters and the probe length
+   histogram. */
 #  ifndef HASHTABLE_NSTATS
 #    define _stats_inc(c) (c++)
+#    define _stats_probe(t, n) \
+    (t->probe_hist[(n) < HASHTABLE_PROBE_HIST ? \
+                   (n) : HASHTABLE_PROBE_HIST - 1]++)
 #  else
 #    define _stats_inc(c)
+#    define _stats_probe(t, n)
 #  endif
 
 /** Allocate and initialize a hashtable instance.
@@ -254,7 +276,36 @@ static inline unsigned nozero(unsigned h)
  * \return The initialized hashtable instance or NULL if it failed. */
 static inline hashtable_t *NAME_new(int size)
 {
-    return _hashtable_new(size);
+    return _hashtable_new(size, NULL);
+}
+
+/** Empty a hashtable instance for reuse.
+ *
+ * This reuses the hashtable's memory if it is the right size for the new
+ * size and from the same allocator, and otherwise frees it and allocates a new
+ * one.
+ *
+ * \param *t - The hashtable to reset, or NULL to allocate a new one.
+ *
+ * \param size - The desired minimum size of the hash table.
+ *
+ * \param *a - The allocator to use, or NULL for the default.
+ *
+ * \return The emptied hashtable instance or NULL if it failed. */
+static inline hashtable_t *NAME_reset(hashtable_t *t, int size,
+                                      const struct rs_allocator *a)
+{
+    return _hashtable_reset(t, size, a);
+}
+
+/** Remove all the entries from a hashtable instance.
+ *
+ * This doesn't free the entries, and keeps the hashtable's size.
+ *
+ * \param *t - The hashtable to clear. */
+static inline void NAME_clear(hashtable_t *t)
+{
+    _hashtable_clear(t);
 }
 
 /** Destroy and free a hashtable instance.
@@ -276,9 +327,7 @@ static inline void NAME_free(hashtable_t *t)
  * \param *t - The hashtable to initializ stats for. */
 static inline void NAME_stats_init(hashtable_t *t)
 {
-#  ifndef HASHTABLE_NSTATS
-    t->find_count = t->match_count = t->hashcmp_count = t->entrycmp_count = 0;
-#  endif
+    _hashtable_stats_init(t);
 }
 
 /** Add an entry to a hashtable.
@@ -335,12 +384,14 @@ static inline ENTRY_t *NAME_find(hashtable_t *t, MATCH_t *m)
             _stats_inc(t->entrycmp_count);
             if (!MATCH_cmp(m, e = t->etable[i])) {
                 _stats_inc(t->match_count);
+                _stats_probe(t, s + 1);
                 return e;
             }
         }
     }
     /* Also count the compare for the empty bucket. */
     _stats_inc(t->hashcmp_count);
+    _stats_probe(t, s + 1);
     return NULL;
 }
 
@@ -399,6 +450,8 @@ static inline ENTRY_t *NAME_next(hashtable_t *t, int *i)
 #  undef KEY_hash
 #  undef MATCH_cmp
 #  undef NAME_new
+#  undef NAME_reset
+#  undef NAME_clear
 #  undef NAME_free
 #  undef NAME_stats_init
 #  undef NAME_add
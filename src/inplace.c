@@ -0,0 +1,613 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file inplace.c
+ * Apply a delta to a basis file in place.
+ *
+ * The whole delta is read first to get the list of COPY and LITERAL commands
+ * and their positions in the new file. COPY commands that copy data to where
+ * it already is are skipped. The rest form a dependency graph where copy A
+ * must be done before copy B if B writes over any of the data A reads. This
+ * graph is ordered with Kahn's topological sort. When it has cycles, the
+ * smallest remaining copy has its data read into a spill buffer, and is
+ * written after all the other copies are done. If the spill buffer would be
+ * bigger than rs_spillbuflen the patch fails before anything is written.
+ *
+ * After the copies, the spilled data and then the literal data are written,
+ * since nothing needs to read the basis data they replace. Finally the file
+ * is truncated to the length of the new file. If the delta has a whole-file
+ * checksum the new file is read back and checked against it.
+ *
+ * A copy that overlaps itself is done in chunks in the direction that avoids
+ * overwriting its data before it is read, like memmove(). */
+
+#include "config.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "librsync.h"
+#include "fileutil.h"
+#include "blake2.h"
+#include "command.h"
+#include "prototab.h"
+#include "trace.h"
+#include "util.h"
+
+/** Size of the buffer used for copying data. */
+#define RS_INPLACE_BUFLEN (1024 * 1024)
+
+/** Default spill buffer size for breaking copy cycles. */
+#define RS_INPLACE_SPILLLEN (64 * 1024 * 1024)
+
+/** Spill buffer size for rs_patch_file_inplace(). */
+LIBRSYNC_EXPORT int rs_spillbuflen = 0;
+
+/** A COPY or LITERAL command.
+ *
+ * For COPY commands \p src is the basis position, and for LITERAL commands
+ * it's the position of the literal data in the delta. */
+typedef struct rs_inplace_cmd {
+    rs_long_t src, dst, len;
+} rs_inplace_cmd_t;
+
+/** A growable array of commands. */
+typedef struct rs_inplace_cmds {
+    rs_inplace_cmd_t *cmds;
+    int count, alloc;
+} rs_inplace_cmds_t;
+
+/** Sort key for ordering copies by source position. */
+typedef struct rs_inplace_key {
+    rs_long_t key;
+    int idx;
+} rs_inplace_key_t;
+
+/** A node in the tree of source ends and the range of sorted copies under
+ * it. */
+typedef struct rs_inplace_node {
+    int node, lo, hi;
+} rs_inplace_node_t;
+
+static void rs_inplace_add(rs_inplace_cmds_t *a, rs_long_t src, rs_long_t dst,
+                           rs_long_t len)
+{
+    if (a->count == a->alloc) {
+        a->alloc = a->alloc ? 2 * a->alloc : 256;
+        a->cmds = rs_realloc(a->cmds, a->alloc * sizeof(*a->cmds),
+                             "inplace commands");
+    }
+    a->cmds[a->count].src = src;
+    a->cmds[a->count].dst = dst;
+    a->cmds[a->count].len = len;
+    a->count++;
+}
+
+static int rs_inplace_key_cmp(const void *a, const void *b)
+{
+    const rs_inplace_key_t *ka = a, *kb = b;
+
+    return (ka->key > kb->key) - (ka->key < kb->key);
+}
+
+static rs_result rs_inplace_read(FILE *f, void *buf, size_t len)
+{
+    if (fread(buf, 1, len, f) == len)
+        return RS_DONE;
+    if (ferror(f)) {
+        rs_error("error reading delta");
+        return RS_IO_ERROR;
+    }
+    rs_error("unexpected end of delta");
+    return RS_INPUT_ENDED;
+}
+
+static rs_result rs_inplace_read_netint(FILE *f, int len, rs_long_t *v)
+{
+    rs_byte_t buf[8];
+    rs_result result;
+    int i;
+
+    assert(len <= 8);
+    if ((result = rs_inplace_read(f, buf, (size_t)len)) != RS_DONE)
+        return result;
+    for (*v = 0, i = 0; i < len; i++)
+        *v = *v << 8 | buf[i];
+    return RS_DONE;
+}
+
+/** Read all the commands in a seekable delta.
+ *
+ * \param sum Set to the whole-file checksum if the delta has one.
+ *
+ * \param sum_len Set to the length of the checksum, or 0 if there is none. */
+static rs_result rs_inplace_parse(FILE *delta, rs_long_t basis_len,
+                                  rs_inplace_cmds_t *copies,
+                                  rs_inplace_cmds_t *lits, rs_long_t *new_len,
+                                  rs_byte_t *sum, int *sum_len,
+                                  rs_stats_t *stats)
+{
+    rs_byte_t magic[4], op;
+    const rs_prototab_ent_t *cmd;
+    rs_long_t delta_pos = 4, param1, param2 = 0, out = 0;
+    int sum_found = 0;
+    rs_result result;
+
+    if ((result = rs_inplace_read(delta, magic, 4)) != RS_DONE)
+        return result;
+    if (((rs_long_t)magic[0] << 24 | magic[1] << 16 | magic[2] << 8 | magic[3])
+        != RS_DELTA_MAGIC) {
+        rs_error("bad delta magic number");
+        return RS_BAD_MAGIC;
+    }
+    while (1) {
+        if ((result = rs_inplace_read(delta, &op, 1)) != RS_DONE)
+            return result;
+        cmd = &rs_prototab[op];
+        param1 = cmd->immediate;
+        if (cmd->len_1
+            && (result =
+                rs_inplace_read_netint(delta, cmd->len_1, &param1)) != RS_DONE)
+            return result;
+        if (cmd->len_2
+            && (result =
+                rs_inplace_read_netint(delta, cmd->len_2, &param2)) != RS_DONE)
+            return result;
+        delta_pos += 1 + cmd->len_1 + cmd->len_2;
+        switch (cmd->kind) {
+        case RS_KIND_END:
+            if (*sum_len && !sum_found) {
+                rs_error("delta ended without the CHECKSUM command");
+                return RS_CORRUPT;
+            }
+            *new_len = out;
+            return RS_DONE;
+        case RS_KIND_CHECKSUM:
+            if (op == RS_OP_CHECKSUM_BEGIN) {
+                if (param1 <= 0 || param1 > RS_MAX_STRONG_SUM_LENGTH
+                    || *sum_len || out) {
+                    rs_error("invalid CHECKSUM_BEGIN(sum_len=" FMT_LONG
+                             ") command", param1);
+                    return RS_CORRUPT;
+                }
+                *sum_len = (int)param1;
+                break;
+            }
+            if (!*sum_len || sum_found) {
+                rs_error("CHECKSUM command without CHECKSUM_BEGIN");
+                return RS_CORRUPT;
+            }
+            if ((result = rs_inplace_read(delta, sum, (size_t)*sum_len))
+                != RS_DONE)
+                return result;
+            delta_pos += *sum_len;
+            /* The length can be checked before anything is written. */
+            if (param1 != out) {
+                rs_error("output length " FMT_LONG
+                         " does not match CHECKSUM length " FMT_LONG, out,
+                         param1);
+                return RS_CORRUPT;
+            }
+            sum_found = 1;
+            break;
+        case RS_KIND_LITERAL:
+            if (param1 <= 0) {
+                rs_error("invalid length=" FMT_LONG " on LITERAL command",
+                         param1);
+                return RS_CORRUPT;
+            }
+            rs_inplace_add(lits, delta_pos, out, param1);
+            stats->lit_cmds++;
+            stats->lit_bytes += param1;
+            stats->lit_cmdbytes += 1 + cmd->len_1;
+            delta_pos += param1;
+            if ((result = rs_file_seek(delta, delta_pos)) != RS_DONE)
+                return result;
+            out += param1;
+            break;
+        case RS_KIND_COPY:
+            if (param1 < 0 || param2 <= 0 || param2 > basis_len - param1) {
+                rs_error("invalid COPY(position=" FMT_LONG ", length="
+                         FMT_LONG ") for basis length " FMT_LONG, param1,
+                         param2, basis_len);
+                return RS_CORRUPT;
+            }
+            /* Copies to where the data already is can be skipped. */
+            if (param1 != out)
+                rs_inplace_add(copies, param1, out, param2);
+            stats->copy_cmds++;
+            stats->copy_bytes += param2;
+            stats->copy_cmdbytes += 1 + cmd->len_1 + cmd->len_2;
+            out += param2;
+            break;
+        default:
+            rs_error("bogus command %#04x", op);
+            return RS_CORRUPT;
+        }
+    }
+}
+
+/** Order the copies so no data is overwritten before it is read.
+ *
+ * \param order Set to the order the copies should be done in.
+ *
+ * \param spill Set to non-zero for copies that should be read into the spill
+ * buffer instead of copied directly.
+ *
+ * \param spill_len Set to the total size of spilled copies. */
+static void rs_inplace_plan(const rs_inplace_cmd_t *c, int n, int *order,
+                            char *spill, rs_long_t *spill_len)
+{
+    rs_inplace_key_t *bysrc, *bylen;
+    rs_inplace_node_t stack[64], t;
+    rs_long_t *maxend;
+    int *efrom = NULL, *eto = NULL, *start, *adj, *indeg, *fill;
+    size_t m = 0, ealloc = 0, e;
+    char *queued;
+    int i, k, head, tail, p, size, sp;
+
+    /* Sort copies by source and build a binary tree of the max source end
+       under each node, so we can find the sources that overlap a destination
+       without looking at all the ones before it that don't. */
+    bysrc = rs_alloc((n ? n : 1) * sizeof(*bysrc), "inplace keys");
+    for (i = 0; i < n; i++) {
+        bysrc[i].key = c[i].src;
+        bysrc[i].idx = i;
+    }
+    qsort(bysrc, (size_t)n, sizeof(*bysrc), rs_inplace_key_cmp);
+    for (size = 1; size < n; size *= 2) ;
+    maxend = rs_alloc_struct0(2 * (size_t)size * sizeof(*maxend),
+                              "inplace tree");
+    for (k = 0; k < n; k++)
+        maxend[size + k] = c[bysrc[k].idx].src + c[bysrc[k].idx].len;
+    for (k = size - 1; k > 0; k--)
+        maxend[k] = maxend[2 * k] > maxend[2 * k + 1] ? maxend[2 * k] :
+            maxend[2 * k + 1];
+    /* Add an edge a->b for every copy a whose source b overwrites. */
+    for (i = 0; i < n; i++) {
+        const rs_long_t d = c[i].dst, d_end = c[i].dst + c[i].len;
+        int lo = 0, hi = n;
+
+        /* Find the first source starting at or after the destination end. */
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+
+            if (bysrc[mid].key < d_end)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        /* Walk the subtrees with sources before the destination end that end
+           after its start. The tree depth is at most 31, so the stack can't
+           overflow. */
+        sp = 0;
+        if (lo) {
+            stack[sp].node = 1;
+            stack[sp].lo = 0;
+            stack[sp++].hi = size;
+        }
+        while (sp) {
+            int a, mid;
+
+            t = stack[--sp];
+            if (t.lo >= lo || maxend[t.node] <= d)
+                continue;
+            if (t.node < size) {
+                mid = t.lo + (t.hi - t.lo) / 2;
+                stack[sp].node = 2 * t.node;
+                stack[sp].lo = t.lo;
+                stack[sp++].hi = mid;
+                stack[sp].node = 2 * t.node + 1;
+                stack[sp].lo = mid;
+                stack[sp++].hi = t.hi;
+                continue;
+            }
+            if ((a = bysrc[t.lo].idx) == i)
+                continue;
+            if (m == ealloc) {
+                ealloc = ealloc ? 2 * ealloc : 256;
+                efrom = rs_realloc(efrom, ealloc * sizeof(int), "inplace edges");
+                eto = rs_realloc(eto, ealloc * sizeof(int), "inplace edges");
+            }
+            efrom[m] = a;
+            eto[m] = i;
+            m++;
+        }
+    }
+    rs_free(maxend);
+    /* Build the adjacency lists and indegrees. */
+    start = rs_alloc_struct0((n + 1) * sizeof(int), "inplace graph");
+    indeg = rs_alloc_struct0((n ? n : 1) * sizeof(int), "inplace graph");
+    fill = rs_alloc_struct0((n ? n : 1) * sizeof(int), "inplace graph");
+    adj = rs_alloc((m ? m : 1) * sizeof(int), "inplace graph");
+    for (e = 0; e < m; e++)
+        start[efrom[e] + 1]++;
+    for (i = 0; i < n; i++)
+        start[i + 1] += start[i];
+    for (e = 0; e < m; e++) {
+        adj[start[efrom[e]] + fill[efrom[e]]++] = eto[e];
+        indeg[eto[e]]++;
+    }
+    rs_free(fill);
+    rs_free(efrom);
+    rs_free(eto);
+    rs_trace("inplace graph has %d copies and " FMT_SIZE " dependencies", n,
+             m);
+    /* Copies sorted by length for choosing which to spill. */
+    bylen = bysrc;
+    for (i = 0; i < n; i++) {
+        bylen[i].key = c[i].len;
+        bylen[i].idx = i;
+    }
+    qsort(bylen, (size_t)n, sizeof(*bylen), rs_inplace_key_cmp);
+    /* Kahn's topological sort using order as the queue. */
+    queued = rs_alloc_struct0((n ? n : 1), "inplace graph");
+    memset(spill, 0, (size_t)n);
+    *spill_len = 0;
+    for (tail = 0, i = 0; i < n; i++)
+        if (!indeg[i]) {
+            queued[i] = 1;
+            order[tail++] = i;
+        }
+    for (head = 0, p = 0; head < n;) {
+        if (head == tail) {
+            /* Stuck on a cycle, spill the smallest remaining copy. */
+            while (queued[bylen[p].idx])
+                p++;
+            i = bylen[p].idx;
+            queued[i] = spill[i] = 1;
+            *spill_len += c[i].len;
+            order[tail++] = i;
+        }
+        i = order[head++];
+        for (k = start[i]; k < start[i + 1]; k++)
+            if (!--indeg[adj[k]] && !queued[adj[k]]) {
+                queued[adj[k]] = 1;
+                order[tail++] = adj[k];
+            }
+    }
+    rs_free(queued);
+    rs_free(bysrc);
+    rs_free(start);
+    rs_free(adj);
+    rs_free(indeg);
+}
+
+/** Copy data between positions in the same file like memmove(). */
+static rs_result rs_inplace_move(FILE *f, rs_long_t src, rs_long_t dst,
+                                 rs_long_t len, rs_byte_t *buf)
+{
+    rs_result result;
+    rs_long_t off;
+    size_t n;
+
+    /* Copy forwards if moving data down, otherwise backwards. */
+    for (off = src > dst ? 0 : len; src > dst ? off < len : off > 0;) {
+        if (src > dst) {
+            n = len - off < RS_INPLACE_BUFLEN ? (size_t)(len - off) :
+                RS_INPLACE_BUFLEN;
+        } else {
+            n = off < RS_INPLACE_BUFLEN ? (size_t)off : RS_INPLACE_BUFLEN;
+            off -= (rs_long_t)n;
+        }
+        if ((result = rs_file_seek(f, src + off)) != RS_DONE)
+            return result;
+        if (fread(buf, 1, n, f) != n) {
+            rs_error("error reading basis");
+            return RS_IO_ERROR;
+        }
+        if ((result = rs_file_seek(f, dst + off)) != RS_DONE)
+            return result;
+        if (fwrite(buf, 1, n, f) != n) {
+            rs_error("error writing basis");
+            return RS_IO_ERROR;
+        }
+        if (src > dst)
+            off += (rs_long_t)n;
+    }
+    return RS_DONE;
+}
+
+/** Copy literal data from the delta into the file. */
+static rs_result rs_inplace_literal(FILE *f, FILE *delta,
+                                    const rs_inplace_cmd_t *lit,
+                                    rs_byte_t *buf)
+{
+    rs_result result;
+    rs_long_t off;
+    size_t n;
+
+    if ((result = rs_file_seek(delta, lit->src)) != RS_DONE
+        || (result = rs_file_seek(f, lit->dst)) != RS_DONE)
+        return result;
+    for (off = 0; off < lit->len; off += (rs_long_t)n) {
+        n = lit->len - off < RS_INPLACE_BUFLEN ? (size_t)(lit->len - off) :
+            RS_INPLACE_BUFLEN;
+        if ((result = rs_inplace_read(delta, buf, n)) != RS_DONE)
+            return result;
+        if (fwrite(buf, 1, n, f) != n) {
+            rs_error("error writing basis");
+            return RS_IO_ERROR;
+        }
+    }
+    return RS_DONE;
+}
+
+/* Execute the plan. */
+static rs_result rs_inplace_apply(FILE *f, FILE *delta,
+                                  const rs_inplace_cmds_t *copies,
+                                  const rs_inplace_cmds_t *lits,
+                                  const int *order, const char *spill,
+                                  rs_long_t spill_len, rs_long_t new_len)
+{
+    const rs_inplace_cmd_t *c = copies->cmds;
+    rs_byte_t *buf, *spillbuf = NULL;
+    rs_result result = RS_DONE;
+    rs_long_t off = 0;
+    int i, k;
+
+    buf = rs_alloc(RS_INPLACE_BUFLEN, "inplace buffer");
+    if (spill_len)
+        spillbuf = rs_alloc((size_t)spill_len, "inplace spill buffer");
+    for (k = 0; k < copies->count && result == RS_DONE; k++) {
+        i = order[k];
+        if (!spill[i]) {
+            result = rs_inplace_move(f, c[i].src, c[i].dst, c[i].len, buf);
+        } else if ((result = rs_file_seek(f, c[i].src)) == RS_DONE) {
+            if (fread(spillbuf + off, 1, (size_t)c[i].len, f) !=
+                (size_t)c[i].len) {
+                rs_error("error reading basis");
+                result = RS_IO_ERROR;
+            }
+            off += c[i].len;
+        }
+    }
+    for (off = 0, k = 0; k < copies->count && result == RS_DONE; k++) {
+        i = order[k];
+        if (!spill[i])
+            continue;
+        if ((result = rs_file_seek(f, c[i].dst)) == RS_DONE
+            && fwrite(spillbuf + off, 1, (size_t)c[i].len, f) !=
+            (size_t)c[i].len) {
+            rs_error("error writing basis");
+            result = RS_IO_ERROR;
+        }
+        off += c[i].len;
+    }
+    for (k = 0; k < lits->count && result == RS_DONE; k++)
+        result = rs_inplace_literal(f, delta, &lits->cmds[k], buf);
+    if (result == RS_DONE)
+        result = rs_file_truncate(f, new_len);
+    rs_free(spillbuf);
+    rs_free(buf);
+    return result;
+}
+
+/** Check the patched file against the whole-file checksum from the delta.
+ *
+ * The output is not written in order, so unlike rs_patch_file() this has to
+ * read it back after it has all been written. */
+static rs_result rs_inplace_verify(FILE *f, rs_long_t new_len,
+                                   const rs_byte_t *sum, int sum_len)
+{
+    rs_byte_t *buf, out[RS_MAX_STRONG_SUM_LENGTH];
+    blake2b_state ctx;
+    rs_result result;
+    rs_long_t off;
+    size_t n;
+
+    if ((result = rs_file_seek(f, 0)) != RS_DONE)
+        return result;
+    buf = rs_alloc(RS_INPLACE_BUFLEN, "inplace buffer");
+    blake2b_init(&ctx, (size_t)sum_len);
+    for (off = 0; off < new_len; off += (rs_long_t)n) {
+        n = new_len - off < RS_INPLACE_BUFLEN ? (size_t)(new_len - off) :
+            RS_INPLACE_BUFLEN;
+        if (fread(buf, 1, n, f) != n) {
+            rs_error("error reading basis");
+            rs_free(buf);
+            return RS_IO_ERROR;
+        }
+        blake2b_update(&ctx, buf, n);
+    }
+    rs_free(buf);
+    blake2b_final(&ctx, out, (size_t)sum_len);
+    if (memcmp(out, sum, (size_t)sum_len)) {
+        rs_error("output does not match CHECKSUM");
+        return RS_CORRUPT;
+    }
+    return RS_DONE;
+}
+
+rs_result rs_patch_file_inplace(FILE *basis_file, FILE *delta_file,
+                                rs_stats_t *stats)
+{
+    rs_inplace_cmds_t copies = { NULL, 0, 0 }, lits = { NULL, 0, 0 };
+    const rs_long_t max_spill =
+        rs_spillbuflen ? rs_spillbuflen : RS_INPLACE_SPILLLEN;
+    rs_long_t basis_len = rs_file_size(basis_file), new_len, spill_len = 0;
+    FILE *delta = delta_file;
+    rs_stats_t st;
+    rs_byte_t sum[RS_MAX_STRONG_SUM_LENGTH];
+    int sum_len = 0;
+    int *order = NULL;
+    char *spill = NULL;
+    rs_result result;
+
+    memset(&st, 0, sizeof(st));
+    st.op = "patch";
+    st.start = time(NULL);
+    if (basis_len < 0) {
+        rs_error("in-place patch needs a regular basis file");
+        return RS_IO_ERROR;
+    }
+    /* Spool a delta that's not a regular file so it can be seeked. */
+    if (rs_file_size(delta_file) < 0) {
+        rs_byte_t *buf = rs_alloc(RS_INPLACE_BUFLEN, "inplace buffer");
+        size_t n;
+
+        if (!(delta = tmpfile())) {
+            rs_error("failed to create temporary file for delta");
+            rs_free(buf);
+            return RS_IO_ERROR;
+        }
+        while ((n = fread(buf, 1, RS_INPLACE_BUFLEN, delta_file)))
+            fwrite(buf, 1, n, delta);
+        rs_free(buf);
+        if (ferror(delta_file) || ferror(delta)) {
+            rs_error("failed to spool delta");
+            fclose(delta);
+            return RS_IO_ERROR;
+        }
+    }
+    if ((result = rs_file_seek(delta, 0)) != RS_DONE)
+        goto out;
+    if ((result = rs_inplace_parse(delta, basis_len, &copies, &lits, &new_len,
+                                   sum, &sum_len, &st)) != RS_DONE)
+        goto out;
+    order = rs_alloc((copies.count ? copies.count : 1) * sizeof(int),
+                     "inplace order");
+    spill = rs_alloc((copies.count ? copies.count : 1), "inplace spill");
+    rs_inplace_plan(copies.cmds, copies.count, order, spill, &spill_len);
+    rs_trace("inplace patch has %d copies to do, " FMT_LONG
+             " bytes to spill", copies.count, spill_len);
+    if (spill_len > max_spill) {
+        rs_error("in-place patch needs " FMT_LONG
+                 " bytes of spill buffer, more than the limit " FMT_LONG,
+                 spill_len, max_spill);
+        result = RS_MEM_ERROR;
+        goto out;
+    }
+    result = rs_inplace_apply(basis_file, delta, &copies, &lits, order, spill,
+                              spill_len, new_len);
+    if (result == RS_DONE && sum_len)
+        result = rs_inplace_verify(basis_file, new_len, sum, sum_len);
+  out:
+    st.end = time(NULL);
+    if (stats)
+        memcpy(stats, &st, sizeof(*stats));
+    if (delta != delta_file)
+        fclose(delta);
+    rs_free(copies.cmds);
+    rs_free(lits.cmds);
+    rs_free(order);
+    rs_free(spill);
+    return result;
+}
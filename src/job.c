@@ -40,6 +40,7 @@
 #include "librsync.h"
 #include "job.h"
 #include "stream.h"
+#include "sumset.h"
 #include "trace.h"
 #include "util.h"
 
@@ -57,23 +58,132 @@ rs_job_t *rs_job_new(char const *job_name, rs_result (*statefn)(rs_job_t *))
 
     job->stats.op = job_name;
     job->stats.start = time(NULL);
+    job->times.start_ns = rs_now_ns();
 
     rs_trace("start %s job", job_name);
 
     return job;
 }
 
+void rs_job_reset(rs_job_t *job, char const *job_name,
+                  rs_result (*statefn)(rs_job_t *))
+{
+    rs_byte_t *scoop_buf = job->scoop_buf;
+    size_t scoop_alloc = job->scoop_alloc;
+    int scoop_ring = job->scoop_ring;
+    const rs_allocator_t *allocator = job->allocator;
+    rs_long_t budget_bytes = job->budget_bytes, budget_ns = job->budget_ns;
+
+    rs_job_check(job);
+    if (job->job_owns_sig)
+        rs_free_sumset(job->signature);
+    if (job->basis_cache)
+        rs_basis_cache_free(job->basis_cache);
+    /* Start again from scratch, but keep the scoop buffer and settings. */
+    rs_bzero(job, sizeof *job);
+    job->scoop_buf = job->scoop_next = scoop_buf;
+    job->scoop_alloc = scoop_alloc;
+    job->scoop_ring = scoop_ring;
+    job->allocator = allocator;
+    job->budget_bytes = budget_bytes;
+    job->budget_ns = budget_ns;
+
+    job->job_name = job_name;
+    job->dogtag = RS_JOB_TAG;
+    job->statefn = statefn;
+
+    job->stats.op = job_name;
+    job->stats.start = time(NULL);
+    job->times.start_ns = rs_now_ns();
+
+    rs_trace("restart job as %s job", job_name);
+}
+
 rs_result rs_job_free(rs_job_t *job)
 {
-    free(job->scoop_buf);
+    rs_scoop_free(job);
     if (job->job_owns_sig)
         rs_free_sumset(job->signature);
+    if (job->basis_cache)
+        rs_basis_cache_free(job->basis_cache);
     rs_bzero(job, sizeof *job);
-    free(job);
+    rs_free(job);
 
     return RS_DONE;
 }
 
+rs_result rs_job_set_allocator(rs_job_t *job, const rs_allocator_t *allocator)
+{
+    rs_job_check(job);
+    if (job->scoop_avail) {
+        rs_error("can't change the allocator of a job with buffered input");
+        return RS_PARAM_ERROR;
+    }
+    /* Free a scoop kept from before the job was reset. */
+    if (job->scoop_buf && allocator != job->allocator) {
+        rs_scoop_free(job);
+        job->scoop_buf = job->scoop_next = NULL;
+        job->scoop_alloc = 0;
+        job->scoop_ring = 0;
+    }
+    job->allocator = allocator;
+    return RS_DONE;
+}
+
+rs_result rs_job_set_budget(rs_job_t *job, rs_long_t bytes, rs_long_t nanos)
+{
+    rs_job_check(job);
+    if (bytes < 0 || nanos < 0) {
+        rs_error("invalid job budget of " FMT_LONG " bytes, " FMT_LONG " ns",
+                 bytes, nanos);
+        return RS_PARAM_ERROR;
+    }
+    job->budget_bytes = bytes;
+    job->budget_ns = nanos;
+    return RS_DONE;
+}
+
+/** Set the work to do before the budget is next checked. */
+static void rs_job_budget_refill(rs_job_t *job)
+{
+    rs_long_t left = RS_JOB_BUDGET_NONE;
+
+    if (job->budget_bytes)
+        left = job->budget_bytes - job->budget_done;
+    if (job->budget_ns && left > RS_JOB_BUDGET_CLOCK)
+        left = RS_JOB_BUDGET_CLOCK;
+    job->budget_left = job->budget_chunk = left;
+}
+
+/** Start the budget for an rs_job_iter() call. */
+static void rs_job_budget_start(rs_job_t *job)
+{
+    job->budget_done = 0;
+    job->budget_yield = 0;
+    if (job->budget_ns)
+        job->budget_deadline = rs_now_ns() + job->budget_ns;
+    rs_job_budget_refill(job);
+}
+
+/** Check if the budget is spent when rs_job_budget_spend() runs out.
+ *
+ * \return Non-zero if the job should yield. */
+int rs_job_budget_check(rs_job_t *job)
+{
+    if (job->budget_yield)
+        return 1;
+    job->budget_done += job->budget_chunk - job->budget_left;
+    if ((job->budget_bytes && job->budget_done >= job->budget_bytes)
+        || (job->budget_ns && rs_now_ns() >= job->budget_deadline)) {
+        rs_trace("yielding after " FMT_LONG " bytes of work",
+                 job->budget_done);
+        job->budget_yield = 1;
+        return 1;
+    }
+    rs_job_budget_refill(job);
+    return 0;
+}
+
 static rs_result rs_job_complete(rs_job_t *job, rs_result result)
 {
     rs_job_check(job);
@@ -82,6 +192,7 @@ static rs_result rs_job_complete(rs_job_t *job, rs_result result)
 
     job->final_result = result;
     job->stats.end = time(NULL);
+    job->times.end_ns = rs_now_ns();
     if (result != RS_DONE) {
         rs_error("%s job failed: %s", job->job_name, rs_strerror(result));
     } else {
@@ -90,17 +201,61 @@ static rs_result rs_job_complete(rs_job_t *job, rs_result result)
     return result;
 }
 
+/** Update the stats after an rs_job_work() call.
+ *
+ * This adds the time for the call to the phase times, and the false matches
+ * counted by the signature during the call.
+ *
+ * \param start The time the call started.
+ *
+ * \param strong_ns The signature's strongsum time when the call started.
+ *
+ * \param false_count The signature's false match count when the call
+ * started.
+ *
+ * \param other_ns The emit and IO time when the call started. */
+static void rs_job_update_stats(rs_job_t *job, rs_long_t start,
+                                rs_long_t strong_ns, rs_long_t false_count,
+                                rs_long_t other_ns)
+{
+    rs_signature_t *sig = job->signature;
+    rs_long_t t = rs_now_ns() - start;
+
+    if (sig) {
+        strong_ns = sig->strong_ns - strong_ns;
+        job->times.strong_ns += strong_ns;
+        t -= strong_ns;
+        job->stats.false_matches += (int)(sig->false_count - false_count);
+    }
+    t -= job->times.emit_ns + job->times.io_ns - other_ns;
+    if (job->work_ns)
+        *job->work_ns += t;
+    /* The signature load and hashtable times are kept in the signature. */
+    if (sig) {
+        job->times.loadsig_ns = sig->load_ns;
+        job->times.hashtable_ns = sig->hashtable_ns;
+    }
+}
+
 rs_result rs_job_iter(rs_job_t *job, rs_buffers_t *buffers)
 {
     rs_result result;
     size_t orig_in, orig_out;
+    rs_long_t start, strong_ns = 0, false_count = 0, other_ns;
 
     rs_job_check(job);
     assert(buffers);
 
     orig_in = buffers->avail_in;
     orig_out = buffers->avail_out;
+    start = rs_now_ns();
+    if (job->signature) {
+        strong_ns = job->signature->strong_ns;
+        false_count = job->signature->false_count;
+    }
+    other_ns = job->times.emit_ns + job->times.io_ns;
     result = rs_job_work(job, buffers);
+    rs_job_update_stats(job, start, strong_ns, false_count, other_ns);
     if (result == RS_BLOCKED || result == RS_DONE)
         if ((orig_in == buffers->avail_in) && (orig_out == buffers->avail_out)
             && orig_in && orig_out) {
@@ -113,6 +268,64 @@ rs_result rs_job_iter(rs_job_t *job, rs_buffers_t *buffers)
     return result;
 }
 
+/* Get the index of the last non-empty segment, or -1 if there are none. */
+static int rs_job_iov_last(const rs_iovec_t *iov, int n)
+{
+    while (n > 0 && !iov[n - 1].iov_len)
+        n--;
+    return n - 1;
+}
+
+rs_result rs_job_iterv(rs_job_t *job, const rs_iovec_t *in, int nin,
+                       int eof_in, size_t *in_used, const rs_iovec_t *out,
+                       int nout, size_t *out_used)
+{
+    const int in_last = rs_job_iov_last(in, nin);
+    const int out_last = rs_job_iov_last(out, nout);
+    rs_buffers_t buf;
+    size_t in_off = 0, out_off = 0, avail_in, avail_out;
+    int i = 0, o = 0;
+    rs_result result;
+
+    rs_job_check(job);
+    *in_used = *out_used = 0;
+    while (1) {
+        /* Move on to the next non-empty segments. */
+        while (i <= in_last && in_off == in[i].iov_len) {
+            i++;
+            in_off = 0;
+        }
+        while (o <= out_last && out_off == out[o].iov_len) {
+            o++;
+            out_off = 0;
+        }
+        buf.next_in = i <= in_last ? (char *)in[i].iov_base + in_off : NULL;
+        buf.avail_in = avail_in = i <= in_last ? in[i].iov_len - in_off : 0;
+        buf.eof_in = eof_in && i >= in_last;
+        buf.next_out =
+            o <= out_last ? (char *)out[o].iov_base + out_off : NULL;
+        buf.avail_out = avail_out =
+            o <= out_last ? out[o].iov_len - out_off : 0;
+        result = rs_job_iter(job, &buf);
+        in_off += avail_in - buf.avail_in;
+        *in_used += avail_in - buf.avail_in;
+        out_off += avail_out - buf.avail_out;
+        *out_used += avail_out - buf.avail_out;
+        if (result != RS_BLOCKED)
+            return result;
+        /* Keep going if there are more output segments, or more input
+           segments and output space. Don't feed more input when the output
+           is full, or it would just pile up in the scoop. */
+        if (o < out_last && out_off == out[o].iov_len)
+            continue;
+        if (i < in_last && in_off == in[i].iov_len
+            && (out_last < 0 || o < out_last
+                || (o == out_last && out_off < out[o].iov_len)))
+            continue;
+        return result;
+    }
+}
+
 static rs_result rs_job_work(rs_job_t *job, rs_buffers_t *buffers)
 {
     rs_result result;
@@ -121,6 +334,8 @@ static rs_result rs_job_work(rs_job_t *job, rs_buffers_t *buffers)
     assert(buffers);
 
     job->stream = buffers;
+    job->sum_mark = rs_job_sum_pos(job);
+    rs_job_budget_start(job);
     while (1) {
         result = rs_tube_catchup(job);
         if (result == RS_DONE && job->statefn) {
@@ -132,11 +347,63 @@ static rs_result rs_job_work(rs_job_t *job, rs_buffers_t *buffers)
                 continue;
             }
         }
+        if (result == RS_RUNNING && !job->budget_yield)
+            continue;
+        rs_job_sum_update(job);
+        if (result == RS_RUNNING) {
+            rs_trace("%s job yielded", job->job_name);
+            return result;
+        }
         if (result == RS_BLOCKED)
             return result;
-        if (result != RS_RUNNING)
-            return rs_job_complete(job, result);
+        return rs_job_complete(job, result);
+    }
+}
+
+/** Start calculating a whole-file checksum of the job's input or output.
+ *
+ * \param sum_len The length of the checksum, up to RS_MAX_STRONG_SUM_LENGTH.
+ *
+ * \param output Non-zero to checksum the output data instead of the input. */
+void rs_job_sum_begin(rs_job_t *job, int sum_len, int output)
+{
+    assert(0 < sum_len && sum_len <= RS_MAX_STRONG_SUM_LENGTH);
+    blake2b_init(&job->sum_ctx, (size_t)sum_len);
+    job->sum_len = sum_len;
+    job->sum_output = output;
+    job->sum_bytes = 0;
+    job->sum_mark = job->stream ? rs_job_sum_pos(job) : NULL;
+}
+
+/** Add the data consumed or produced since the last update to the checksum.
+ *
+ * This is done every time rs_job_iter() returns, so the data is checksummed
+ * while it is still in the caller's buffers. */
+void rs_job_sum_update(rs_job_t *job)
+{
+    const rs_byte_t *pos;
+
+    if (!job->sum_len)
+        return;
+    pos = rs_job_sum_pos(job);
+    if (pos > job->sum_mark) {
+        blake2b_update(&job->sum_ctx, job->sum_mark,
+                       (size_t)(pos - job->sum_mark));
+        job->sum_bytes += pos - job->sum_mark;
     }
+    job->sum_mark = pos;
+}
+
+/** Finish the whole-file checksum and stop calculating it.
+ *
+ * \param sum Set to the checksum of the data up to the current stream
+ * position. */
+void rs_job_sum_final(rs_job_t *job, rs_byte_t *sum)
+{
+    assert(job->sum_len);
+    rs_job_sum_update(job);
+    blake2b_final(&job->sum_ctx, sum, (size_t)job->sum_len);
+    job->sum_len = 0;
 }
 
 const rs_stats_t *rs_job_statistics(rs_job_t *job)
@@ -144,6 +411,16 @@ const rs_stats_t *rs_job_statistics(rs_job_t *job)
     return &job->stats;
 }
 
+const rs_times_t *rs_job_times(rs_job_t *job)
+{
+    return &job->times;
+}
+
+const rs_hists_t *rs_job_hists(rs_job_t *job)
+{
+    return &job->hists;
+}
+
 int rs_job_input_is_ending(rs_job_t *job)
 {
     return job->stream->eof_in;
@@ -153,22 +430,27 @@ rs_result rs_job_drive(rs_job_t *job, rs_buffers_t *buf, rs_driven_cb in_cb,
                        void *in_opaque, rs_driven_cb out_cb, void *out_opaque)
 {
     rs_result result, iores;
+    rs_long_t start;
 
     rs_bzero(buf, sizeof *buf);
 
     do {
         if (!buf->eof_in && in_cb) {
+            start = rs_now_ns();
             iores = in_cb(job, buf, in_opaque);
+            job->times.io_ns += rs_now_ns() - start;
             if (iores != RS_DONE)
                 return iores;
         }
 
         result = rs_job_iter(job, buf);
-        if (result != RS_DONE && result != RS_BLOCKED)
+        if (result != RS_DONE && result != RS_BLOCKED && result != RS_RUNNING)
             return result;
 
         if (out_cb) {
+            start = rs_now_ns();
             iores = (out_cb) (job, buf, out_opaque);
+            job->times.io_ns += rs_now_ns() - start;
             if (iores != RS_DONE)
                 return iores;
         }
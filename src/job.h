@@ -19,8 +19,9 @@
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
-#include "mdfour.h"
+#include "blake2.h"
 #include "checksum.h"
+#include "basiscache.h"
 
 /** The contents of this structure are private. */
 struct rs_job {
@@ -43,6 +44,11 @@ struct rs_job {
     int sig_block_len;
     int sig_strong_len;
 
+    /** The weak sum length and basis length of v2 signatures, or -1 if
+     * unknown. */
+    int sig_weak_len;
+    rs_long_t sig_basis_len;
+
     /** The size of the signature file if available. Used by loadsums.c when
      * initializing the signature to preallocate memory. */
     rs_long_t sig_fsize;
@@ -53,11 +59,26 @@ struct rs_job {
     /** Flag indicating signature should be destroyed with the job. */
     int job_owns_sig;
 
+    /** The fine signature being filled in by a match job. */
+    rs_signature_t *fine_sig;
+
+    /** The match map bitmap of coarse blocks used by an unmatched signature
+     * job, with the coarse block count and length. */
+    const rs_byte_t *match_map;
+    int match_count, match_block_len;
+
+    /** The next coarse block of an unmatched signature job and the bytes left
+     * in the current one, negative if it is skipped, or the next map byte to
+     * write out for a match job. Before the map is checked match_left is the
+     * length of the map. */
+    int match_idx;
+    rs_long_t match_left;
+
     /** Command byte currently being processed, if any. */
     unsigned char op;
 
     /** The weak signature digest used by readsums.c */
-    rs_weak_sum_t weak_sig;
+    rs_weak_sum64_t weak_sig;
 
     /** The rollsum weak signature accumulator used by delta.c */
     weaksum_t weak_sum;
@@ -66,11 +87,32 @@ struct rs_job {
     rs_long_t param1, param2;
 
     struct rs_prototab_ent const *cmd;
-    rs_mdfour_t output_md4;
+
+    /** Length of the whole-file checksum of the delta input or patch output,
+     * or 0 if it is not being calculated. */
+    int sum_len;
+
+    /** Flag indicating the whole-file checksum is of the output, not input. */
+    int sum_output;
+
+    /** Number of bytes added to the whole-file checksum so far. */
+    rs_long_t sum_bytes;
+
+    /** The stream position the whole-file checksum has been updated to. */
+    const rs_byte_t *sum_mark;
+
+    /** The whole-file checksum accumulator. */
+    blake2b_state sum_ctx;
 
     /** Encoding statistics. */
     rs_stats_t stats;
 
+    /** Nanosecond times for the job and its phases. */
+    rs_times_t times;
+
+    /** Command length histograms. */
+    rs_hists_t hists;
+
     /** Buffer of data in the scoop. Allocation is scoop_buf[0..scoop_alloc],
      * and scoop_next[0..scoop_avail] contains data yet to be processed.
      * scoop_next[scoop_pos..scoop_avail] is the data yet to be scanned. */
@@ -79,9 +121,35 @@ struct rs_job {
     size_t scoop_alloc;         /* the allocation size */
     size_t scoop_avail;         /* the data size */
     size_t scoop_pos;           /* the scan position */
+    int scoop_ring;             /* if scoop_buf is a mirrored ring buffer */
 
-    /** If USED is >0, then buf contains that much write data to be sent out. */
-    rs_byte_t write_buf[36];
+    /** The allocator for memory used while running, or NULL for the
+     * default. */
+    const rs_allocator_t *allocator;
+
+    /** The work budget for each rs_job_iter() call in bytes and nanoseconds,
+     * or 0 for no limit. */
+    rs_long_t budget_bytes, budget_ns;
+
+    /** The work left before the budget is next checked, the amount that was
+     * left at the last check, and the work done since rs_job_iter() was
+     * called. */
+    rs_long_t budget_left, budget_chunk, budget_done;
+
+    /** The time the rs_job_iter() call must yield by. */
+    rs_long_t budget_deadline;
+
+    /** Flag indicating the budget is spent and the job should yield. */
+    int budget_yield;
+
+    /** The phase time in the job's own states is counted in, or NULL. Time
+     * calculating strong sums, emitting output, and in IO callbacks is
+     * counted separately. */
+    rs_long_t *work_ns;
+
+    /** If USED is >0, then buf contains that much write data to be sent out.
+     * It must fit a signature block or a CHECKSUM command. */
+    rs_byte_t write_buf[44];
     size_t write_len;
 
     /** If \p copy_len is >0, then that much data should be copied through
@@ -94,11 +162,47 @@ struct rs_job {
     /** Callback used to copy data from the basis into the output. */
     rs_copy_cb *copy_cb;
     void *copy_arg;
+
+    /** Cache of basis extents used by patch.c, or NULL if disabled. */
+    rs_basis_cache_t *basis_cache;
 };
 
 rs_job_t *rs_job_new(const char *, rs_result (*statefn)(rs_job_t *));
+void rs_job_reset(rs_job_t *job, const char *job_name,
+                  rs_result (*statefn)(rs_job_t *));
 
 int rs_job_input_is_ending(rs_job_t *job);
+void rs_job_sum_begin(rs_job_t *job, int sum_len, int output);
+void rs_job_sum_update(rs_job_t *job);
+void rs_job_sum_final(rs_job_t *job, rs_byte_t *sum);
+int rs_job_budget_check(rs_job_t *job);
+
+/** Account for \p len bytes of work done by the job.
+ *
+ * This is cheap enough to call for every byte scanned. The clock is only
+ * read every ::RS_JOB_BUDGET_CLOCK bytes of work.
+ *
+ * \return Non-zero if the job's budget is spent and it should yield by
+ * returning RS_RUNNING. */
+static inline int rs_job_budget_spend(rs_job_t *job, size_t len)
+{
+    job->budget_left -= (rs_long_t)len;
+    return job->budget_left <= 0 && rs_job_budget_check(job);
+}
+
+/** Get the stream position the whole-file checksum is calculated up to. */
+static inline const rs_byte_t *rs_job_sum_pos(rs_job_t const *job)
+{
+    if (job->sum_output)
+        return (const rs_byte_t *)job->stream->next_out;
+    return (const rs_byte_t *)job->stream->next_in;
+}
+
+/** Bytes of work between reading the clock for a time budget. */
+#define RS_JOB_BUDGET_CLOCK (64 * 1024)
+
+/** Bytes of work between budget checks when there is no budget. */
+#define RS_JOB_BUDGET_NONE ((rs_long_t)1 << 62)
 
 /** Magic job tag number for checking jobs have been initialized. */
 #define RS_JOB_TAG 20010225
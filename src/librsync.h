@@ -70,6 +70,15 @@ typedef enum {
      * The four-byte literal \c "rs\x026". */
     RS_DELTA_MAGIC = 0x72730236,
 
+    /** A match map of the coarse signature blocks found in a new file.
+     *
+     * Supported since librsync 2.3.3.
+     *
+     * The four-byte literal \c "rs\x036".
+     *
+     * \sa rs_match_begin() */
+    RS_MATCH_MAGIC = 0x72730336,
+
     /** A signature file with MD4 signatures.
      *
      * Backward compatible with librsync < 1.0, but strongly deprecated because
@@ -108,8 +117,184 @@ typedef enum {
      * \sa rs_sig_begin() */
     RS_RK_BLAKE2_SIG_MAGIC = 0x72730147,
 
+    /** A signature file with rollsum and XXH3-128 hash.
+     *
+     * XXH3 is much faster than BLAKE2 but is not a cryptographic hash, so it
+     * should only be used for data that can be trusted not to contain
+     * deliberate collisions. Supported since librsync 2.3.3.
+     *
+     * The four-byte literal \c "rs\x018".
+     *
+     * \sa rs_sig_begin() */
+    RS_XXH3_SIG_MAGIC = 0x72730138,
+
+    /** A signature file with RabinKarp rollsum and XXH3-128 hash.
+     *
+     * The fastest signature type for trusted data. Supported since librsync
+     * 2.3.3.
+     *
+     * The four-byte literal \c "rs\x01H".
+     *
+     * \sa rs_sig_begin() */
+    RS_RK_XXH3_SIG_MAGIC = 0x72730148,
+
+    /** A signature file with rollsum and BLAKE3 hash.
+     *
+     * BLAKE3 is a cryptographic hash like BLAKE2, but is faster for large
+     * blocks because it hashes each block as a tree of 1KB chunks that can be
+     * hashed in parallel. Supported since librsync 2.3.3.
+     *
+     * The four-byte literal \c "rs\x019".
+     *
+     * \sa rs_sig_begin() */
+    RS_BLAKE3_SIG_MAGIC = 0x72730139,
+
+    /** A signature file with RabinKarp rollsum and BLAKE3 hash.
+     *
+     * Supported since librsync 2.3.3.
+     *
+     * The four-byte literal \c "rs\x01I".
+     *
+     * \sa rs_sig_begin() */
+    RS_RK_BLAKE3_SIG_MAGIC = 0x72730149,
+
+    /** A signature file with RabinKarp64 rollsum and MD4 hash.
+     *
+     * The RabinKarp64 magics use a 64 bit RabinKarp rollsum, which makes
+     * false weak sum matches that need a strong sum calculated far rarer for
+     * signatures with very many blocks, at the cost of 4 more bytes per block.
+     * Supported since librsync 2.3.3.
+     *
+     * The four-byte literal \c "rs\x01V".
+     *
+     * \sa rs_sig_begin() */
+    RS_RK64_MD4_SIG_MAGIC = 0x72730156,
+
+    /** A signature file with RabinKarp64 rollsum and BLAKE2 hash.
+     *
+     * Supported since librsync 2.3.3.
+     *
+     * The four-byte literal \c "rs\x01W".
+     *
+     * \sa rs_sig_begin() */
+    RS_RK64_BLAKE2_SIG_MAGIC = 0x72730157,
+
+    /** A signature file with RabinKarp64 rollsum and XXH3-128 hash.
+     *
+     * Supported since librsync 2.3.3.
+     *
+     * The four-byte literal \c "rs\x01X".
+     *
+     * \sa rs_sig_begin() */
+    RS_RK64_XXH3_SIG_MAGIC = 0x72730158,
+
+    /** A signature file with RabinKarp64 rollsum and BLAKE3 hash.
+     *
+     * Supported since librsync 2.3.3.
+     *
+     * The four-byte literal \c "rs\x01Y".
+     *
+     * \sa rs_sig_begin() */
+    RS_RK64_BLAKE3_SIG_MAGIC = 0x72730159,
+
+    /** A signature file with CRC32C rollsum and MD4 hash.
+     *
+     * The CRC32C magics use a CRC32C rollsum, which uses the SSE4.2 crc32
+     * instruction if the CPU supports it to calculate block weak sums faster
+     * than RabinKarp. Supported since librsync 2.3.3.
+     *
+     * The four-byte literal \c "rs\x01f".
+     *
+     * \sa rs_sig_begin() */
+    RS_CRC32C_MD4_SIG_MAGIC = 0x72730166,
+
+    /** A signature file with CRC32C rollsum and BLAKE2 hash.
+     *
+     * Supported since librsync 2.3.3.
+     *
+     * The four-byte literal \c "rs\x01g".
+     *
+     * \sa rs_sig_begin() */
+    RS_CRC32C_BLAKE2_SIG_MAGIC = 0x72730167,
+
+    /** A signature file with CRC32C rollsum and XXH3-128 hash.
+     *
+     * Supported since librsync 2.3.3.
+     *
+     * The four-byte literal \c "rs\x01h".
+     *
+     * \sa rs_sig_begin() */
+    RS_CRC32C_XXH3_SIG_MAGIC = 0x72730168,
+
+    /** A signature file with CRC32C rollsum and BLAKE3 hash.
+     *
+     * Supported since librsync 2.3.3.
+     *
+     * The four-byte literal \c "rs\x01i".
+     *
+     * \sa rs_sig_begin() */
+    RS_CRC32C_BLAKE3_SIG_MAGIC = 0x72730169,
+
+    /** A signature file of content-defined chunks with MD4 hash.
+     *
+     * The CDC magics split the file into variable length chunks using
+     * content-defined chunking, with the block length as the average chunk
+     * length. Delta finds the chunk boundaries in the new file the same way
+     * and only looks up the strong sum of each chunk, instead of rolling a
+     * weak sum over every byte. Supported since librsync 2.3.3.
+     *
+     * The four-byte literal \c "rs\x01v".
+     *
+     * \sa rs_sig_begin() */
+    RS_CDC_MD4_SIG_MAGIC = 0x72730176,
+
+    /** A signature file of content-defined chunks with BLAKE2 hash.
+     *
+     * Supported since librsync 2.3.3.
+     *
+     * The four-byte literal \c "rs\x01w".
+     *
+     * \sa rs_sig_begin() */
+    RS_CDC_BLAKE2_SIG_MAGIC = 0x72730177,
+
+    /** A signature file of content-defined chunks with XXH3-128 hash.
+     *
+     * Supported since librsync 2.3.3.
+     *
+     * The four-byte literal \c "rs\x01x".
+     *
+     * \sa rs_sig_begin() */
+    RS_CDC_XXH3_SIG_MAGIC = 0x72730178,
+
+    /** A signature file of content-defined chunks with BLAKE3 hash.
+     *
+     * Supported since librsync 2.3.3.
+     *
+     * The four-byte literal \c "rs\x01y".
+     *
+     * \sa rs_sig_begin() */
+    RS_CDC_BLAKE3_SIG_MAGIC = 0x72730179,
+
 } rs_magic_number;
 
+/** Get the compact v2 signature magic for a signature magic.
+ *
+ * v2 signatures have a varint header with the basis file length, and their
+ * weak sums are truncated to the fewest bytes that keep false weak sum matches
+ * rare for the number of blocks. Chunk lengths of CDC signatures are
+ * truncated to the bytes needed for the maximum chunk length. They are made
+ * by passing a v2 magic to rs_sig_begin(), and loaded like any other
+ * signature.
+ *
+ * Supported since librsync 2.3.3.
+ *
+ * The four-byte literal \c "rs\x04" followed by the same last byte as the
+ * v1 magic.
+ *
+ * \sa rs_sig_set_basis_len() */
+#  define RS_SIG_V2_MAGIC(magic) \
+    ((rs_magic_number)(((magic) & ~0xff00) | 0x0400))
+
 /** Log severity levels.
  *
  * These are the same as syslog, at least in glibc.
@@ -181,8 +366,10 @@ typedef enum rs_result {
     RS_DONE = 0,                /**< Completed successfully. */
     RS_BLOCKED = 1,             /**< Blocked waiting for more data. */
     RS_RUNNING = 2,             /**< The job is still running, and not yet
-                                 * finished or blocked. (This value should
-                                 * never be seen by the application.) */
+                                 * finished or blocked. This is only returned
+                                 * to the application when the job yields
+                                 * because its budget set by
+                                 * rs_job_set_budget() is spent. */
     RS_TEST_SKIPPED = 77,       /**< Test neither passed or failed. */
     RS_IO_ERROR = 100,          /**< Error in file or network IO. */
     RS_SYNTAX_ERROR = 101,      /**< Command line syntax error. */
@@ -204,6 +391,9 @@ typedef enum rs_result {
 /** Return an English description of a ::rs_result value. */
 LIBRSYNC_EXPORT char const *rs_strerror(rs_result r);
 
+/** The number of buckets in the ::rs_hists_t command length histograms. */
+#  define RS_STATS_HIST_LEN 32
+
 /** Performance statistics from a librsync encoding or decoding operation.
  *
  * \sa api_stats \sa rs_format_stats() \sa rs_log_stats() */
@@ -217,7 +407,8 @@ typedef struct rs_stats {
 
     rs_long_t copy_cmds, copy_bytes, copy_cmdbytes;
     rs_long_t sig_cmds, sig_bytes;
-    int false_matches;
+    int false_matches;          /**< Number of weak sum matches in a delta
+                                 * that had a different strong sum. */
 
     rs_long_t sig_blocks;       /**< Number of blocks described by the
                                  * signature. */
@@ -230,12 +421,47 @@ typedef struct rs_stats {
     time_t start, end;
 } rs_stats_t;
 
+/** Monotonic nanosecond times for a job and its phases.
+ *
+ * These are kept separate from ::rs_stats_t so its layout stays the same for
+ * applications that allocate it for the whole-file functions.
+ *
+ * \sa api_stats \sa rs_job_times() \sa rs_format_job_stats() */
+typedef struct rs_times {
+    rs_long_t start_ns;         /**< When the job started. */
+    rs_long_t end_ns;           /**< When the job finished, or 0 if it
+                                 * hasn't. */
+    rs_long_t loadsig_ns;       /**< Time loading the signature. */
+    rs_long_t hashtable_ns;     /**< Time building the signature hashtable. */
+    rs_long_t scan_ns;          /**< Time scanning the input for signature or
+                                 * delta jobs, not including the phases
+                                 * below. */
+    rs_long_t strong_ns;        /**< Time calculating strong sums. */
+    rs_long_t emit_ns;          /**< Time writing commands and data to the
+                                 * output buffer. */
+    rs_long_t io_ns;            /**< Time waiting in IO callbacks, including
+                                 * reading the basis for patch jobs. */
+} rs_times_t;
+
+/** Histograms of the command lengths in a delta or patch job.
+ *
+ * Bucket i counts the lengths from 2^i to 2^(i+1)-1, and the last bucket also
+ * counts all longer ones. Like ::rs_times_t these are kept separate from
+ * ::rs_stats_t so its layout stays the same.
+ *
+ * \sa api_stats \sa rs_job_hists() */
+typedef struct rs_hists {
+    rs_long_t lit_hist[RS_STATS_HIST_LEN];      /**< Literal lengths. */
+    rs_long_t copy_hist[RS_STATS_HIST_LEN];     /**< Copy lengths. */
+} rs_hists_t;
+
 /** MD4 message-digest accumulator.
  *
  * \sa rs_mdfour(), rs_mdfour_begin(), rs_mdfour_update(), rs_mdfour_result() */
 typedef struct rs_mdfour rs_mdfour_t;
 
-LIBRSYNC_EXPORT extern const int RS_MD4_SUM_LENGTH, RS_BLAKE2_SUM_LENGTH;
+LIBRSYNC_EXPORT extern const int RS_MD4_SUM_LENGTH, RS_BLAKE2_SUM_LENGTH,
+    RS_XXH3_SUM_LENGTH, RS_BLAKE3_SUM_LENGTH;
 
 #  define RS_MAX_STRONG_SUM_LENGTH 32
 
@@ -281,6 +507,42 @@ LIBRSYNC_EXPORT int rs_log_stats(rs_stats_t const *stats);
 /** The signature datastructure type. */
 typedef struct rs_signature rs_signature_t;
 
+/** The number of buckets in the ::rs_match_stats_t probe length histogram. */
+#  define RS_MATCH_PROBE_HIST_LEN 16
+
+/** Statistics for matching blocks against a signature.
+ *
+ * These are accumulated over all the delta jobs using the signature since its
+ * hashtable was built by rs_build_hash_table().
+ *
+ * \sa rs_signature_stats() \sa rs_signature_log_stats() */
+typedef struct rs_match_stats {
+    rs_long_t find_count;       /**< Number of searches for a block. */
+    rs_long_t match_count;      /**< Number of matching blocks found. */
+    rs_long_t weakcmp_count;    /**< Number of weak sum compares. */
+    rs_long_t strongcmp_count;  /**< Number of strong sum compares. */
+    rs_long_t strongcalc_count; /**< Number of strong sums calculated. */
+    rs_long_t false_matches;    /**< Number of strong sum compares that
+                                 * failed after the weak sums matched. */
+    /** Histogram of the number of hashtable buckets looked at by searches.
+     * Bucket i counts searches that looked at i buckets, with 0 for searches
+     * the bloom filter ruled out, and the last bucket also counts all
+     * longer ones. */
+    rs_long_t probe_hist[RS_MATCH_PROBE_HIST_LEN];
+} rs_match_stats_t;
+
+/** Get the match statistics for a signature.
+ *
+ * \param sig - the signature, which must have had rs_build_hash_table()
+ * called.
+ *
+ * \param stats - set to the signature's match statistics.
+ *
+ * \return RS_DONE, or RS_UNIMPLEMENTED if librsync was built without
+ * hashtable stats, in which case only false_matches is set. */
+LIBRSYNC_EXPORT rs_result rs_signature_stats(rs_signature_t const *sig,
+                                             rs_match_stats_t *stats);
+
 /** Log the rs_signature_delta match stats. */
 LIBRSYNC_EXPORT void rs_signature_log_stats(rs_signature_t const *sig);
 
@@ -378,13 +640,15 @@ typedef struct rs_buffers_s rs_buffers_t;
 typedef struct rs_job rs_job_t;
 
 /** Run a ::rs_job state machine until it blocks (::RS_BLOCKED), returns an
- * error, or completes (::RS_DONE).
+ * error, completes (::RS_DONE), or yields (::RS_RUNNING).
  *
  * \param job Description of job state.
  *
  * \param buffers Pointer to structure describing input and output buffers.
  *
- * \return The ::rs_result that caused iteration to stop.
+ * \return The ::rs_result that caused iteration to stop. ::RS_RUNNING means
+ * the job's budget set by rs_job_set_budget() was spent, and it should be
+ * called again to continue, with or without more input or output space.
  *
  * \c buffers->eof_in should be true if there is no more data after what's in
  * the input buffer. The final block checksum will run across whatever's in
@@ -393,6 +657,49 @@ typedef struct rs_job rs_job_t;
  * \sa \ref api_streaming */
 LIBRSYNC_EXPORT rs_result rs_job_iter(rs_job_t *job, rs_buffers_t *buffers);
 
+/** A buffer segment for rs_job_iterv().
+ *
+ * This has the same members as the POSIX struct iovec. */
+typedef struct rs_iovec {
+    void *iov_base;             /**< Start of the segment. */
+    size_t iov_len;             /**< Length of the segment. */
+} rs_iovec_t;
+
+/** Run a ::rs_job state machine over scattered input and output buffers.
+ *
+ * This is like rs_job_iter(), but takes the input and output as arrays of
+ * buffer segments, such as chains of network packet buffers, so they don't
+ * need to be copied into contiguous buffers first. The segments are used in
+ * order, moving to the next input or output segment whenever the job has
+ * used up the current one. Empty segments are skipped.
+ *
+ * \param job Description of job state.
+ *
+ * \param in Array of input segments.
+ *
+ * \param nin Number of input segments.
+ *
+ * \param eof_in True if there is no more data after the input segments.
+ *
+ * \param in_used Set to the number of input bytes used. Unused input starts
+ * that many bytes into the input segments, and must be passed in again.
+ *
+ * \param out Array of output segments.
+ *
+ * \param nout Number of output segments.
+ *
+ * \param out_used Set to the number of bytes written to the output segments.
+ *
+ * \return The ::rs_result that caused iteration to stop. ::RS_BLOCKED means
+ * all the input segments have been used, or all the output segments are
+ * full.
+ *
+ * \sa rs_job_iter() */
+LIBRSYNC_EXPORT rs_result rs_job_iterv(rs_job_t *job, const rs_iovec_t *in,
+                                       int nin, int eof_in, size_t *in_used,
+                                       const rs_iovec_t *out, int nout,
+                                       size_t *out_used);
+
 /** Type of application-supplied function for rs_job_drive().
  *
  * \sa \ref api_pull */
@@ -408,9 +715,125 @@ LIBRSYNC_EXPORT rs_result rs_job_drive(rs_job_t *job, rs_buffers_t *buf,
 /** Return a pointer to the statistics in a job. */
 LIBRSYNC_EXPORT const rs_stats_t *rs_job_statistics(rs_job_t *job);
 
+/** Return a pointer to the nanosecond times in a job. */
+LIBRSYNC_EXPORT const rs_times_t *rs_job_times(rs_job_t *job);
+
+/** Return a pointer to the command length histograms in a job. */
+LIBRSYNC_EXPORT const rs_hists_t *rs_job_hists(rs_job_t *job);
+
+/** Return a human-readable representation of a job's statistics.
+ *
+ * This is like rs_format_stats(), but uses the job's nanosecond times for the
+ * speeds and adds the time taken by each phase.
+ *
+ * \sa 
+ef api_stats */
+LIBRSYNC_EXPORT char *rs_format_job_stats(rs_job_t *job, char *buf,
+                                          size_t size);
+
+/** Write a job's statistics and phase times into the current log as text.
+ *
+ * \sa 
+ef api_stats \sa 
+ef api_trace */
+LIBRSYNC_EXPORT int rs_log_job_stats(rs_job_t *job);
+
 /** Deallocate job state. */
 LIBRSYNC_EXPORT rs_result rs_job_free(rs_job_t *);
 
+/** Limit the work a job does in each rs_job_iter() call.
+ *
+ * With large buffers a single rs_job_iter() call can otherwise run for a long
+ * time, for example while a delta job scans megabytes of input. When the
+ * budget for a call is spent the job yields by returning ::RS_RUNNING, so an
+ * event loop can service other jobs before calling it again.
+ *
+ * Work is counted as the bytes of input scanned, or signature blocks
+ * processed, or output copied for patch jobs. The clock is only read every
+ * 64KB of work, so time budgets can be overrun by the time that takes. The
+ * job always does some work before yielding, so it will always make
+ * progress.
+ *
+ * \param job The job to set the budget for.
+ *
+ * \param bytes The maximum bytes of work per call, or 0 for no limit.
+ *
+ * \param nanos The maximum nanoseconds per call, or 0 for no limit.
+ *
+ * \return RS_DONE, or RS_PARAM_ERROR if a limit is negative. */
+LIBRSYNC_EXPORT rs_result rs_job_set_budget(rs_job_t *job, rs_long_t bytes,
+                                            rs_long_t nanos);
+
+/** Memory allocator hooks.
+ *
+ * Each function is passed the \p ctx pointer, and otherwise works like
+ * malloc(), realloc() and free(). The alloc and realloc functions can return
+ * NULL to refuse an allocation, for example to limit memory use.
+ *
+ * \sa rs_set_allocator() \sa rs_job_set_allocator() */
+typedef struct rs_allocator {
+    void *(*alloc)(void *ctx, size_t size);
+    void *(*realloc)(void *ctx, void *ptr, size_t size);
+    void (*free)(void *ctx, void *ptr);
+    void *ctx;
+} rs_allocator_t;
+
+/** Set the allocator used for all librsync memory.
+ *
+ * This must be called before any librsync objects are created, and the
+ * allocator must stay valid until they are all freed. If it refuses an
+ * allocation librsync aborts like it does when malloc() fails, except for the
+ * memory used by running jobs, where the job fails with RS_MEM_ERROR.
+ *
+ * \param allocator The allocator to use, or NULL to use malloc(). */
+LIBRSYNC_EXPORT void rs_set_allocator(const rs_allocator_t *allocator);
+
+/** Set the allocator for the memory a job uses as it runs.
+ *
+ * This is used for the job's input buffer and for the block sums and
+ * hashtable of a signature loaded by a rs_loadsig_begin() job. If it refuses
+ * an allocation the job fails with RS_MEM_ERROR instead of aborting. It must
+ * be called before the job is run or after it is reset, and the allocator
+ * must stay valid until the job and any signature it loaded are freed.
+ *
+ * \param job The job to set the allocator for.
+ *
+ * \param allocator The allocator to use, or NULL to use the one set by
+ * rs_set_allocator().
+ *
+ * \return RS_DONE, or RS_PARAM_ERROR if the job has input buffered. */
+LIBRSYNC_EXPORT rs_result rs_job_set_allocator(rs_job_t *job,
+                                               const rs_allocator_t
+                                               *allocator);
+
+/** An arena of memory that is all freed at once.
+ *
+ * \sa rs_arena_new() */
+typedef struct rs_arena rs_arena_t;
+
+/** Create a new memory arena.
+ *
+ * An arena hands out memory from large chunks, and only returns it when the
+ * arena is freed. Use rs_arena_allocator() to get an allocator for it to pass
+ * to rs_job_set_allocator(). This avoids fragmenting the heap in
+ * long-running processes, and lets all the memory for a group of jobs and
+ * signatures be limited, accounted for, and freed in one go.
+ *
+ * \param limit The maximum number of bytes the arena can use, or 0 for no
+ * limit. */
+LIBRSYNC_EXPORT rs_arena_t *rs_arena_new(size_t limit);
+
+/** Get an allocator that allocates from an arena. */
+LIBRSYNC_EXPORT const rs_allocator_t *rs_arena_allocator(rs_arena_t *arena);
+
+/** Get the number of bytes of memory an arena is using. */
+LIBRSYNC_EXPORT size_t rs_arena_used(rs_arena_t const *arena);
+
+/** Free an arena and all the memory allocated from it.
+ *
+ * Any jobs and signatures using it must be freed first. */
+LIBRSYNC_EXPORT void rs_arena_free(rs_arena_t *arena);
+
 /** Get or check signature arguments for a given file size.
  *
  * This can be used to get the recommended arguments for generating a
@@ -460,12 +883,66 @@ LIBRSYNC_EXPORT rs_result rs_sig_args(rs_long_t old_fsize,
 LIBRSYNC_EXPORT rs_job_t *rs_sig_begin(size_t block_len, size_t strong_len,
                                        rs_magic_number sig_magic);
 
+/** Reuse a finished job to generate another signature.
+ *
+ * This sets up a job from any of the *_begin() functions as if it was
+ * created by rs_sig_begin(), but reuses the memory the job has already
+ * allocated. Reusing jobs avoids most of the setup cost for each file when
+ * processing lots of small files.
+ *
+ * \sa rs_sig_begin() */
+LIBRSYNC_EXPORT rs_result rs_sig_reset(rs_job_t *job, size_t block_len,
+                                       size_t strong_len,
+                                       rs_magic_number sig_magic);
+
+/** Set the length of the basis file for a v2 signature.
+ *
+ * The length is written in the header of v2 signatures, and the weak sum
+ * length is chosen from it. Without it the length is unknown and the weak
+ * sums are not truncated. It is ignored for v1 signatures.
+ *
+ * This must be called before the job is first run.
+ *
+ * \param job A job created with rs_sig_begin().
+ *
+ * \param basis_len The length of the basis file, or -1 if unknown.
+ *
+ * \sa RS_SIG_V2_MAGIC() */
+LIBRSYNC_EXPORT rs_result rs_sig_set_basis_len(rs_job_t *job,
+                                               rs_long_t basis_len);
+
 /** Prepare to compute a streaming delta.
  *
  * \todo Add a version of this that takes a ::rs_magic_number controlling the
  * delta format. */
 LIBRSYNC_EXPORT rs_job_t *rs_delta_begin(rs_signature_t *);
 
+/** Reuse a finished job to compute another delta.
+ *
+ * This is like rs_delta_begin() but reuses an existing job.
+ *
+ * \sa rs_sig_reset() */
+LIBRSYNC_EXPORT rs_result rs_delta_reset(rs_job_t *job, rs_signature_t *);
+
+/** Add a whole-file checksum of the new file to a delta.
+ *
+ * The delta will include the length and BLAKE2b hash of the new file, and
+ * patch will check the output it writes against them as it goes, failing with
+ * RS_CORRUPT if it doesn't match. This detects a wrong or modified basis file
+ * without needing to read and hash the new file again after patching.
+ * Deltas with a checksum cannot be applied by versions of librsync before
+ * 2.3.3.
+ *
+ * This must be called before the job is first run.
+ *
+ * \param job A job created with rs_delta_begin().
+ *
+ * \param sum_len The length of the checksum in bytes, up to
+ * RS_MAX_STRONG_SUM_LENGTH, or 0 for no checksum (the default).
+ *
+ * \sa rs_deltasumlen */
+LIBRSYNC_EXPORT rs_result rs_delta_set_checksum(rs_job_t *job, int sum_len);
+
 /** Read a signature from a file into an ::rs_signature structure in memory.
  *
  * Once there, it can be used to generate a delta to a newer version of the
@@ -475,11 +952,74 @@ LIBRSYNC_EXPORT rs_job_t *rs_delta_begin(rs_signature_t *);
  * before you can use them. */
 LIBRSYNC_EXPORT rs_job_t *rs_loadsig_begin(rs_signature_t **);
 
+/** Reuse a finished job to read another signature.
+ *
+ * This is like rs_loadsig_begin() but reuses an existing job. If \p
+ * *signature is a signature from a previous rs_loadsig_begin() or
+ * rs_loadsig_reset() the new signature is read into it, reusing its memory
+ * for the block sums and hashtable. Any previous contents are discarded, so
+ * it must not be in use by another job. If \p *signature is NULL a new
+ * signature is allocated.
+ *
+ * \sa rs_sig_reset() */
+LIBRSYNC_EXPORT rs_result rs_loadsig_reset(rs_job_t *job,
+                                           rs_signature_t **signature);
+
 /** Call this after loading a signature to index it.
  *
  * Use rs_free_sumset() to release it after use. */
 LIBRSYNC_EXPORT rs_result rs_build_hash_table(rs_signature_t *sums);
 
+/** Find the blocks of a coarse signature in a new file.
+ *
+ * This is the first step of a two-level signature exchange, which avoids
+ * sending fine block sums for the parts of a large file that haven't changed.
+ * The receiver sends a signature with a large block length from
+ * rs_sig_begin(), and the sender loads it, calls rs_build_hash_table(), and
+ * runs this job on the new file. It writes out a match map of the coarse
+ * blocks found, which is sent back to the receiver for
+ * rs_sig_unmatched_begin(). The sender then loads the signature of the
+ * unmatched blocks it gets back, and calls rs_merge_sumset() to complete the
+ * fine signature before using it for rs_delta_begin() as usual. The new file
+ * is read twice, once by this job and once by the delta.
+ *
+ * CDC signatures can't be used as coarse signatures.
+ *
+ * \param coarse_sig The coarse signature, which must stay valid until the job
+ * is done.
+ *
+ * \param block_len The fine block length, which must divide the coarse block
+ * length.
+ *
+ * \param fine_sig On return points to the new fine signature. It has the sums
+ * of the coarse blocks found, and must be released with rs_free_sumset(). */
+LIBRSYNC_EXPORT rs_job_t *rs_match_begin(rs_signature_t *coarse_sig,
+                                         size_t block_len,
+                                         rs_signature_t **fine_sig);
+
+/** Start generating a signature of the blocks not found by rs_match_begin().
+ *
+ * This reads the same basis file as the coarse signature was made from, and
+ * writes a signature with the fine block length and format of the match map
+ * that only has the fine blocks of the coarse blocks that were not found.
+ *
+ * \param map The match map, which must stay valid until the job is done.
+ *
+ * \param map_len The length of the match map. */
+LIBRSYNC_EXPORT rs_job_t *rs_sig_unmatched_begin(const void *map,
+                                                 size_t map_len);
+
+/** Merge a loaded signature of the unmatched blocks into a fine signature.
+ *
+ * \param sig The fine signature from rs_match_begin().
+ *
+ * \param unmatched The signature from rs_sig_unmatched_begin(), loaded with
+ * rs_loadsig_begin(). It isn't changed, and can be freed after.
+ *
+ * \return RS_DONE, or RS_CORRUPT if the signatures don't fit together. */
+LIBRSYNC_EXPORT rs_result rs_merge_sumset(rs_signature_t *sig,
+                                          rs_signature_t const *unmatched);
+
 /** Callback used to retrieve parts of the basis file.
  *
  * \param pos Position where copying should begin.
@@ -503,14 +1043,100 @@ typedef rs_result rs_copy_cb(void *opaque, rs_long_t pos, size_t *len,
  *
  * \param copy_arg Opaque environment pointer passed through to the callback.
  *
- * \todo As output is produced, accumulate the MD4 checksum of the output. Then
- * if we find a CHECKSUM command we can check it's contents against the output.
+ * If the delta has a whole-file checksum the output is checked against it as
+ * it is produced, and the job fails with RS_CORRUPT if it doesn't match. Note
+ * the mismatch can only be detected at the end, after all the output has been
+ * written.
  *
- * \todo Implement COPY commands.
+ * \sa rs_delta_set_checksum()
  *
  * \sa rs_patch_file() \sa \ref api_streaming */
 LIBRSYNC_EXPORT rs_job_t *rs_patch_begin(rs_copy_cb * copy_cb, void *copy_arg);
 
+/** Reuse a finished job to apply another delta.
+ *
+ * This is like rs_patch_begin() but reuses an existing job. Any basis cache
+ * is freed, so call rs_patch_set_cache() again if it is needed.
+ *
+ * \sa rs_sig_reset() */
+LIBRSYNC_EXPORT rs_result rs_patch_reset(rs_job_t *job, rs_copy_cb * copy_cb,
+                                         void *copy_arg);
+
+/** Set the size of the basis cache used by a patch job.
+ *
+ * The basis cache lets patch read the basis in larger extents. On a cache miss
+ * it looks ahead at the delta commands already buffered, merges nearby
+ * following COPY commands into a single read, and serves them from the cache.
+ * This turns many small random basis reads into fewer larger sequential reads,
+ * which is much faster on spinning disks and network filesystems. The least
+ * recently used extents are discarded to keep the cache within \p size bytes,
+ * waiting for any asynchronous reads into them to finish if needed, and COPY
+ * commands larger than a quarter of the cache bypass it.
+ *
+ * When the cache is enabled the ::rs_copy_cb may be asked for data past the
+ * end of the range used by any COPY command, including past the end of the
+ * basis. It should return a short read with RS_DONE when it has some but not
+ * all of the requested data.
+ *
+ * The cache is disabled by default for jobs created with rs_patch_begin().
+ *
+ * \param job A job created with rs_patch_begin().
+ *
+ * \param size The maximum size of the cache in bytes, or 0 to disable it.
+ *
+ * \sa rs_cachelen */
+LIBRSYNC_EXPORT rs_result rs_patch_set_cache(rs_job_t *job, size_t size);
+
+/** Use asynchronous reads of the basis file for a patch job.
+ *
+ * This uses Linux io_uring to read the basis file directly from \p basis_fd
+ * into the basis cache, keeping up to \p depth reads in flight. Reads are
+ * started ahead of time for the COPY commands already buffered in the delta
+ * input, and the output is still produced in order as the reads complete.
+ * This makes much better use of devices like NVMe drives that can serve many
+ * reads at once. It enables a default size basis cache if rs_patch_set_cache()
+ * has not been used to enable one.
+ *
+ * The ::rs_copy_cb is still used for COPY commands that bypass the cache and
+ * for any reads that fail, so it must read the same basis file.
+ *
+ * \param job A job created with rs_patch_begin().
+ *
+ * \param basis_fd A file descriptor for the basis file that supports
+ * positioned reads. It is not closed by the job.
+ *
+ * \param depth The maximum number of reads in flight, or 0 to disable
+ * asynchronous reads.
+ *
+ * \return RS_DONE if asynchronous reads are enabled, or RS_UNIMPLEMENTED if
+ * they are not supported on this platform, in which case the job will still
+ * work using synchronous reads. */
+LIBRSYNC_EXPORT rs_result rs_patch_set_async(rs_job_t *job, int basis_fd,
+                                             int depth);
+
+/** A pool of worker threads for running batches of jobs.
+ *
+ * \sa rs_pool_new() \sa rs_sig_batch() */
+typedef struct rs_pool rs_pool_t;
+
+/** Create a pool of worker threads.
+ *
+ * The pool can be used for any number of batches, including batches of
+ * different kinds, and is shared by batches started from different threads
+ * by running them one after another. If librsync was built without pthreads
+ * the pool has no threads and batches are run by the calling thread.
+ *
+ * \param nthreads The number of threads, or 0 for one per online CPU. */
+LIBRSYNC_EXPORT rs_pool_t *rs_pool_new(int nthreads);
+
+/** Get the number of worker threads in a pool. */
+LIBRSYNC_EXPORT int rs_pool_threads(rs_pool_t const *pool);
+
+/** Stop the threads of a pool and free it.
+ *
+ * No batches can be running on it. */
+LIBRSYNC_EXPORT void rs_pool_free(rs_pool_t *pool);
+
 #  ifndef RSYNC_NO_STDIO_INTERFACE
 #    include <stdio.h>
 
@@ -554,6 +1180,79 @@ LIBRSYNC_EXPORT rs_result rs_file_copy_cb(void *arg, rs_long_t pos, size_t *len,
  * only need to change these in testing. */
 LIBRSYNC_EXPORT extern int rs_inbuflen, rs_outbuflen;
 
+/** Basis cache size for rs_patch_file().
+ *
+ * The default 0 means don't use a basis cache, a negative value means use the
+ * recommended cache size, and any other value is the cache size in bytes.
+ *
+ * \sa rs_patch_set_cache() */
+LIBRSYNC_EXPORT extern int rs_cachelen;
+
+/** Asynchronous basis read depth for rs_patch_file().
+ *
+ * The default 0 means read the basis synchronously through its FILE, a
+ * negative value means use the recommended number of reads in flight, and any
+ * other value is the number of reads in flight. Asynchronous reads go directly
+ * to the basis file descriptor, so the basis FILE must not have any data
+ * buffered in stdio. This also enables the basis cache if ::rs_cachelen
+ * doesn't.
+ *
+ * \sa rs_patch_set_async() */
+LIBRSYNC_EXPORT extern int rs_asyncdepth;
+
+/** Whole-file checksum length for rs_delta_file().
+ *
+ * The default 0 means don't add a checksum to the delta, any other value is
+ * the checksum length in bytes.
+ *
+ * \sa rs_delta_set_checksum() */
+LIBRSYNC_EXPORT extern int rs_deltasumlen;
+
+/** File IO methods for the whole-file functions.
+ *
+ * \sa rs_fileio */
+typedef enum {
+    /** Buffered IO with stdio, the default. */
+    RS_FILEIO_STDIO = 0,
+    /** IO directly on the file descriptors with large page-aligned buffers,
+     * hinting to the kernel that file data doesn't need to be cached. */
+    RS_FILEIO_FD = 1,
+    /** Like ::RS_FILEIO_FD, but bypassing the page cache with O_DIRECT where
+     * the platform and filesystem support it. */
+    RS_FILEIO_DIRECT = 2
+} rs_fileio_mode;
+
+/** File IO method for the whole-file functions.
+ *
+ * The default ::RS_FILEIO_STDIO reads and writes the files through stdio.
+ * The other ::rs_fileio_mode values bypass stdio and use the underlying file
+ * descriptors directly, which avoids a copy and keeps huge files from
+ * filling the page cache. The FILEs must not have any data buffered in stdio
+ * when they are passed in. Platforms without pread() always use stdio, and
+ * threaded IO with ::rs_pipelinebufs also uses stdio. */
+LIBRSYNC_EXPORT extern int rs_fileio;
+
+/** Number of buffers for threaded file IO in the whole-file functions.
+ *
+ * The default 0 means do file IO on the calling thread. Any other value means
+ * use a reader and writer thread with this many input and output buffers
+ * each, so file IO overlaps with processing. Use 2 for double buffering or 3
+ * for triple buffering. This is ignored if librsync was built without
+ * pthreads.
+ *
+ * The reader thread reads ahead at most this many buffers. If a job finishes
+ * before the end of its input, for example a patch whose delta is followed by
+ * more data on a pipe, the reader is cancelled in its read and the whole-file
+ * function returns without waiting for more input. Anything read ahead past
+ * the end of the job is discarded. */
+LIBRSYNC_EXPORT extern int rs_pipelinebufs;
+
+/** Spill buffer size for rs_patch_file_inplace().
+ *
+ * The default 0 means use the recommended maximum size of 64MB, any other
+ * value overrides it. */
+LIBRSYNC_EXPORT extern int rs_spillbuflen;
+
 /** Generate the signature of a basis file, and write it out to another.
  *
  * It's recommended you use rs_sig_args() to get the recommended arguments for
@@ -600,11 +1299,157 @@ LIBRSYNC_EXPORT rs_result rs_loadsig_file(FILE *sig_file,
 LIBRSYNC_EXPORT rs_result rs_delta_file(rs_signature_t *, FILE *new_file,
                                         FILE *delta_file, rs_stats_t *);
 
+/** Find the blocks of a coarse signature in a new file and write a match map.
+ *
+ * \param coarse_sig The coarse signature, with its hashtable built.
+ *
+ * \param new_file Readable stdio file of the new file.
+ *
+ * \param map_file Writable stdio file for the match map.
+ *
+ * \param block_len The fine block length.
+ *
+ * \param fine_sig On return points to the new fine signature, to complete
+ * with rs_merge_sumset().
+ *
+ * \param stats Optional pointer to receive statistics.
+ *
+ * \sa rs_match_begin() \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_match_file(rs_signature_t *coarse_sig,
+                                        FILE *new_file, FILE *map_file,
+                                        size_t block_len,
+                                        rs_signature_t **fine_sig,
+                                        rs_stats_t *stats);
+
+/** Generate a signature of the blocks of a basis file not found in a match
+ * map.
+ *
+ * \param old_file Readable stdio file of the basis file.
+ *
+ * \param map_file Readable stdio file of the match map, which is read into
+ * memory first.
+ *
+ * \param sig_file Writable stdio file for the signature.
+ *
+ * \param stats Optional pointer to receive statistics.
+ *
+ * \sa rs_sig_unmatched_begin() \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_sig_unmatched_file(FILE *old_file,
+                                                FILE *map_file,
+                                                FILE *sig_file,
+                                                rs_stats_t *stats);
+
 /** Apply a patch, relative to a basis, into a new file.
  *
  * \sa \ref api_whole */
 LIBRSYNC_EXPORT rs_result rs_patch_file(FILE *basis_file, FILE *delta_file,
                                         FILE *new_file, rs_stats_t *);
+
+/** Apply a patch to a basis file in place, turning it into the new file.
+ *
+ * This avoids needing space for a separate copy of the new file. The whole
+ * delta is read first, and the COPY commands are ordered so that no part of
+ * the basis is overwritten before every COPY that needs it has read it. COPY
+ * commands that would copy data to where it already is are skipped entirely.
+ * Circular dependencies between COPY commands are broken by reading some of
+ * them into a spill buffer in memory, limited by ::rs_spillbuflen. Finally
+ * the file is truncated to the length of the new file.
+ *
+ * The delta is checked and the order planned before anything is written, so
+ * if the delta is corrupt or needs too much spill buffer this fails with the
+ * basis unchanged. An IO error part way through will leave it damaged.
+ *
+ * \param basis_file A regular file opened for reading and writing, for example
+ * with fopen() mode "r+b".
+ *
+ * \param delta_file The delta to apply. If it's not a regular file it will
+ * be copied into a temporary file first.
+ *
+ * \param stats Optional pointer to receive statistics.
+ *
+ * \return RS_DONE on success, or RS_MEM_ERROR if the spill buffer needed is
+ * bigger than ::rs_spillbuflen.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_patch_file_inplace(FILE *basis_file,
+                                                FILE *delta_file,
+                                                rs_stats_t *stats);
+
+/** An item for rs_sig_batch().
+ *
+ * The arguments are the same as for rs_sig_file(), and the result and stats
+ * are set when the batch runs. */
+typedef struct rs_sig_batch_item {
+    FILE *old_file;             /**< The file to generate a signature for. */
+    FILE *sig_file;             /**< The file to write the signature to. */
+    size_t block_len;           /**< The block length, or 0. */
+    size_t strong_len;          /**< The strongsum length, 0, or -1. */
+    rs_magic_number sig_magic;  /**< The signature format, or 0. */
+    rs_result result;           /**< The result of the job. */
+    rs_stats_t stats;           /**< The statistics of the job. */
+} rs_sig_batch_item_t;
+
+/** An item for rs_delta_batch().
+ *
+ * The arguments are the same as for rs_delta_file(), and the result and
+ * stats are set when the batch runs. */
+typedef struct rs_delta_batch_item {
+    rs_signature_t *sig;        /**< The loaded signature with its hashtable
+                                 * built. It can't be shared with other items. */
+    FILE *new_file;             /**< The new file. */
+    FILE *delta_file;           /**< The file to write the delta to. */
+    rs_result result;           /**< The result of the job. */
+    rs_stats_t stats;           /**< The statistics of the job. */
+} rs_delta_batch_item_t;
+
+/** An item for rs_patch_batch().
+ *
+ * The arguments are the same as for rs_patch_file(), and the result and
+ * stats are set when the batch runs. */
+typedef struct rs_patch_batch_item {
+    FILE *basis_file;           /**< The basis file. */
+    FILE *delta_file;           /**< The delta to apply. */
+    FILE *new_file;             /**< The file to write the new file to. */
+    rs_result result;           /**< The result of the job. */
+    rs_stats_t stats;           /**< The statistics of the job. */
+} rs_patch_batch_item_t;
+
+/** Generate the signatures of a batch of files concurrently.
+ *
+ * This runs rs_sig_file() for each item on the threads of \p pool, and waits
+ * for them all to finish. The worker threads steal work from each other so
+ * they are kept busy even when the files have very different sizes. Every
+ * item is run even if some fail, and each item's result and stats are set.
+ *
+ * \param items The items to run.
+ *
+ * \param n The number of items.
+ *
+ * \param pool The pool to run them on, or NULL to run them one at a time in
+ * the calling thread.
+ *
+ * \return RS_DONE if all the items succeeded, or otherwise the result of the
+ * first item that failed.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_sig_batch(rs_sig_batch_item_t *items, size_t n,
+                                       rs_pool_t *pool);
+
+/** Generate the deltas of a batch of files concurrently.
+ *
+ * This is like rs_sig_batch() but runs rs_delta_file() for each item.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_delta_batch(rs_delta_batch_item_t *items,
+                                         size_t n, rs_pool_t *pool);
+
+/** Apply the patches of a batch of files concurrently.
+ *
+ * This is like rs_sig_batch() but runs rs_patch_file() for each item.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_patch_batch(rs_patch_batch_item_t *items,
+                                         size_t n, rs_pool_t *pool);
 #  endif                        /* !RSYNC_NO_STDIO_INTERFACE */
 
 #  ifdef __cplusplus
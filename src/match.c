@@ -0,0 +1,191 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file match.c
+ * Find the blocks of a coarse signature in a new file and write a match map.
+ *
+ * This is the first half of a two-level signature exchange. The receiver
+ * sends a coarse signature with large blocks, and this scans the new file for
+ * them the same way as delta.c does, but only notes which coarse blocks were
+ * found instead of emitting commands. The match map written out tells the
+ * receiver which coarse blocks it doesn't need to send fine block sums for.
+ *
+ * The fine block sums of the coarse blocks found are calculated from the new
+ * file as they are found, which gives the same sums as the receiver would
+ * have sent. They are put in a fine signature with the unmatched blocks left
+ * empty for rs_merge_sumset() to fill in from the receiver's signature of the
+ * unmatched blocks.
+ *
+ * A coarse block only counts as found if it matched in full, since the fine
+ * blocks of a partly matched block are unknown. Only the last coarse block
+ * can be shorter than the coarse block length. */
+
+#include "config.h"
+#include <assert.h>
+#include <stdlib.h>
+#include "librsync.h"
+#include "job.h"
+#include "sumset.h"
+#include "checksum.h"
+#include "stream.h"
+#include "netint.h"
+#include "trace.h"
+#include "util.h"
+
+/** The maximum bytes of the match map bitmap written by each state call. */
+#define RS_MATCH_MAP_CHUNK 32
+
+static rs_result rs_match_s_scan(rs_job_t *job);
+static rs_result rs_match_s_header(rs_job_t *job);
+static rs_result rs_match_s_map(rs_job_t *job);
+
+/** State function that sets up the fine signature. */
+static rs_result rs_match_s_init(rs_job_t *job)
+{
+    rs_signature_t *sig = job->signature;
+    rs_result result;
+
+    if ((result =
+         rs_signature_fine_init(job->fine_sig, sig,
+                                (size_t)job->sig_block_len)) != RS_DONE)
+        return result;
+    weaksum_init(&job->weak_sum, rs_signature_weaksum_kind(sig));
+    job->stats.block_len = sig->block_len;
+    job->statefn = sig->count ? rs_match_s_scan : rs_match_s_header;
+    return RS_RUNNING;
+}
+
+/** State function that scans the new file for coarse blocks.
+ *
+ * All the input available is scanned and then dropped from the scoop, except
+ * for the last block which is kept to roll the weak sum over. At eof the
+ * weak sum is rolled out over the remaining data to find a short last
+ * block. */
+static rs_result rs_match_s_scan(rs_job_t *job)
+{
+    rs_signature_t *sig = job->signature;
+    const size_t block_len = (size_t)sig->block_len;
+    const rs_byte_t *p;
+    rs_long_t match_pos;
+    rs_result result;
+    size_t len;
+    int idx, eof;
+
+    rs_job_check(job);
+    /* read the input into the scoop */
+    len = rs_scoop_total_avail(job);
+    if (job->scoop_avail < len
+        && (result = rs_scoop_input(job, len)) != RS_DONE)
+        return result;
+    eof = job->stream->eof_in;
+    while ((job->scoop_pos + block_len < job->scoop_avail)
+           || (eof && job->scoop_pos < job->scoop_avail)) {
+        p = job->scoop_next + job->scoop_pos;
+        /* calculate the weak_sum if we don't have one */
+        if (weaksum_count(&job->weak_sum) == 0) {
+            len = job->scoop_avail - job->scoop_pos;
+            if (len > block_len)
+                len = block_len;
+            weaksum_update(&job->weak_sum, p, len);
+        } else {
+            len = weaksum_count(&job->weak_sum);
+        }
+        match_pos =
+            rs_signature_find_match(sig, weaksum_digest(&job->weak_sum), p,
+                                    len);
+        idx = (int)(match_pos / sig->block_len);
+        if (match_pos != -1 && (len == block_len || idx == sig->count - 1)) {
+            rs_trace("found coarse block %d length " FMT_SIZE, idx, len);
+            rs_signature_add_coarse_match(job->fine_sig, idx, p, len);
+            job->stats.copy_cmds++;
+            job->stats.copy_bytes += len;
+            weaksum_reset(&job->weak_sum);
+        } else {
+            if (job->scoop_pos + block_len < job->scoop_avail)
+                weaksum_rotate(&job->weak_sum, p[0], p[block_len]);
+            else
+                weaksum_rollout(&job->weak_sum, p[0]);
+            len = 1;
+        }
+        job->scoop_pos += len;
+        /* yield if the work budget is spent by the len bytes scanned */
+        if (rs_job_budget_spend(job, len))
+            break;
+    }
+    /* drop the scanned data from the scoop */
+    job->scoop_avail -= job->scoop_pos;
+    job->scoop_next += job->scoop_pos;
+    job->scoop_pos = 0;
+    if (job->budget_yield)
+        return RS_RUNNING;
+    if (!eof)
+        return RS_BLOCKED;
+    job->statefn = rs_match_s_header;
+    return RS_RUNNING;
+}
+
+/** State function that writes out the match map header. */
+static rs_result rs_match_s_header(rs_job_t *job)
+{
+    rs_signature_t *sig = job->signature;
+
+    rs_squirt_n4(job, RS_MATCH_MAGIC);
+    rs_squirt_n4(job, sig->magic);
+    rs_squirt_n4(job, sig->block_len);
+    rs_squirt_n4(job, job->sig_block_len);
+    rs_squirt_n4(job, sig->strong_sum_len);
+    rs_squirt_n4(job, sig->count);
+    rs_trace("sent match map header (magic %#x, coarse block len = %d, "
+             "fine block len = %d, strong sum len = %d, coarse blocks = %d)",
+             sig->magic, sig->block_len, job->sig_block_len,
+             sig->strong_sum_len, sig->count);
+    job->match_idx = 0;
+    job->statefn = rs_match_s_map;
+    return RS_RUNNING;
+}
+
+/** State function that writes out the next part of the match map bitmap. */
+static rs_result rs_match_s_map(rs_job_t *job)
+{
+    const int map_len = (job->signature->count + 7) / 8;
+    int len = map_len - job->match_idx;
+
+    if (len > RS_MATCH_MAP_CHUNK)
+        len = RS_MATCH_MAP_CHUNK;
+    rs_tube_write(job, job->fine_sig->coarse_matched + job->match_idx,
+                  (size_t)len);
+    job->match_idx += len;
+    return job->match_idx < map_len ? RS_RUNNING : RS_DONE;
+}
+
+rs_job_t *rs_match_begin(rs_signature_t *coarse_sig, size_t block_len,
+                         rs_signature_t **fine_sig)
+{
+    rs_job_t *job;
+
+    rs_signature_check(coarse_sig);
+    /* Caller must have called rs_build_hash_table() by now. */
+    assert(coarse_sig->hashtable || !coarse_sig->count);
+    job = rs_job_new("match", rs_match_s_init);
+    job->signature = coarse_sig;
+    job->work_ns = &job->times.scan_ns;
+    job->sig_block_len = (int)block_len;
+    job->fine_sig = *fine_sig = rs_alloc_struct(rs_signature_t);
+    return job;
+}
@@ -25,7 +25,18 @@
  *
  * Generating checksums is pretty easy, since we can always just process
  * whatever data is available. When a whole block has arrived, or we've reached
- * the end of the file, we write the checksum out. */
+ * the end of the file, we write the checksum out.
+ *
+ * For CDC signatures we need to see up to the maximum chunk length to find
+ * where the next chunk ends, and write out its length and strong sum.
+ *
+ * Compact v2 signatures have a varint header with the basis length, and write
+ * only the top bytes of the weak sums, as many as rs_sig_weak_len() says are
+ * needed for the basis length.
+ *
+ * A signature of the unmatched blocks skips over the coarse blocks a match map
+ * from rs_match_begin() says were found in the new file, and writes out the
+ * fine blocks of the rest. */
 
 #include "config.h"
 #include <assert.h>
@@ -33,6 +44,7 @@
 #include "librsync.h"
 #include "job.h"
 #include "sumset.h"
+#include "cdc.h"
 #include "stream.h"
 #include "netint.h"
 #include "trace.h"
@@ -41,6 +53,8 @@
 /* Possible state functions for signature generation. */
 static rs_result rs_sig_s_header(rs_job_t *);
 static rs_result rs_sig_s_generate(rs_job_t *);
+static rs_result rs_sig_s_chunk(rs_job_t *);
+static rs_result rs_sig_s_unmatched(rs_job_t *);
 
 /** State of trying to send the signature header. \private */
 static rs_result rs_sig_s_header(rs_job_t *job)
@@ -53,13 +67,30 @@ static rs_result rs_sig_s_header(rs_job_t *job)
                            job->sig_strong_len, 0)) != RS_DONE)
         return result;
     rs_squirt_n4(job, sig->magic);
-    rs_squirt_n4(job, sig->block_len);
-    rs_squirt_n4(job, sig->strong_sum_len);
-    rs_trace("sent header (magic %#x, block len = %d, strong sum len = %d)",
-             sig->magic, sig->block_len, sig->strong_sum_len);
+    if (rs_signature_is_v2(sig)) {
+        sig->weak_sum_len =
+            rs_sig_weak_len(sig->magic, (size_t)sig->block_len,
+                            job->sig_basis_len);
+        sig->basis_len = job->sig_basis_len;
+        rs_squirt_varint(job, sig->block_len);
+        rs_squirt_varint(job, sig->strong_sum_len);
+        rs_squirt_varint(job, sig->weak_sum_len);
+        /* The basis length is stored plus one so zero means unknown. */
+        rs_squirt_varint(job, sig->basis_len + 1);
+        rs_trace("sent v2 header (magic %#x, block len = %d, strong sum len = "
+                 "%d, weak sum len = %d, basis len = " FMT_LONG ")", sig->magic,
+                 sig->block_len, sig->strong_sum_len, sig->weak_sum_len,
+                 sig->basis_len);
+    } else {
+        rs_squirt_n4(job, sig->block_len);
+        rs_squirt_n4(job, sig->strong_sum_len);
+        rs_trace("sent header (magic %#x, block len = %d, strong sum len = "
+                 "%d)", sig->magic, sig->block_len, sig->strong_sum_len);
+    }
     job->stats.block_len = sig->block_len;
 
-    job->statefn = rs_sig_s_generate;
+    job->statefn =
+        rs_signature_is_cdc(sig) ? rs_sig_s_chunk : rs_sig_s_generate;
     return RS_RUNNING;
 }
 
@@ -68,12 +99,22 @@ static rs_result rs_sig_s_header(rs_job_t *job)
 static rs_result rs_sig_do_block(rs_job_t *job, const void *block, size_t len)
 {
     rs_signature_t *sig = job->signature;
-    rs_weak_sum_t weak_sum;
+    rs_weak_sum64_t weak_sum;
     rs_strong_sum_t strong_sum;
+    rs_long_t start;
 
-    weak_sum = rs_signature_calc_weak_sum(sig, block, len);
+    /* CDC signatures have the chunk length instead of a weak sum. */
+    if (rs_signature_is_cdc(sig))
+        weak_sum = (rs_weak_sum64_t)len;
+    else
+        weak_sum =
+            rs_signature_file_weak_sum(sig,
+                                       rs_signature_calc_weak_sum(sig, block,
+                                                                  len));
+    start = rs_now_ns();
     rs_signature_calc_strong_sum(sig, block, len, &strong_sum);
-    rs_squirt_n4(job, weak_sum);
+    sig->strong_ns += rs_now_ns() - start;
+    rs_squirt_netint(job, (rs_long_t)weak_sum, rs_signature_weak_sum_len(sig));
     rs_tube_write(job, strong_sum, sig->strong_sum_len);
     if (rs_trace_enabled()) {
         char strong_sum_hex[RS_MAX_STRONG_SUM_LENGTH * 2 + 1];
@@ -82,6 +123,7 @@ static rs_result rs_sig_do_block(rs_job_t *job, const void *block, size_t len)
                  strong_sum_hex);
     }
     job->stats.sig_blocks++;
+    rs_job_budget_spend(job, len);
     return RS_RUNNING;
 }
 
@@ -108,6 +150,121 @@ static rs_result rs_sig_s_generate(rs_job_t *job)
     return rs_sig_do_block(job, block, len);
 }
 
+/** State of reading up to a maximum length chunk and trying to generate the
+ * sum of the chunk at its start. \private */
+static rs_result rs_sig_s_chunk(rs_job_t *job)
+{
+    const size_t avg_len = job->signature->block_len;
+    rs_result result;
+    size_t len;
+    void *block;
+
+    /* must see a maximum length chunk, otherwise try again */
+    len = rs_cdc_max_len(avg_len);
+    result = rs_scoop_readahead(job, len, &block);
+    /* If we are near EOF, chunk whatever is left. */
+    if (result == RS_INPUT_ENDED && (len = rs_scoop_total_avail(job)))
+        result = rs_scoop_readahead(job, len, &block);
+    if (result == RS_INPUT_ENDED) {
+        return RS_DONE;
+    } else if (result != RS_DONE) {
+        rs_trace("generate stopped: %s", rs_strerror(result));
+        return result;
+    }
+    len = rs_cdc_cut(block, len, avg_len);
+    rs_scoop_advance(job, len);
+    rs_trace("got " FMT_SIZE " byte chunk", len);
+    return rs_sig_do_block(job, block, len);
+}
+
+/** State of checking the match map and trying to send the signature header
+ * of the unmatched blocks. \private */
+static rs_result rs_sig_s_unmatched_header(rs_job_t *job)
+{
+    const rs_byte_t *map = job->match_map;
+    /* The map length is kept in match_left until the map is checked. */
+    const rs_long_t map_len = job->match_left;
+    rs_result result;
+
+    if (map_len < 24 || (int)rs_netint_get(map, 4) != RS_MATCH_MAGIC) {
+        rs_error("not a match map");
+        return RS_BAD_MAGIC;
+    }
+    job->sig_magic = (int)rs_netint_get(map + 4, 4);
+    job->match_block_len = (int)rs_netint_get(map + 8, 4);
+    job->sig_block_len = (int)rs_netint_get(map + 12, 4);
+    job->sig_strong_len = (int)rs_netint_get(map + 16, 4);
+    job->match_count = (int)rs_netint_get(map + 20, 4);
+    if (job->sig_block_len <= 0 || job->match_block_len <= 0
+        || job->match_block_len % job->sig_block_len || job->match_count < 0
+        || map_len != 24 + ((rs_long_t)job->match_count + 7) / 8) {
+        rs_error("corrupt match map with coarse block_len=%d, fine "
+                 "block_len=%d, and %d coarse blocks", job->match_block_len,
+                 job->sig_block_len, job->match_count);
+        return RS_CORRUPT;
+    }
+    job->match_map = map + 24;
+    job->match_idx = 0;
+    job->match_left = 0;
+    if ((result = rs_sig_s_header(job)) != RS_RUNNING)
+        return result;
+    if (rs_signature_is_cdc(job->signature)) {
+        rs_error("match map for a CDC signature");
+        return RS_CORRUPT;
+    }
+    job->statefn = rs_sig_s_unmatched;
+    return RS_RUNNING;
+}
+
+/** State of skipping matched coarse blocks, or reading a fine block of an
+ * unmatched one and trying to generate its sum. \private */
+static rs_result rs_sig_s_unmatched(rs_job_t *job)
+{
+    rs_buffers_t *const stream = job->stream;
+    rs_result result;
+    size_t len;
+    void *block;
+    int idx;
+
+    /* Start the next coarse block. Blocks past the map's are unmatched. */
+    if (!job->match_left) {
+        idx = job->match_idx++;
+        job->match_left = job->match_block_len;
+        if (idx < job->match_count
+            && (job->match_map[idx / 8] >> (idx % 8)) & 1)
+            job->match_left = -job->match_left;
+    }
+    /* A negative match_left is the bytes left to skip in a matched block. */
+    if (job->match_left < 0) {
+        len = job->scoop_avail ? job->scoop_avail : stream->avail_in;
+        if ((rs_long_t)len > -job->match_left)
+            len = (size_t)-job->match_left;
+        if (!len)
+            return rs_job_input_is_ending(job) ? RS_DONE : RS_BLOCKED;
+        rs_trace("skipped " FMT_SIZE " bytes of coarse block %d", len,
+                 job->match_idx - 1);
+        rs_scoop_advance(job, len);
+        rs_job_budget_spend(job, len);
+        job->match_left += (rs_long_t)len;
+        return RS_RUNNING;
+    }
+    /* must get a whole block, otherwise try again */
+    len = (size_t)job->signature->block_len;
+    result = rs_scoop_read(job, len, &block);
+    /* If we are near EOF, get whatever is left. */
+    if (result == RS_INPUT_ENDED)
+        result = rs_scoop_read_rest(job, &len, &block);
+    if (result == RS_INPUT_ENDED) {
+        return RS_DONE;
+    } else if (result != RS_DONE) {
+        rs_trace("generate stopped: %s", rs_strerror(result));
+        return result;
+    }
+    rs_trace("got " FMT_SIZE " byte block", len);
+    job->match_left -= (rs_long_t)len;
+    return rs_sig_do_block(job, block, len);
+}
+
 rs_job_t *rs_sig_begin(size_t block_len, size_t strong_len,
                        rs_magic_number sig_magic)
 {
@@ -116,8 +273,52 @@ rs_job_t *rs_sig_begin(size_t block_len, size_t strong_len,
     job = rs_job_new("signature", rs_sig_s_header);
     job->signature = rs_alloc_struct(rs_signature_t);
     job->job_owns_sig = 1;
+    job->work_ns = &job->times.scan_ns;
     job->sig_magic = sig_magic;
     job->sig_block_len = (int)block_len;
     job->sig_strong_len = (int)strong_len;
+    job->sig_basis_len = -1;
+    return job;
+}
+
+rs_result rs_sig_reset(rs_job_t *job, size_t block_len, size_t strong_len,
+                       rs_magic_number sig_magic)
+{
+    rs_signature_t *sig = job->job_owns_sig ? job->signature : NULL;
+
+    /* Keep a signature this job already owns instead of allocating one. */
+    job->job_owns_sig = 0;
+    rs_job_reset(job, "signature", rs_sig_s_header);
+    if (sig)
+        rs_signature_done(sig);
+    else
+        sig = rs_alloc_struct(rs_signature_t);
+    job->signature = sig;
+    job->job_owns_sig = 1;
+    job->work_ns = &job->times.scan_ns;
+    job->sig_magic = sig_magic;
+    job->sig_block_len = (int)block_len;
+    job->sig_strong_len = (int)strong_len;
+    job->sig_basis_len = -1;
+    return RS_DONE;
+}
+
+rs_result rs_sig_set_basis_len(rs_job_t *job, rs_long_t basis_len)
+{
+    job->sig_basis_len = basis_len < 0 ? -1 : basis_len;
+    return RS_DONE;
+}
+
+rs_job_t *rs_sig_unmatched_begin(const void *map, size_t map_len)
+{
+    rs_job_t *job;
+
+    job = rs_job_new("signature", rs_sig_s_unmatched_header);
+    job->signature = rs_alloc_struct(rs_signature_t);
+    job->job_owns_sig = 1;
+    job->work_ns = &job->times.scan_ns;
+    job->sig_basis_len = -1;
+    job->match_map = map;
+    job->match_left = (rs_long_t)map_len;
     return job;
 }
@@ -36,7 +36,10 @@
  *
  * The `squirt` routines also return a result code which in theory could be
  * RS_BLOCKED if there is not enough output space to proceed, but in practice
- * is always RS_DONE. */
+ * is always RS_DONE.
+ *
+ * The `varint' routines use LEB128 encoding, with the low 7 bits first and
+ * the top bit of each byte set if more bytes follow. */
 
 #include "config.h"
 #include <assert.h>
@@ -47,6 +50,9 @@
 
 #define RS_MAX_INT_BYTES 8
 
+/** The maximum bytes of a varint for non-negative rs_long_t values. */
+#define RS_MAX_VARINT_BYTES 9
+
 /** Write a single byte to a stream output. */
 rs_result rs_squirt_byte(rs_job_t *job, rs_byte_t val)
 {
@@ -81,6 +87,22 @@ rs_result rs_squirt_n4(rs_job_t *job, int val)
     return rs_squirt_netint(job, val, 4);
 }
 
+/** Write a non-negative variable-length integer to a stream as a varint. */
+rs_result rs_squirt_varint(rs_job_t *job, rs_long_t val)
+{
+    rs_byte_t buf[RS_MAX_VARINT_BYTES];
+    int len = 0;
+
+    assert(val >= 0);
+    while (val >= 0x80) {
+        buf[len++] = (rs_byte_t)(val | 0x80);
+        val >>= 7;
+    }
+    buf[len++] = (rs_byte_t)val;
+    rs_tube_write(job, buf, len);
+    return RS_DONE;
+}
+
 rs_result rs_suck_byte(rs_job_t *job, rs_byte_t *val)
 {
     rs_result result;
@@ -95,13 +117,15 @@ rs_result rs_suck_netint(rs_job_t *job, rs_long_t *val, int len)
 {
     rs_result result;
     rs_byte_t *buf;
+    uintmax_t v = 0;
     int i;
 
     assert(len <= RS_MAX_INT_BYTES);
     if ((result = rs_scoop_read(job, len, (void **)&buf)) == RS_DONE) {
-        *val = 0;
+        /* Accumulate unsigned so 8 byte values can't overflow. */
         for (i = 0; i < len; i++)
-            *val = (*val << 8) | (rs_long_t)buf[i];
+            v = (v << 8) | buf[i];
+        *val = (rs_long_t)v;
     }
     return result;
 }
@@ -116,6 +140,35 @@ rs_result rs_suck_n4(rs_job_t *job, int *val)
     return result;
 }
 
+/** Read a varint from a stream.
+ *
+ * This looks ahead until it sees the last byte of the varint so that nothing
+ * is consumed if it is incomplete. Varints too long for a non-negative
+ * rs_long_t are RS_CORRUPT. */
+rs_result rs_suck_varint(rs_job_t *job, rs_long_t *val)
+{
+    rs_result result;
+    rs_byte_t *buf;
+    uintmax_t v = 0;
+    int i, len = 0;
+
+    do {
+        if (++len > RS_MAX_VARINT_BYTES)
+            return RS_CORRUPT;
+        if ((result =
+             rs_scoop_readahead(job, (size_t)len, (void **)&buf)) != RS_DONE)
+            return result;
+    } while (buf[len - 1] & 0x80);
+    /* Accumulate from the last byte, which has the top bits. */
+    for (i = len - 1; i >= 0; i--)
+        v = (v << 7) | (buf[i] & 0x7f);
+    if (v > (uintmax_t)INT64_MAX)
+        return RS_CORRUPT;
+    rs_scoop_advance(job, (size_t)len);
+    *val = (rs_long_t)v;
+    return RS_DONE;
+}
+
 int rs_int_len(rs_long_t val)
 {
     assert(val >= 0);
@@ -23,9 +23,21 @@
 rs_result rs_squirt_byte(rs_job_t *job, rs_byte_t val);
 rs_result rs_squirt_netint(rs_job_t *job, rs_long_t val, int len);
 rs_result rs_squirt_n4(rs_job_t *job, int val);
+rs_result rs_squirt_varint(rs_job_t *job, rs_long_t val);
 
 rs_result rs_suck_byte(rs_job_t *job, rs_byte_t *val);
 rs_result rs_suck_netint(rs_job_t *job, rs_long_t *val, int len);
 rs_result rs_suck_n4(rs_job_t *job, int *val);
+rs_result rs_suck_varint(rs_job_t *job, rs_long_t *val);
 
 int rs_int_len(rs_long_t val);
+
+/** Get a len byte network order integer from a buffer. */
+static inline rs_long_t rs_netint_get(const rs_byte_t *p, int len)
+{
+    uint64_t v = 0;
+
+    while (len--)
+        v = (v << 8) | *p++;
+    return (rs_long_t)v;
+}
@@ -29,11 +29,13 @@
 #include <string.h>
 #include "librsync.h"
 #include "job.h"
+#include "basiscache.h"
 #include "netint.h"
 #include "stream.h"
 #include "command.h"
 #include "prototab.h"
 #include "trace.h"
+#include "util.h"
 
 static rs_result rs_patch_s_cmdbyte(rs_job_t *);
 static rs_result rs_patch_s_params(rs_job_t *);
@@ -41,6 +43,12 @@ static rs_result rs_patch_s_run(rs_job_t *);
 static rs_result rs_patch_s_literal(rs_job_t *);
 static rs_result rs_patch_s_copy(rs_job_t *);
 static rs_result rs_patch_s_copying(rs_job_t *);
+static rs_result rs_patch_s_checksum(rs_job_t *);
+static rs_result rs_patch_run_buffered(rs_job_t *);
+
+/** Maximum number of buffered commands to look ahead at for coalescing basis
+ * reads. */
+#define RS_PATCH_LOOKAHEAD_CMDS 64
 
 /** State of trying to read the first byte of a command. Once we've taken that
  * in, we can know how much data to read to get the arguments. */
@@ -48,6 +56,10 @@ static rs_result rs_patch_s_cmdbyte(rs_job_t *job)
 {
     rs_result result;
 
+    /* Run any complete commands buffered before going one byte at a time. */
+    result = rs_patch_run_buffered(job);
+    if (result != RS_RUNNING || job->statefn != rs_patch_s_cmdbyte)
+        return result;
     if ((result = rs_suck_byte(job, &job->op)) != RS_DONE)
         return result;
     job->cmd = &rs_prototab[job->op];
@@ -95,11 +107,18 @@ static rs_result rs_patch_s_run(rs_job_t *job)
         job->statefn = rs_patch_s_literal;
         return RS_RUNNING;
     case RS_KIND_END:
+        if (job->sum_len) {
+            rs_error("delta ended without the CHECKSUM command");
+            return RS_CORRUPT;
+        }
         return RS_DONE;
         /* so we exit here; trying to continue causes an error */
     case RS_KIND_COPY:
         job->statefn = rs_patch_s_copy;
         return RS_RUNNING;
+    case RS_KIND_CHECKSUM:
+        job->statefn = rs_patch_s_checksum;
+        return RS_RUNNING;
     default:
         rs_error("bogus command %#04x", job->op);
         return RS_CORRUPT;
@@ -120,7 +139,9 @@ static rs_result rs_patch_s_literal(rs_job_t *job)
     stats->lit_cmds++;
     stats->lit_bytes += len;
     stats->lit_cmdbytes += 1 + job->cmd->len_1;
+    rs_stats_hist_add(job->hists.lit_hist, len);
     rs_tube_copy(job, (size_t)len);
+    rs_job_budget_spend(job, (size_t)len);
     job->statefn = rs_patch_s_cmdbyte;
     return RS_RUNNING;
 }
@@ -143,19 +164,263 @@ static rs_result rs_patch_s_copy(rs_job_t *job)
     stats->copy_cmds++;
     stats->copy_bytes += len;
     stats->copy_cmdbytes += 1 + job->cmd->len_1 + job->cmd->len_2;
+    rs_stats_hist_add(job->hists.copy_hist, len);
     job->basis_pos = pos;
     job->basis_len = len;
     job->statefn = rs_patch_s_copying;
     return RS_RUNNING;
 }
 
+/** Called for the CHECKSUM_BEGIN and CHECKSUM commands.
+ *
+ * CHECKSUM_BEGIN starts calculating the checksum of the output as it is
+ * written, and CHECKSUM checks it against the checksum read from the delta. */
+static rs_result rs_patch_s_checksum(rs_job_t *job)
+{
+    rs_stats_t *stats = &job->stats;
+    rs_byte_t sum[RS_MAX_STRONG_SUM_LENGTH];
+    int sum_len;
+    rs_result result;
+    void *p;
+
+    if (job->op == RS_OP_CHECKSUM_BEGIN) {
+        rs_trace("CHECKSUM_BEGIN(sum_len=" FMT_LONG ")", job->param1);
+        if (job->param1 <= 0 || job->param1 > RS_MAX_STRONG_SUM_LENGTH
+            || job->sum_len || stats->lit_bytes || stats->copy_bytes) {
+            rs_error("invalid CHECKSUM_BEGIN(sum_len=" FMT_LONG ") command",
+                     job->param1);
+            return RS_CORRUPT;
+        }
+        rs_job_sum_begin(job, (int)job->param1, 1);
+        job->statefn = rs_patch_s_cmdbyte;
+        return RS_RUNNING;
+    }
+    if (!job->sum_len) {
+        rs_error("CHECKSUM command without CHECKSUM_BEGIN");
+        return RS_CORRUPT;
+    }
+    if ((result = rs_scoop_read(job, (size_t)job->sum_len, &p)) != RS_DONE)
+        return result;
+    rs_trace("CHECKSUM(length=" FMT_LONG ")", job->param1);
+    sum_len = job->sum_len;
+    rs_job_sum_final(job, sum);
+    if (job->param1 != job->sum_bytes) {
+        rs_error("output length " FMT_LONG " does not match CHECKSUM length "
+                 FMT_LONG, job->sum_bytes, job->param1);
+        return RS_CORRUPT;
+    }
+    if (memcmp(p, sum, (size_t)sum_len)) {
+        rs_error("output does not match CHECKSUM");
+        return RS_CORRUPT;
+    }
+    job->statefn = rs_patch_s_cmdbyte;
+    return RS_RUNNING;
+}
+
+/** Get the byte at offset \p i in the buffered input. */
+static inline rs_byte_t rs_patch_peek(rs_job_t *job, size_t i)
+{
+    if (i < job->scoop_avail)
+        return job->scoop_next[i];
+    return (rs_byte_t)job->stream->next_in[i - job->scoop_avail];
+}
+
+/** Get the \p len byte network integer at offset \p i in the buffered input. */
+static rs_long_t rs_patch_peek_netint(rs_job_t *job, size_t i, int len)
+{
+    rs_long_t v = 0;
+
+    while (len--)
+        v = v << 8 | rs_patch_peek(job, i++);
+    return v;
+}
+
+/** Run the complete LITERAL and COPY commands in the buffered input.
+ *
+ * Deltas with lots of small commands would otherwise spend most of their time
+ * going through rs_job_work() and the states for each part of each command.
+ * This decodes and runs them in a loop until it reaches a command that is
+ * incomplete or not a LITERAL or COPY, or the output is blocked. Those are
+ * left for the normal states to handle.
+ *
+ * \return RS_RUNNING with statefn still rs_patch_s_cmdbyte() if the next
+ * command needs the normal states, or the result of the command that
+ * stopped. */
+static rs_result rs_patch_run_buffered(rs_job_t *job)
+{
+    const rs_prototab_ent_t *cmd;
+    size_t avail, cmd_len;
+    rs_result result;
+
+    while (1) {
+        /* Stop for rs_job_work() to yield if the work budget is spent. */
+        if (job->budget_yield)
+            return RS_RUNNING;
+        /* Commands can't span the scoop and input, see rs_scoop_advance(). */
+        avail = job->scoop_avail ? job->scoop_avail : job->stream->avail_in;
+        if (!avail)
+            return RS_RUNNING;
+        cmd = &rs_prototab[rs_patch_peek(job, 0)];
+        cmd_len = (size_t)(1 + cmd->len_1 + cmd->len_2);
+        if ((cmd->kind != RS_KIND_LITERAL && cmd->kind != RS_KIND_COPY)
+            || cmd_len > avail)
+            return RS_RUNNING;
+        job->op = rs_patch_peek(job, 0);
+        job->cmd = cmd;
+        job->param1 = cmd->len_1 ? rs_patch_peek_netint(job, 1, cmd->len_1) :
+            cmd->immediate;
+        job->param2 = rs_patch_peek_netint(job, 1 + cmd->len_1, cmd->len_2);
+        rs_scoop_advance(job, cmd_len);
+        if (cmd->kind == RS_KIND_LITERAL) {
+            if ((result = rs_patch_s_literal(job)) != RS_RUNNING)
+                return result;
+            /* Copy out the literal data before the next command. */
+            if ((result = rs_tube_catchup(job)) != RS_DONE)
+                return result;
+        } else {
+            if ((result = rs_patch_s_copy(job)) != RS_RUNNING)
+                return result;
+            while (job->statefn == rs_patch_s_copying)
+                if ((result = rs_patch_s_copying(job)) != RS_RUNNING
+                    || job->budget_yield)
+                    return result;
+        }
+    }
+}
+
+/** Find the next complete COPY command in the buffered input.
+ *
+ * This looks ahead at the commands already buffered in the scoop and input
+ * without consuming them, skipping over LITERAL commands and their data.
+ *
+ * \param i The offset in the buffered input to start at, updated to the
+ * offset after the COPY command found.
+ *
+ * \param n The maximum number of commands to look at, decremented for every
+ * command looked at.
+ *
+ * \return Non-zero if a COPY command was found, or zero if there are no more
+ * complete COPY commands buffered before an incomplete or other command. */
+static int rs_patch_next_copy(rs_job_t *job, size_t *i, int *n, rs_long_t *pos,
+                              rs_long_t *len)
+{
+    const size_t avail = rs_scoop_total_avail(job);
+
+    while (*n > 0 && *i < avail) {
+        const rs_prototab_ent_t *cmd = &rs_prototab[rs_patch_peek(job, *i)];
+        const size_t cmd_len = (size_t)(1 + cmd->len_1 + cmd->len_2);
+
+        (*n)--;
+        if (cmd_len > avail - *i)
+            return 0;
+        *pos = cmd->len_1 ? rs_patch_peek_netint(job, *i + 1, cmd->len_1) :
+            cmd->immediate;
+        *len = rs_patch_peek_netint(job, *i + 1 + cmd->len_1, cmd->len_2);
+        *i += cmd_len;
+        if (cmd->kind == RS_KIND_LITERAL) {
+            /* Skip over the literal data, pos is the literal length. */
+            if (*pos <= 0 || (rs_long_t)(avail - *i) < *pos)
+                return 0;
+            *i += (size_t)*pos;
+        } else if (cmd->kind == RS_KIND_COPY && *pos >= 0 && *len > 0) {
+            return 1;
+        } else {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/** Find how far a basis read ending at \p end can be extended.
+ *
+ * Following buffered COPY commands after offset \p i that start at or after
+ * \p start, no more than RS_BASIS_CACHE_MAX_GAP past the current end of the
+ * read, and that end within \p max_end are merged into the read.
+ *
+ * \return The extended end of the read. */
+static rs_long_t rs_patch_lookahead(rs_job_t *job, size_t i, rs_long_t start,
+                                    rs_long_t end, rs_long_t max_end)
+{
+    int n = RS_PATCH_LOOKAHEAD_CMDS;
+    rs_long_t pos, len;
+
+    while (rs_patch_next_copy(job, &i, &n, &pos, &len)) {
+        if (pos >= start && pos <= end + RS_BASIS_CACHE_MAX_GAP
+            && len <= max_end - pos && pos + len > end)
+            end = pos + len;
+    }
+    return end;
+}
+
+/** Start asynchronous basis reads for the current and buffered COPY commands.
+ *
+ * This queues reads for uncached extents starting at each COPY command,
+ * extended like synchronous reads to cover nearby following COPY commands,
+ * until the cache will not take any more. */
+static void rs_patch_prefetch(rs_job_t *job)
+{
+    rs_basis_cache_t *cache = job->basis_cache;
+    const rs_long_t max = (rs_long_t)rs_basis_cache_extent_max(cache);
+    rs_long_t pos = job->basis_pos, len = job->basis_len, end;
+    int n = RS_PATCH_LOOKAHEAD_CMDS;
+    size_t i = 0;
+
+    do {
+        if (len < max && !rs_basis_cache_contains(cache, pos)) {
+            end = rs_patch_lookahead(job, i, pos, pos + len, pos + max);
+            if (end < pos + RS_BASIS_CACHE_MIN_READ)
+                end = pos + RS_BASIS_CACHE_MIN_READ;
+            if (rs_basis_cache_prefetch(cache, pos, (size_t)(end - pos)) !=
+                RS_DONE)
+                return;
+        }
+    } while (rs_patch_next_copy(job, &i, &n, &pos, &len));
+}
+
+/** Get the basis data for the current COPY command from the basis cache.
+ *
+ * On a cache miss this reads a new extent into the cache that covers the rest
+ * of the COPY command, extended to cover nearby following COPY commands and
+ * rounded up to RS_BASIS_CACHE_MIN_READ. If asynchronous reads are enabled,
+ * reads for following COPY commands are started ahead of time, and on a miss
+ * this waits for the read of the current COPY command to complete. */
+static rs_result rs_patch_cache_copy(rs_job_t *job, size_t *len, void **ptr)
+{
+    rs_basis_cache_t *cache = job->basis_cache;
+    const rs_long_t pos = job->basis_pos;
+    const rs_long_t max_end = pos + (rs_long_t)rs_basis_cache_extent_max(cache);
+    rs_long_t end;
+    rs_result result;
+
+    if (rs_basis_cache_refill(cache))
+        rs_patch_prefetch(job);
+    if ((*ptr = rs_basis_cache_find(cache, pos, len)))
+        return RS_DONE;
+    if (rs_basis_cache_refill(cache)) {
+        rs_patch_prefetch(job);
+        rs_basis_cache_wait(cache, pos);
+        if ((*ptr = rs_basis_cache_find(cache, pos, len)))
+            return RS_DONE;
+    }
+    end = rs_patch_lookahead(job, 0, pos, pos + job->basis_len, max_end);
+    if (end < pos + RS_BASIS_CACHE_MIN_READ)
+        end = pos + RS_BASIS_CACHE_MIN_READ;
+    result = rs_basis_cache_read(cache, job->copy_cb, job->copy_arg, pos,
+                                 (size_t)(end - pos), (size_t)job->basis_len);
+    if (result != RS_DONE)
+        return result;
+    *ptr = rs_basis_cache_find(cache, pos, len);
+    assert(*ptr);
+    return RS_DONE;
+}
+
 /** Called when we're executing a COPY command and waiting for all the data to
  * be retrieved from the callback. */
 static rs_result rs_patch_s_copying(rs_job_t *job)
 {
     rs_result result;
     rs_buffers_t *buffs = job->stream;
-    rs_long_t req = job->basis_len;
+    rs_long_t req = job->basis_len, start;
     size_t len = buffs->avail_out;
     void *ptr = buffs->next_out;
 
@@ -165,10 +430,20 @@ static rs_result rs_patch_s_copying(rs_job_t *job)
     /* Adjust request to min of amount requested and space available. */
     if (len < req)
         req = (rs_long_t)len;
+    /* Don't copy more than the work budget allows. */
+    if (job->budget_left > 0 && job->budget_left < req)
+        req = job->budget_left;
     rs_trace("copy " FMT_LONG " bytes from basis at offset " FMT_LONG "", req,
              job->basis_pos);
     len = (size_t)req;
-    result = (job->copy_cb) (job->copy_arg, job->basis_pos, &len, &ptr);
+    start = rs_now_ns();
+    /* Use the basis cache if enabled and the copy is small enough. */
+    if (job->basis_cache && job->basis_len <
+        (rs_long_t)rs_basis_cache_extent_max(job->basis_cache))
+        result = rs_patch_cache_copy(job, &len, &ptr);
+    else
+        result = (job->copy_cb) (job->copy_arg, job->basis_pos, &len, &ptr);
+    job->times.io_ns += rs_now_ns() - start;
     if (result != RS_DONE) {
         rs_trace("copy callback returned %s", rs_strerror(result));
         return result;
@@ -189,6 +464,7 @@ static rs_result rs_patch_s_copying(rs_job_t *job)
     buffs->avail_out -= len;
     job->basis_pos += (rs_long_t)len;
     job->basis_len -= (rs_long_t)len;
+    rs_job_budget_spend(job, len);
     if (!job->basis_len) {
         /* Nothing left to copy, we are done! */
         job->statefn = rs_patch_s_cmdbyte;
@@ -220,6 +496,30 @@ rs_job_t *rs_patch_begin(rs_copy_cb * copy_cb, void *copy_arg)
 
     job->copy_cb = copy_cb;
     job->copy_arg = copy_arg;
-    rs_mdfour_begin(&job->output_md4);
     return job;
 }
+
+rs_result rs_patch_reset(rs_job_t *job, rs_copy_cb * copy_cb, void *copy_arg)
+{
+    rs_job_reset(job, "patch", rs_patch_s_header);
+    job->copy_cb = copy_cb;
+    job->copy_arg = copy_arg;
+    return RS_DONE;
+}
+
+rs_result rs_patch_set_cache(rs_job_t *job, size_t size)
+{
+    rs_job_check(job);
+    if (job->basis_cache)
+        rs_basis_cache_free(job->basis_cache);
+    job->basis_cache = size ? rs_basis_cache_new(size) : NULL;
+    return RS_DONE;
+}
+
+rs_result rs_patch_set_async(rs_job_t *job, int basis_fd, int depth)
+{
+    rs_job_check(job);
+    if (!job->basis_cache)
+        job->basis_cache = rs_basis_cache_new(RS_BASIS_CACHE_DEFAULT);
+    return rs_basis_cache_async(job->basis_cache, basis_fd, depth);
+}
@@ -0,0 +1,319 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * pipeline.c -- threaded whole-file IO for jobs.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file pipeline.c
+ * Threaded whole-file IO for jobs.
+ *
+ * Each direction of IO uses a ::rs_pipe, which is a ring of buffers passed
+ * between a producer and a consumer thread. For input the reader thread is
+ * the producer and the job is the consumer, and for output the job is the
+ * producer and the writer thread is the consumer. The producer fills the
+ * buffer after the full ones, and the consumer uses the oldest full one. Each
+ * side only holds one buffer at a time, and the producer waits until the
+ * consumer has finished with a buffer before reusing it.
+ *
+ * The reader only reads ahead as far as the ring of buffers. If the job
+ * finishes before the end of its input, the reader may be blocked in fread()
+ * on a pipe or socket that never delivers more data, so it is cancelled
+ * rather than waited for. It only allows cancellation during fread(), so it
+ * never leaves the pipe locked. */
+
+#include "config.h"
+#include "pipeline.h"
+
+#ifdef HAVE_PTHREAD
+#  include <assert.h>
+#  include <errno.h>
+#  include <pthread.h>
+#  include <stdlib.h>
+#  include <string.h>
+#  include "job.h"
+#  include "trace.h"
+#  include "util.h"
+
+/** A ring of buffers passed between two threads. */
+typedef struct rs_pipe {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    FILE *f;                    /**< The file to read or write. */
+    int nbufs;                  /**< The number of buffers. */
+    size_t buf_len;             /**< The size of each buffer. */
+    rs_byte_t **bufs;           /**< The buffers. */
+    size_t *lens;               /**< The data length in each full buffer. */
+    int head;                   /**< The oldest full buffer. */
+    int count;                  /**< The number of full buffers. */
+    int held;                   /**< If the consumer holds a buffer. */
+    int eof;                    /**< If the producer has finished. */
+    int stop;                   /**< If either side has given up. */
+    rs_result result;           /**< The result of the IO thread. */
+    rs_long_t total;            /**< Bytes transferred by the IO thread. */
+    pthread_t thread;
+} rs_pipe_t;
+
+static void rs_pipe_init(rs_pipe_t *p, FILE *f, int nbufs, size_t buf_len)
+{
+    int i;
+
+    rs_bzero(p, sizeof *p);
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    p->f = f;
+    p->nbufs = nbufs;
+    p->buf_len = buf_len;
+    p->bufs = rs_alloc(nbufs * sizeof *p->bufs, "pipeline buffers");
+    p->lens = rs_alloc(nbufs * sizeof *p->lens, "pipeline lengths");
+    for (i = 0; i < nbufs; i++)
+        p->bufs[i] = rs_alloc(buf_len, "pipeline buffer");
+    p->result = RS_DONE;
+}
+
+static void rs_pipe_destroy(rs_pipe_t *p)
+{
+    int i;
+
+    for (i = 0; i < p->nbufs; i++)
+        rs_free(p->bufs[i]);
+    rs_free(p->bufs);
+    rs_free(p->lens);
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->lock);
+}
+
+/** Get the next empty buffer for the producer to fill.
+ *
+ * \return The buffer index, or -1 if the consumer has stopped. */
+static int rs_pipe_acquire(rs_pipe_t *p)
+{
+    int i = -1;
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->stop && p->count + p->held >= p->nbufs)
+        pthread_cond_wait(&p->cond, &p->lock);
+    if (!p->stop)
+        i = (p->head + p->count) % p->nbufs;
+    pthread_mutex_unlock(&p->lock);
+    return i;
+}
+
+/** Pass the buffer from rs_pipe_acquire() holding \p len bytes on to the
+ * consumer. */
+static void rs_pipe_put(rs_pipe_t *p, size_t len)
+{
+    pthread_mutex_lock(&p->lock);
+    p->lens[(p->head + p->count) % p->nbufs] = len;
+    p->count++;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+/** Release the consumer's buffer and get the next full one.
+ *
+ * \return The buffer index, or -1 if there are no more. */
+static int rs_pipe_take(rs_pipe_t *p)
+{
+    int i = -1;
+
+    pthread_mutex_lock(&p->lock);
+    p->held = 0;
+    pthread_cond_broadcast(&p->cond);
+    while (!p->stop && !p->eof && !p->count)
+        pthread_cond_wait(&p->cond, &p->lock);
+    if (!p->stop && p->count) {
+        i = p->head;
+        p->head = (p->head + 1) % p->nbufs;
+        p->count--;
+        p->held = 1;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return i;
+}
+
+/** Finish the pipe, from the producer when it has no more data, or from
+ * either side when it gives up. */
+static void rs_pipe_close(rs_pipe_t *p, int stop, rs_result result)
+{
+    pthread_mutex_lock(&p->lock);
+    p->eof = 1;
+    p->stop |= stop;
+    if (result != RS_DONE)
+        p->result = result;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void *rs_pipe_reader(void *arg)
+{
+    rs_pipe_t *p = arg;
+    size_t len;
+    int i;
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    while ((i = rs_pipe_acquire(p)) >= 0) {
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        len = fread(p->bufs[i], 1, p->buf_len, p->f);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        if (len) {
+            p->total += len;
+            rs_pipe_put(p, len);
+        }
+        /* fread() only returns short at the end of file or on error. */
+        if (len < p->buf_len) {
+            if (ferror(p->f)) {
+                rs_error("error reading file: %s", strerror(errno));
+                rs_pipe_close(p, 0, RS_IO_ERROR);
+            } else {
+                rs_trace("seen end of file on input");
+                rs_pipe_close(p, 0, RS_DONE);
+            }
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void *rs_pipe_writer(void *arg)
+{
+    rs_pipe_t *p = arg;
+    int i;
+
+    while ((i = rs_pipe_take(p)) >= 0) {
+        if (fwrite(p->bufs[i], 1, p->lens[i], p->f) != p->lens[i]) {
+            rs_error("error writing file: %s", strerror(errno));
+            rs_pipe_close(p, 1, RS_IO_ERROR);
+            break;
+        }
+        p->total += p->lens[i];
+    }
+    return NULL;
+}
+
+/** Drive the job with buffers from the \p in and \p out pipes. */
+static rs_result rs_pipeline_drive(rs_job_t *job, rs_pipe_t *in,
+                                   rs_pipe_t *out)
+{
+    rs_buffers_t buf;
+    rs_result result;
+    rs_long_t start;
+    int i;
+
+    rs_bzero(&buf, sizeof buf);
+    if (!in)
+        buf.eof_in = 1;
+    if (out) {
+        i = rs_pipe_acquire(out);
+        buf.next_out = (char *)out->bufs[i];
+        buf.avail_out = out->buf_len;
+    }
+    do {
+        /* Take the next input buffer when the last one is used up. */
+        if (!buf.eof_in && !buf.avail_in) {
+            start = rs_now_ns();
+            i = rs_pipe_take(in);
+            job->times.io_ns += rs_now_ns() - start;
+            if (i >= 0) {
+                buf.next_in = (char *)in->bufs[i];
+                buf.avail_in = in->lens[i];
+            } else if (in->result != RS_DONE) {
+                return in->result;
+            } else {
+                buf.eof_in = 1;
+            }
+        }
+        result = rs_job_iter(job, &buf);
+        if (result != RS_DONE && result != RS_BLOCKED && result != RS_RUNNING)
+            return result;
+        /* Pass on the output buffer when it is full or the job is done. */
+        if (out && (!buf.avail_out || result == RS_DONE)
+            && buf.avail_out < out->buf_len) {
+            rs_pipe_put(out, out->buf_len - buf.avail_out);
+            start = rs_now_ns();
+            i = rs_pipe_acquire(out);
+            job->times.io_ns += rs_now_ns() - start;
+            if (i < 0)
+                return out->result;
+            buf.next_out = (char *)out->bufs[i];
+            buf.avail_out = out->buf_len;
+        }
+    } while (result != RS_DONE);
+    return result;
+}
+
+/** Run a job with a reader and writer thread doing the file IO.
+ *
+ * \param in_file - input file, or NULL if there is no input.
+ *
+ * \param out_file - output file, or NULL if there is no output.
+ *
+ * \param inbuflen - the size of each input buffer.
+ *
+ * \param outbuflen - the size of each output buffer.
+ *
+ * \param nbufs - the number of buffers for each of input and output, 2 for
+ * double buffering, 3 for triple buffering, etc.
+ *
+ * \return RS_DONE if the job completed, or otherwise an error result. */
+rs_result rs_pipeline_run(rs_job_t *job, FILE *in_file, FILE *out_file,
+                          size_t inbuflen, size_t outbuflen, int nbufs)
+{
+    rs_pipe_t in, out;
+    rs_result result;
+    int in_err = 0, out_err = 0;
+
+    assert(nbufs > 0);
+    if (in_file) {
+        rs_pipe_init(&in, in_file, nbufs, inbuflen);
+        in_err = pthread_create(&in.thread, NULL, rs_pipe_reader, &in);
+    }
+    if (out_file) {
+        rs_pipe_init(&out, out_file, nbufs, outbuflen);
+        out_err = pthread_create(&out.thread, NULL, rs_pipe_writer, &out);
+    }
+    if (in_err || out_err) {
+        rs_error("failed to start pipeline thread: %s",
+                 strerror(in_err ? in_err : out_err));
+        result = RS_INTERNAL_ERROR;
+    } else {
+        result = rs_pipeline_drive(job, in_file ? &in : NULL,
+                                   out_file ? &out : NULL);
+    }
+    /* Let the writer finish, or stop both threads if the job failed. */
+    if (in_file) {
+        rs_pipe_close(&in, 1, RS_DONE);
+        /* The reader may be blocked reading past the end of what the job
+           needed, so cancel it instead of waiting for more input. */
+        if (!in_err) {
+            pthread_cancel(in.thread);
+            pthread_join(in.thread, NULL);
+        }
+        job->stats.in_bytes += in.total;
+        rs_pipe_destroy(&in);
+    }
+    if (out_file) {
+        rs_pipe_close(&out, result != RS_DONE, RS_DONE);
+        if (!out_err)
+            pthread_join(out.thread, NULL);
+        job->stats.out_bytes += out.total;
+        if (result == RS_DONE)
+            result = out.result;
+        rs_pipe_destroy(&out);
+    }
+    return result;
+}
+
+#endif                          /* HAVE_PTHREAD */
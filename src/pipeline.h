@@ -0,0 +1,41 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * pipeline.h -- threaded whole-file IO for jobs.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file pipeline.h
+ * Threaded whole-file IO for jobs.
+ *
+ * rs_pipeline_run() runs a job like rs_whole_run(), but with a reader thread
+ * reading the input file and a writer thread writing the output file, so file
+ * IO overlaps with the job's processing. Each thread has a small ring of
+ * buffers it shares with the job. The job processes one buffer while the
+ * reader fills the others, and fills one output buffer while the writer
+ * writes out the others.
+ *
+ * This is only available if librsync was built with pthreads, as indicated by
+ * HAVE_PTHREAD. */
+#ifndef PIPELINE_H
+#  define PIPELINE_H
+
+#  include <stdio.h>
+#  include "librsync.h"
+
+rs_result rs_pipeline_run(rs_job_t *job, FILE *in_file, FILE *out_file,
+                          size_t inbuflen, size_t outbuflen, int nbufs);
+
+#endif                          /* !PIPELINE_H */
@@ -0,0 +1,242 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * pool.c -- thread pools for batches of jobs.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file pool.c
+ * Thread pools for batches of jobs.
+ *
+ * The worker threads wait for a batch to start, then run its tasks using work
+ * stealing. Each worker has a queue holding a range of task indexes, and the
+ * batch is split evenly between them at the start. A worker runs the tasks
+ * from the front of its own range, and when that is empty it steals the back
+ * half of the range of another worker. This keeps all the workers busy when
+ * some tasks take much longer than others, like for files of very different
+ * sizes, without the workers contending for a single shared queue.
+ *
+ * Without pthreads a pool has no threads, and batches are run one task at a
+ * time by the calling thread. */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+#include "librsync.h"
+#include "pool.h"
+#include "trace.h"
+#include "util.h"
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+
+/** A worker's queue of task indexes next..end-1. */
+typedef struct rs_pool_queue {
+    rs_pool_t *pool;            /**< The pool of the worker. */
+    int worker;                 /**< The index of the worker. */
+    pthread_mutex_t lock;
+    size_t next;                /**< The next task to run. */
+    size_t end;                 /**< The end of the tasks. */
+} rs_pool_queue_t;
+#endif
+
+struct rs_pool {
+    int nthreads;               /**< The number of worker threads. */
+#ifdef HAVE_PTHREAD
+    pthread_t *threads;         /**< The worker threads. */
+    rs_pool_queue_t *queues;    /**< The queue for each worker. */
+    pthread_mutex_t batch_lock; /**< Held while running a batch. */
+    pthread_mutex_t lock;       /**< Protects the fields below. */
+    pthread_cond_t cond;        /**< Signalled when the fields change. */
+    unsigned long batch;        /**< Incremented when a batch starts. */
+    int active;                 /**< The workers still running the batch. */
+    int stop;                   /**< If the workers should exit. */
+    rs_pool_fn *fn;             /**< The batch's task function. */
+    void *arg;                  /**< The batch's task argument. */
+#endif
+};
+
+#ifdef HAVE_PTHREAD
+/** Get the next task for worker \p w, stealing one if it has none.
+ *
+ * \return 1 if there is a task in \p *i, or 0 if there are none left. */
+static int rs_pool_next(rs_pool_t *pool, int w, size_t *i)
+{
+    rs_pool_queue_t *q = &pool->queues[w], *v;
+    size_t mid, end = 0;
+    int j, found = 0;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->next < q->end) {
+        *i = q->next++;
+        found = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    /* Look for a victim with tasks left, starting with the next worker. */
+    for (j = 1; !found && j < pool->nthreads; j++) {
+        v = &pool->queues[(w + j) % pool->nthreads];
+        pthread_mutex_lock(&v->lock);
+        if (v->next < v->end) {
+            /* Take the back half, rounded up so a single task is taken. */
+            mid = v->next + (v->end - v->next) / 2;
+            end = v->end;
+            v->end = mid;
+            found = 1;
+        }
+        pthread_mutex_unlock(&v->lock);
+        /* Run the first stolen task, and queue the rest. Only one queue is
+           locked at a time so thieves can't deadlock. */
+        if (found) {
+            *i = mid;
+            pthread_mutex_lock(&q->lock);
+            q->next = mid + 1;
+            q->end = end;
+            pthread_mutex_unlock(&q->lock);
+        }
+    }
+    return found;
+}
+
+static void *rs_pool_worker(void *arg)
+{
+    rs_pool_queue_t *q = arg;
+    rs_pool_t *pool = q->pool;
+    unsigned long batch = 0;
+    size_t i;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stop && pool->batch == batch)
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        if (pool->stop)
+            break;
+        batch = pool->batch;
+        pthread_mutex_unlock(&pool->lock);
+        while (rs_pool_next(pool, q->worker, &i))
+            pool->fn(pool->arg, i);
+        pthread_mutex_lock(&pool->lock);
+        if (!--pool->active)
+            pthread_cond_broadcast(&pool->cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+#endif                          /* HAVE_PTHREAD */
+
+rs_pool_t *rs_pool_new(int nthreads)
+{
+    rs_pool_t *pool = rs_alloc_struct(rs_pool_t);
+
+#ifdef HAVE_PTHREAD
+    int i, err;
+
+    if (nthreads <= 0) {
+#  ifdef _SC_NPROCESSORS_ONLN
+        nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#  endif
+        if (nthreads <= 0)
+            nthreads = 1;
+    }
+    pool->threads = rs_alloc(nthreads * sizeof(*pool->threads), "pool threads");
+    pool->queues = rs_alloc(nthreads * sizeof(*pool->queues), "pool queues");
+    pthread_mutex_init(&pool->batch_lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    for (i = 0; i < nthreads; i++) {
+        pool->queues[i].pool = pool;
+        pool->queues[i].worker = i;
+        pthread_mutex_init(&pool->queues[i].lock, NULL);
+        pool->queues[i].next = pool->queues[i].end = 0;
+        if ((err =
+             pthread_create(&pool->threads[i], NULL, rs_pool_worker,
+                            &pool->queues[i]))) {
+            rs_error("failed to start pool thread: %s", strerror(err));
+            pthread_mutex_destroy(&pool->queues[i].lock);
+            break;
+        }
+    }
+    /* Use the threads that did start, or none to run batches inline. */
+    pool->nthreads = i;
+    rs_trace("started pool with %d threads", i);
+#else
+    (void)nthreads;
+#endif
+    return pool;
+}
+
+void rs_pool_free(rs_pool_t *pool)
+{
+#ifdef HAVE_PTHREAD
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->nthreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+        pthread_mutex_destroy(&pool->queues[i].lock);
+    }
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->batch_lock);
+    rs_free(pool->queues);
+    rs_free(pool->threads);
+#endif
+    rs_free(pool);
+}
+
+int rs_pool_threads(rs_pool_t const *pool)
+{
+    return pool ? pool->nthreads : 0;
+}
+
+/** Run \p fn for each index 0..n-1 on the pool's threads.
+ *
+ * This waits for all the tasks to finish. If \p pool is NULL or has no
+ * threads the tasks are run in order by the calling thread. Batches from
+ * different threads on the same pool are run one after another. */
+void rs_pool_run(rs_pool_t *pool, size_t n, rs_pool_fn *fn, void *arg)
+{
+    size_t i;
+
+    if (!pool || !pool->nthreads) {
+        for (i = 0; i < n; i++)
+            fn(arg, i);
+        return;
+    }
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&pool->batch_lock);
+    /* Split the tasks evenly between the workers' queues. */
+    for (i = 0; i < (size_t)pool->nthreads; i++) {
+        pthread_mutex_lock(&pool->queues[i].lock);
+        pool->queues[i].next = n * i / pool->nthreads;
+        pool->queues[i].end = n * (i + 1) / pool->nthreads;
+        pthread_mutex_unlock(&pool->queues[i].lock);
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->active = pool->nthreads;
+    pool->batch++;
+    pthread_cond_broadcast(&pool->cond);
+    while (pool->active)
+        pthread_cond_wait(&pool->cond, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->batch_lock);
+#endif
+}
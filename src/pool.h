@@ -0,0 +1,37 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * pool.h -- thread pools for batches of jobs.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file pool.h
+ * Thread pools for batches of jobs.
+ *
+ * rs_pool_run() runs a task for each index of a batch on the pool's threads,
+ * and waits for them all to finish. It is used by the batch functions like
+ * rs_sig_batch(). */
+#ifndef POOL_H
+#  define POOL_H
+
+#  include <stddef.h>
+#  include "librsync.h"
+
+/** A task run for item \p i of a batch. */
+typedef void rs_pool_fn(void *arg, size_t i);
+
+void rs_pool_run(rs_pool_t *pool, size_t n, rs_pool_fn *fn, void *arg);
+
+#endif                          /* !POOL_H */
@@ -118,8 +118,8 @@ const struct rs_prototab_ent rs_prototab[] = {
     {RS_KIND_COPY, 0, 8, 2},    /* RS_OP_COPY_N8_N2 = 0x52 */
     {RS_KIND_COPY, 0, 8, 4},    /* RS_OP_COPY_N8_N4 = 0x53 */
     {RS_KIND_COPY, 0, 8, 8},    /* RS_OP_COPY_N8_N8 = 0x54 */
-    {RS_KIND_RESERVED, 85, 0, 0},       /* RS_OP_RESERVED_85 = 0x55 */
-    {RS_KIND_RESERVED, 86, 0, 0},       /* RS_OP_RESERVED_86 = 0x56 */
+    {RS_KIND_CHECKSUM, 0, 1, 0},        /* RS_OP_CHECKSUM_BEGIN = 0x55 */
+    {RS_KIND_CHECKSUM, 0, 8, 0},        /* RS_OP_CHECKSUM = 0x56 */
     {RS_KIND_RESERVED, 87, 0, 0},       /* RS_OP_RESERVED_87 = 0x57 */
     {RS_KIND_RESERVED, 88, 0, 0},       /* RS_OP_RESERVED_88 = 0x58 */
     {RS_KIND_RESERVED, 89, 0, 0},       /* RS_OP_RESERVED_89 = 0x59 */
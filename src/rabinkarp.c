@@ -20,18 +20,19 @@
  */
 #include "rabinkarp.h"
 
-/* Constant for RABINKARP_MULT^2. */
+/* Constants for RABINKARP_MULT^2 and RABINKARP64_MULT^2. */
 #define RABINKARP_MULT2 0xa5b71959U
+#define RABINKARP64_MULT2 0x685f98a2018fade9ULL
 
 /* Macros for doing 16 bytes with 2 mults that can be done in parallel. Testing
    showed this as a performance sweet spot vs 16x1, 8x2, 4x4 1x16 alternative
    arrangements. */
-#define PAR2X1(hash,buf,i) (RABINKARP_MULT2*(hash) + \
-			    RABINKARP_MULT*buf[i] + \
-			    buf[i+1])
-#define PAR2X2(hash,buf,i) PAR2X1(PAR2X1(hash,buf,i),buf,i+2)
-#define PAR2X4(hash,buf,i) PAR2X2(PAR2X2(hash,buf,i),buf,i+4)
-#define PAR2X8(hash,buf) PAR2X4(PAR2X4(hash,buf,0),buf,8)
+#define PAR2X1(M,hash,buf,i) (M##_MULT2*(hash) + \
+			      M##_MULT*buf[i] + \
+			      buf[i+1])
+#define PAR2X2(M,hash,buf,i) PAR2X1(M,PAR2X1(M,hash,buf,i),buf,i+2)
+#define PAR2X4(M,hash,buf,i) PAR2X2(M,PAR2X2(M,hash,buf,i),buf,i+4)
+#define PAR2X8(M,hash,buf) PAR2X4(M,PAR2X4(M,hash,buf,0),buf,8)
 
 /* Table of RABINKARP_MULT^(2^(i+1)) for power lookups. */
 const static uint32_t RABINKARP_MULT_POW2[32] = {
@@ -90,7 +91,7 @@ void rabinkarp_update(rabinkarp_t *sum, const unsigned char *buf, size_t len)
     uint32_t hash = sum->hash;
 
     while (n >= 16) {
-        hash = PAR2X8(hash, buf);
+        hash = PAR2X8(RABINKARP, hash, buf);
         buf += 16;
         n -= 16;
     }
@@ -102,3 +103,38 @@ void rabinkarp_update(rabinkarp_t *sum, const unsigned char *buf, size_t len)
     sum->count += len;
     sum->mult *= rabinkarp_pow((uint32_t)len);
 }
+
+/* Get the value of RABINKARP64_MULT^n. */
+static inline uint64_t rabinkarp64_pow(uint64_t n)
+{
+    uint64_t m = RABINKARP64_MULT;
+    uint64_t ans = 1;
+    while (n) {
+        if (n & 1) {
+            ans *= m;
+        }
+        m *= m;
+        n >>= 1;
+    }
+    return ans;
+}
+
+void rabinkarp64_update(rabinkarp64_t *sum, const unsigned char *buf,
+                        size_t len)
+{
+    size_t n = len;
+    uint64_t hash = sum->hash;
+
+    while (n >= 16) {
+        hash = PAR2X8(RABINKARP64, hash, buf);
+        buf += 16;
+        n -= 16;
+    }
+    while (n) {
+        hash = RABINKARP64_MULT * hash + *buf++;
+        n--;
+    }
+    sum->hash = hash;
+    sum->count += len;
+    sum->mult *= rabinkarp64_pow((uint64_t)len);
+}
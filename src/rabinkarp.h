@@ -91,4 +91,64 @@ static inline uint32_t rabinkarp_digest(rabinkarp_t *sum)
     return sum->hash;
 }
 
+/** The RabinKarp64 multiplier.
+ *
+ * This is the multiplier of Knuth's MMIX 64 bit LCG. The 64 bit RabinKarp
+ * uses the same RABINKARP_SEED and rolling arithmetic modulo 2^64, so weak
+ * sum collisions between different blocks are far rarer for signatures with
+ * very many blocks. */
+#  define RABINKARP64_MULT 0x5851f42d4c957f2dULL
+
+/** The RabinKarp64 inverse multiplier modulo 2^64. */
+#  define RABINKARP64_INVM 0xc097ef87329e28a5ULL
+
+/** The RabinKarp64 seed adjustment; (RABINKARP64_MULT - 1) * RABINKARP_SEED */
+#  define RABINKARP64_ADJ 0x5851f42d4c957f2cULL
+
+/** The rabinkarp64_t state type.
+ *
+ * The count must be first so it overlays the count of the other weaksums. */
+typedef struct _rabinkarp64 {
+    size_t count;               /**< Count of bytes included in sum. */
+    uint64_t hash;              /**< The accumulated hash value. */
+    uint64_t mult;              /**< The value of RABINKARP64_MULT^count. */
+} rabinkarp64_t;
+
+static inline void rabinkarp64_init(rabinkarp64_t *sum)
+{
+    sum->count = 0;
+    sum->hash = RABINKARP_SEED;
+    sum->mult = 1;
+}
+
+void rabinkarp64_update(rabinkarp64_t *sum, const unsigned char *buf,
+                        size_t len);
+
+static inline void rabinkarp64_rotate(rabinkarp64_t *sum, unsigned char out,
+                                      unsigned char in)
+{
+    sum->hash =
+        sum->hash * RABINKARP64_MULT + in - sum->mult * (out +
+                                                         RABINKARP64_ADJ);
+}
+
+static inline void rabinkarp64_rollin(rabinkarp64_t *sum, unsigned char in)
+{
+    sum->hash = sum->hash * RABINKARP64_MULT + in;
+    sum->count++;
+    sum->mult *= RABINKARP64_MULT;
+}
+
+static inline void rabinkarp64_rollout(rabinkarp64_t *sum, unsigned char out)
+{
+    sum->count--;
+    sum->mult *= RABINKARP64_INVM;
+    sum->hash -= sum->mult * (out + RABINKARP64_ADJ);
+}
+
+static inline uint64_t rabinkarp64_digest(rabinkarp64_t *sum)
+{
+    return sum->hash;
+}
+
 #endif                          /* _RABINKARP_H_ */
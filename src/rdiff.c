@@ -59,6 +59,11 @@ static int show_stats = 0;
 static int bzip2_level = 0;
 static int gzip_level = 0;
 static int file_force = 0;
+static int file_inplace = 0;
+static int delta_checksum = 0;
+static int sig_compact = 0;
+static char *match_name = NULL;
+static char *coarse_name = NULL;
 
 enum {
     OPT_GZIP = 1069, OPT_BZIP2
@@ -66,6 +71,7 @@ enum {
 
 char *rs_hash_name;
 char *rs_rollsum_name;
+char *rs_fileio_name;
 
 static void rdiff_usage(const char *error, ...)
 {
@@ -96,8 +102,12 @@ static void bad_option(poptContext opcon, int error)
 static void help(void)
 {
     printf("Usage: rdiff [OPTIONS] signature [BASIS [SIGNATURE]]\n"
+           "             [OPTIONS] signature --match=MAP BASIS [SIGNATURE]\n"
+           "             [OPTIONS] match SIGNATURE [NEWFILE [MAP]]\n"
            "             [OPTIONS] delta SIGNATURE [NEWFILE [DELTA]]\n"
-           "             [OPTIONS] patch BASIS [DELTA [NEWFILE]]\n" "\n"
+           "             [OPTIONS] delta --coarse=SIGNATURE SIGNATURE NEWFILE [DELTA]\n"
+           "             [OPTIONS] patch BASIS [DELTA [NEWFILE]]\n"
+           "             [OPTIONS] patch --inplace BASIS [DELTA]\n" "\n"
            "Options:\n"
            "  -v, --verbose             Trace internal processing\n"
            "  -V, --version             Show program version\n"
@@ -105,13 +115,31 @@ static void help(void)
            "  -s, --statistics          Show performance statistics\n"
            "  -f, --force               Force overwriting existing files\n"
            "Signature generation options:\n"
-           "  -H, --hash=ALG            Hash algorithm: blake2 (default), md4\n"
-           "  -R, --rollsum=ALG         Rollsum algorithm: rabinkarp (default), rollsum\n"
+           "  -H, --hash=ALG            Hash algorithm: blake2 (default), blake3, xxh3,\n"
+           "                            md4\n"
+           "  -R, --rollsum=ALG         Rollsum algorithm: rabinkarp (default),\n"
+           "                            rabinkarp64, crc32c, rollsum, or cdc for\n"
+           "                            content-defined chunks\n"
+           "      --compact             Generate a compact v2 signature\n"
+           "      --match=MAP           Only sign the blocks not found by match\n"
            "Delta-encoding options:\n"
            "  -b, --block-size=BYTES    Signature block size, 0 (default) for recommended\n"
            "  -S, --sum-size=BYTES      Signature strength, 0 (default) for max, -1 for min\n"
+           "      --checksum            Add a whole-file checksum for patch to verify\n"
+           "      --coarse=SIGNATURE    Delta against the coarse signature given to\n"
+           "                            match and the signature made with its map\n"
+           "Patch options:\n"
+           "      --inplace             Patch the basis file in place\n"
+           "      --spill-size=BYTES    In-place patch spill buffer limit, 0 (default)\n"
+           "                            for recommended\n"
            "IO options:\n" "  -I, --input-size=BYTES    Input buffer size\n"
            "  -O, --output-size=BYTES   Output buffer size\n"
+           "      --cache-size=BYTES    Patch basis cache size, 0 (default) to\n"
+           "                            disable, -1 for recommended\n"
+           "      --async-depth=READS   Patch basis reads in flight with io_uring,\n"
+           "                            0 (default) to disable, -1 for recommended\n"
+           "      --pipeline=BUFS       Do file IO in threads with BUFS buffers each\n"
+           "      --io=METHOD           File IO method: stdio (default), fd, direct\n"
            "  -z, --gzip[=LEVEL]        gzip-compress deltas\n"
            "  -i, --bzip2[=LEVEL]       bzip2-compress deltas\n");
 }
@@ -187,12 +215,22 @@ static void rdiff_options(poptContext opcon)
             bad_option(opcon, c);
         }
     }
+    if (!rs_fileio_name || !strcmp(rs_fileio_name, "stdio")) {
+        rs_fileio = RS_FILEIO_STDIO;
+    } else if (!strcmp(rs_fileio_name, "fd")) {
+        rs_fileio = RS_FILEIO_FD;
+    } else if (!strcmp(rs_fileio_name, "direct")) {
+        rs_fileio = RS_FILEIO_DIRECT;
+    } else {
+        rdiff_usage("Unknown IO method '%s'.", rs_fileio_name);
+        exit(RS_SYNTAX_ERROR);
+    }
 }
 
 /** Generate signature from remaining command line arguments. */
 static rs_result rdiff_sig(poptContext opcon)
 {
-    FILE *basis_file, *sig_file;
+    FILE *basis_file, *sig_file, *map_file;
     rs_stats_t stats;
     rs_result result;
     rs_magic_number sig_magic;
@@ -202,10 +240,26 @@ static rs_result rdiff_sig(poptContext opcon)
 
     rdiff_no_more_args(opcon);
 
+    /* The signature of unmatched blocks has the match map's format. */
+    if (match_name) {
+        map_file = rs_file_open(match_name, "rb", file_force);
+        result = rs_sig_unmatched_file(basis_file, map_file, sig_file, &stats);
+        rs_file_close(map_file);
+        rs_file_close(sig_file);
+        rs_file_close(basis_file);
+        if (result == RS_DONE && show_stats)
+            rs_log_stats(&stats);
+        return result;
+    }
+
     if (!rs_hash_name || !strcmp(rs_hash_name, "blake2")) {
         sig_magic = RS_BLAKE2_SIG_MAGIC;
     } else if (!strcmp(rs_hash_name, "md4")) {
         sig_magic = RS_MD4_SIG_MAGIC;
+    } else if (!strcmp(rs_hash_name, "blake3")) {
+        sig_magic = RS_BLAKE3_SIG_MAGIC;
+    } else if (!strcmp(rs_hash_name, "xxh3")) {
+        sig_magic = RS_XXH3_SIG_MAGIC;
     } else {
         rdiff_usage("Unknown hash algorithm '%s'.", rs_hash_name);
         exit(RS_SYNTAX_ERROR);
@@ -213,10 +267,21 @@ static rs_result rdiff_sig(poptContext opcon)
     if (!rs_rollsum_name || !strcmp(rs_rollsum_name, "rabinkarp")) {
         /* The RabinKarp magics are 0x10 greater than the rollsum magics. */
         sig_magic += 0x10;
+    } else if (!strcmp(rs_rollsum_name, "rabinkarp64")) {
+        /* The RabinKarp64 magics are 0x20 greater than the rollsum magics. */
+        sig_magic += 0x20;
+    } else if (!strcmp(rs_rollsum_name, "crc32c")) {
+        /* The CRC32C magics are 0x30 greater than the rollsum magics. */
+        sig_magic += 0x30;
+    } else if (!strcmp(rs_rollsum_name, "cdc")) {
+        /* The CDC magics are 0x40 greater than the rollsum magics. */
+        sig_magic += 0x40;
     } else if (strcmp(rs_rollsum_name, "rollsum")) {
         rdiff_usage("Unknown rollsum algorithm '%s'.", rs_rollsum_name);
         exit(RS_SYNTAX_ERROR);
     }
+    if (sig_compact)
+        sig_magic = RS_SIG_V2_MAGIC(sig_magic);
 
     result =
         rs_sig_file(basis_file, sig_file, block_len, strong_len, sig_magic,
@@ -233,6 +298,105 @@ static rs_result rdiff_sig(poptContext opcon)
     return result;
 }
 
+/** Find the blocks of a coarse signature in a new file.
+ *
+ * This sets *fine to the fine signature of the blocks found, and writes out
+ * the match map. */
+static rs_result rdiff_do_match(FILE *sig_file, FILE *new_file, FILE *map_file,
+                                size_t fine_len, rs_signature_t **fine)
+{
+    rs_signature_t *coarse;
+    rs_stats_t stats;
+    rs_result result;
+
+    *fine = NULL;
+    if ((result = rs_loadsig_file(sig_file, &coarse, &stats)) != RS_DONE)
+        return result;
+    if (show_stats)
+        rs_log_stats(&stats);
+    if ((result = rs_build_hash_table(coarse)) == RS_DONE)
+        result =
+            rs_match_file(coarse, new_file, map_file, fine_len, fine, &stats);
+    if (result == RS_DONE && show_stats)
+        rs_log_stats(&stats);
+    rs_free_sumset(coarse);
+    return result;
+}
+
+static rs_result rdiff_match(poptContext opcon)
+{
+    FILE *sig_file, *new_file, *map_file;
+    char const *sig_name;
+    rs_signature_t *fine;
+    rs_result result;
+
+    if (!(sig_name = poptGetArg(opcon))) {
+        rdiff_usage("Usage for match: "
+                    "rdiff [OPTIONS] match SIGNATURE [NEWFILE [MAP]]");
+        exit(RS_SYNTAX_ERROR);
+    }
+
+    sig_file = rs_file_open(sig_name, "rb", file_force);
+    new_file = rs_file_open(poptGetArg(opcon), "rb", file_force);
+    map_file = rs_file_open(poptGetArg(opcon), "wb", file_force);
+
+    rdiff_no_more_args(opcon);
+
+    result =
+        rdiff_do_match(sig_file, new_file, map_file,
+                       block_len ? (size_t)block_len : RS_DEFAULT_BLOCK_LEN,
+                       &fine);
+    if (fine)
+        rs_free_sumset(fine);
+
+    rs_file_close(map_file);
+    rs_file_close(new_file);
+    rs_file_close(sig_file);
+
+    return result;
+}
+
+/** Make a fine signature from the coarse signature and the signature of the
+ * unmatched blocks, by matching the coarse signature again. */
+static rs_result rdiff_loadsig_coarse(FILE *sig_file, FILE *new_file,
+                                      rs_signature_t **sumset)
+{
+    FILE *coarse_file, *map_file;
+    rs_signature_t *unmatched;
+    rs_stats_t stats;
+    rs_result result;
+
+    *sumset = NULL;
+    if ((result = rs_loadsig_file(sig_file, &unmatched, &stats)) != RS_DONE)
+        return result;
+    if (show_stats)
+        rs_log_stats(&stats);
+    coarse_file = rs_file_open(coarse_name, "rb", file_force);
+    if (!(map_file = tmpfile())) {
+        fprintf(stderr, "rdiff: Can't create temporary match map file.\n");
+        result = RS_IO_ERROR;
+    } else {
+        result =
+            rdiff_do_match(coarse_file, new_file, map_file,
+                           (size_t)stats.block_len, sumset);
+        fclose(map_file);
+    }
+    rs_file_close(coarse_file);
+    /* The delta reads the new file again from the start. */
+    if (result == RS_DONE && fseek(new_file, 0, SEEK_SET)) {
+        fprintf(stderr, "rdiff: Can't rewind the new file for the delta.\n");
+        result = RS_IO_ERROR;
+    }
+    if (result == RS_DONE)
+        result = rs_merge_sumset(*sumset, unmatched);
+    rs_free_sumset(unmatched);
+    if (result != RS_DONE && *sumset) {
+        rs_free_sumset(*sumset);
+        *sumset = NULL;
+    }
+    return result;
+}
+
 static rs_result rdiff_delta(poptContext opcon)
 {
     FILE *sig_file, *new_file, *delta_file;
@@ -253,16 +417,21 @@ static rs_result rdiff_delta(poptContext opcon)
 
     rdiff_no_more_args(opcon);
 
-    result = rs_loadsig_file(sig_file, &sumset, &stats);
+    if (coarse_name) {
+        result = rdiff_loadsig_coarse(sig_file, new_file, &sumset);
+    } else {
+        result = rs_loadsig_file(sig_file, &sumset, &stats);
+        if (result == RS_DONE && show_stats)
+            rs_log_stats(&stats);
+    }
     if (result != RS_DONE)
         return result;
 
-    if (show_stats)
-        rs_log_stats(&stats);
-
     if ((result = rs_build_hash_table(sumset)) != RS_DONE)
         return result;
 
+    if (delta_checksum)
+        rs_deltasumlen = RS_MAX_STRONG_SUM_LENGTH;
     result = rs_delta_file(sumset, new_file, delta_file, &stats);
 
     rs_file_close(delta_file);
@@ -293,6 +462,23 @@ static rs_result rdiff_patch(poptContext opcon)
         exit(RS_SYNTAX_ERROR);
     }
 
+    if (file_inplace) {
+        basis_file = rs_file_open(basis_name, "r+b", file_force);
+        delta_file = rs_file_open(poptGetArg(opcon), "rb", file_force);
+
+        rdiff_no_more_args(opcon);
+
+        result = rs_patch_file_inplace(basis_file, delta_file, &stats);
+
+        rs_file_close(delta_file);
+        rs_file_close(basis_file);
+
+        if (show_stats)
+            rs_log_stats(&stats);
+
+        return result;
+    }
+
     basis_file = rs_file_open(basis_name, "rb", file_force);
     delta_file = rs_file_open(poptGetArg(opcon), "rb", file_force);
     new_file = rs_file_open(poptGetArg(opcon), "wb", file_force);
@@ -321,11 +507,14 @@ static rs_result rdiff_action(poptContext opcon)
         return rdiff_sig(opcon);
     else if (isprefix(action, "delta"))
         return rdiff_delta(opcon);
+    else if (isprefix(action, "match"))
+        return rdiff_match(opcon);
     else if (isprefix(action, "patch"))
         return rdiff_patch(opcon);
 
     rdiff_usage
-        ("You must specify an action: `signature', `delta', or `patch'.");
+        ("You must specify an action: `signature', `match', `delta', or "
+         "`patch'.");
     exit(RS_SYNTAX_ERROR);
 }
 
@@ -337,6 +526,16 @@ int main(const int argc, const char *argv[])
         {"version", 'V', POPT_ARG_NONE, 0, 'V'},
         {"input-size", 'I', POPT_ARG_INT, &rs_inbuflen},
         {"output-size", 'O', POPT_ARG_INT, &rs_outbuflen},
+        {"cache-size", 0, POPT_ARG_INT, &rs_cachelen},
+        {"async-depth", 0, POPT_ARG_INT, &rs_asyncdepth},
+        {"spill-size", 0, POPT_ARG_INT, &rs_spillbuflen},
+        {"pipeline", 0, POPT_ARG_INT, &rs_pipelinebufs},
+        {"io", 0, POPT_ARG_STRING, &rs_fileio_name},
+        {"inplace", 0, POPT_ARG_NONE, &file_inplace},
+        {"checksum", 0, POPT_ARG_NONE, &delta_checksum},
+        {"compact", 0, POPT_ARG_NONE, &sig_compact},
+        {"match", 0, POPT_ARG_STRING, &match_name},
+        {"coarse", 0, POPT_ARG_STRING, &coarse_name},
         {"hash", 'H', POPT_ARG_STRING, &rs_hash_name},
         {"rollsum", 'R', POPT_ARG_STRING, &rs_rollsum_name},
         {"help", '?', POPT_ARG_NONE, 0, 'h'},
@@ -29,94 +29,210 @@
 #include "librsync.h"
 #include "job.h"
 #include "sumset.h"
+#include "cdc.h"
 #include "stream.h"
 #include "netint.h"
 #include "trace.h"
 #include "util.h"
 
-static rs_result rs_loadsig_s_weak(rs_job_t *job);
-static rs_result rs_loadsig_s_strong(rs_job_t *job);
+/** The most blocks to allocate up front from the basis length of a v2
+ * signature of unknown size, since the header could be corrupt. */
+#define RS_LOADSIG_MAX_PRESIZE (1 << 20)
+
+static rs_result rs_loadsig_s_blocks(rs_job_t *job);
 
 /** Add a just-read-in checksum pair to the signature block. */
-static rs_result rs_loadsig_add_sum(rs_job_t *job, rs_strong_sum_t *strong)
+static rs_result rs_loadsig_add_sum(rs_job_t *job, rs_weak_sum64_t weak,
+                                    rs_strong_sum_t *strong)
 {
     rs_signature_t *sig = job->signature;
 
+    if (rs_signature_is_cdc(sig)
+        && (weak < 1
+            || weak > (rs_weak_sum64_t)rs_cdc_max_len(sig->block_len))) {
+        rs_error("chunk length " FMT_WEAKSUM " is bogus", weak);
+        return RS_CORRUPT;
+    }
     if (rs_trace_enabled()) {
         char hexbuf[RS_MAX_STRONG_SUM_LENGTH * 2 + 2];
         rs_hexify(hexbuf, strong, sig->strong_sum_len);
-        rs_trace("got block: weak=" FMT_WEAKSUM ", strong=%s", job->weak_sig,
-                 hexbuf);
+        rs_trace("got block: weak=" FMT_WEAKSUM ", strong=%s", weak, hexbuf);
     }
-    rs_signature_add_block(job->signature, job->weak_sig, strong);
+    if (!rs_signature_add_block(sig, weak, strong))
+        return RS_MEM_ERROR;
     job->stats.sig_blocks++;
     return RS_RUNNING;
 }
 
-static rs_result rs_loadsig_s_weak(rs_job_t *job)
+/** State of reading and adding block sums.
+ *
+ * If the scoop is empty, all the whole block sums in the input are added
+ * directly from it, up to the work budget. A block sum split across input
+ * buffers is read into the scoop and added by itself. */
+static rs_result rs_loadsig_s_blocks(rs_job_t *job)
 {
-    int l;
+    rs_signature_t *sig = job->signature;
+    rs_buffers_t *const stream = job->stream;
+    const int weak_len = rs_signature_weak_sum_len(sig);
+    const size_t sum_len = (size_t)weak_len + (size_t)sig->strong_sum_len;
+    const int direct = !job->scoop_avail && stream->avail_in >= sum_len;
+    rs_byte_t *p;
+    size_t n, i;
     rs_result result;
 
-    if ((result = rs_suck_n4(job, &l)) != RS_DONE) {
-        if (result == RS_INPUT_ENDED)   /* ending here is OK */
-            return RS_DONE;
-        return result;
+    if (!direct) {
+        if ((result = rs_scoop_read(job, sum_len, (void **)&p)) != RS_DONE) {
+            /* ending between block sums is OK */
+            if (result == RS_INPUT_ENDED && !rs_scoop_total_avail(job))
+                return RS_DONE;
+            return result;
+        }
+        n = 1;
+    } else {
+        p = (rs_byte_t *)stream->next_in;
+        n = stream->avail_in / sum_len;
+    }
+    for (i = 0; i < n; i++, p += sum_len) {
+        if ((result =
+             rs_loadsig_add_sum(job,
+                                (rs_weak_sum64_t)rs_netint_get(p, weak_len),
+                                (rs_strong_sum_t *)(p + weak_len))) !=
+            RS_RUNNING)
+            return result;
+        /* yield if the work budget is spent by the block sums added */
+        if (rs_job_budget_spend(job, sum_len)) {
+            i++;
+            break;
+        }
     }
-    job->weak_sig = l;
-    job->statefn = rs_loadsig_s_strong;
+    if (direct)
+        rs_scoop_advance(job, i * sum_len);
     return RS_RUNNING;
 }
 
-static rs_result rs_loadsig_s_strong(rs_job_t *job)
+/** Initialize the signature from the header that has been read. */
+static rs_result rs_loadsig_init(rs_job_t *job)
 {
+    rs_signature_t *sig = job->signature;
+    const int v2 = rs_magic_is_v2(job->sig_magic);
+    rs_long_t sum_len, count;
     rs_result result;
-    rs_strong_sum_t *strongsum;
 
+    /* Memory kept from another allocator can't be reused. */
+    if (sig->allocator != job->allocator) {
+        rs_signature_done(sig);
+        sig->allocator = job->allocator;
+    }
+    /* Initialize the signature, reusing its memory if it was reset. */
     if ((result =
-         rs_scoop_read(job, job->signature->strong_sum_len,
-                       (void **)&strongsum)) != RS_DONE)
+         rs_signature_reinit(sig, job->sig_magic, job->sig_block_len,
+                             job->sig_strong_len,
+                             v2 ? -1 : job->sig_fsize)) != RS_DONE)
+        return result;
+    if (v2) {
+        if (job->sig_weak_len > rs_signature_weak_sum_max(sig)) {
+            rs_error("weak sum length %d is bogus for magic %#x",
+                     job->sig_weak_len, sig->magic);
+            return RS_CORRUPT;
+        }
+        sig->weak_sum_len = job->sig_weak_len;
+        sig->basis_len = job->sig_basis_len;
+        /* Allocate for the blocks of the basis, or the blocks that would fit
+           in the signature file if that is smaller. */
+        sum_len = (rs_long_t)sig->weak_sum_len + sig->strong_sum_len;
+        count = job->sig_fsize >= 0 ?
+            job->sig_fsize / sum_len : RS_LOADSIG_MAX_PRESIZE;
+        if (sig->basis_len >= 0 && !rs_signature_is_cdc(sig)) {
+            rs_long_t basis_count =
+                (sig->basis_len + sig->block_len - 1) / sig->block_len;
+            if (basis_count < count)
+                count = basis_count;
+        } else if (job->sig_fsize < 0) {
+            count = 0;
+        }
+        if (count > INT32_MAX)
+            count = INT32_MAX;
+        if ((result = rs_signature_reserve(sig, (int)count)) != RS_DONE)
+            return result;
+    }
+    job->statefn = rs_loadsig_s_blocks;
+    return RS_RUNNING;
+}
+
+static rs_result rs_loadsig_s_basislen(rs_job_t *job)
+{
+    rs_long_t l;
+    rs_result result;
+
+    if ((result = rs_suck_varint(job, &l)) != RS_DONE)
+        return result;
+    /* The basis length is stored plus one so zero means unknown. */
+    job->sig_basis_len = l - 1;
+    rs_trace("got basis length " FMT_LONG, job->sig_basis_len);
+    return rs_loadsig_init(job);
+}
+
+static rs_result rs_loadsig_s_weaklen(rs_job_t *job)
+{
+    rs_long_t l;
+    rs_result result;
+
+    if ((result = rs_suck_varint(job, &l)) != RS_DONE)
         return result;
-    job->statefn = rs_loadsig_s_weak;
-    return rs_loadsig_add_sum(job, strongsum);
+    if (l < 1 || l > 8) {
+        rs_error("weak sum length " FMT_LONG " is implausible", l);
+        return RS_CORRUPT;
+    }
+    rs_trace("got weak sum length " FMT_LONG, l);
+    job->sig_weak_len = (int)l;
+    job->statefn = rs_loadsig_s_basislen;
+    return RS_RUNNING;
 }
 
 static rs_result rs_loadsig_s_stronglen(rs_job_t *job)
 {
-    int l;
+    rs_long_t l;
+    int n;
     rs_result result;
 
-    if ((result = rs_suck_n4(job, &l)) != RS_DONE)
+    if (rs_magic_is_v2(job->sig_magic))
+        result = rs_suck_varint(job, &l);
+    else if ((result = rs_suck_n4(job, &n)) == RS_DONE)
+        l = n;
+    if (result != RS_DONE)
         return result;
     if (l < 0 || l > RS_MAX_STRONG_SUM_LENGTH) {
-        rs_error("strong sum length %d is implausible", l);
+        rs_error("strong sum length " FMT_LONG " is implausible", l);
         return RS_CORRUPT;
     }
-    rs_trace("got strong sum length %d", l);
-    job->sig_strong_len = l;
-    /* Initialize the signature. */
-    if ((result =
-         rs_signature_init(job->signature, job->sig_magic, job->sig_block_len,
-                           job->sig_strong_len, job->sig_fsize)) != RS_DONE)
-        return result;
-    job->statefn = rs_loadsig_s_weak;
-    return RS_RUNNING;
+    rs_trace("got strong sum length " FMT_LONG, l);
+    job->sig_strong_len = (int)l;
+    if (rs_magic_is_v2(job->sig_magic)) {
+        job->statefn = rs_loadsig_s_weaklen;
+        return RS_RUNNING;
+    }
+    return rs_loadsig_init(job);
 }
 
 static rs_result rs_loadsig_s_blocklen(rs_job_t *job)
 {
-    int l;
+    rs_long_t l;
+    int n;
     rs_result result;
 
-    if ((result = rs_suck_n4(job, &l)) != RS_DONE)
+    if (rs_magic_is_v2(job->sig_magic))
+        result = rs_suck_varint(job, &l);
+    else if ((result = rs_suck_n4(job, &n)) == RS_DONE)
+        l = n;
+    if (result != RS_DONE)
         return result;
-    if (l < 1) {
-        rs_error("block length of %d is bogus", l);
+    if (l < 1 || l > INT32_MAX) {
+        rs_error("block length of " FMT_LONG " is bogus", l);
         return RS_CORRUPT;
     }
-    rs_trace("got block length %d", l);
-    job->sig_block_len = l;
-    job->stats.block_len = l;
+    rs_trace("got block length " FMT_LONG, l);
+    job->sig_block_len = (int)l;
+    job->stats.block_len = (int)l;
     job->statefn = rs_loadsig_s_stronglen;
     return RS_RUNNING;
 }
@@ -140,5 +256,16 @@ rs_job_t *rs_loadsig_begin(rs_signature_t **signature)
 
     job = rs_job_new("loadsig", rs_loadsig_s_magic);
     *signature = job->signature = rs_alloc_struct(rs_signature_t);
+    job->work_ns = &job->signature->load_ns;
     return job;
 }
+
+rs_result rs_loadsig_reset(rs_job_t *job, rs_signature_t **signature)
+{
+    rs_job_reset(job, "loadsig", rs_loadsig_s_magic);
+    if (!*signature)
+        *signature = rs_alloc_struct(rs_signature_t);
+    job->signature = *signature;
+    job->work_ns = &job->signature->load_ns;
+    return RS_DONE;
+}
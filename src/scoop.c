@@ -46,6 +46,15 @@
  * As a future optimization, we might try to take data directly from the input
  * buffer if there's already enough there.
  *
+ * The scoop buffer is a ring buffer where possible. The same memory is mapped
+ * twice, one mapping straight after the other, so the data in the scoop is
+ * always contiguous even when it wraps around the end of the buffer. This
+ * means the scoop never needs to move data back to the front of the buffer to
+ * make room for more. Once the scoop has grown big enough for the job, it
+ * also never needs to be reallocated. On platforms without memfd_create(), or
+ * for scoops smaller than a page, it falls back to an ordinary buffer and
+ * moves the data to the front when needed.
+ *
  * \todo We probably know a maximum amount of data that can be scooped up, so
  * we could just avoid dynamic allocation. However that can't be fixed at
  * compile time, because when generating a delta it needs to be large enough to
@@ -62,9 +71,68 @@
 #include "stream.h"
 #include "trace.h"
 #include "util.h"
+#ifdef HAVE_MEMFD_CREATE
+#  include <unistd.h>
+#  include <sys/mman.h>
+#endif
 
-/** Try to accept a from the input buffer to get LEN bytes in the scoop. */
-void rs_scoop_input(rs_job_t *job, size_t len)
+/** Allocate a ring buffer of \p size bytes mapped twice in a row.
+ *
+ * \return The buffer, or NULL if a ring buffer couldn't be made. */
+static rs_byte_t *rs_scoop_ring_alloc(size_t size)
+{
+#ifdef HAVE_MEMFD_CREATE
+    long pagesize = sysconf(_SC_PAGESIZE);
+    rs_byte_t *buf;
+    int fd;
+
+    if (pagesize <= 0 || size % (size_t)pagesize)
+        return NULL;
+    if ((fd = memfd_create("librsync-scoop", MFD_CLOEXEC)) < 0)
+        return NULL;
+    if (ftruncate(fd, (off_t)size) < 0) {
+        close(fd);
+        return NULL;
+    }
+    /* Reserve space for both mappings, then map the memory over it twice. */
+    buf = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    if (mmap(buf, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0)
+        == MAP_FAILED
+        || mmap(buf + size, size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(buf, 2 * size);
+        close(fd);
+        return NULL;
+    }
+    /* The mappings keep the memory alive without the fd. */
+    close(fd);
+    return buf;
+#else
+    return NULL;
+#endif
+}
+
+/** Free the scoop buffer. */
+void rs_scoop_free(rs_job_t *job)
+{
+#ifdef HAVE_MEMFD_CREATE
+    if (job->scoop_ring) {
+        munmap(job->scoop_buf, 2 * job->scoop_alloc);
+        return;
+    }
+#endif
+    rs_free_with(job->allocator, job->scoop_buf);
+}
+
+/** Try to accept a from the input buffer to get LEN bytes in the scoop.
+ *
+ * \return RS_DONE, or RS_MEM_ERROR if a larger scoop couldn't be
+ * allocated. */
+rs_result rs_scoop_input(rs_job_t *job, size_t len)
 {
     rs_buffers_t *stream = job->stream;
     size_t tocopy;
@@ -75,16 +143,29 @@ void rs_scoop_input(rs_job_t *job, size_t len)
         /* Need to allocate a larger scoop. */
         rs_byte_t *newbuf;
         size_t newsize;
+        int ring;
         for (newsize = 64; newsize < len; newsize <<= 1) ;
-        newbuf = rs_alloc(newsize, "scoop buffer");
+        /* Only use a ring buffer if memory is coming from malloc(). */
+        ring = rs_allocator_is_malloc(job->allocator)
+            && (newbuf = rs_scoop_ring_alloc(newsize)) != NULL;
+        if (!ring
+            && !(newbuf =
+                 rs_alloc_with(job->allocator, newsize, "scoop buffer")))
+            return RS_MEM_ERROR;
         if (job->scoop_avail)
             memcpy(newbuf, job->scoop_next, job->scoop_avail);
         if (job->scoop_buf)
-            free(job->scoop_buf);
+            rs_scoop_free(job);
         job->scoop_buf = job->scoop_next = newbuf;
-        rs_trace("resized scoop buffer to " FMT_SIZE " bytes from " FMT_SIZE "",
-                 newsize, job->scoop_alloc);
+        job->scoop_ring = ring;
+        rs_trace("resized scoop %s to " FMT_SIZE " bytes from " FMT_SIZE "",
+                 ring ? "ring buffer" : "buffer", newsize, job->scoop_alloc);
         job->scoop_alloc = newsize;
+    } else if (job->scoop_ring) {
+        /* Wrap the data back into the first mapping, the data past the end
+           of it is already in the second mapping. */
+        if (job->scoop_next >= job->scoop_buf + job->scoop_alloc)
+            job->scoop_next -= job->scoop_alloc;
     } else if (job->scoop_buf != job->scoop_next) {
         /* Move existing data to the front of the scoop. */
         rs_trace("moving scoop " FMT_SIZE " bytes to reuse " FMT_SIZE " bytes",
@@ -104,6 +185,7 @@ void rs_scoop_input(rs_job_t *job, size_t len)
     job->scoop_avail += tocopy;
     stream->next_in += tocopy;
     stream->avail_in -= tocopy;
+    return RS_DONE;
 }
 
 /** Advance the input cursor forward \p len bytes.
@@ -148,6 +230,7 @@ void rs_scoop_advance(rs_job_t *job, size_t len)
 rs_result rs_scoop_readahead(rs_job_t *job, size_t len, void **ptr)
 {
     rs_buffers_t *stream = job->stream;
+    rs_result result;
     rs_job_check(job);
 
     if (!job->scoop_avail && stream->avail_in >= len) {
@@ -159,7 +242,8 @@ rs_result rs_scoop_readahead(rs_job_t *job, size_t len, void **ptr)
         /* There is not enough data in the scoop. */
         rs_trace("scoop has less than " FMT_SIZE " bytes, scooping from "
                  FMT_SIZE " input bytes", len, stream->avail_in);
-        rs_scoop_input(job, len);
+        if ((result = rs_scoop_input(job, len)) != RS_DONE)
+            return result;
     }
     if (job->scoop_avail >= len) {
         /* There is enough data in the scoop now. */
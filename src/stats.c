@@ -37,11 +37,32 @@ int rs_log_stats(rs_stats_t const *stats)
     return 0;
 }
 
-char *rs_format_stats(rs_stats_t const *stats, char *buf, size_t size)
+int rs_log_job_stats(rs_job_t *job)
+{
+    char buf[1000];
+
+    rs_format_job_stats(job, buf, sizeof buf - 1);
+    rs_log(RS_LOG_INFO | RS_LOG_NONAME, "%s", buf);
+    return 0;
+}
+
+/** Append a phase time in milliseconds to the time[] stats if it is set. */
+static int rs_format_phase(char *buf, size_t size, int len, int *n,
+                           char const *name, rs_long_t ns)
+{
+    if (!ns || (size_t)len >= size)
+        return len;
+    return len + snprintf(buf + len, size - (size_t)len, "%s%s %.3f ms",
+                          (*n)++ ? ", " : " time[", name, (double)ns / 1e6);
+}
+
+/** Format stats, with the phase times if \p times is not NULL. */
+static char *rs_format_times(rs_stats_t const *stats, rs_times_t const *times,
+                             char *buf, size_t size)
 {
     char const *op = stats->op;
-    int len, sec;
-    double mb_in, mb_out;
+    int len, n = 0;
+    double sec, mb_in, mb_out;
 
     if (!op)
         op = "noop";
@@ -79,15 +100,43 @@ char *rs_format_stats(rs_stats_t const *stats, char *buf, size_t size)
                      " bytes per block]", stats->sig_blocks, stats->block_len);
     }
 
-    sec = (int)(stats->end - stats->start);
-    if (sec == 0)
+    /* Use the nanosecond times if we have them, so short jobs get sensible
+       speeds. */
+    if (times && times->start_ns && times->end_ns > times->start_ns)
+        sec = (double)(times->end_ns - times->start_ns) / 1e9;
+    else
+        sec = (double)(stats->end - stats->start);
+    if (sec <= 0)
         sec = 1;                // avoid division by zero
     mb_in = (double)stats->in_bytes / 1e6;
     mb_out = (double)stats->out_bytes / 1e6;
     len +=
         snprintf(buf + len, size - (size_t)len,
-                 " speed[%.1f MB (%.1f MB/s) in, %.1f MB (%.1f MB/s) out, %d sec]",
+                 " speed[%.1f MB (%.1f MB/s) in, %.1f MB (%.1f MB/s) out, %.3f sec]",
                  mb_in, mb_in / sec, mb_out, mb_out / sec, sec);
 
+    if (!times)
+        return buf;
+    len = rs_format_phase(buf, size, len, &n, "loadsig", times->loadsig_ns);
+    len = rs_format_phase(buf, size, len, &n, "hashtable",
+                          times->hashtable_ns);
+    len = rs_format_phase(buf, size, len, &n, "scan", times->scan_ns);
+    len = rs_format_phase(buf, size, len, &n, "strong", times->strong_ns);
+    len = rs_format_phase(buf, size, len, &n, "emit", times->emit_ns);
+    len = rs_format_phase(buf, size, len, &n, "io", times->io_ns);
+    if (n && (size_t)len < size)
+        snprintf(buf + len, size - (size_t)len, "]");
+
     return buf;
 }
+
+char *rs_format_stats(rs_stats_t const *stats, char *buf, size_t size)
+{
+    return rs_format_times(stats, NULL, buf, size);
+}
+
+char *rs_format_job_stats(rs_job_t *job, char *buf, size_t size)
+{
+    return rs_format_times(rs_job_statistics(job), rs_job_times(job), buf,
+                           size);
+}
@@ -26,59 +26,128 @@
 #include <string.h>
 #include "librsync.h"
 #include "sumset.h"
+#include "cdc.h"
 #include "trace.h"
 #include "util.h"
 
-static void rs_block_sig_init(rs_block_sig_t *sig, rs_weak_sum_t weak_sum,
+static void rs_block_sig_init(rs_block_sig_t *sig, rs_weak_sum64_t weak_sum,
                               rs_strong_sum_t *strong_sum, int strong_len)
 {
-    sig->weak_sum = weak_sum;
-    if (strong_sum)
+    /* Fold 64 bit weaksums into 32 bits. This leaves 32 bit weaksums
+       unchanged. */
+    sig->weak_sum = (uint32_t)(weak_sum ^ (weak_sum >> 32));
+    if (strong_sum) {
         memcpy(sig->strong_sum, strong_sum, (size_t)strong_len);
+        /* Zero pad short strong sums for rs_chunk_sig_hash(). */
+        if (strong_len < 4)
+            memset(sig->strong_sum + strong_len, 0, (size_t)(4 - strong_len));
+    }
 }
 
 static inline unsigned rs_block_sig_hash(const rs_block_sig_t *sig)
 {
-    return (unsigned)sig->weak_sum;
+    return sig->weak_sum;
 }
 
 typedef struct rs_block_match {
     rs_block_sig_t block_sig;
+    rs_weak_sum64_t weak_sum;
     rs_signature_t *signature;
     const void *buf;
     size_t len;
 } rs_block_match_t;
 
 static void rs_block_match_init(rs_block_match_t *match, rs_signature_t *sig,
-                                rs_weak_sum_t weak_sum,
+                                rs_weak_sum64_t weak_sum,
                                 rs_strong_sum_t *strong_sum, const void *buf,
                                 size_t len)
 {
     rs_block_sig_init(&match->block_sig, weak_sum, strong_sum,
                       sig->strong_sum_len);
+    match->weak_sum = weak_sum;
     match->signature = sig;
     match->buf = buf;
     match->len = len;
 }
 
+/* Check if a signature's block sigs keep the high 32 bits of 64 bit weak
+   sums, which are needed for RabinKarp64 weak sums and CDC chunk offsets. */
+static inline int rs_signature_is_wide(const rs_signature_t *sig)
+{
+    return rs_signature_weaksum_kind(sig) == RS_RABINKARP64
+        || rs_signature_is_cdc(sig);
+}
+
+/* Get the size of a block_sig's strong_sum rounded up to align uint32_t. */
+static inline size_t rs_block_sig_strong_size(const rs_signature_t *sig)
+{
+    return ((size_t)sig->strong_sum_len + 3) & ~(size_t)3;
+}
+
+/* Get the pointer to the high 32 bits of a wide signature's block_sig. */
+static inline uint32_t *rs_block_sig_weak_hi(const rs_signature_t *sig,
+                                             const rs_block_sig_t *block_sig)
+{
+    return (uint32_t *)((char *)block_sig->strong_sum +
+                        rs_block_sig_strong_size(sig));
+}
+
+/* Get the whole weak sum of a block_sig in a signature. */
+static inline rs_weak_sum64_t rs_block_sig_weak_sum(const rs_signature_t *sig,
+                                                    const rs_block_sig_t
+                                                    *block_sig)
+{
+    uint32_t hi;
+
+    if (!rs_signature_is_wide(sig))
+        return block_sig->weak_sum;
+    hi = *rs_block_sig_weak_hi(sig, block_sig);
+    return (rs_weak_sum64_t)hi << 32 | (block_sig->weak_sum ^ hi);
+}
+
+/* Set a block_sig in a signature, including the high 32 bits if wide. */
+static void rs_block_sig_set(const rs_signature_t *sig,
+                             rs_block_sig_t *block_sig,
+                             rs_weak_sum64_t weak_sum,
+                             rs_strong_sum_t *strong_sum)
+{
+    rs_block_sig_init(block_sig, weak_sum, strong_sum, sig->strong_sum_len);
+    if (rs_signature_is_wide(sig))
+        *rs_block_sig_weak_hi(sig, block_sig) = (uint32_t)(weak_sum >> 32);
+}
+
 static inline int rs_block_match_cmp(rs_block_match_t *match,
                                      const rs_block_sig_t *block_sig)
 {
+    int cmp;
+
+    /* The hashtable only compares the 32 bit keys, so check the whole weaksum
+       first to avoid calculating strong sums for 64 bit weaksums that differ. */
+    if (match->weak_sum != rs_block_sig_weak_sum(match->signature, block_sig))
+        return 1;
     /* If buf is not NULL, the strong sum is yet to be calculated. */
     if (match->buf) {
+        rs_long_t start = rs_now_ns();
+
 #ifndef HASHTABLE_NSTATS
         match->signature->calc_strong_count++;
 #endif
         rs_signature_calc_strong_sum(match->signature, match->buf, match->len,
                                      &(match->block_sig.strong_sum));
+        match->signature->strong_ns += rs_now_ns() - start;
         match->buf = NULL;
     }
-    return memcmp(&match->block_sig.strong_sum, &block_sig->strong_sum,
-                  (size_t)match->signature->strong_sum_len);
+    /* Count weak sum matches that turn out to be false. */
+    if ((cmp =
+         memcmp(&match->block_sig.strong_sum, &block_sig->strong_sum,
+                (size_t)match->signature->strong_sum_len)))
+        match->signature->false_count++;
+    return cmp;
 }
 
-/* Disable mix32() in the hashtable because RabinKarp doesn't need it. We
-   manually apply mix32() to rollsums before using them in the hashtable. */
+/* Disable mix32() in the hashtable because RabinKarp and CRC32C don't need
+   it. We manually apply mix32() to rollsums before using them in the
+   hashtable. */
 #define HASHTABLE_NMIX32
 /* Instantiate hashtable for rs_block_sig and rs_block_match. */
 #define ENTRY rs_block_sig
@@ -86,13 +155,17 @@ static inline int rs_block_match_cmp(rs_block_match_t *match,
 #define NAME hashtable
 #include "hashtable.h"
 
+#if HASHTABLE_PROBE_HIST != RS_MATCH_PROBE_HIST_LEN
+#  error "hashtable and rs_match_stats_t probe histograms differ in size"
+#endif
+
 /* Get the size of a packed rs_block_sig_t. */
 static inline size_t rs_block_sig_size(const rs_signature_t *sig)
 {
-    /* Round up to multiple of sizeof(weak_sum) to align memory correctly. */
-    const size_t mask = sizeof(rs_weak_sum_t)- 1;
-    return (offsetof(rs_block_sig_t, strong_sum) +
-            (((size_t)sig->strong_sum_len + mask) & ~mask));
+    /* Only wide signatures store the high 32 bits of their weak sums. */
+    return offsetof(rs_block_sig_t, strong_sum) +
+        rs_block_sig_strong_size(sig) +
+        (rs_signature_is_wide(sig) ? sizeof(uint32_t) : 0);
 }
 
 /* Get the pointer to the block_sig_t from a block index. */
@@ -111,6 +184,73 @@ static inline int rs_block_sig_idx(const rs_signature_t *sig,
                   (char *)sig->block_sigs) / rs_block_sig_size(sig));
 }
 
+/* The chunks of CDC signatures use the same rs_block_sig_t entries with the
+   chunk's end offset as the weak_sum. They are found by their strong sum and
+   length, so they use a separate hashtable instantiation. */
+typedef rs_block_sig_t rs_chunk_sig_t;
+
+static inline unsigned rs_chunk_sig_hash(const rs_chunk_sig_t *sig)
+{
+    unsigned h;
+
+    /* The strong sum is already well distributed. */
+    memcpy(&h, sig->strong_sum, sizeof(h));
+    return h;
+}
+
+/* Get the length of a chunk from its end offset and the previous chunk's. */
+static inline rs_long_t rs_chunk_sig_len(const rs_signature_t *sig,
+                                         const rs_chunk_sig_t *chunk_sig)
+{
+    if ((void *)chunk_sig == sig->block_sigs)
+        return (rs_long_t)rs_block_sig_weak_sum(sig, chunk_sig);
+    return (rs_long_t)(rs_block_sig_weak_sum(sig, chunk_sig) -
+                       rs_block_sig_weak_sum(sig, (rs_chunk_sig_t *)
+                                             ((char *)chunk_sig -
+                                              rs_block_sig_size(sig))));
+}
+
+typedef struct rs_chunk_match {
+    rs_chunk_sig_t chunk_sig;
+    rs_signature_t *signature;
+    rs_long_t len;
+} rs_chunk_match_t;
+
+static inline int rs_chunk_match_cmp(rs_chunk_match_t *match,
+                                     const rs_chunk_sig_t *chunk_sig)
+{
+    rs_signature_t *sig = match->signature;
+
+    /* Count hash key matches that turn out to be false. */
+    if (memcmp(&match->chunk_sig.strong_sum, &chunk_sig->strong_sum,
+               (size_t)sig->strong_sum_len)
+        || rs_chunk_sig_len(sig, chunk_sig) != match->len) {
+        sig->false_count++;
+        return 1;
+    }
+    return 0;
+}
+
+/* Instantiate hashtable for rs_chunk_sig and rs_chunk_match. */
+#define ENTRY rs_chunk_sig
+#define MATCH rs_chunk_match
+#define NAME chunktable
+#include "hashtable.h"
+
+/* Get the weak sum key used for matching from a weak sum in a signature file.
+
+   The top bytes of truncated v2 weak sums are zero, so apply mix32() to the
+   short ones to spread them over the hashtable buckets and bloom filter. */
+static inline rs_weak_sum64_t rs_signature_weak_key(const rs_signature_t *sig,
+                                                    rs_weak_sum64_t weak_sum)
+{
+    if (!rs_signature_is_v2(sig))
+        /* Apply mix32() to rollsum weaksums to improve their distribution. */
+        return rs_signature_weaksum_kind(sig) == RS_ROLLSUM ?
+            mix32((unsigned)weak_sum) : weak_sum;
+    return sig->weak_sum_len < 4 ? mix32((unsigned)weak_sum) : weak_sum;
+}
+
 rs_result rs_sig_args(rs_long_t old_fsize, rs_magic_number * magic,
                       size_t *block_len, size_t *strong_len)
 {
@@ -122,15 +262,35 @@ rs_result rs_sig_args(rs_long_t old_fsize, rs_magic_number * magic,
 
     /* Check and set default arguments. */
     *magic = *magic ? *magic : RS_RK_BLAKE2_SIG_MAGIC;
-    switch (*magic) {
+    switch (rs_magic_v1(*magic)) {
     case RS_BLAKE2_SIG_MAGIC:
     case RS_RK_BLAKE2_SIG_MAGIC:
+    case RS_RK64_BLAKE2_SIG_MAGIC:
+    case RS_CRC32C_BLAKE2_SIG_MAGIC:
+    case RS_CDC_BLAKE2_SIG_MAGIC:
         max_strong_len = RS_BLAKE2_SUM_LENGTH;
         break;
+    case RS_BLAKE3_SIG_MAGIC:
+    case RS_RK_BLAKE3_SIG_MAGIC:
+    case RS_RK64_BLAKE3_SIG_MAGIC:
+    case RS_CRC32C_BLAKE3_SIG_MAGIC:
+    case RS_CDC_BLAKE3_SIG_MAGIC:
+        max_strong_len = RS_BLAKE3_SUM_LENGTH;
+        break;
     case RS_MD4_SIG_MAGIC:
     case RS_RK_MD4_SIG_MAGIC:
+    case RS_RK64_MD4_SIG_MAGIC:
+    case RS_CRC32C_MD4_SIG_MAGIC:
+    case RS_CDC_MD4_SIG_MAGIC:
         max_strong_len = RS_MD4_SUM_LENGTH;
         break;
+    case RS_XXH3_SIG_MAGIC:
+    case RS_RK_XXH3_SIG_MAGIC:
+    case RS_RK64_XXH3_SIG_MAGIC:
+    case RS_CRC32C_XXH3_SIG_MAGIC:
+    case RS_CDC_XXH3_SIG_MAGIC:
+        max_strong_len = RS_XXH3_SUM_LENGTH;
+        break;
     default:
         rs_error("invalid magic %#x", *magic);
         return RS_BAD_MAGIC;
@@ -147,6 +307,12 @@ rs_result rs_sig_args(rs_long_t old_fsize, rs_magic_number * magic,
     }
     if (*block_len == 0)
         *block_len = rec_block_len;
+    /* CDC signatures store chunk lengths up to 4 * block_len in 32 bits. */
+    if (rs_magic_is_cdc(*magic) && rs_cdc_max_len(*block_len) > 0xffffffffU) {
+        rs_error("invalid block_len=" FMT_SIZE " for magic=%#x", *block_len,
+                 (int)*magic);
+        return RS_PARAM_ERROR;
+    }
     /* The recommended strong_len assumes the worst case new_fsize = old_fsize
        + 16MB with no matches. This results in comparing a block at every byte
        offset against all the blocks in the signature, or new_fsize*block_num
@@ -181,10 +347,34 @@ rs_result rs_sig_args(rs_long_t old_fsize, rs_magic_number * magic,
     return RS_DONE;
 }
 
+int rs_sig_weak_len(rs_magic_number magic, size_t block_len,
+                    rs_long_t old_fsize)
+{
+    const int max_len = rs_magic_weak_sum_max(magic);
+    rs_long_t count;
+    int bits;
+
+    /* CDC signatures need the bytes for the maximum chunk length. */
+    if (rs_magic_is_cdc(magic))
+        return (rs_long_ln2((rs_long_t)rs_cdc_max_len(block_len)) + 8) / 8;
+    if (old_fsize < 0)
+        return max_len;
+    /* Each byte of the new file scanned is compared against all count blocks,
+       giving count/2^bits false weak sum matches per byte that each cost a
+       strong sum of block_len bytes. Use enough bits to keep this at 1/8 of a
+       byte of strong sums per byte scanned, with at least 16 bits. */
+    count = (old_fsize + (rs_long_t)block_len - 1) / (rs_long_t)block_len;
+    bits = rs_long_ln2(8 * count * (rs_long_t)block_len + 1) + 1;
+    if (bits < 16)
+        bits = 16;
+    return (bits + 7) / 8 < max_len ? (bits + 7) / 8 : max_len;
+}
+
 rs_result rs_signature_init(rs_signature_t *sig, rs_magic_number magic,
                             size_t block_len, size_t strong_len,
                             rs_long_t sig_fsize)
 {
+    size_t blocksig_len;
     rs_result result;
 
     /* Check and set default arguments, using old_fsize=-1 for unknown. */
@@ -194,18 +384,73 @@ rs_result rs_signature_init(rs_signature_t *sig, rs_magic_number magic,
     sig->magic = magic;
     sig->block_len = (int)block_len;
     sig->strong_sum_len = (int)strong_len;
+    sig->weak_sum_len = rs_signature_weak_sum_max(sig);
+    sig->basis_len = -1;
     sig->count = 0;
     /* Calculate the number of blocks if we have the signature file size. */
-    /* Magic+header is 12 bytes, each block thereafter is 4 bytes
+    /* Magic+header is 12 bytes, each block thereafter is 4 or 8 bytes
        weak_sum+strong_sum_len bytes */
-    sig->size = (int)(sig_fsize < 12 ? 0 : (sig_fsize - 12) / (4 + strong_len));
-    if (sig->size)
-        sig->block_sigs =
-            rs_alloc(sig->size * rs_block_sig_size(sig),
-                     "signature->block_sigs");
-    else
-        sig->block_sigs = NULL;
+    blocksig_len = (size_t)rs_signature_weak_sum_len(sig) + strong_len;
+    sig->size = (int)(sig_fsize < 12 ? 0 : (sig_fsize - 12) / blocksig_len);
+    sig->allocator = NULL;
+    sig->block_sigs = NULL;
     sig->hashtable = NULL;
+    sig->load_ns = sig->hashtable_ns = sig->strong_ns = 0;
+    sig->false_count = 0;
+    sig->coarse_count = sig->coarse_block_len = sig->coarse_last = 0;
+    sig->coarse_matched = NULL;
+    if (sig->size
+        && !(sig->block_sigs =
+             rs_alloc_with(NULL, sig->size * rs_block_sig_size(sig),
+                           "signature->block_sigs")))
+        return RS_MEM_ERROR;
+#ifndef HASHTABLE_NSTATS
+    sig->calc_strong_count = 0;
+#endif
+    rs_signature_check(sig);
+    return RS_DONE;
+}
+
+rs_result rs_signature_reinit(rs_signature_t *sig, rs_magic_number magic,
+                              size_t block_len, size_t strong_len,
+                              rs_long_t sig_fsize)
+{
+    void *block_sigs = sig->block_sigs;
+    size_t alloc = sig->block_sigs ? sig->size * rs_block_sig_size(sig) : 0;
+    hashtable_t *hashtable = sig->hashtable;
+    size_t blocksig_len, need;
+    rs_result result;
+
+    if ((result = rs_sig_args(-1, &magic, &block_len, &strong_len)) != RS_DONE)
+        return result;
+    sig->magic = magic;
+    sig->block_len = (int)block_len;
+    sig->strong_sum_len = (int)strong_len;
+    sig->weak_sum_len = rs_signature_weak_sum_max(sig);
+    sig->basis_len = -1;
+    sig->count = 0;
+    /* Grow block_sigs if it can't hold the blocks for sig_fsize. */
+    sig->size = (int)(alloc / rs_block_sig_size(sig));
+    blocksig_len = (size_t)rs_signature_weak_sum_len(sig) + strong_len;
+    need = sig_fsize < 12 ? 0 : (size_t)(sig_fsize - 12) / blocksig_len;
+    if (need > (size_t)sig->size) {
+        if (!(block_sigs =
+              rs_realloc_with(sig->allocator, block_sigs,
+                              need * rs_block_sig_size(sig),
+                              "signature->block_sigs")))
+            return RS_MEM_ERROR;
+        sig->size = (int)need;
+    }
+    sig->block_sigs = block_sigs;
+    /* Empty the old hashtable, it points at the old block_sigs. */
+    if ((sig->hashtable = hashtable))
+        hashtable_clear(hashtable);
+    /* Keep strong_ns and false_count, a running job may have a snapshot of
+       them to count its own share from. */
+    sig->load_ns = sig->hashtable_ns = 0;
+    rs_free_with(sig->allocator, sig->coarse_matched);
+    sig->coarse_count = sig->coarse_block_len = sig->coarse_last = 0;
+    sig->coarse_matched = NULL;
 #ifndef HASHTABLE_NSTATS
     sig->calc_strong_count = 0;
 #endif
@@ -213,40 +458,192 @@ rs_result rs_signature_init(rs_signature_t *sig, rs_magic_number magic,
     return RS_DONE;
 }
 
+rs_result rs_signature_reserve(rs_signature_t *sig, int size)
+{
+    void *block_sigs;
+
+    if (size <= sig->size)
+        return RS_DONE;
+    if (!(block_sigs =
+          rs_realloc_with(sig->allocator, sig->block_sigs,
+                          (size_t)size * rs_block_sig_size(sig),
+                          "signature->block_sigs")))
+        return RS_MEM_ERROR;
+    sig->block_sigs = block_sigs;
+    sig->size = size;
+    return RS_DONE;
+}
+
+rs_result rs_signature_fine_init(rs_signature_t *sig,
+                                 rs_signature_t const *coarse,
+                                 size_t block_len)
+{
+    rs_result result;
+
+    rs_signature_check(coarse);
+    if (rs_signature_is_cdc(coarse) || block_len == 0
+        || coarse->block_len % block_len) {
+        rs_error("invalid fine block_len=" FMT_SIZE " for magic=%#x with "
+                 "block_len=%d", block_len, coarse->magic, coarse->block_len);
+        return RS_PARAM_ERROR;
+    }
+    if ((result =
+         rs_signature_init(sig, coarse->magic, block_len,
+                           coarse->strong_sum_len, -1)) != RS_DONE)
+        return result;
+    sig->coarse_count = coarse->count;
+    sig->coarse_block_len = coarse->block_len;
+    /* Make space for all the fine blocks of every coarse block. */
+    sig->size = coarse->count * (coarse->block_len / (int)block_len);
+    if (sig->size
+        && !(sig->block_sigs =
+             rs_alloc_with(sig->allocator,
+                           (size_t)sig->size * rs_block_sig_size(sig),
+                           "signature->block_sigs")))
+        return RS_MEM_ERROR;
+    if (!(sig->coarse_matched =
+          rs_alloc_with(sig->allocator, (size_t)coarse->count / 8 + 1,
+                        "signature->coarse_matched")))
+        return RS_MEM_ERROR;
+    memset(sig->coarse_matched, 0, (size_t)coarse->count / 8 + 1);
+    return RS_DONE;
+}
+
+void rs_signature_add_coarse_match(rs_signature_t *sig, int coarse_idx,
+                                   void const *buf, size_t len)
+{
+    const size_t block_len = (size_t)sig->block_len;
+    const int first = coarse_idx * (sig->coarse_block_len / sig->block_len);
+    const unsigned char *p = buf;
+    rs_weak_sum64_t weak_sum;
+    rs_strong_sum_t strong_sum;
+    rs_long_t start;
+    size_t n;
+    int i = first;
+
+    assert(0 <= coarse_idx && coarse_idx < sig->coarse_count);
+    assert(len <= (size_t)sig->coarse_block_len);
+    /* Only the first copy of a coarse block found is needed. */
+    if (rs_signature_coarse_matched(sig, coarse_idx))
+        return;
+    sig->coarse_matched[coarse_idx / 8] |= (unsigned char)(1 << (coarse_idx % 8));
+    for (; len; p += n, len -= n) {
+        n = len < block_len ? len : block_len;
+        /* Use the same weak sum keys as rs_signature_add_block(). */
+        weak_sum =
+            rs_signature_weak_key(sig, rs_signature_file_weak_sum
+                                  (sig, rs_signature_calc_weak_sum(sig, p, n)));
+        start = rs_now_ns();
+        rs_signature_calc_strong_sum(sig, p, n, &strong_sum);
+        sig->strong_ns += rs_now_ns() - start;
+        rs_block_sig_set(sig, rs_block_sig_ptr(sig, i++), weak_sum,
+                         &strong_sum);
+    }
+    if (coarse_idx == sig->coarse_count - 1)
+        sig->coarse_last = i - first;
+}
+
+rs_result rs_merge_sumset(rs_signature_t *sig, rs_signature_t const *unmatched)
+{
+    const size_t size = rs_block_sig_size(sig);
+    int ratio, i, n, j = 0;
+
+    rs_signature_check(sig);
+    rs_signature_check(unmatched);
+    if (!sig->coarse_matched || sig->hashtable) {
+        rs_error("signature is not an unmerged fine signature");
+        return RS_PARAM_ERROR;
+    }
+    if (unmatched->magic != sig->magic || unmatched->block_len != sig->block_len
+        || unmatched->strong_sum_len != sig->strong_sum_len
+        || unmatched->weak_sum_len != sig->weak_sum_len) {
+        rs_error("unmatched signature magic=%#x, block_len=%d, strong_len=%d, "
+                 "weak_len=%d differs from the fine signature",
+                 unmatched->magic, unmatched->block_len,
+                 unmatched->strong_sum_len, unmatched->weak_sum_len);
+        return RS_CORRUPT;
+    }
+    ratio = sig->coarse_block_len / sig->block_len;
+    /* Fill in the fine blocks of each unmatched coarse block in order. Only
+       the last coarse block can have fewer fine blocks. */
+    for (i = 0; i < sig->coarse_count; i++) {
+        if (rs_signature_coarse_matched(sig, i)) {
+            n = i == sig->coarse_count - 1 ? sig->coarse_last : ratio;
+        } else {
+            n = unmatched->count - j < ratio ? unmatched->count - j : ratio;
+            if (n == 0 || (n < ratio && i < sig->coarse_count - 1)) {
+                rs_error("unmatched signature is missing blocks for coarse "
+                         "block %d", i);
+                return RS_CORRUPT;
+            }
+            memcpy(rs_block_sig_ptr(sig, i * ratio),
+                   rs_block_sig_ptr(unmatched, j), (size_t)n * size);
+            j += n;
+        }
+        sig->count = i * ratio + n;
+    }
+    if (j != unmatched->count) {
+        rs_error("unmatched signature has %d extra blocks",
+                 unmatched->count - j);
+        return RS_CORRUPT;
+    }
+    rs_free_with(sig->allocator, sig->coarse_matched);
+    sig->coarse_matched = NULL;
+    sig->load_ns += unmatched->load_ns;
+    return RS_DONE;
+}
+
 void rs_signature_done(rs_signature_t *sig)
 {
     hashtable_free(sig->hashtable);
-    free(sig->block_sigs);
+    rs_free_with(sig->allocator, sig->block_sigs);
+    rs_free_with(sig->allocator, sig->coarse_matched);
     rs_bzero(sig, sizeof(*sig));
 }
 
 rs_block_sig_t *rs_signature_add_block(rs_signature_t *sig,
-                                       rs_weak_sum_t weak_sum,
+                                       rs_weak_sum64_t weak_sum,
                                        rs_strong_sum_t *strong_sum)
 {
     rs_signature_check(sig);
-    /* Apply mix32() to rollsum weaksums to improve their distribution. */
-    if (rs_signature_weaksum_kind(sig) == RS_ROLLSUM)
-        weak_sum = mix32(weak_sum);
+    /* Store the end offset of chunks, after the previous chunk's. */
+    if (rs_signature_is_cdc(sig)) {
+        if (sig->count)
+            weak_sum += rs_block_sig_ptr(sig, sig->count - 1)->weak_sum;
+    } else {
+        weak_sum = rs_signature_weak_key(sig, weak_sum);
+    }
     /* If block_sigs is full, allocate more space. */
     if (sig->count == sig->size) {
-        sig->size = sig->size ? sig->size * 2 : 16;
-        sig->block_sigs =
-            rs_realloc(sig->block_sigs, sig->size * rs_block_sig_size(sig),
-                       "signature->block_sigs");
+        int size = sig->size ? sig->size * 2 : 16;
+        void *block_sigs =
+            rs_realloc_with(sig->allocator, sig->block_sigs,
+                            size * rs_block_sig_size(sig),
+                            "signature->block_sigs");
+
+        if (!block_sigs)
+            return NULL;
+        sig->block_sigs = block_sigs;
+        sig->size = size;
     }
     rs_block_sig_t *b = rs_block_sig_ptr(sig, sig->count++);
-    rs_block_sig_init(b, weak_sum, strong_sum, sig->strong_sum_len);
+    rs_block_sig_set(sig, b, weak_sum, strong_sum);
     return b;
 }
 
-rs_long_t rs_signature_find_match(rs_signature_t *sig, rs_weak_sum_t weak_sum,
-                                  void const *buf, size_t len)
+rs_long_t rs_signature_find_match(rs_signature_t *sig,
+                                  rs_weak_sum64_t weak_sum, void const *buf,
+                                  size_t len)
 {
     rs_block_match_t m;
     rs_block_sig_t *b;
 
     rs_signature_check(sig);
+    /* Match the top bytes of the weak sum for truncated v2 weak sums. */
+    if (rs_signature_is_v2(sig))
+        weak_sum = rs_signature_weak_key(sig, weak_sum >> 8 *
+                                         (rs_signature_weak_sum_max(sig) -
+                                          sig->weak_sum_len));
     rs_block_match_init(&m, sig, weak_sum, NULL, buf, len);
     if ((b = hashtable_find(sig->hashtable, &m))) {
         return (rs_long_t)rs_block_sig_idx(sig, b) * sig->block_len;
@@ -254,48 +651,123 @@ rs_long_t rs_signature_find_match(rs_signature_t *sig, rs_weak_sum_t weak_sum,
     return -1;
 }
 
-void rs_signature_log_stats(rs_signature_t const *sig)
+rs_long_t rs_signature_find_chunk(rs_signature_t *sig, void const *buf,
+                                  size_t len)
+{
+    rs_chunk_match_t m;
+    rs_strong_sum_t strong_sum;
+    rs_chunk_sig_t *b;
+    rs_long_t start = rs_now_ns();
+
+    rs_signature_check(sig);
+    assert(rs_signature_is_cdc(sig));
+    /* Every chunk looked up needs its strong sum. */
+#ifndef HASHTABLE_NSTATS
+    sig->calc_strong_count++;
+#endif
+    rs_signature_calc_strong_sum(sig, buf, len, &strong_sum);
+    sig->strong_ns += rs_now_ns() - start;
+    rs_block_sig_init(&m.chunk_sig, 0, &strong_sum, sig->strong_sum_len);
+    m.signature = sig;
+    m.len = (rs_long_t)len;
+    if ((b = chunktable_find(sig->hashtable, &m)))
+        return (rs_long_t)rs_block_sig_weak_sum(sig, b) - m.len;
+    return -1;
+}
+
+rs_result rs_signature_stats(rs_signature_t const *sig,
+                             rs_match_stats_t *stats)
 {
 #ifndef HASHTABLE_NSTATS
     hashtable_t *t = sig->hashtable;
+    rs_long_t probed = 0;
+    int i;
+#endif
+
+    rs_bzero(stats, sizeof *stats);
+    stats->false_matches = sig->false_count;
+#ifndef HASHTABLE_NSTATS
+    if (!t)
+        return RS_DONE;
+    stats->find_count = t->find_count;
+    stats->match_count = t->match_count;
+    stats->weakcmp_count = t->hashcmp_count;
+    stats->strongcmp_count = t->entrycmp_count;
+    stats->strongcalc_count = sig->calc_strong_count;
+    for (i = 1; i < RS_MATCH_PROBE_HIST_LEN; i++)
+        probed += stats->probe_hist[i] = t->probe_hist[i];
+    /* The rest were ruled out by the bloom filter without probing. */
+    stats->probe_hist[0] = t->find_count - probed;
+    return RS_DONE;
+#else
+    return RS_UNIMPLEMENTED;
+#endif
+}
+
+void rs_signature_log_stats(rs_signature_t const *sig)
+{
+#ifndef HASHTABLE_NSTATS
+    rs_match_stats_t s;
+    double finds;
 
+    rs_signature_stats(sig, &s);
+    finds = s.find_count ? (double)s.find_count : 1.0;
     rs_log(RS_LOG_INFO | RS_LOG_NONAME,
-           "match statistics: signature[%ld searches, %ld (%.3f%%) matches, "
-           "%ld (%.3fx) weak sum compares, %ld (%.3f%%) strong sum compares, "
-           "%ld (%.3f%%) strong sum calcs]", t->find_count, t->match_count,
-           100.0 * (double)t->match_count / (double)t->find_count,
-           t->hashcmp_count, (double)t->hashcmp_count / (double)t->find_count,
-           t->entrycmp_count,
-           100.0 * (double)t->entrycmp_count / (double)t->find_count,
-           sig->calc_strong_count,
-           100.0 * (double)sig->calc_strong_count / (double)t->find_count);
+           "match statistics: signature[" FMT_LONG " searches, " FMT_LONG
+           " (%.3f%%) matches, " FMT_LONG " (%.3fx) weak sum compares, "
+           FMT_LONG " (%.3f%%) strong sum compares, " FMT_LONG
+           " (%.3f%%) strong sum calcs, " FMT_LONG " false matches]",
+           s.find_count, s.match_count, 100.0 * (double)s.match_count / finds,
+           s.weakcmp_count, (double)s.weakcmp_count / finds,
+           s.strongcmp_count, 100.0 * (double)s.strongcmp_count / finds,
+           s.strongcalc_count, 100.0 * (double)s.strongcalc_count / finds,
+           s.false_matches);
 #endif
 }
 
 rs_result rs_build_hash_table(rs_signature_t *sig)
 {
+    rs_long_t start = rs_now_ns();
     rs_block_match_t m;
+    rs_chunk_match_t c;
     rs_block_sig_t *b;
     int i;
 
     rs_signature_check(sig);
-    sig->hashtable = hashtable_new(sig->count);
+    /* Reuse the hashtable from a reinitialized signature if possible. */
+    sig->hashtable = hashtable_reset(sig->hashtable, sig->count, sig->allocator);
     if (!sig->hashtable)
         return RS_MEM_ERROR;
     for (i = 0; i < sig->count; i++) {
         b = rs_block_sig_ptr(sig, i);
-        rs_block_match_init(&m, sig, b->weak_sum, &b->strong_sum, NULL, 0);
-        if (!hashtable_find(sig->hashtable, &m))
-            hashtable_add(sig->hashtable, b);
+        if (rs_signature_is_cdc(sig)) {
+            /* Only add the first of any duplicate chunks. */
+            rs_block_sig_init(&c.chunk_sig, rs_block_sig_weak_sum(sig, b),
+                              &b->strong_sum, sig->strong_sum_len);
+            c.signature = sig;
+            c.len = rs_chunk_sig_len(sig, b);
+            if (!chunktable_find(sig->hashtable, &c))
+                chunktable_add(sig->hashtable, b);
+        } else {
+            rs_block_match_init(&m, sig, rs_block_sig_weak_sum(sig, b),
+                                &b->strong_sum, NULL, 0);
+            if (!hashtable_find(sig->hashtable, &m))
+                hashtable_add(sig->hashtable, b);
+        }
     }
     hashtable_stats_init(sig->hashtable);
+    sig->false_count = 0;
+#ifndef HASHTABLE_NSTATS
+    sig->calc_strong_count = 0;
+#endif
+    sig->hashtable_ns = rs_now_ns() - start;
     return RS_DONE;
 }
 
 void rs_free_sumset(rs_signature_t *psums)
 {
     rs_signature_done(psums);
-    free(psums);
+    rs_free(psums);
 }
 
 void rs_sumset_dump(rs_signature_t const *sums)
@@ -312,7 +784,7 @@ void rs_sumset_dump(rs_signature_t const *sums)
         b = rs_block_sig_ptr(sums, i);
         rs_hexify(strong_hex, b->strong_sum, sums->strong_sum_len);
         rs_log(RS_LOG_INFO | RS_LOG_NONAME,
-               "sum %6d: weak=" FMT_WEAKSUM ", strong=%s", i, b->weak_sum,
-               strong_hex);
+               "sum %6d: weak=" FMT_WEAKSUM ", strong=%s", i,
+               rs_block_sig_weak_sum(sums, b), strong_hex);
     }
 }
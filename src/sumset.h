@@ -24,9 +24,13 @@
 #include "hashtable.h"
 #include "checksum.h"
 
-/** Signature of a single block. */
+/** Signature of a single block.
+ *
+ * Signatures with 64 bit weak sums or CDC chunk end offsets store them folded
+ * into 32 bits here, with the high 32 bits packed after the strong sum. */
 typedef struct rs_block_sig {
-    rs_weak_sum_t weak_sum;     /**< Block's weak checksum. */
+    uint32_t weak_sum;          /**< Block's weak checksum, or the chunk's
+                                 * end offset for CDC signatures. */
     rs_strong_sum_t strong_sum; /**< Block's strong checksum. */
 } rs_block_sig_t;
 
@@ -38,10 +42,23 @@ struct rs_signature {
     int magic;                  /**< The signature magic value. */
     int block_len;              /**< The block length. */
     int strong_sum_len;         /**< The block strong sum length. */
+    int weak_sum_len;           /**< The weak sum length in the file. */
+    rs_long_t basis_len;        /**< The basis length for v2, or -1. */
     int count;                  /**< Total number of blocks. */
     int size;                   /**< Total number of blocks allocated. */
+    const rs_allocator_t *allocator;    /**< The memory allocator. */
     void *block_sigs;           /**< The packed block_sigs for all blocks. */
     hashtable_t *hashtable;     /**< The hashtable for finding matches. */
+    rs_long_t load_ns;          /**< Time spent loading the signature. */
+    rs_long_t hashtable_ns;     /**< Time spent building the hashtable. */
+    rs_long_t strong_ns;        /**< Total time calculating strongsums. */
+    rs_long_t false_count;      /**< The count of failed strongsum compares. */
+    /* The coarse blocks for a fine signature made by rs_match_begin(). */
+    int coarse_count;           /**< The number of coarse blocks, or 0. */
+    int coarse_block_len;       /**< The coarse block length. */
+    int coarse_last;            /**< The fine blocks in the last coarse block
+                                 * if it matched. */
+    unsigned char *coarse_matched;      /**< Bitmap of matched coarse blocks. */
     /* The is extra stats not included in the hashtable stats. */
 #ifndef HASHTABLE_NSTATS
     long calc_strong_count;     /**< The count of strongsum calcs done. */
@@ -66,29 +83,125 @@ rs_result rs_signature_init(rs_signature_t *sig, rs_magic_number magic,
                             size_t block_len, size_t strong_len,
                             rs_long_t sig_fsize);
 
+/** Reinitialize an rs_signature instance, reusing its memory.
+ *
+ * This is like rs_signature_init(), but \p sig must be either zeroed or
+ * already initialized. Its block_sigs and hashtable memory is kept for reuse
+ * instead of being freed and allocated again, and new memory comes from its
+ * allocator. Its strong sum time and false match count keep counting up, since
+ * jobs count their own share of them from snapshots. */
+rs_result rs_signature_reinit(rs_signature_t *sig, rs_magic_number magic,
+                              size_t block_len, size_t strong_len,
+                              rs_long_t sig_fsize);
+
 /** Destroy an rs_signature instance. */
 void rs_signature_done(rs_signature_t *sig);
 
-/** Add a block to an rs_signature instance. */
+/** Add a block to an rs_signature instance.
+ *
+ * For CDC signatures the weak_sum is the length of the chunk.
+ *
+ * \return The added block, or NULL if there is not enough memory. */
 rs_block_sig_t *rs_signature_add_block(rs_signature_t *sig,
-                                       rs_weak_sum_t weak_sum,
+                                       rs_weak_sum64_t weak_sum,
                                        rs_strong_sum_t *strong_sum);
 
+/** Grow an rs_signature instance to hold at least size blocks. */
+rs_result rs_signature_reserve(rs_signature_t *sig, int size);
+
 /** Find a matching block offset in a signature. */
-rs_long_t rs_signature_find_match(rs_signature_t *sig, rs_weak_sum_t weak_sum,
-                                  void const *buf, size_t len);
+rs_long_t rs_signature_find_match(rs_signature_t *sig,
+                                  rs_weak_sum64_t weak_sum, void const *buf,
+                                  size_t len);
+
+/** Initialize a fine signature for the blocks of a coarse signature.
+ *
+ * The fine signature has the coarse signature's magic and strong sum length,
+ * and space for the fine blocks of every coarse block. The fine blocks of
+ * coarse blocks found in the new file are added with
+ * rs_signature_add_coarse_match(), and the rest with rs_merge_sumset().
+ *
+ * \param block_len - the fine block length, which must divide the coarse
+ * block length. */
+rs_result rs_signature_fine_init(rs_signature_t *sig,
+                                 rs_signature_t const *coarse,
+                                 size_t block_len);
+
+/** Add the fine blocks of a coarse block found in the new file. */
+void rs_signature_add_coarse_match(rs_signature_t *sig, int coarse_idx,
+                                   void const *buf, size_t len);
+
+/** Find a matching chunk offset in a CDC signature. */
+rs_long_t rs_signature_find_chunk(rs_signature_t *sig, void const *buf,
+                                  size_t len);
+
+/** Check if a signature magic is a compact v2 magic. */
+static inline int rs_magic_is_v2(int magic)
+{
+    return (magic & ~0xff) == (RS_SIG_V2_MAGIC(RS_MD4_SIG_MAGIC) & ~0xff);
+}
+
+/** Get the v1 magic for a signature magic, which is itself if it is v1. */
+static inline int rs_magic_v1(int magic)
+{
+    return rs_magic_is_v2(magic) ?
+        (magic & ~0xff00) | (RS_MD4_SIG_MAGIC & 0xff00) : magic;
+}
+
+/** Get the weaksum kind for a signature magic. */
+static inline weaksum_kind_t rs_magic_weaksum_kind(int magic)
+{
+    switch (magic & 0xf0) {
+    case 0x30:
+        return RS_ROLLSUM;
+    case 0x50:
+        return RS_RABINKARP64;
+    case 0x60:
+        return RS_CRC32C;
+    default:
+        return RS_RABINKARP;
+    }
+}
+
+/** Check if a signature magic is of content-defined chunks. */
+static inline int rs_magic_is_cdc(int magic)
+{
+    return (magic & 0xf0) == 0x70;
+}
+
+/** Get the full length in bytes of the weaksums for a signature magic. */
+static inline int rs_magic_weak_sum_max(int magic)
+{
+    return rs_magic_weaksum_kind(magic) == RS_RABINKARP64
+        && !rs_magic_is_cdc(magic) ? 8 : 4;
+}
+
+/** Get the weak sum length in bytes for a v2 signature.
+ *
+ * This is the fewest bytes that keep the cost of false weak sum matches
+ * small for the number of blocks in a basis of old_fsize bytes. It is the
+ * full weak sum length if old_fsize is unknown (-1), and the bytes needed for
+ * the maximum chunk length for CDC signatures. */
+int rs_sig_weak_len(rs_magic_number magic, size_t block_len,
+                    rs_long_t old_fsize);
 
 /** Assert that rs_sig_args() args for rs_signature_init() are valid.
  *
  * We don't use a static inline function here so that assert failure output
  * points at where rs_sig_args_check() was called from. */
 #define rs_sig_args_check(magic, block_len, strong_len) do {\
-    assert(((magic) & ~0xff) == (RS_MD4_SIG_MAGIC & ~0xff));\
-    assert(((magic) & 0xf0) == 0x30 || ((magic) & 0xf0) == 0x40);\
+    assert((rs_magic_v1(magic) & ~0xff) == (RS_MD4_SIG_MAGIC & ~0xff));\
+    assert(((magic) & 0xf0) == 0x30 || ((magic) & 0xf0) == 0x40 ||\
+           ((magic) & 0xf0) == 0x50 || ((magic) & 0xf0) == 0x60 ||\
+           ((magic) & 0xf0) == 0x70);\
     assert((((magic) & 0x0f) == 0x06 &&\
 	    (int)(strong_len) <= RS_MD4_SUM_LENGTH) ||\
 	   (((magic) & 0x0f) == 0x07 &&\
-	    (int)(strong_len) <= RS_BLAKE2_SUM_LENGTH));\
+	    (int)(strong_len) <= RS_BLAKE2_SUM_LENGTH) ||\
+	   (((magic) & 0x0f) == 0x08 &&\
+	    (int)(strong_len) <= RS_XXH3_SUM_LENGTH) ||\
+	   (((magic) & 0x0f) == 0x09 &&\
+	    (int)(strong_len) <= RS_BLAKE3_SUM_LENGTH));\
     assert(0 < (block_len));\
     assert(0 < (strong_len) && (strong_len) <= RS_MAX_STRONG_SUM_LENGTH);\
 } while (0)
@@ -103,28 +216,87 @@ rs_long_t rs_signature_find_match(rs_signature_t *sig, rs_weak_sum_t weak_sum,
     assert(!(sig)->hashtable || (sig)->hashtable->count <= (sig)->count);\
 } while (0)
 
+/** Check if a coarse block of a fine signature was matched. */
+static inline int rs_signature_coarse_matched(rs_signature_t const *sig,
+                                              int coarse_idx)
+{
+    return (sig->coarse_matched[coarse_idx / 8] >> (coarse_idx % 8)) & 1;
+}
+
 /** Get the weaksum kind for a signature. */
 static inline weaksum_kind_t rs_signature_weaksum_kind(rs_signature_t const
                                                        *sig)
 {
-    return (sig->magic & 0xf0) == 0x30 ? RS_ROLLSUM : RS_RABINKARP;
+    return rs_magic_weaksum_kind(sig->magic);
+}
+
+/** Check if a signature is of content-defined chunks. */
+static inline int rs_signature_is_cdc(rs_signature_t const *sig)
+{
+    return rs_magic_is_cdc(sig->magic);
+}
+
+/** Check if a signature is in the compact v2 format. */
+static inline int rs_signature_is_v2(rs_signature_t const *sig)
+{
+    return rs_magic_is_v2(sig->magic);
+}
+
+/** Get the length in bytes of the weaksums in a signature file.
+ *
+ * For CDC signatures this is the length of the chunk lengths. */
+static inline int rs_signature_weak_sum_len(rs_signature_t const *sig)
+{
+    return sig->weak_sum_len;
+}
+
+/** Get the full length in bytes of the weaksums for a signature's magic. */
+static inline int rs_signature_weak_sum_max(rs_signature_t const *sig)
+{
+    return rs_magic_weak_sum_max(sig->magic);
 }
 
 /** Get the strongsum kind for a signature. */
 static inline strongsum_kind_t rs_signature_strongsum_kind(rs_signature_t const
                                                            *sig)
 {
-    return (sig->magic & 0x0f) == 0x06 ? RS_MD4 : RS_BLAKE2;
+    switch (sig->magic & 0x0f) {
+    case 0x06:
+        return RS_MD4;
+    case 0x08:
+        return RS_XXH3;
+    case 0x09:
+        return RS_BLAKE3;
+    default:
+        return RS_BLAKE2;
+    }
 }
 
 /** Calculate the weak sum of a buffer. */
-static inline rs_weak_sum_t rs_signature_calc_weak_sum(rs_signature_t const
-                                                       *sig, void const *buf,
-                                                       size_t len)
+static inline rs_weak_sum64_t rs_signature_calc_weak_sum(rs_signature_t const
+                                                         *sig, void const *buf,
+                                                         size_t len)
 {
     return rs_calc_weak_sum(rs_signature_weaksum_kind(sig), buf, len);
 }
 
+/** Get the weak sum written in a signature file for a calculated weak sum.
+ *
+ * v2 signatures have the top weak_sum_len bytes of the weak sum used for
+ * matching, which for rollsums has mix32() applied. */
+static inline rs_weak_sum64_t rs_signature_file_weak_sum(rs_signature_t const
+                                                         *sig,
+                                                         rs_weak_sum64_t
+                                                         weak_sum)
+{
+    if (!rs_signature_is_v2(sig))
+        return weak_sum;
+    if (rs_signature_weaksum_kind(sig) == RS_ROLLSUM)
+        weak_sum = mix32((unsigned)weak_sum);
+    return weak_sum >> 8 * (rs_signature_weak_sum_max(sig) -
+                            sig->weak_sum_len);
+}
+
 /** Calculate the strong sum of a buffer. */
 static inline void rs_signature_calc_strong_sum(rs_signature_t const *sig,
                                                 void const *buf, size_t len,
@@ -35,7 +35,7 @@
 #include <inttypes.h>
 /* Printf format patters for standard librsync types. */
 #define FMT_LONG "%"PRIdMAX
-#define FMT_WEAKSUM "%08"PRIx32
+#define FMT_WEAKSUM "%08"PRIx64
 /* Old MSVC compilers don't support "%zu" and have "%Iu" instead. */
 #ifdef HAVE_PRINTF_Z
 #  define FMT_SIZE "%zu"
@@ -59,6 +59,7 @@
 #include "job.h"
 #include "stream.h"
 #include "trace.h"
+#include "util.h"
 
 static void rs_tube_catchup_write(rs_job_t *job)
 {
@@ -152,11 +153,7 @@ static void rs_tube_catchup_copy(rs_job_t *job)
     }
 }
 
-/** Put whatever will fit from the tube into the output of the stream.
- *
- * \return RS_DONE if the tube is now empty and ready to accept another
- * command, RS_BLOCKED if there is still stuff waiting to go out. */
-rs_result rs_tube_catchup(rs_job_t *job)
+static rs_result rs_tube_flush(rs_job_t *job)
 {
     if (job->write_len) {
         rs_tube_catchup_write(job);
@@ -178,6 +175,26 @@ rs_result rs_tube_catchup(rs_job_t *job)
     return RS_DONE;
 }
 
+/** Put whatever will fit from the tube into the output of the stream.
+ *
+ * The time this takes is counted in the job's emit_ns time.
+ *
+ * \return RS_DONE if the tube is now empty and ready to accept another
+ * command, RS_BLOCKED if there is still stuff waiting to go out. */
+rs_result rs_tube_catchup(rs_job_t *job)
+{
+    rs_long_t start;
+    rs_result result;
+
+    /* Don't bother timing it if there is nothing to do. */
+    if (!job->write_len && !job->copy_len)
+        return RS_DONE;
+    start = rs_now_ns();
+    result = rs_tube_flush(job);
+    job->times.emit_ns += rs_now_ns() - start;
+    return result;
+}
+
 /* Check whether there is data in the tube waiting to go out.
 
    \return true if the previous command has finished doing all its output. */
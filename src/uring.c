@@ -0,0 +1,248 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * uring.c -- minimal Linux io_uring file reader.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include "librsync.h"
+#include "uring.h"
+#include "trace.h"
+#include "util.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#  include <errno.h>
+#  include <stdint.h>
+#  include <string.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <linux/io_uring.h>
+
+struct rs_uring {
+    int fd;                     /**< The io_uring file descriptor. */
+    unsigned depth;             /**< Maximum number of queued reads. */
+    unsigned inflight;          /**< Number of reads not yet completed. */
+    /* The submission queue ring. */
+    void *sq_ptr;
+    size_t sq_size;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    /* The completion queue ring, which may share the sq_ptr mapping. */
+    void *cq_ptr;
+    size_t cq_size;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+static int rs_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                          unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, NULL, 0);
+}
+
+/** Create an io_uring for up to \p depth queued reads.
+ *
+ * \return The new ring, or NULL if io_uring is not available. */
+rs_uring_t *rs_uring_new(unsigned depth)
+{
+    struct io_uring_params p;
+    rs_uring_t *ring;
+    unsigned char *sq, *cq;
+
+    memset(&p, 0, sizeof(p));
+    ring = rs_alloc_struct(rs_uring_t);
+    ring->fd = (int)syscall(__NR_io_uring_setup, depth, &p);
+    if (ring->fd < 0) {
+        rs_trace("io_uring_setup failed: %s", strerror(errno));
+        rs_free(ring);
+        return NULL;
+    }
+    ring->depth = depth < p.sq_entries ? depth : p.sq_entries;
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP && ring->cq_size > ring->sq_size)
+        ring->sq_size = ring->cq_size;
+    ring->sq_ptr =
+        mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr =
+            mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED)
+            goto fail;
+    }
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes =
+        mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        goto fail;
+    sq = ring->sq_ptr;
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    cq = ring->cq_ptr;
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    rs_trace("created io_uring with depth %u", ring->depth);
+    return ring;
+  fail:
+    rs_trace("io_uring mmap failed: %s", strerror(errno));
+    if (ring->sq_ptr == MAP_FAILED)
+        ring->sq_ptr = NULL;
+    if (ring->cq_ptr == MAP_FAILED)
+        ring->cq_ptr = NULL;
+    if (ring->sqes == MAP_FAILED)
+        ring->sqes = NULL;
+    rs_uring_free(ring);
+    return NULL;
+}
+
+/** Free an io_uring.
+ *
+ * This waits for any queued reads to complete first, so their buffers can be
+ * safely freed after this returns. */
+void rs_uring_free(rs_uring_t *ring)
+{
+    void *data;
+    int res;
+
+    while (ring->inflight && rs_uring_wait(ring, &data, &res) == 0) ;
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+    if (ring->sq_ptr)
+        munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->fd);
+    rs_free(ring);
+}
+
+/** Queue a read of \p len bytes at \p pos from \p fd into \p buf.
+ *
+ * \param data Opaque pointer returned by rs_uring_wait() when the read
+ * completes.
+ *
+ * \return 0 on success, or a negative errno value if the read could not be
+ * queued. */
+int rs_uring_read(rs_uring_t *ring, int fd, void *buf, size_t len,
+                  rs_long_t pos, void *data)
+{
+    struct io_uring_sqe *sqe;
+    unsigned tail, idx;
+    int ret;
+
+    if (ring->inflight >= ring->depth)
+        return -EBUSY;
+    tail = *ring->sq_tail;
+    idx = tail & *ring->sq_mask;
+    sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = (unsigned)len;
+    sqe->off = (uint64_t)pos;
+    sqe->user_data = (uintptr_t)data;
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    do {
+        ret = rs_uring_enter(ring->fd, 1, 0, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret <= 0) {
+        /* Take the entry back out of the queue, including if it wasn't
+           submitted, since rs_uring_wait() never submits it. */
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+        return ret < 0 ? -errno : -EAGAIN;
+    }
+    ring->inflight++;
+    return 0;
+}
+
+/** Wait for a queued read to complete.
+ *
+ * \param data Set to the opaque pointer given to rs_uring_read().
+ *
+ * \param res Set to the number of bytes read, or a negative errno value if the
+ * read failed.
+ *
+ * \return 0 on success, or a negative errno value if waiting failed. */
+int rs_uring_wait(rs_uring_t *ring, void **data, int *res)
+{
+    struct io_uring_cqe *cqe;
+    unsigned head;
+
+    while (1) {
+        head = *ring->cq_head;
+        if (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+            break;
+        if (rs_uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0
+            && errno != EINTR)
+            return -errno;
+    }
+    cqe = &ring->cqes[head & *ring->cq_mask];
+    *data = (void *)(uintptr_t)cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    ring->inflight--;
+    return 0;
+}
+
+unsigned rs_uring_inflight(rs_uring_t const *ring)
+{
+    return ring->inflight;
+}
+
+#else                           /* !HAVE_LINUX_IO_URING_H */
+
+rs_uring_t *rs_uring_new(unsigned depth)
+{
+    rs_trace("io_uring is not supported on this platform");
+    return NULL;
+}
+
+void rs_uring_free(rs_uring_t *ring)
+{
+}
+
+unsigned rs_uring_inflight(rs_uring_t const *ring)
+{
+    return 0;
+}
+
+int rs_uring_read(rs_uring_t *ring, int fd, void *buf, size_t len,
+                  rs_long_t pos, void *data)
+{
+    return -1;
+}
+
+int rs_uring_wait(rs_uring_t *ring, void **data, int *res)
+{
+    return -1;
+}
+
+#endif                          /* !HAVE_LINUX_IO_URING_H */
@@ -0,0 +1,43 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * uring.h -- minimal Linux io_uring file reader.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file uring.h
+ * A minimal Linux io_uring reader for asynchronous basis file reads.
+ *
+ * This uses the io_uring system calls directly so there is no dependency on
+ * liburing. It only supports reads, and queues at most \p depth reads at a
+ * time. On platforms without io_uring, or if the kernel refuses to set one
+ * up, rs_uring_new() returns NULL and callers should fall back to
+ * synchronous reads. */
+#ifndef URING_H
+#  define URING_H
+
+#  include <stddef.h>
+#  include "librsync.h"
+
+typedef struct rs_uring rs_uring_t;
+
+rs_uring_t *rs_uring_new(unsigned depth);
+void rs_uring_free(rs_uring_t *ring);
+unsigned rs_uring_inflight(rs_uring_t const *ring);
+int rs_uring_read(rs_uring_t *ring, int fd, void *buf, size_t len,
+                  rs_long_t pos, void *data);
+int rs_uring_wait(rs_uring_t *ring, void **data, int *res);
+
+#endif                          /* !URING_H */
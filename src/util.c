@@ -26,6 +26,7 @@
 #include "config.h"
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "librsync.h"
 #include "util.h"
 #include "trace.h"
@@ -35,11 +36,77 @@ void rs_bzero(void *buf, size_t size)
     memset(buf, 0, size);
 }
 
+static void *rs_malloc_alloc(void *UNUSED(ctx), size_t size)
+{
+    return malloc(size);
+}
+
+static void *rs_malloc_realloc(void *UNUSED(ctx), void *ptr, size_t size)
+{
+    return realloc(ptr, size);
+}
+
+static void rs_malloc_free(void *UNUSED(ctx), void *ptr)
+{
+    free(ptr);
+}
+
+/** The default allocator using malloc(). */
+static const rs_allocator_t rs_malloc_allocator = {
+    rs_malloc_alloc, rs_malloc_realloc, rs_malloc_free, NULL
+};
+
+/** The allocator used when no other allocator is given. */
+static const rs_allocator_t *rs_default_allocator = &rs_malloc_allocator;
+
+void rs_set_allocator(const rs_allocator_t *allocator)
+{
+    rs_default_allocator = allocator ? allocator : &rs_malloc_allocator;
+}
+
+int rs_allocator_is_malloc(const rs_allocator_t *allocator)
+{
+    return (allocator ? allocator : rs_default_allocator) ==
+        &rs_malloc_allocator;
+}
+
+void *rs_alloc_with(const rs_allocator_t *allocator, size_t size,
+                    char const *name)
+{
+    void *p;
+
+    if (!allocator)
+        allocator = rs_default_allocator;
+    if (!(p = allocator->alloc(allocator->ctx, size)))
+        rs_error("couldn't allocate " FMT_SIZE " bytes for %s", size, name);
+    return p;
+}
+
+void *rs_realloc_with(const rs_allocator_t *allocator, void *ptr, size_t size,
+                      char const *name)
+{
+    void *p;
+
+    if (!allocator)
+        allocator = rs_default_allocator;
+    if (!(p = allocator->realloc(allocator->ctx, ptr, size)))
+        rs_error("couldn't reallocate " FMT_SIZE " bytes for %s", size, name);
+    return p;
+}
+
+void rs_free_with(const rs_allocator_t *allocator, void *ptr)
+{
+    if (!allocator)
+        allocator = rs_default_allocator;
+    if (ptr)
+        allocator->free(allocator->ctx, ptr);
+}
+
 void *rs_alloc_struct0(size_t size, char const *name)
 {
     void *p;
 
-    if (!(p = malloc(size))) {
+    if (!(p = rs_default_allocator->alloc(rs_default_allocator->ctx, size))) {
         rs_fatal("couldn't allocate instance of %s", name);
     }
     rs_bzero(p, size);
@@ -50,7 +117,7 @@ void *rs_alloc(size_t size, char const *name)
 {
     void *p;
 
-    if (!(p = malloc(size))) {
+    if (!(p = rs_default_allocator->alloc(rs_default_allocator->ctx, size))) {
         rs_fatal("couldn't allocate instance of %s", name);
     }
 
@@ -61,12 +128,19 @@ void *rs_realloc(void *ptr, size_t size, char const *name)
 {
     void *p;
 
-    if (!(p = realloc(ptr, size))) {
+    if (!(p =
+          rs_default_allocator->realloc(rs_default_allocator->ctx, ptr,
+                                        size))) {
         rs_fatal("couldn't reallocate instance of %s", name);
     }
     return p;
 }
 
+void rs_free(void *ptr)
+{
+    rs_free_with(NULL, ptr);
+}
+
 int rs_long_ln2(rs_long_t v)
 {
     int n;
@@ -92,3 +166,21 @@ int rs_long_sqrt(rs_long_t v)
     }
     return (int)n;
 }
+
+rs_long_t rs_now_ns(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (!clock_gettime(CLOCK_MONOTONIC, &ts))
+        return (rs_long_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+    return (rs_long_t)clock() * (1000000000 / CLOCKS_PER_SEC);
+}
+
+void rs_stats_hist_add(rs_long_t *hist, rs_long_t len)
+{
+    int i = rs_long_ln2(len);
+
+    hist[i < RS_STATS_HIST_LEN ? i : RS_STATS_HIST_LEN - 1]++;
+}
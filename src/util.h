@@ -23,12 +23,28 @@
 void *rs_alloc(size_t size, char const *name);
 void *rs_realloc(void *ptr, size_t size, char const *name);
 void *rs_alloc_struct0(size_t size, char const *name);
+void rs_free(void *ptr);
+
+/* Allocate with a specific allocator, or the default if it is NULL. Unlike
+   rs_alloc() these return NULL if the allocation fails. */
+void *rs_alloc_with(const rs_allocator_t *allocator, size_t size,
+                    char const *name);
+void *rs_realloc_with(const rs_allocator_t *allocator, void *ptr, size_t size,
+                      char const *name);
+void rs_free_with(const rs_allocator_t *allocator, void *ptr);
+int rs_allocator_is_malloc(const rs_allocator_t *allocator);
 
 void rs_bzero(void *buf, size_t size);
 
 int rs_long_ln2(rs_long_t v);
 int rs_long_sqrt(rs_long_t v);
 
+/* Get a monotonic time in nanoseconds. */
+rs_long_t rs_now_ns(void);
+
+/* Count a command length in an rs_hists_t length histogram. */
+void rs_stats_hist_add(rs_long_t *hist, rs_long_t len);
+
 /** Allocate and zero-fill an instance of TYPE. */
 #define rs_alloc_struct(type)				\
         ((type *) rs_alloc_struct0(sizeof(type), #type))
@@ -29,6 +29,7 @@
 
 #include "config.h"
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -37,15 +38,69 @@
 #include "sumset.h"
 #include "job.h"
 #include "buf.h"
+#include "basiscache.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "trace.h"
+#include "util.h"
+#ifdef HAVE_POSIX_FADVISE
+#  include <fcntl.h>
+#endif
 
 /** Whole file IO buffer sizes. */
 LIBRSYNC_EXPORT int rs_inbuflen = 0, rs_outbuflen = 0;
 
+/** Whole file patch basis cache size. */
+LIBRSYNC_EXPORT int rs_cachelen = 0;
+
+/** Whole file patch asynchronous basis read depth. */
+LIBRSYNC_EXPORT int rs_asyncdepth = 0;
+
+/** Whole file delta checksum length. */
+LIBRSYNC_EXPORT int rs_deltasumlen = 0;
+
+/** Whole file IO method. */
+LIBRSYNC_EXPORT int rs_fileio = RS_FILEIO_STDIO;
+
+/** Whole file threaded IO buffer count. */
+LIBRSYNC_EXPORT int rs_pipelinebufs = 0;
+
+#ifdef HAVE_PREAD
+/** Run a job like rs_whole_run() with IO on the file descriptors. */
+static rs_result rs_whole_run_fd(rs_job_t *job, FILE *in_file, FILE *out_file,
+                                 int inbuflen, int outbuflen)
+{
+    rs_buffers_t buf;
+    rs_result result;
+    rs_fdbuf_t *in_fb = NULL, *out_fb = NULL;
+
+    if (in_file)
+        in_fb = rs_fdbuf_new(fileno(in_file), (size_t)inbuflen, rs_fileio);
+    if (out_file) {
+        /* Write out anything the caller left buffered in stdio first. */
+        fflush(out_file);
+        out_fb = rs_fdbuf_new(fileno(out_file), (size_t)outbuflen, rs_fileio);
+    }
+    result =
+        rs_job_drive(job, &buf, in_fb ? rs_infdbuf_fill : NULL, in_fb,
+                     out_fb ? rs_outfdbuf_drain : NULL, out_fb);
+    if (result == RS_DONE && out_fb)
+        result = rs_outfdbuf_flush(job, &buf, out_fb);
+    if (in_fb)
+        rs_fdbuf_free(in_fb);
+    if (out_fb)
+        rs_fdbuf_free(out_fb);
+    return result;
+}
+#endif
+
 /** Run a job continuously, with input to/from the two specified files.
  *
  * The job should already be set up, and must be freed by the caller after
  * return. If rs_inbuflen or rs_outbuflen are set, they will override the
- * inbuflen and outbuflen arguments.
+ * inbuflen and outbuflen arguments. If rs_pipelinebufs is set and threads are
+ * supported, the file IO is done by separate threads with rs_pipeline_run().
+ * Otherwise if rs_fileio is set, IO is done directly on the file descriptors.
  *
  * \param in_file - input file, or NULL if there is no input.
  *
@@ -66,6 +121,15 @@ rs_result rs_whole_run(rs_job_t *job, FILE *in_file, FILE *out_file,
     /* Override buffer sizes if rs_inbuflen or rs_outbuflen are set. */
     inbuflen = rs_inbuflen ? rs_inbuflen : inbuflen;
     outbuflen = rs_outbuflen ? rs_outbuflen : outbuflen;
+#ifdef HAVE_PTHREAD
+    if (rs_pipelinebufs > 0)
+        return rs_pipeline_run(job, in_file, out_file, (size_t)inbuflen,
+                               (size_t)outbuflen, rs_pipelinebufs);
+#endif
+#ifdef HAVE_PREAD
+    if (rs_fileio != RS_FILEIO_STDIO)
+        return rs_whole_run_fd(job, in_file, out_file, inbuflen, outbuflen);
+#endif
     if (in_file)
         in_fb = rs_filebuf_new(in_file, inbuflen);
     if (out_file)
@@ -93,6 +157,8 @@ rs_result rs_sig_file(FILE *old_file, FILE *sig_file, size_t block_len,
                      &strong_len)) != RS_DONE)
         return r;
     job = rs_sig_begin(block_len, strong_len, sig_magic);
+    /* v2 signatures choose their weak sum length from the basis length. */
+    rs_sig_set_basis_len(job, old_fsize);
     /* Size inbuf for 4 blocks, outbuf for header + 4 blocksums. */
     r = rs_whole_run(job, old_file, sig_file, 4 * (int)block_len,
                      12 + 4 * (4 + (int)strong_len));
@@ -128,6 +194,11 @@ rs_result rs_delta_file(rs_signature_t *sig, FILE *new_file, FILE *delta_file,
     rs_result r;
 
     job = rs_delta_begin(sig);
+    if (rs_deltasumlen
+        && (r = rs_delta_set_checksum(job, rs_deltasumlen)) != RS_DONE) {
+        rs_job_free(job);
+        return r;
+    }
     /* Size inbuf for 1 block, outbuf for literal cmd + 4 blocks. */
     r = rs_whole_run(job, new_file, delta_file, sig->block_len,
                      10 + 4 * sig->block_len);
@@ -137,17 +208,154 @@ rs_result rs_delta_file(rs_signature_t *sig, FILE *new_file, FILE *delta_file,
     return r;
 }
 
+rs_result rs_match_file(rs_signature_t *coarse_sig, FILE *new_file,
+                        FILE *map_file, size_t block_len,
+                        rs_signature_t **fine_sig, rs_stats_t *stats)
+{
+    rs_job_t *job;
+    rs_result r;
+
+    job = rs_match_begin(coarse_sig, block_len, fine_sig);
+    /* Size inbuf for 4 coarse blocks, outbuf for the map header + 1K. */
+    r = rs_whole_run(job, new_file, map_file, 4 * coarse_sig->block_len,
+                     24 + 1024);
+    if (stats)
+        memcpy(stats, &job->stats, sizeof *stats);
+    rs_job_free(job);
+    return r;
+}
+
+rs_result rs_sig_unmatched_file(FILE *old_file, FILE *map_file,
+                                FILE *sig_file, rs_stats_t *stats)
+{
+    rs_job_t *job;
+    rs_result r;
+    rs_byte_t *map = NULL, *p;
+    size_t map_len = 0, map_size = 0, n;
+
+    /* Read the whole match map into memory. It has 1 bit per coarse block. */
+    do {
+        if (map_len == map_size) {
+            map_size = map_size ? 2 * map_size : 4096;
+            if (!(p = rs_realloc_with(NULL, map, map_size, "match map"))) {
+                rs_free_with(NULL, map);
+                return RS_MEM_ERROR;
+            }
+            map = p;
+        }
+        n = fread(map + map_len, 1, map_size - map_len, map_file);
+        map_len += n;
+    } while (n);
+    if (ferror(map_file)) {
+        rs_error("error reading match map: %s", strerror(errno));
+        rs_free_with(NULL, map);
+        return RS_IO_ERROR;
+    }
+    job = rs_sig_unmatched_begin(map, map_len);
+    /* Size inbuf for 4 fine blocks, outbuf for header + 4 blocksums. */
+    r = rs_whole_run(job, old_file, sig_file, 4 * RS_DEFAULT_BLOCK_LEN,
+                     12 + 4 * (4 + RS_MAX_STRONG_SUM_LENGTH));
+    if (stats)
+        memcpy(stats, &job->stats, sizeof *stats);
+    rs_job_free(job);
+    rs_free_with(NULL, map);
+    return r;
+}
+
 rs_result rs_patch_file(FILE *basis_file, FILE *delta_file, FILE *new_file,
                         rs_stats_t *stats)
 {
     rs_job_t *job;
     rs_result r;
 
-    job = rs_patch_begin(rs_file_copy_cb, basis_file);
+#ifdef HAVE_PREAD
+    int basis_fd = fileno(basis_file);
+
+    /* Read the basis with pread() instead of seeking stdio. */
+    if (rs_fileio != RS_FILEIO_STDIO)
+        job = rs_patch_begin(rs_fd_copy_cb, &basis_fd);
+    else
+#endif
+        job = rs_patch_begin(rs_file_copy_cb, basis_file);
+    /* Only use the basis cache if rs_cachelen enables it. */
+    if (rs_cachelen)
+        rs_patch_set_cache(job, rs_cachelen > 0 ? (size_t)rs_cachelen :
+                           RS_BASIS_CACHE_DEFAULT);
+    /* Only read the basis asynchronously if rs_asyncdepth enables it. */
+    if (rs_asyncdepth)
+        rs_patch_set_async(job, fileno(basis_file), rs_asyncdepth > 0 ?
+                           rs_asyncdepth : RS_BASIS_CACHE_DEPTH);
     /* Default size inbuf and outbuf 64K. */
     r = rs_whole_run(job, delta_file, new_file, 64 * 1024, 64 * 1024);
+#if defined(HAVE_PREAD) && defined(HAVE_POSIX_FADVISE)
+    /* The basis is read out of order, so drop it from the page cache after. */
+    if (rs_fileio != RS_FILEIO_STDIO)
+        posix_fadvise(basis_fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
     if (stats)
         memcpy(stats, &job->stats, sizeof *stats);
     rs_job_free(job);
     return r;
 }
+
+static void rs_sig_batch_task(void *arg, size_t i)
+{
+    rs_sig_batch_item_t *item = (rs_sig_batch_item_t *)arg + i;
+
+    item->result =
+        rs_sig_file(item->old_file, item->sig_file, item->block_len,
+                    item->strong_len, item->sig_magic, &item->stats);
+}
+
+static void rs_delta_batch_task(void *arg, size_t i)
+{
+    rs_delta_batch_item_t *item = (rs_delta_batch_item_t *)arg + i;
+
+    item->result =
+        rs_delta_file(item->sig, item->new_file, item->delta_file,
+                      &item->stats);
+}
+
+static void rs_patch_batch_task(void *arg, size_t i)
+{
+    rs_patch_batch_item_t *item = (rs_patch_batch_item_t *)arg + i;
+
+    item->result =
+        rs_patch_file(item->basis_file, item->delta_file, item->new_file,
+                      &item->stats);
+}
+
+rs_result rs_sig_batch(rs_sig_batch_item_t *items, size_t n, rs_pool_t *pool)
+{
+    size_t i;
+
+    rs_pool_run(pool, n, rs_sig_batch_task, items);
+    for (i = 0; i < n; i++)
+        if (items[i].result != RS_DONE)
+            return items[i].result;
+    return RS_DONE;
+}
+
+rs_result rs_delta_batch(rs_delta_batch_item_t *items, size_t n,
+                         rs_pool_t *pool)
+{
+    size_t i;
+
+    rs_pool_run(pool, n, rs_delta_batch_task, items);
+    for (i = 0; i < n; i++)
+        if (items[i].result != RS_DONE)
+            return items[i].result;
+    return RS_DONE;
+}
+
+rs_result rs_patch_batch(rs_patch_batch_item_t *items, size_t n,
+                         rs_pool_t *pool)
+{
+    size_t i;
+
+    rs_pool_run(pool, n, rs_patch_batch_task, items);
+    for (i = 0; i < n; i++)
+        if (items[i].result != RS_DONE)
+            return items[i].result;
+    return RS_DONE;
+}
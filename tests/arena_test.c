@@ -0,0 +1,163 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "librsync.h"
+
+static unsigned rnd_state = 1;
+
+static unsigned rnd(unsigned n)
+{
+    rnd_state = rnd_state * 1103515245 + 12345;
+    return (rnd_state >> 16) % n;
+}
+
+/* A global allocator that counts outstanding allocations. */
+static long outstanding = 0;
+
+static void *count_alloc(void *ctx, size_t size)
+{
+    (*(long *)ctx)++;
+    return malloc(size);
+}
+
+static void *count_realloc(void *ctx, void *ptr, size_t size)
+{
+    if (!ptr)
+        (*(long *)ctx)++;
+    return realloc(ptr, size);
+}
+
+static void count_free(void *ctx, void *ptr)
+{
+    (*(long *)ctx)--;
+    free(ptr);
+}
+
+static const rs_allocator_t count_allocator = {
+    count_alloc, count_realloc, count_free, &outstanding
+};
+
+/* Run a job over the input in small pieces, returning its result. */
+static rs_result run(rs_job_t *job, char *in, size_t in_len, char *out,
+                     size_t out_len, size_t *out_used)
+{
+    rs_buffers_t buf;
+    rs_result result;
+
+    buf.next_in = in;
+    buf.avail_in = 0;
+    buf.eof_in = 0;
+    buf.next_out = out;
+    buf.avail_out = out_len;
+    do {
+        size_t left = in_len - (size_t)(buf.next_in - in) - buf.avail_in;
+        size_t n = 1 + rnd(1000);
+
+        if (n >= left) {
+            buf.avail_in += left;
+            buf.eof_in = 1;
+        } else {
+            buf.avail_in += n;
+        }
+        result = rs_job_iter(job, &buf);
+    } while (result == RS_BLOCKED);
+    if (out_used)
+        *out_used = out_len - buf.avail_out;
+    return result;
+}
+
+static rs_result copy_cb(void *arg, rs_long_t pos, size_t *len, void **buf)
+{
+    const char *basis = arg;
+
+    if (pos + (rs_long_t)*len > 40000)
+        *len = pos < 40000 ? (size_t)(40000 - pos) : 0;
+    memcpy(*buf, basis + pos, *len);
+    return RS_DONE;
+}
+
+int main(int argc, char **argv)
+{
+    char *old = malloc(40000), *new = malloc(40000), *sig = malloc(10000),
+        *delta = malloc(50000), *out = malloc(50000);
+    size_t sig_len, delta_len, out_len, i;
+    rs_signature_t *sumset;
+    rs_arena_t *arena;
+    rs_job_t *job;
+
+    /* All librsync memory comes from the global allocator. */
+    rs_set_allocator(&count_allocator);
+    for (i = 0; i < 40000; i++)
+        old[i] = (char)rnd(256);
+    memcpy(new, old, 40000);
+    memcpy(new + 20000, "changed", 7);
+
+    job = rs_sig_begin(64, 8, RS_RK_BLAKE2_SIG_MAGIC);
+    assert(run(job, old, 40000, sig, 10000, &sig_len) == RS_DONE);
+    rs_job_free(job);
+    assert(outstanding == 0);
+
+    /* Load the signature and make a delta with an arena. */
+    arena = rs_arena_new(0);
+    job = rs_loadsig_begin(&sumset);
+    assert(rs_job_set_allocator(job, rs_arena_allocator(arena)) == RS_DONE);
+    assert(run(job, sig, sig_len, NULL, 0, NULL) == RS_DONE);
+    rs_job_free(job);
+    assert(rs_build_hash_table(sumset) == RS_DONE);
+    /* The signature's block sums and hashtable are in the arena. */
+    assert(rs_arena_used(arena) > 625 * 12);
+    job = rs_delta_begin(sumset);
+    assert(rs_job_set_allocator(job, rs_arena_allocator(arena)) == RS_DONE);
+    assert(run(job, new, 40000, delta, 50000, &delta_len) == RS_DONE);
+    rs_job_free(job);
+    assert(delta_len < 1000);
+    job = rs_patch_begin(copy_cb, old);
+    assert(rs_job_set_allocator(job, rs_arena_allocator(arena)) == RS_DONE);
+    assert(run(job, delta, delta_len, out, 50000, &out_len) == RS_DONE);
+    rs_job_free(job);
+    assert(out_len == 40000);
+    assert(!memcmp(out, new, 40000));
+    rs_free_sumset(sumset);
+    rs_arena_free(arena);
+    assert(outstanding == 0);
+
+    /* Running out of arena memory fails the job. */
+    arena = rs_arena_new(1000);
+    job = rs_loadsig_begin(&sumset);
+    assert(rs_job_set_allocator(job, rs_arena_allocator(arena)) == RS_DONE);
+    assert(run(job, sig, sig_len, NULL, 0, NULL) == RS_MEM_ERROR);
+    rs_job_free(job);
+    rs_free_sumset(sumset);
+    assert(rs_arena_used(arena) == 0);
+    rs_arena_free(arena);
+    assert(outstanding == 0);
+
+    rs_set_allocator(NULL);
+    free(old);
+    free(new);
+    free(sig);
+    free(delta);
+    free(out);
+    return 0;
+}
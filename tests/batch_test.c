@@ -0,0 +1,164 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "librsync.h"
+
+#define NFILES 13
+#define MAX_LEN 300000
+
+static unsigned rnd_state = 1;
+
+static unsigned rnd(unsigned n)
+{
+    rnd_state = rnd_state * 1103515245 + 12345;
+    return (rnd_state >> 16) % n;
+}
+
+/* Make a temporary file holding len bytes of buf. */
+static FILE *make_file(const char *buf, size_t len)
+{
+    FILE *f = tmpfile();
+
+    assert(f);
+    assert(fwrite(buf, 1, len, f) == len);
+    rewind(f);
+    return f;
+}
+
+/* Read the whole of a file into buf, returning its length. */
+static size_t read_file(FILE *f, char *buf)
+{
+    size_t len;
+
+    rewind(f);
+    len = fread(buf, 1, 2 * MAX_LEN, f);
+    rewind(f);
+    return len;
+}
+
+int main(int argc, char **argv)
+{
+    rs_sig_batch_item_t sigs[NFILES], seq[NFILES];
+    rs_delta_batch_item_t deltas[NFILES];
+    rs_patch_batch_item_t patches[NFILES];
+    FILE *old[NFILES], *new[NFILES];
+    char *buf = malloc(MAX_LEN), *buf2 = malloc(2 * MAX_LEN),
+        *buf3 = malloc(2 * MAX_LEN);
+    size_t len[NFILES], i, j, l;
+    rs_pool_t *pool;
+
+    /* Files of very different sizes, with some changes in the new ones. */
+    for (i = 0; i < NFILES; i++) {
+        len[i] = i % 4 == 0 ? rnd(MAX_LEN) : rnd(5000);
+        for (j = 0; j < len[i]; j++)
+            buf[j] = (char)rnd(256);
+        old[i] = make_file(buf, len[i]);
+        for (j = 0; j < len[i] / 1000; j++)
+            buf[rnd((unsigned)len[i])] ^= 1;
+        new[i] = make_file(buf, len[i]);
+    }
+    pool = rs_pool_new(4);
+    assert(rs_pool_threads(pool) >= 1);
+
+    /* An empty batch does nothing. */
+    assert(rs_sig_batch(sigs, 0, pool) == RS_DONE);
+
+    /* Signatures match ones generated one at a time. */
+    memset(sigs, 0, sizeof(sigs));
+    memset(seq, 0, sizeof(seq));
+    for (i = 0; i < NFILES; i++) {
+        sigs[i].old_file = old[i];
+        sigs[i].sig_file = tmpfile();
+        sigs[i].block_len = 256;
+        sigs[i].strong_len = 8;
+        seq[i] = sigs[i];
+        seq[i].sig_file = tmpfile();
+    }
+    assert(rs_sig_batch(sigs, NFILES, pool) == RS_DONE);
+    for (i = 0; i < NFILES; i++)
+        rewind(old[i]);
+    assert(rs_sig_batch(seq, NFILES, NULL) == RS_DONE);
+    for (i = 0; i < NFILES; i++) {
+        assert(sigs[i].result == RS_DONE);
+        assert(sigs[i].stats.in_bytes == (rs_long_t)len[i]);
+        l = read_file(sigs[i].sig_file, buf2);
+        assert(l == read_file(seq[i].sig_file, buf3));
+        assert(!memcmp(buf2, buf3, l));
+        rewind(old[i]);
+    }
+
+    /* Deltas and patches on the same pool recreate the new files. */
+    memset(deltas, 0, sizeof(deltas));
+    for (i = 0; i < NFILES; i++) {
+        assert(rs_loadsig_file(sigs[i].sig_file, &deltas[i].sig, NULL) ==
+               RS_DONE);
+        assert(rs_build_hash_table(deltas[i].sig) == RS_DONE);
+        deltas[i].new_file = new[i];
+        deltas[i].delta_file = tmpfile();
+    }
+    assert(rs_delta_batch(deltas, NFILES, pool) == RS_DONE);
+    memset(patches, 0, sizeof(patches));
+    for (i = 0; i < NFILES; i++) {
+        rewind(deltas[i].delta_file);
+        patches[i].basis_file = old[i];
+        patches[i].delta_file = deltas[i].delta_file;
+        patches[i].new_file = tmpfile();
+    }
+    assert(rs_patch_batch(patches, NFILES, pool) == RS_DONE);
+    for (i = 0; i < NFILES; i++) {
+        assert(patches[i].stats.out_bytes == (rs_long_t)len[i]);
+        l = read_file(patches[i].new_file, buf2);
+        assert(l == len[i]);
+        assert(l == read_file(new[i], buf3));
+        assert(!memcmp(buf2, buf3, l));
+    }
+
+    /* A failing item doesn't stop the others. */
+    for (i = 0; i < NFILES; i++) {
+        rewind(patches[i].delta_file);
+        fclose(patches[i].new_file);
+        patches[i].new_file = tmpfile();
+    }
+    fclose(patches[5].delta_file);
+    patches[5].delta_file = make_file("bogus delta", 11);
+    assert(rs_patch_batch(patches, NFILES, pool) == RS_BAD_MAGIC);
+    for (i = 0; i < NFILES; i++)
+        assert(patches[i].result == (i == 5 ? RS_BAD_MAGIC : RS_DONE));
+
+    rs_pool_free(pool);
+    for (i = 0; i < NFILES; i++) {
+        rs_free_sumset(deltas[i].sig);
+        fclose(old[i]);
+        fclose(new[i]);
+        fclose(sigs[i].sig_file);
+        fclose(seq[i].sig_file);
+        fclose(patches[i].delta_file);
+        fclose(patches[i].new_file);
+    }
+    free(buf);
+    free(buf2);
+    free(buf3);
+    return 0;
+}
@@ -0,0 +1,145 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "librsync.h"
+
+#define OLD_LEN 500000
+#define OUT_LEN 1000000
+
+static unsigned rnd_state = 1;
+
+static unsigned rnd(unsigned n)
+{
+    rnd_state = rnd_state * 1103515245 + 12345;
+    return (rnd_state >> 16) % n;
+}
+
+/* Run a job with all the input at once and a budget, counting the yields. */
+static size_t run(rs_job_t *job, rs_long_t bytes, rs_long_t nanos, char *in,
+                  size_t in_len, char *out, int *yields)
+{
+    rs_buffers_t buf;
+    rs_result result;
+
+    assert(rs_job_set_budget(job, bytes, nanos) == RS_DONE);
+    buf.next_in = in;
+    buf.avail_in = in_len;
+    buf.eof_in = 1;
+    buf.next_out = out;
+    buf.avail_out = OUT_LEN;
+    *yields = 0;
+    while ((result = rs_job_iter(job, &buf)) == RS_RUNNING)
+        (*yields)++;
+    assert(result == RS_DONE);
+    return OUT_LEN - buf.avail_out;
+}
+
+static rs_result copy_cb(void *arg, rs_long_t pos, size_t *len, void **buf)
+{
+    const char *basis = arg;
+
+    if (pos + (rs_long_t)*len > OLD_LEN)
+        *len = pos < OLD_LEN ? (size_t)(OLD_LEN - pos) : 0;
+    memcpy(*buf, basis + pos, *len);
+    return RS_DONE;
+}
+
+int main(int argc, char **argv)
+{
+    char *old = malloc(OLD_LEN), *new = malloc(OLD_LEN),
+        *sig = malloc(OUT_LEN), *sig2 = malloc(OUT_LEN),
+        *delta = malloc(OUT_LEN), *delta2 = malloc(OUT_LEN),
+        *out = malloc(OUT_LEN);
+    size_t sig_len, delta_len, out_len, i;
+    rs_signature_t *sumset;
+    rs_job_t *job;
+    int yields;
+
+    for (i = 0; i < OLD_LEN; i++)
+        old[i] = (char)rnd(256);
+    memcpy(new, old, OLD_LEN);
+    /* Half the new file doesn't match, so delta scans it a byte at a time. */
+    for (i = 0; i < OLD_LEN / 2; i++)
+        new[i] = (char)rnd(256);
+
+    /* Budgets must not be negative. */
+    job = rs_sig_begin(1024, 8, RS_RK_BLAKE2_SIG_MAGIC);
+    assert(rs_job_set_budget(job, -1, 0) == RS_PARAM_ERROR);
+    assert(rs_job_set_budget(job, 0, -1) == RS_PARAM_ERROR);
+
+    /* Without a budget the job doesn't yield. */
+    sig_len = run(job, 0, 0, old, OLD_LEN, sig, &yields);
+    rs_job_free(job);
+    assert(yields == 0);
+
+    /* A byte budget yields after about that many bytes of blocks. */
+    job = rs_sig_begin(1024, 8, RS_RK_BLAKE2_SIG_MAGIC);
+    assert(run(job, 100000, 0, old, OLD_LEN, sig2, &yields) == sig_len);
+    rs_job_free(job);
+    assert(yields == OLD_LEN / 100352);
+    assert(!memcmp(sig, sig2, sig_len));
+
+    /* Loading the signature yields too. */
+    job = rs_loadsig_begin(&sumset);
+    run(job, 1000, 0, sig, sig_len, NULL, &yields);
+    rs_job_free(job);
+    assert(yields > 0);
+    assert(rs_build_hash_table(sumset) == RS_DONE);
+
+    /* Delta yields while scanning, with the same output. */
+    job = rs_delta_begin(sumset);
+    delta_len = run(job, 0, 0, new, OLD_LEN, delta, &yields);
+    rs_job_free(job);
+    assert(yields == 0);
+    job = rs_delta_begin(sumset);
+    assert(run(job, 10000, 0, new, OLD_LEN, delta2, &yields) == delta_len);
+    rs_job_free(job);
+    assert(!memcmp(delta, delta2, delta_len));
+    assert(yields >= OLD_LEN / 10000 - 1);
+
+    /* A tiny time budget yields every time the clock is read. */
+    job = rs_delta_begin(sumset);
+    assert(run(job, 0, 1, new, OLD_LEN, delta2, &yields) == delta_len);
+    rs_job_free(job);
+    assert(!memcmp(delta, delta2, delta_len));
+    assert(yields >= OLD_LEN / (64 * 1024) - 1);
+
+    /* Patch yields while copying, but only between the 32KB literals. */
+    job = rs_patch_begin(copy_cb, old);
+    out_len = run(job, 50000, 0, delta, delta_len, out, &yields);
+    rs_job_free(job);
+    assert(yields >= OLD_LEN / 100000);
+    assert(out_len == OLD_LEN);
+    assert(!memcmp(out, new, OLD_LEN));
+
+    rs_free_sumset(sumset);
+    free(old);
+    free(new);
+    free(sig);
+    free(sig2);
+    free(delta);
+    free(delta2);
+    free(out);
+    return 0;
+}
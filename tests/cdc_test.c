@@ -0,0 +1,102 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * cdc_test -- tests for content-defined chunking.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include "cdc.h"
+
+#define DATA_LEN 65536
+#define AVG_LEN 256
+
+/* Chunk a buffer, returning the number of chunks and their end offsets. */
+static int chunk_ends(const unsigned char *buf, size_t len, size_t *ends)
+{
+    size_t pos = 0, n;
+    int count = 0;
+
+    while (pos < len) {
+        n = rs_cdc_cut(buf + pos, len - pos, AVG_LEN);
+        assert(n > 0);
+        /* Only the last chunk can be shorter than the minimum. */
+        assert(n >= rs_cdc_min_len(AVG_LEN) || pos + n == len);
+        assert(n <= rs_cdc_max_len(AVG_LEN));
+        pos += n;
+        ends[count++] = pos;
+    }
+    return count;
+}
+
+int main(int argc, char **argv)
+{
+    static unsigned char buf[DATA_LEN + 100];
+    static size_t ends[DATA_LEN], ends2[DATA_LEN];
+    uint32_t x = 1;
+    size_t i, sum;
+    int count, count2, j, k;
+
+    /* Test the Gear table is the splitmix64 outputs seeded with 0. */
+    assert(rs_cdc_gear[0] == 0xe220a8397b1dcdafULL);
+    assert(rs_cdc_gear[255] == 0x5a5832bb47bcf19eULL);
+
+    /* Test the chunk length limits. */
+    assert(rs_cdc_min_len(AVG_LEN) == 64);
+    assert(rs_cdc_max_len(AVG_LEN) == 1024);
+
+    /* Test short data is a single chunk. */
+    memset(buf, 0, sizeof(buf));
+    assert(rs_cdc_cut(buf, 0, AVG_LEN) == 0);
+    assert(rs_cdc_cut(buf, 10, AVG_LEN) == 10);
+    assert(rs_cdc_cut(buf, 64, AVG_LEN) == 64);
+
+    /* Test data without boundaries is cut at the maximum length. */
+    assert(rs_cdc_cut(buf, DATA_LEN, AVG_LEN) == 1024);
+
+    /* Initialize pseudo-random test data. */
+    for (i = 0; i < DATA_LEN; i++) {
+        x = x * 1103515245 + 12345;
+        buf[i] = (unsigned char)(x >> 16);
+    }
+
+    /* Test the chunk lengths are near the average. */
+    count = chunk_ends(buf, DATA_LEN, ends);
+    assert(ends[count - 1] == DATA_LEN);
+    assert(count > DATA_LEN / AVG_LEN / 2 && count < DATA_LEN / AVG_LEN * 2);
+    for (sum = 0, j = 0; j < count; j++)
+        sum += ends[j];
+    /* The boundaries are part of the signature format, so must not change. */
+    assert(count == 203);
+    assert(sum == 6601076);
+
+    /* Test inserting data only changes the chunks near the insert. */
+    memmove(buf + 1000 + 100, buf + 1000, DATA_LEN - 1000);
+    memset(buf + 1000, 0xaa, 100);
+    count2 = chunk_ends(buf, DATA_LEN + 100, ends2);
+    for (j = 0; ends[j] < 1000; j++)
+        assert(ends2[j] == ends[j]);
+    /* The boundaries after the insert resynchronize. */
+    for (k = j; ends2[k] < 1000 + 100 + rs_cdc_max_len(AVG_LEN); k++) ;
+    for (; ends[j] + 100 < ends2[k]; j++) ;
+    assert(count2 - k == count - j);
+    for (; k < count2; j++, k++)
+        assert(ends2[k] == ends[j] + 100);
+    return 0;
+}
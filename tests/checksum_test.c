@@ -26,6 +26,10 @@
 #include <assert.h>
 #include <string.h>
 #include "checksum.h"
+#include "blake3.h"
+
+/* A BLAKE3 test vector input of 100KB of the bytes 0 to 250 repeated. */
+static unsigned char big[102400];
 
 /* Test driver for rollsum. */
 int main(int argc, char **argv)
@@ -133,9 +137,63 @@ int main(int argc, char **argv)
     assert(weaksum_count(&r) == 0);
     assert(weaksum_digest(&r) == 0x00000001);
 
+    /* RS_RABINKARP64 weaksum tests. */
+    weaksum_init(&r, RS_RABINKARP64);
+    assert(r.kind == RS_RABINKARP64);
+    assert(weaksum_count(&r) == 0);
+    assert(weaksum_digest(&r) == 0x0000000000000001);
+    weaksum_rollin(&r, 0);
+    weaksum_rollin(&r, 1);
+    weaksum_rollin(&r, 2);
+    weaksum_rollin(&r, 3);      /* [0,1,2,3] */
+    assert(weaksum_count(&r) == 4);
+    assert(weaksum_digest(&r) == 0x1450bbe02d2d6a57);
+    weaksum_rotate(&r, 0, 4);
+    weaksum_rotate(&r, 1, 5);
+    weaksum_rotate(&r, 2, 6);
+    weaksum_rotate(&r, 3, 7);   /* [4,5,6,7] */
+    assert(weaksum_count(&r) == 4);
+    assert(weaksum_digest(&r) == 0x432894f92e56c287);
+    weaksum_rollout(&r, 4);     /* [5,6,7] */
+    assert(weaksum_count(&r) == 3);
+    assert(weaksum_digest(&r) == 0x26ce1db0c5748997);
+    weaksum_reset(&r);
+    assert(r.kind == RS_RABINKARP64);
+    assert(weaksum_count(&r) == 0);
+    weaksum_update(&r, buf, 256);
+    assert(weaksum_digest(&r) == 0xb6cd667b5980a381);
+
+    /* RS_CRC32C weaksum tests. */
+    weaksum_init(&r, RS_CRC32C);
+    assert(r.kind == RS_CRC32C);
+    assert(weaksum_count(&r) == 0);
+    assert(weaksum_digest(&r) == 0x00000000);
+    weaksum_rollin(&r, 0);
+    weaksum_rollin(&r, 1);
+    weaksum_rollin(&r, 2);
+    weaksum_rollin(&r, 3);      /* [0,1,2,3] */
+    assert(weaksum_count(&r) == 4);
+    assert(weaksum_digest(&r) == 0xd9331aa3);
+    weaksum_rotate(&r, 0, 4);
+    weaksum_rotate(&r, 1, 5);
+    weaksum_rotate(&r, 2, 6);
+    weaksum_rotate(&r, 3, 7);   /* [4,5,6,7] */
+    assert(weaksum_count(&r) == 4);
+    assert(weaksum_digest(&r) == 0xb5df7989);
+    weaksum_rollout(&r, 4);     /* [5,6,7] */
+    assert(weaksum_count(&r) == 3);
+    assert(weaksum_digest(&r) == 0xe6fea0c7);
+    weaksum_reset(&r);
+    assert(r.kind == RS_CRC32C);
+    assert(weaksum_count(&r) == 0);
+    weaksum_update(&r, buf, 256);
+    assert(weaksum_digest(&r) == 0x9c44184b);
+
     /* Test rs_calc_weaksum() */
     assert(rs_calc_weak_sum(RS_ROLLSUM, buf, 256) == 0x3a009e80);
     assert(rs_calc_weak_sum(RS_RABINKARP, buf, 256) == 0xc1972381);
+    assert(rs_calc_weak_sum(RS_RABINKARP64, buf, 256) == 0xb6cd667b5980a381);
+    assert(rs_calc_weak_sum(RS_CRC32C, buf, 256) == 0x9c44184b);
 
     /* Test rs_calc_strongsum() */
     rs_strong_sum_t sum;
@@ -149,10 +207,49 @@ int main(int argc, char **argv)
         0x6f, 0x9d, 0x0c, 0x80, 0x49, 0x64, 0xa1, 0xf4,
         0xaa, 0xee, 0xa3, 0xb9, 0xfb, 0x59, 0x98, 0x35,
     };
+    const unsigned char xx3[16] = {
+        0xf1, 0xf8, 0xa9, 0x3f, 0x50, 0x84, 0x9a, 0xc3,
+        0x94, 0x08, 0xa4, 0x43, 0x3b, 0x95, 0x2d, 0x71,
+    };
+    const unsigned char bk3[32] = {
+        0x4a, 0x49, 0x5b, 0xa4, 0x24, 0x61, 0x74, 0x8e,
+        0xca, 0x8f, 0xda, 0xd6, 0x18, 0xf9, 0x76, 0xaa,
+        0x72, 0x6c, 0xc2, 0x90, 0x3d, 0xe9, 0xfc, 0xb4,
+        0x07, 0x35, 0xa7, 0x86, 0xac, 0x1c, 0x19, 0x6b,
+    };
+    const unsigned char bk3_big[32] = {
+        0xbc, 0x3e, 0x3d, 0x41, 0xa1, 0x14, 0x6b, 0x06,
+        0x9a, 0xbf, 0xfa, 0xd3, 0xc0, 0xd4, 0x48, 0x60,
+        0xcf, 0x66, 0x43, 0x90, 0xaf, 0xce, 0x4d, 0x96,
+        0x61, 0xf7, 0x90, 0x2e, 0x79, 0x43, 0xe0, 0x85,
+    };
+    rs_blake3_t bk3_ctx;
+    const unsigned char xx3_empty[16] = {
+        0x99, 0xaa, 0x06, 0xd3, 0x01, 0x47, 0x98, 0xd8,
+        0x60, 0x01, 0xc3, 0x24, 0x46, 0x8d, 0x49, 0x7f,
+    };
 
     rs_calc_strong_sum(RS_MD4, buf, 256, &sum);
     assert(!memcmp(sum, md4, RS_MD4_SUM_LENGTH));
     rs_calc_strong_sum(RS_BLAKE2, buf, 256, &sum);
     assert(!memcmp(sum, bk2, RS_BLAKE2_SUM_LENGTH));
+    rs_calc_strong_sum(RS_XXH3, buf, 256, &sum);
+    assert(!memcmp(sum, xx3, RS_XXH3_SUM_LENGTH));
+    rs_calc_strong_sum(RS_XXH3, buf, 0, &sum);
+    assert(!memcmp(sum, xx3_empty, RS_XXH3_SUM_LENGTH));
+    rs_calc_strong_sum(RS_BLAKE3, buf, 256, &sum);
+    assert(!memcmp(sum, bk3, RS_BLAKE3_SUM_LENGTH));
+
+    /* BLAKE3 of many chunks, all at once and in uneven pieces. */
+    for (size_t i = 0; i < sizeof big; i++)
+        big[i] = (unsigned char)(i % 251);
+    rs_calc_strong_sum(RS_BLAKE3, big, sizeof big, &sum);
+    assert(!memcmp(sum, bk3_big, RS_BLAKE3_SUM_LENGTH));
+    rs_blake3_begin(&bk3_ctx);
+    for (size_t i = 0; i < sizeof big; i += 1000)
+        rs_blake3_update(&bk3_ctx, big + i,
+                         sizeof big - i < 1000 ? sizeof big - i : 1000);
+    rs_blake3_result(&bk3_ctx, sum, RS_BLAKE3_SUM_LENGTH);
+    assert(!memcmp(sum, bk3_big, RS_BLAKE3_SUM_LENGTH));
     return 0;
 }
@@ -0,0 +1,109 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * crc32c_test -- tests for the CRC32C rolling checksum.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include "crc32c.h"
+
+int main(int argc, char **argv)
+{
+    crc32c_t r, s, t;
+    int i;
+    unsigned char buf[4096];
+
+    /* Test crc32c_init() */
+    crc32c_init(&r);
+    assert(r.count == 0);
+    assert(crc32c_digest(&r) == 0x00000000);
+
+    /* Test crc32c_rollin() */
+    crc32c_rollin(&r, 0);       /* [0] */
+    assert(r.count == 1);
+    assert(crc32c_digest(&r) == 0x527d5351);
+    crc32c_rollin(&r, 1);
+    crc32c_rollin(&r, 2);
+    crc32c_rollin(&r, 3);       /* [0,1,2,3] */
+    assert(r.count == 4);
+    assert(crc32c_digest(&r) == 0xd9331aa3);
+
+    /* Test crc32c_rotate() */
+    crc32c_rotate(&r, 0, 4);    /* [1,2,3,4] */
+    assert(r.count == 4);
+    assert(crc32c_digest(&r) == 0x29308cf4);
+    crc32c_rotate(&r, 1, 5);
+    crc32c_rotate(&r, 2, 6);
+    crc32c_rotate(&r, 3, 7);    /* [4,5,6,7] */
+    assert(r.count == 4);
+    assert(crc32c_digest(&r) == 0xb5df7989);
+
+    /* Test crc32c_rollout() */
+    crc32c_rollout(&r, 4);      /* [5,6,7] */
+    assert(r.count == 3);
+    assert(crc32c_digest(&r) == 0xe6fea0c7);
+    crc32c_rollout(&r, 5);
+    crc32c_rollout(&r, 6);
+    crc32c_rollout(&r, 7);      /* [] */
+    assert(r.count == 0);
+    assert(crc32c_digest(&r) == 0x00000000);
+
+    /* Test crc32c_update() */
+    for (i = 0; i < 256; i++)
+        buf[i] = (unsigned char)i;
+    crc32c_update(&r, buf, 256);
+    assert(crc32c_digest(&r) == 0x9c44184b);
+    for (i = 0; i < 128; i++)
+        crc32c_rollout(&r, buf[i]);     /* [128..255] */
+    assert(r.count == 128);
+    assert(crc32c_digest(&r) == 0x10797441);
+    crc32c_init(&r);
+    crc32c_update(&r, (const unsigned char *)"123456789", 9);
+    assert(crc32c_digest(&r) == 0xe3069283);
+
+    /* Check update against rollin, and rotate against update. */
+    for (i = 0; i < 4096; i++)
+        buf[i] = (unsigned char)(i * 7 + (i >> 5));
+    crc32c_init(&r);
+    crc32c_update(&r, buf, 4000);
+    crc32c_init(&s);
+    for (i = 0; i < 4000; i++)
+        crc32c_rollin(&s, buf[i]);
+    assert(crc32c_digest(&r) == crc32c_digest(&s));
+    assert(r.shift == s.shift);
+    /* Also check the table fallback matches the crc32 instruction. */
+    crc32c_init(&r);
+    crc32c_update(&r, buf, 1000);
+    crc32c_init(&t);
+    t.sse42 = 0;
+    crc32c_update(&t, buf, 1000);
+    assert(crc32c_digest(&r) == crc32c_digest(&t));
+    for (i = 1000; i < 4096; i++) {
+        crc32c_rotate(&r, buf[i - 1000], buf[i]);
+        crc32c_rotate(&t, buf[i - 1000], buf[i]);
+        if (i % 1000 == 0) {
+            crc32c_init(&s);
+            crc32c_update(&s, buf + i - 999, 1000);
+            assert(crc32c_digest(&r) == crc32c_digest(&s));
+            assert(crc32c_digest(&t) == crc32c_digest(&s));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,419 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* End-to-end signature, delta and patch benchmark.
+ *
+ * For each mutation profile this generates a reproducible pair of basis and
+ * new files in memory, and times making the basis signature, making the
+ * delta of the new file, and patching the basis to get the new file back.
+ * Each profile runs in its own process if possible so it gets its own peak
+ * RSS. The results are printed as text, CSV or JSON. Run with -h for the
+ * options. */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_FORK
+#  include <sys/types.h>
+#  include <sys/wait.h>
+#  include <unistd.h>
+#endif
+#ifdef HAVE_GETRUSAGE
+#  include <sys/resource.h>
+#endif
+#include "librsync.h"
+
+/* The benchmark settings. */
+static size_t size = 64 << 20;
+static size_t block_len = RS_DEFAULT_BLOCK_LEN;
+static int reps = 3;
+static unsigned seed = 1;
+static const char *format = "text";
+
+/* The basis and new files, and their lengths. */
+static unsigned char *old, *new;
+static size_t old_len, new_len;
+
+static unsigned long long rnd_state;
+
+/* A 64 bit LCG using the top bits, so random data doesn't repeat. */
+static unsigned rnd(unsigned n)
+{
+    rnd_state = rnd_state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned)(rnd_state >> 33) % n;
+}
+
+static void fill_random(unsigned char *p, size_t len)
+{
+    while (len--)
+        *p++ = (unsigned char)rnd(256);
+}
+
+/* Overwrite 1 to 16 bytes about every \p gap bytes of new. */
+static void edit_scattered(size_t gap)
+{
+    size_t i, len;
+
+    for (i = rnd((unsigned)gap); i < new_len; i += gap / 2 + rnd((unsigned)gap)) {
+        len = 1 + rnd(16);
+        if (len > new_len - i)
+            len = new_len - i;
+        fill_random(new + i, len);
+    }
+}
+
+static void gen_unchanged(void)
+{
+    fill_random(old, old_len);
+    memcpy(new, old, new_len = old_len);
+}
+
+static void gen_append(void)
+{
+    gen_unchanged();
+    fill_random(new + old_len, old_len / 10);
+    new_len += old_len / 10;
+}
+
+static void gen_scattered(void)
+{
+    gen_unchanged();
+    edit_scattered(64 << 10);
+}
+
+/* Copy runs of about 1MB, inserting or deleting up to 4KB between them. */
+static void gen_shift(void)
+{
+    size_t o = 0, len;
+
+    fill_random(old, old_len);
+    new_len = 0;
+    while (o < old_len) {
+        len = (512 << 10) + rnd(1 << 20);
+        if (len > old_len - o)
+            len = old_len - o;
+        memcpy(new + new_len, old + o, len);
+        new_len += len;
+        o += len;
+        len = 1 + rnd(4096);
+        if (rnd(2)) {
+            fill_random(new + new_len, len);
+            new_len += len;
+        } else {
+            o += len;
+        }
+    }
+}
+
+static void gen_random(void)
+{
+    fill_random(old, old_len);
+    fill_random(new, new_len = old_len);
+}
+
+/* A 1000 byte pattern repeated, so there are many duplicate blocks. */
+static void gen_repetitive(void)
+{
+    size_t i;
+
+    fill_random(old, 1000);
+    for (i = 1000; i < old_len; i++)
+        old[i] = old[i - 1000];
+    memcpy(new, old, new_len = old_len);
+    edit_scattered(64 << 10);
+}
+
+/* Zeros with 4KB of random data about every 256KB. */
+static void gen_zeros(void)
+{
+    size_t i;
+
+    memset(old, 0, old_len);
+    for (i = rnd(256 << 10); i + 4096 < old_len; i += (128 << 10) + rnd(256 << 10))
+        fill_random(old + i, 4096);
+    memcpy(new, old, new_len = old_len);
+    edit_scattered(256 << 10);
+}
+
+static const struct {
+    const char *name;
+    void (*gen)(void);
+} profiles[] = {
+    {"unchanged", gen_unchanged},
+    {"append", gen_append},
+    {"scattered", gen_scattered},
+    {"shift", gen_shift},
+    {"random", gen_random},
+    {"repetitive", gen_repetitive},
+    {"zeros", gen_zeros},
+};
+
+#define NPROFILES (int)(sizeof profiles / sizeof profiles[0])
+
+static rs_result copy_cb(void *arg, rs_long_t pos, size_t *len, void **buf)
+{
+    if (pos + (rs_long_t)*len > (rs_long_t)old_len)
+        *len = pos < (rs_long_t)old_len ? (size_t)((rs_long_t)old_len - pos) : 0;
+    *buf = old + pos;
+    return RS_DONE;
+}
+
+/* Run a job over all its input and output at once.
+ *
+ * \return The time the job took in nanoseconds, including the time to load
+ * and build the hashtable for a delta job's signature. */
+static rs_long_t run(rs_job_t *job, const void *in, size_t in_len, void *out,
+                     size_t out_size, size_t *out_len)
+{
+    const rs_stats_t *stats = rs_job_statistics(job);
+    const rs_times_t *times = rs_job_times(job);
+    rs_buffers_t buf;
+    rs_long_t t;
+
+    buf.next_in = (char *)in;
+    buf.avail_in = in_len;
+    buf.eof_in = 1;
+    buf.next_out = out;
+    buf.avail_out = out_size;
+    if (rs_job_iter(job, &buf) != RS_DONE) {
+        fprintf(stderr, "%s job failed\n", stats->op);
+        exit(1);
+    }
+    if (out_len)
+        *out_len = out_size - buf.avail_out;
+    t = times->end_ns - times->start_ns + times->loadsig_ns +
+        times->hashtable_ns;
+    rs_job_free(job);
+    return t > 0 ? t : 1;
+}
+
+static rs_long_t min_time(rs_long_t a, rs_long_t b)
+{
+    return a && a < b ? a : b;
+}
+
+static double mb_per_sec(size_t len, rs_long_t ns)
+{
+    return (double)len * 1e3 / (double)ns;
+}
+
+/* Benchmark a profile and print its results. */
+static void bench(int p, int first)
+{
+    size_t sig_size = 12 + (size / block_len + 1) * (4 + RS_MAX_STRONG_SUM_LENGTH);
+    size_t delta_size = 2 * size + 65536, sig_len, delta_len = 0, out_len;
+    unsigned char *sig = malloc(sig_size), *delta = malloc(delta_size);
+    unsigned char *out = malloc(delta_size);
+    rs_long_t sig_ns = 0, delta_ns = 0, patch_ns = 0, rss = 0;
+    rs_signature_t *sumset;
+    double ratio;
+    int r;
+
+    old = malloc(old_len = size);
+    new = malloc(delta_size);
+    rnd_state = seed;
+    profiles[p].gen();
+    for (r = 0; r < reps; r++) {
+        sig_ns = min_time(sig_ns,
+                          run(rs_sig_begin(block_len, 0, RS_RK_BLAKE2_SIG_MAGIC),
+                              old, old_len, sig, sig_size, &sig_len));
+        run(rs_loadsig_begin(&sumset), sig, sig_len, NULL, 0, NULL);
+        if (rs_build_hash_table(sumset) != RS_DONE)
+            exit(1);
+        delta_ns = min_time(delta_ns,
+                            run(rs_delta_begin(sumset), new, new_len, delta,
+                                delta_size, &delta_len));
+        rs_free_sumset(sumset);
+        patch_ns = min_time(patch_ns,
+                            run(rs_patch_begin(copy_cb, NULL), delta,
+                                delta_len, out, delta_size, &out_len));
+        if (out_len != new_len || memcmp(out, new, new_len)) {
+            fprintf(stderr, "%s patch output doesn't match\n",
+                    profiles[p].name);
+            exit(1);
+        }
+    }
+#ifdef HAVE_GETRUSAGE
+    {
+        struct rusage ru;
+
+        if (!getrusage(RUSAGE_SELF, &ru))
+            rss = ru.ru_maxrss;
+    }
+#endif
+    ratio = (double)delta_len / (double)new_len;
+    if (!strcmp(format, "json"))
+        printf("%s\n    {\"profile\": \"%s\", \"old_bytes\": %.0f, "
+               "\"new_bytes\": %.0f, \"delta_bytes\": %.0f, "
+               "\"delta_ratio\": %.4f, \"sig_mb_per_sec\": %.1f, "
+               "\"delta_mb_per_sec\": %.1f, \"patch_mb_per_sec\": %.1f, "
+               "\"peak_rss_kb\": %.0f}", first ? "" : ",", profiles[p].name,
+               (double)old_len, (double)new_len, (double)delta_len, ratio,
+               mb_per_sec(old_len, sig_ns), mb_per_sec(new_len, delta_ns),
+               mb_per_sec(new_len, patch_ns), (double)rss);
+    else if (!strcmp(format, "csv"))
+        printf("%s,%.0f,%.0f,%.0f,%.4f,%.1f,%.1f,%.1f,%.0f\n",
+               profiles[p].name, (double)old_len, (double)new_len,
+               (double)delta_len, ratio, mb_per_sec(old_len, sig_ns),
+               mb_per_sec(new_len, delta_ns), mb_per_sec(new_len, patch_ns),
+               (double)rss);
+    else
+        printf("%-12s %10.0f %10.0f %8.4f %10.1f %10.1f %10.1f %10.0f\n",
+               profiles[p].name, (double)new_len, (double)delta_len, ratio,
+               mb_per_sec(old_len, sig_ns), mb_per_sec(new_len, delta_ns),
+               mb_per_sec(new_len, patch_ns), (double)rss);
+    fflush(stdout);
+    free(old);
+    free(new);
+    free(sig);
+    free(delta);
+    free(out);
+}
+
+static void print_header(void)
+{
+    if (!strcmp(format, "json"))
+        printf("{\n  \"benchmark\": \"delta_perf\",\n  \"size\": %.0f,\n"
+               "  \"block_len\": %.0f,\n  \"reps\": %d,\n  \"seed\": %u,\n"
+               "  \"results\": [", (double)size, (double)block_len, reps,
+               seed);
+    else if (!strcmp(format, "csv"))
+        printf("profile,old_bytes,new_bytes,delta_bytes,delta_ratio,"
+               "sig_mb_per_sec,delta_mb_per_sec,patch_mb_per_sec,"
+               "peak_rss_kb\n");
+    else
+        printf("%-12s %10s %10s %8s %10s %10s %10s %10s\n", "profile",
+               "new_bytes", "delta", "ratio", "sig MB/s", "delta MB/s",
+               "patch MB/s", "rss KB");
+    fflush(stdout);
+}
+
+static void usage(const char *prog)
+{
+    int i;
+
+    fprintf(stderr,
+            "Usage: %s [OPTIONS] [PROFILE...]\n"
+            "Time signature, delta and patch for generated files, for all\n"
+            "mutation profiles or just the named PROFILEs.\n"
+            "\n"
+            "  -s SIZE  basis file size, with an optional K, M or G suffix\n"
+            "           (default 64M)\n"
+            "  -b LEN   block length (default %d)\n"
+            "  -r N     runs to take the fastest of (default 3)\n"
+            "  -S SEED  random seed for generating the files (default 1)\n"
+            "  -f FMT   output format: text, csv or json (default text)\n"
+            "\n" "Profiles:", prog, RS_DEFAULT_BLOCK_LEN);
+    for (i = 0; i < NPROFILES; i++)
+        fprintf(stderr, " %s", profiles[i].name);
+    fprintf(stderr, "\n");
+}
+
+/* Parse a size with an optional K, M or G suffix, or return 0 if invalid. */
+static size_t parse_size(const char *s)
+{
+    char *end;
+    unsigned long long n = strtoull(s, &end, 10);
+
+    if (*end == 'K' || *end == 'k')
+        n <<= 10, end++;
+    else if (*end == 'M' || *end == 'm')
+        n <<= 20, end++;
+    else if (*end == 'G' || *end == 'g')
+        n <<= 30, end++;
+    return *end ? 0 : (size_t)n;
+}
+
+int main(int argc, char **argv)
+{
+    int selected[NPROFILES], i, p, first = 1, any = 0, bad;
+
+    memset(selected, 0, sizeof selected);
+    for (i = 1; i < argc; i++) {
+        const char *arg = argv[i], *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (arg[0] != '-') {
+            for (p = 0; p < NPROFILES && strcmp(arg, profiles[p].name); p++) ;
+            if (p == NPROFILES) {
+                fprintf(stderr, "%s: unknown profile '%s'\n", argv[0], arg);
+                usage(argv[0]);
+                return 1;
+            }
+            selected[p] = any = 1;
+            continue;
+        }
+        if (!strcmp(arg, "-h") || !val) {
+            usage(argv[0]);
+            return arg[1] != 'h';
+        }
+        i++;
+        bad = 0;
+        if (!strcmp(arg, "-s"))
+            size = parse_size(val);
+        else if (!strcmp(arg, "-b"))
+            block_len = parse_size(val);
+        else if (!strcmp(arg, "-r"))
+            reps = atoi(val);
+        else if (!strcmp(arg, "-S"))
+            seed = (unsigned)strtoul(val, NULL, 10);
+        else if (!strcmp(arg, "-f"))
+            format = val;
+        else
+            bad = 1;
+        if (bad || size < 4096 || !block_len || block_len > size || reps < 1
+            || (strcmp(format, "text") && strcmp(format, "csv")
+                && strcmp(format, "json"))) {
+            fprintf(stderr, "%s: invalid option %s %s\n", argv[0], arg, val);
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    print_header();
+    for (p = 0; p < NPROFILES; p++) {
+        if (any && !selected[p])
+            continue;
+#ifdef HAVE_FORK
+        {
+            /* Run each profile in a child process for its own peak RSS. */
+            pid_t pid = fork();
+            int status;
+
+            if (pid < 0) {
+                perror("fork");
+                return 1;
+            }
+            if (!pid) {
+                bench(p, first);
+                _exit(0);
+            }
+            if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)
+                || WEXITSTATUS(status))
+                return 1;
+        }
+#else
+        bench(p, first);
+#endif
+        first = 0;
+    }
+    if (!strcmp(format, "json"))
+        printf("\n  ]\n}\n");
+    return 0;
+}
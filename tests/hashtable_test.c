@@ -174,6 +174,22 @@ int main(int argc, char **argv)
         count++;
     }
     assert(count == 258);
+
+    /* Test myhashtable_clear() */
+    myhashtable_clear(t);
+    assert(t->size == 512);
+    assert(t->count == 0);
+    mymatch_init(&m, 1);
+    assert(myhashtable_find(t, &m) == NULL);
+    assert(myhashtable_iter(t, &iter) == NULL);
+
+    /* Test myhashtable_reset() reuses a table the right size. */
+    assert(myhashtable_add(t, &entry[1]) == &entry[1]);
+    assert(myhashtable_reset(t, 256, NULL) == t);
+    assert(t->count == 0);
+    t = myhashtable_reset(t, 1000, NULL);
+    assert(t->size == 2048);
+    assert(t->count == 0);
     myhashtable_free(t);
 
     return 0;
@@ -0,0 +1,171 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "librsync.h"
+
+#define MAX_SEGS 16
+
+static unsigned rnd_state = 1;
+
+static unsigned rnd(unsigned n)
+{
+    rnd_state = rnd_state * 1103515245 + 12345;
+    return (rnd_state >> 16) % n;
+}
+
+/* Split buf into random sized segments, some of them empty. */
+static int split(rs_iovec_t *iov, char *buf, size_t len, unsigned max)
+{
+    int n = 0;
+    size_t off = 0, l;
+
+    while (off < len) {
+        l = rnd(max);
+        /* Don't have two empty segments in a row. */
+        if (!l && n && !iov[n - 1].iov_len)
+            l = 1;
+        if (l > len - off)
+            l = len - off;
+        iov[n].iov_base = buf + off;
+        iov[n].iov_len = l;
+        off += l;
+        n++;
+    }
+    return n;
+}
+
+/* Remove used bytes from the front of the segments. */
+static void advance(rs_iovec_t **iov, int *n, size_t used)
+{
+    while (*n && used >= (*iov)->iov_len) {
+        used -= (*iov)->iov_len;
+        (*iov)++;
+        (*n)--;
+    }
+    if (used) {
+        (*iov)->iov_base = (char *)(*iov)->iov_base + used;
+        (*iov)->iov_len -= used;
+    }
+}
+
+/* Run a job over scattered input and output, passing a few segments at a
+ * time. Returns the output length. */
+static size_t run(rs_job_t *job, char *in, size_t in_len, char *out,
+                  size_t out_len)
+{
+    rs_iovec_t *in_iov = malloc((2 * in_len + 1) * sizeof(*in_iov));
+    rs_iovec_t *out_iov = malloc((2 * out_len + 1) * sizeof(*out_iov));
+    rs_iovec_t *iv = in_iov, *ov = out_iov;
+    int nin = split(in_iov, in, in_len, 50);
+    int nout = out ? split(out_iov, out, out_len, 40) : 0;
+    size_t in_used, out_used, total = 0;
+    rs_result result;
+
+    do {
+        int wi = nin < MAX_SEGS ? nin : 1 + (int)rnd(MAX_SEGS);
+        int wo = nout < MAX_SEGS ? nout : 1 + (int)rnd(MAX_SEGS);
+
+        result = rs_job_iterv(job, iv, wi, wi == nin, &in_used, ov, wo,
+                              &out_used);
+        assert(result == RS_DONE || result == RS_BLOCKED);
+        advance(&iv, &nin, in_used);
+        advance(&ov, &nout, out_used);
+        total += out_used;
+    } while (result != RS_DONE);
+    free(in_iov);
+    free(out_iov);
+    return total;
+}
+
+static rs_result copy_cb(void *arg, rs_long_t pos, size_t *len, void **buf)
+{
+    const char *basis = arg;
+
+    if (pos + (rs_long_t)*len > 40000)
+        *len = pos < 40000 ? (size_t)(40000 - pos) : 0;
+    memcpy(*buf, basis + pos, *len);
+    return RS_DONE;
+}
+
+int main(int argc, char **argv)
+{
+    char *old = malloc(40000), *new = malloc(50000), *sig = malloc(10000),
+        *sig2 = malloc(10000), *delta = malloc(60000), *out = malloc(60000);
+    size_t new_len, sig_len, delta_len, out_len, i;
+    rs_signature_t *sumset;
+    rs_buffers_t buf;
+    rs_job_t *job;
+
+    for (i = 0; i < 40000; i++)
+        old[i] = (char)rnd(256);
+    /* The new file has a changed start, a deletion and an insertion. */
+    memcpy(new, "changed", 7);
+    memcpy(new + 7, old + 7, 10000);
+    memcpy(new + 10007, old + 12000, 20000);
+    for (i = 30007; i < 31007; i++)
+        new[i] = (char)rnd(256);
+    memcpy(new + 31007, old + 32000, 8000);
+    new_len = 39007;
+
+    /* A signature from scattered buffers matches one from rs_job_iter(). */
+    job = rs_sig_begin(256, 8, RS_RK_BLAKE2_SIG_MAGIC);
+    sig_len = run(job, old, 40000, sig, 10000);
+    rs_job_free(job);
+    job = rs_sig_begin(256, 8, RS_RK_BLAKE2_SIG_MAGIC);
+    buf.next_in = old;
+    buf.avail_in = 40000;
+    buf.eof_in = 1;
+    buf.next_out = sig2;
+    buf.avail_out = 10000;
+    assert(rs_job_iter(job, &buf) == RS_DONE);
+    rs_job_free(job);
+    assert(sig_len == 10000 - buf.avail_out);
+    assert(!memcmp(sig, sig2, sig_len));
+
+    /* Load the signature, which has no output. */
+    job = rs_loadsig_begin(&sumset);
+    assert(run(job, sig, sig_len, NULL, 0) == 0);
+    rs_job_free(job);
+    assert(rs_build_hash_table(sumset) == RS_DONE);
+
+    /* Delta and patch recreate the new file. */
+    job = rs_delta_begin(sumset);
+    delta_len = run(job, new, new_len, delta, 60000);
+    rs_job_free(job);
+    assert(delta_len < 4000);
+    job = rs_patch_begin(copy_cb, old);
+    out_len = run(job, delta, delta_len, out, 60000);
+    rs_job_free(job);
+    assert(out_len == new_len);
+    assert(!memcmp(out, new, new_len));
+
+    rs_free_sumset(sumset);
+    free(old);
+    free(new);
+    free(sig);
+    free(sig2);
+    free(delta);
+    free(out);
+    return 0;
+}
@@ -0,0 +1,547 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Microbenchmarks for the hot kernels.
+ *
+ * Each kernel processes the same buffer of random data, and is run a number
+ * of untimed warmup times and then timed for a number of repetitions. The
+ * results are printed as text, CSV or JSON. Run with -h for the options. */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "librsync.h"
+#include "blake2.h"
+#include "cdc.h"
+#include "command.h"
+#include "crc32c.h"
+#include "job.h"
+#include "prototab.h"
+#include "rabinkarp.h"
+#include "rollsum.h"
+#include "stream.h"
+#include "sumset.h"
+#include "trace.h"
+#include "util.h"
+
+/* The benchmark settings. */
+static size_t size = 16 << 20;
+static size_t block_len = RS_DEFAULT_BLOCK_LEN;
+static int warmup = 1;
+static int reps = 5;
+static const char *format = "text";
+
+/* The random data the kernels process, and output space for the tube. */
+static unsigned char *data, *out;
+
+/* The signature of data and its block weak sums for the find and hashtable
+   kernels. */
+static rs_signature_t sig;
+static rs_weak_sum64_t *weaks;
+
+/* Stop the compiler optimizing away results. */
+static volatile unsigned sink;
+
+static unsigned rnd_state = 1;
+
+static unsigned rnd(void)
+{
+    rnd_state = rnd_state * 1103515245 + 12345;
+    return rnd_state >> 16;
+}
+
+/* Each kernel returns the number of operations it did. */
+typedef size_t kernel_fn(void);
+
+static size_t bench_rollsum_update(void)
+{
+    Rollsum sum;
+
+    RollsumInit(&sum);
+    RollsumUpdate(&sum, data, size);
+    sink = RollsumDigest(&sum);
+    return 1;
+}
+
+static size_t bench_rollsum_rotate(void)
+{
+    Rollsum sum;
+    size_t i;
+
+    RollsumInit(&sum);
+    RollsumUpdate(&sum, data, block_len);
+    for (i = block_len; i < size; i++)
+        RollsumRotate(&sum, data[i - block_len], data[i]);
+    sink = RollsumDigest(&sum);
+    return size - block_len;
+}
+
+static size_t bench_rabinkarp_update(void)
+{
+    rabinkarp_t sum;
+
+    rabinkarp_init(&sum);
+    rabinkarp_update(&sum, data, size);
+    sink = rabinkarp_digest(&sum);
+    return 1;
+}
+
+static size_t bench_rabinkarp_rotate(void)
+{
+    rabinkarp_t sum;
+    size_t i;
+
+    rabinkarp_init(&sum);
+    rabinkarp_update(&sum, data, block_len);
+    for (i = block_len; i < size; i++)
+        rabinkarp_rotate(&sum, data[i - block_len], data[i]);
+    sink = rabinkarp_digest(&sum);
+    return size - block_len;
+}
+
+static size_t bench_rabinkarp64_update(void)
+{
+    rabinkarp64_t sum;
+
+    rabinkarp64_init(&sum);
+    rabinkarp64_update(&sum, data, size);
+    sink = (unsigned)rabinkarp64_digest(&sum);
+    return 1;
+}
+
+static size_t bench_rabinkarp64_rotate(void)
+{
+    rabinkarp64_t sum;
+    size_t i;
+
+    rabinkarp64_init(&sum);
+    rabinkarp64_update(&sum, data, block_len);
+    for (i = block_len; i < size; i++)
+        rabinkarp64_rotate(&sum, data[i - block_len], data[i]);
+    sink = (unsigned)rabinkarp64_digest(&sum);
+    return size - block_len;
+}
+
+static size_t bench_crc32c_update(void)
+{
+    crc32c_t sum;
+
+    crc32c_init(&sum);
+    crc32c_update(&sum, data, size);
+    sink = crc32c_digest(&sum);
+    return 1;
+}
+
+static size_t bench_crc32c_rotate(void)
+{
+    crc32c_t sum;
+    size_t i;
+
+    crc32c_init(&sum);
+    crc32c_update(&sum, data, block_len);
+    for (i = block_len; i < size; i++)
+        crc32c_rotate(&sum, data[i - block_len], data[i]);
+    sink = crc32c_digest(&sum);
+    return size - block_len;
+}
+
+static size_t bench_cdc_cut(void)
+{
+    size_t pos = 0, ops = 0;
+
+    while (pos < size) {
+        pos += rs_cdc_cut(data + pos, size - pos, block_len);
+        ops++;
+    }
+    sink = (unsigned)ops;
+    return ops;
+}
+
+static size_t bench_mdfour(void)
+{
+    unsigned char sum[RS_MD4_SUM_LENGTH];
+    size_t i;
+
+    for (i = 0; i + block_len <= size; i += block_len)
+        rs_mdfour(sum, data + i, block_len);
+    sink = sum[0];
+    return size / block_len;
+}
+
+static size_t bench_blake2b(void)
+{
+    unsigned char sum[RS_BLAKE2_SUM_LENGTH];
+    size_t i;
+
+    for (i = 0; i + block_len <= size; i += block_len)
+        blake2b(sum, sizeof sum, data + i, block_len, NULL, 0);
+    sink = sum[0];
+    return size / block_len;
+}
+
+static size_t bench_blake3(void)
+{
+    rs_strong_sum_t sum;
+    size_t i;
+
+    for (i = 0; i + block_len <= size; i += block_len)
+        rs_calc_strong_sum(RS_BLAKE3, data + i, block_len, &sum);
+    sink = sum[0];
+    return size / block_len;
+}
+
+static size_t bench_xxh3(void)
+{
+    rs_strong_sum_t sum;
+    size_t i;
+
+    for (i = 0; i + block_len <= size; i += block_len)
+        rs_calc_strong_sum(RS_XXH3, data + i, block_len, &sum);
+    sink = sum[0];
+    return size / block_len;
+}
+
+/* Find every block of data, which includes calculating its strong sum. */
+static size_t bench_find_hit(void)
+{
+    size_t i;
+    int n;
+
+    for (n = 0; n < sig.count; n++) {
+        i = (size_t)n * block_len;
+        if (rs_signature_find_match(&sig, weaks[n], data + i, block_len) !=
+            (rs_long_t)i)
+            abort();
+    }
+    return (size_t)sig.count;
+}
+
+/* Find a different weak sum for every byte, like scanning new data. */
+static size_t bench_find_miss(void)
+{
+    unsigned weak = 1;
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        weak = weak * 1103515245 + 12345;
+        if (rs_signature_find_match(&sig, weak, data, block_len) >= 0)
+            sink++;
+    }
+    return size;
+}
+
+static size_t bench_build_hash_table(void)
+{
+    if (rs_build_hash_table(&sig) != RS_DONE)
+        abort();
+    return (size_t)sig.count;
+}
+
+/* State function that reads the input a block at a time from the scoop. */
+static rs_result scoop_s_read(rs_job_t *job)
+{
+    size_t len = block_len;
+    rs_result result;
+    void *p;
+
+    while ((result = rs_scoop_read(job, len, &p)) == RS_DONE)
+        sink += *(unsigned char *)p;
+    if (result == RS_INPUT_ENDED
+        && (result = rs_scoop_read_rest(job, &len, &p)) == RS_INPUT_ENDED)
+        return RS_DONE;
+    return result;
+}
+
+/* State function that copies the input to the output through the tube in
+   literal commands. */
+static rs_result tube_s_copy(rs_job_t *job)
+{
+    static const rs_byte_t cmd[3] = { RS_OP_LITERAL_N2, 0, 0 };
+    size_t len = job->stream->avail_in;
+
+    if (!len)
+        return rs_job_input_is_ending(job) ? RS_DONE : RS_BLOCKED;
+    if (len > block_len)
+        len = block_len;
+    rs_tube_write(job, cmd, sizeof cmd);
+    rs_tube_copy(job, len);
+    return RS_RUNNING;
+}
+
+/* Run a job over data in odd sized input chunks of in_len bytes and output
+   chunks. */
+static void run_job(rs_job_t *job, size_t in_len, unsigned char *dst)
+{
+    const size_t chunk = 65521;
+    rs_buffers_t buf;
+    rs_result result;
+    size_t in = 0, done = 0, len;
+
+    buf.avail_in = buf.avail_out = 0;
+    buf.eof_in = 0;
+    do {
+        if (!buf.avail_in && !buf.eof_in) {
+            len = size - in < in_len ? size - in : in_len;
+            buf.next_in = (char *)data + in;
+            buf.avail_in = len;
+            in += len;
+            buf.eof_in = in == size;
+        }
+        if (dst && !buf.avail_out) {
+            buf.next_out = (char *)dst + done;
+            buf.avail_out = chunk;
+            done += chunk;
+        }
+        result = rs_job_iter(job, &buf);
+    } while (result == RS_BLOCKED);
+    if (result != RS_DONE)
+        abort();
+    rs_job_free(job);
+}
+
+static size_t bench_scoop(void)
+{
+    /* Input chunks smaller than a block make every read copy into the scoop,
+       wrapping around its ring buffer at odd offsets. */
+    run_job(rs_job_new("scoop", scoop_s_read), block_len / 3 + 1, NULL);
+    return (size + block_len - 1) / block_len;
+}
+
+static size_t bench_tube(void)
+{
+    run_job(rs_job_new("tube", tube_s_copy), 65521, out);
+    return (size + block_len - 1) / block_len;
+}
+
+static const struct {
+    const char *name;
+    kernel_fn *fn;
+} kernels[] = {
+    {"rollsum_update", bench_rollsum_update},
+    {"rollsum_rotate", bench_rollsum_rotate},
+    {"rabinkarp_update", bench_rabinkarp_update},
+    {"rabinkarp_rotate", bench_rabinkarp_rotate},
+    {"rabinkarp64_update", bench_rabinkarp64_update},
+    {"rabinkarp64_rotate", bench_rabinkarp64_rotate},
+    {"crc32c_update", bench_crc32c_update},
+    {"crc32c_rotate", bench_crc32c_rotate},
+    {"cdc_cut", bench_cdc_cut},
+    {"mdfour", bench_mdfour},
+    {"blake2b", bench_blake2b},
+    {"blake3", bench_blake3},
+    {"xxh3", bench_xxh3},
+    {"hashtable_find_hit", bench_find_hit},
+    {"hashtable_find_miss", bench_find_miss},
+    {"build_hash_table", bench_build_hash_table},
+    {"scoop", bench_scoop},
+    {"tube", bench_tube},
+};
+
+#define NKERNELS (int)(sizeof kernels / sizeof kernels[0])
+
+/* Make a signature of data for the find and hashtable kernels. */
+static void make_sig(void)
+{
+    rs_strong_sum_t strong;
+    rabinkarp_t sum;
+    size_t i;
+
+    if (rs_signature_init(&sig, RS_RK_BLAKE2_SIG_MAGIC, block_len,
+                          RS_BLAKE2_SUM_LENGTH, -1) != RS_DONE)
+        abort();
+    weaks = malloc((size / block_len) * sizeof *weaks);
+    for (i = 0; i + block_len <= size; i += block_len) {
+        rabinkarp_init(&sum);
+        rabinkarp_update(&sum, data + i, block_len);
+        weaks[i / block_len] = rabinkarp_digest(&sum);
+        rs_signature_calc_strong_sum(&sig, data + i, block_len, &strong);
+        if (!rs_signature_add_block(&sig, weaks[i / block_len], &strong))
+            abort();
+    }
+    if (rs_build_hash_table(&sig) != RS_DONE)
+        abort();
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+    rs_long_t x = *(const rs_long_t *)a, y = *(const rs_long_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void print_header(void)
+{
+    if (!strcmp(format, "json"))
+        printf("{\n  \"benchmark\": \"kernel_perf\",\n  \"size\": " FMT_SIZE
+               ",\n  \"block_len\": " FMT_SIZE ",\n  \"reps\": %d,\n"
+               "  \"results\": [", size, block_len, reps);
+    else if (!strcmp(format, "csv"))
+        printf("kernel,bytes,ops,reps,min_ns,median_ns,mean_ns,mb_per_sec,"
+               "ns_per_op\n");
+    else
+        printf("%-20s %10s %10s %12s %12s %10s %10s\n", "kernel", "bytes",
+               "ops", "min_ns", "median_ns", "MB/s", "ns/op");
+}
+
+static void print_result(int first, const char *name, size_t ops,
+                         const rs_long_t *times)
+{
+    rs_long_t min = times[0], median = times[reps / 2], total = 0;
+    double mbs, nsop;
+    int i;
+
+    for (i = 0; i < reps; i++)
+        total += times[i];
+    if (min < 1)
+        min = 1;
+    mbs = (double)size * 1e3 / (double)min;
+    nsop = (double)min / (double)ops;
+    if (!strcmp(format, "json"))
+        printf("%s\n    {\"kernel\": \"%s\", \"bytes\": " FMT_SIZE
+               ", \"ops\": " FMT_SIZE ", \"min_ns\": " FMT_LONG
+               ", \"median_ns\": " FMT_LONG ", \"mean_ns\": " FMT_LONG
+               ", \"mb_per_sec\": %.1f, \"ns_per_op\": %.2f}",
+               first ? "" : ",", name, size, ops, min, median, total / reps,
+               mbs, nsop);
+    else if (!strcmp(format, "csv"))
+        printf("%s," FMT_SIZE "," FMT_SIZE ",%d," FMT_LONG "," FMT_LONG ","
+               FMT_LONG ",%.1f,%.2f\n", name, size, ops, reps, min, median,
+               total / reps, mbs, nsop);
+    else
+        printf("%-20s %10.0f %10.0f %12.0f %12.0f %10.1f %10.2f\n", name,
+               (double)size, (double)ops, (double)min, (double)median, mbs,
+               nsop);
+}
+
+static void usage(const char *prog)
+{
+    int i;
+
+    fprintf(stderr,
+            "Usage: %s [OPTIONS] [KERNEL...]\n"
+            "Time librsync's hot kernels, or just the named KERNELs.\n"
+            "\n"
+            "  -s SIZE  bytes of data for each run, with an optional K, M\n"
+            "           or G suffix (default 16M)\n"
+            "  -b LEN   block length (default %d)\n"
+            "  -w N     untimed warmup runs (default 1)\n"
+            "  -r N     timed runs (default 5)\n"
+            "  -f FMT   output format: text, csv or json (default text)\n"
+            "\n" "Kernels:", prog, RS_DEFAULT_BLOCK_LEN);
+    for (i = 0; i < NKERNELS; i++)
+        fprintf(stderr, " %s", kernels[i].name);
+    fprintf(stderr, "\n");
+}
+
+/* Parse a size with an optional K, M or G suffix, or return 0 if invalid. */
+static size_t parse_size(const char *s)
+{
+    char *end;
+    unsigned long long n = strtoull(s, &end, 10);
+
+    if (*end == 'K' || *end == 'k')
+        n <<= 10, end++;
+    else if (*end == 'M' || *end == 'm')
+        n <<= 20, end++;
+    else if (*end == 'G' || *end == 'g')
+        n <<= 30, end++;
+    return *end ? 0 : (size_t)n;
+}
+
+int main(int argc, char **argv)
+{
+    int selected[NKERNELS], i, k, r, first = 1, any = 0, bad;
+    rs_long_t *times, start;
+    size_t ops = 0, j;
+
+    memset(selected, 0, sizeof selected);
+    for (i = 1; i < argc; i++) {
+        const char *arg = argv[i], *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (arg[0] != '-') {
+            for (k = 0; k < NKERNELS && strcmp(arg, kernels[k].name); k++) ;
+            if (k == NKERNELS) {
+                fprintf(stderr, "%s: unknown kernel '%s'\n", argv[0], arg);
+                usage(argv[0]);
+                return 1;
+            }
+            selected[k] = any = 1;
+            continue;
+        }
+        if (!strcmp(arg, "-h") || !val) {
+            usage(argv[0]);
+            return arg[1] != 'h';
+        }
+        i++;
+        bad = 0;
+        if (!strcmp(arg, "-s"))
+            size = parse_size(val);
+        else if (!strcmp(arg, "-b"))
+            block_len = parse_size(val);
+        else if (!strcmp(arg, "-w"))
+            warmup = atoi(val);
+        else if (!strcmp(arg, "-r"))
+            reps = atoi(val);
+        else if (!strcmp(arg, "-f"))
+            format = val;
+        else
+            bad = 1;
+        if (bad || !size || !block_len || block_len > size || warmup < 0
+            || reps < 1 || (strcmp(format, "text") && strcmp(format, "csv")
+                            && strcmp(format, "json"))) {
+            fprintf(stderr, "%s: invalid option %s %s\n", argv[0], arg, val);
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    data = malloc(size);
+    /* Enough output for the data, the command bytes and a spare chunk. */
+    out = malloc(size + 3 * (size / block_len + 1) + 65521);
+    times = malloc(reps * sizeof *times);
+    for (j = 0; j < size; j++)
+        data[j] = (unsigned char)rnd();
+    make_sig();
+
+    print_header();
+    for (k = 0; k < NKERNELS; k++) {
+        if (any && !selected[k])
+            continue;
+        for (r = 0; r < warmup; r++)
+            kernels[k].fn();
+        for (r = 0; r < reps; r++) {
+            start = rs_now_ns();
+            ops = kernels[k].fn();
+            times[r] = rs_now_ns() - start;
+        }
+        qsort(times, reps, sizeof *times, cmp_long);
+        print_result(first, kernels[k].name, ops, times);
+        first = 0;
+    }
+    if (!strcmp(format, "json"))
+        printf("\n  ]\n}\n");
+
+    rs_signature_done(&sig);
+    free(weaks);
+    free(times);
+    free(out);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,192 @@
+# librsync -- the library for network deltas
+#
+# perfcheck.cmake: Run kernel_perf and delta_perf on small deterministic
+# inputs and compare their throughput against a baseline JSON file, failing
+# if anything is slower than the baseline by more than its tolerance.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public License
+# as published by the Free Software Foundation; either version 2.1 of
+# the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this program; if not, write to the Free Software
+# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+# Usage: cmake -DKERNEL_PERF=<path> -DDELTA_PERF=<path> -DBASELINE=<json>
+#              [-DBUILD_TYPE=<type>] [-DTOLERANCE=<percent>] [-DRUNS=<n>]
+#              [-DUPDATE=ON] -P perfcheck.cmake
+#
+# The baseline has a default "tolerance_pct" and a "results" object mapping
+# each measurement name to its "mb_per_sec", with an optional
+# "tolerance_pct" overriding the default for noisy measurements. TOLERANCE
+# overrides the baseline's default. With UPDATE set the baseline is rewritten
+# with the current results, keeping the tolerances. The benchmarks are run
+# RUNS times, 3 by default, and the best result of each is used.
+
+cmake_minimum_required(VERSION 3.19)
+
+foreach(var KERNEL_PERF DELTA_PERF BASELINE)
+  if (NOT ${var})
+    message(FATAL_ERROR "perfcheck: ${var} is not set")
+  endif ()
+endforeach()
+if (NOT BUILD_TYPE MATCHES "^(Release|RelWithDebInfo)$")
+  message(WARNING "perfcheck: comparing a '${BUILD_TYPE}' build against a Release baseline")
+endif ()
+
+# Convert a decimal number string to an integer count of tenths.
+function(to_tenths out value)
+  if (NOT value MATCHES "^([0-9]+)(\\.([0-9]))?")
+    message(FATAL_ERROR "perfcheck: bad number '${value}'")
+  endif ()
+  set(tenths "${CMAKE_MATCH_3}")
+  if (tenths STREQUAL "")
+    set(tenths 0)
+  endif ()
+  math(EXPR n "${CMAKE_MATCH_1} * 10 + ${tenths}")
+  set(${out} ${n} PARENT_SCOPE)
+endfunction()
+
+# Run a benchmark with JSON output, returning its results array.
+function(run_bench out)
+  execute_process(COMMAND ${ARGN} -f json
+                  OUTPUT_VARIABLE json RESULT_VARIABLE rc)
+  if (NOT rc EQUAL 0)
+    message(FATAL_ERROR "perfcheck: '${ARGN}' failed: ${rc}")
+  endif ()
+  string(JSON results GET "${json}" results)
+  set(${out} "${results}" PARENT_SCOPE)
+endfunction()
+
+# Format a count of tenths as a decimal number string.
+function(from_tenths out tenths)
+  math(EXPR whole "${tenths} / 10")
+  math(EXPR frac "${tenths} % 10")
+  set(${out} "${whole}.${frac}" PARENT_SCOPE)
+endfunction()
+
+# Run the benchmarks once, returning lists of names and MB/s in tenths.
+function(run_all out_names out_values)
+  set(names)
+  set(values)
+  run_bench(results ${KERNEL_PERF} -s 4M -w 2 -r 10)
+  string(JSON n LENGTH "${results}")
+  math(EXPR last "${n} - 1")
+  foreach(i RANGE ${last})
+    string(JSON kernel GET "${results}" ${i} kernel)
+    string(JSON mbs GET "${results}" ${i} mb_per_sec)
+    to_tenths(t "${mbs}")
+    list(APPEND names "kernel/${kernel}")
+    list(APPEND values ${t})
+  endforeach()
+  run_bench(results ${DELTA_PERF} -s 8M -r 3)
+  string(JSON n LENGTH "${results}")
+  math(EXPR last "${n} - 1")
+  foreach(i RANGE ${last})
+    string(JSON profile GET "${results}" ${i} profile)
+    foreach(step sig delta patch)
+      string(JSON mbs GET "${results}" ${i} ${step}_mb_per_sec)
+      to_tenths(t "${mbs}")
+      list(APPEND names "delta/${profile}/${step}")
+      list(APPEND values ${t})
+    endforeach()
+  endforeach()
+  set(${out_names} "${names}" PARENT_SCOPE)
+  set(${out_values} "${values}" PARENT_SCOPE)
+endfunction()
+
+# Take the best of several runs, since the timings of separate processes vary
+# more than the repetitions within each one.
+if (NOT RUNS)
+  set(RUNS 3)
+endif ()
+run_all(names values)
+list(LENGTH names n)
+math(EXPR last "${n} - 1")
+foreach(run RANGE 2 ${RUNS})
+  run_all(run_names run_values)
+  set(best)
+  foreach(i RANGE ${last})
+    list(GET values ${i} a)
+    list(GET run_values ${i} b)
+    if (b GREATER a)
+      set(a ${b})
+    endif ()
+    list(APPEND best ${a})
+  endforeach()
+  set(values "${best}")
+endforeach()
+
+if (EXISTS "${BASELINE}")
+  file(READ "${BASELINE}" baseline)
+else ()
+  set(baseline "{\"tolerance_pct\": 25, \"results\": {}}")
+endif ()
+string(JSON default_tol GET "${baseline}" tolerance_pct)
+if (TOLERANCE)
+  set(default_tol ${TOLERANCE})
+endif ()
+
+if (UPDATE)
+  # Write one result per line so baseline diffs are readable.
+  set(out "{\n  \"tolerance_pct\": ${default_tol},\n  \"results\": {")
+  set(sep "")
+  foreach(i RANGE ${last})
+    list(GET names ${i} name)
+    list(GET values ${i} cur)
+    from_tenths(mbs ${cur})
+    string(APPEND out "${sep}\n    \"${name}\": {\"mb_per_sec\": ${mbs}")
+    string(JSON tol ERROR_VARIABLE err GET "${baseline}" results ${name} tolerance_pct)
+    if (NOT err)
+      string(APPEND out ", \"tolerance_pct\": ${tol}")
+    endif ()
+    string(APPEND out "}")
+    set(sep ",")
+  endforeach()
+  string(APPEND out "\n  }\n}\n")
+  file(WRITE "${BASELINE}" "${out}")
+  message(STATUS "perfcheck: wrote ${n} results to ${BASELINE}")
+  return()
+endif ()
+
+set(failed 0)
+foreach(i RANGE ${last})
+  list(GET names ${i} name)
+  list(GET values ${i} cur)
+  from_tenths(mbs ${cur})
+  string(JSON base ERROR_VARIABLE err GET "${baseline}" results ${name} mb_per_sec)
+  if (err)
+    message(STATUS "${name}: ${mbs} MB/s (not in baseline)")
+    continue()
+  endif ()
+  string(JSON tol ERROR_VARIABLE err GET "${baseline}" results ${name} tolerance_pct)
+  if (err)
+    set(tol ${default_tol})
+  endif ()
+  to_tenths(ref "${base}")
+  from_tenths(base ${ref})
+  if (ref EQUAL 0)
+    set(ref 1)
+  endif ()
+  # Fail if cur < ref * (100 - tol) / 100, and show the change in percent.
+  math(EXPR pct "(${cur} - ${ref}) * 100 / ${ref}")
+  math(EXPR floor "${ref} * (100 - ${tol})")
+  math(EXPR cur100 "${cur} * 100")
+  if (cur100 LESS floor)
+    message(STATUS "${name}: ${mbs} MB/s vs ${base} (${pct}%, tolerance ${tol}%) REGRESSED")
+    math(EXPR failed "${failed} + 1")
+  else ()
+    message(STATUS "${name}: ${mbs} MB/s vs ${base} (${pct}%)")
+  endif ()
+endforeach()
+
+if (failed)
+  message(FATAL_ERROR "perfcheck: ${failed} of ${n} results regressed")
+endif ()
+message(STATUS "perfcheck: all ${n} results within tolerance")
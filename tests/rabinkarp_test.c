@@ -29,6 +29,7 @@
 int main(int argc, char **argv)
 {
     rabinkarp_t r;
+    rabinkarp64_t r64;
     int i;
     unsigned char buf[256];
 
@@ -73,5 +74,39 @@ int main(int argc, char **argv)
         buf[i] = (unsigned char)i;
     rabinkarp_update(&r, buf, 256);
     assert(rabinkarp_digest(&r) == 0xc1972381);
+
+    /* Test rabinkarp64 the same way. */
+    rabinkarp64_init(&r64);
+    assert(r64.count == 0);
+    assert(rabinkarp64_digest(&r64) == 0x0000000000000001);
+    rabinkarp64_rollin(&r64, 0);        /* [0] */
+    assert(r64.count == 1);
+    assert(rabinkarp64_digest(&r64) == 0x5851f42d4c957f2d);
+    rabinkarp64_rollin(&r64, 1);
+    rabinkarp64_rollin(&r64, 2);
+    rabinkarp64_rollin(&r64, 3);        /* [0,1,2,3] */
+    assert(r64.count == 4);
+    assert(rabinkarp64_digest(&r64) == 0x1450bbe02d2d6a57);
+    rabinkarp64_rotate(&r64, 0, 4);     /* [1,2,3,4] */
+    assert(rabinkarp64_digest(&r64) == 0xe006b2266d77c063);
+    rabinkarp64_rotate(&r64, 1, 5);
+    rabinkarp64_rotate(&r64, 2, 6);
+    rabinkarp64_rotate(&r64, 3, 7);     /* [4,5,6,7] */
+    assert(r64.count == 4);
+    assert(rabinkarp64_digest(&r64) == 0x432894f92e56c287);
+    rabinkarp64_rollout(&r64, 4);       /* [5,6,7] */
+    assert(r64.count == 3);
+    assert(rabinkarp64_digest(&r64) == 0x26ce1db0c5748997);
+    rabinkarp64_rollout(&r64, 5);
+    rabinkarp64_rollout(&r64, 6);
+    rabinkarp64_rollout(&r64, 7);       /* [] */
+    assert(r64.count == 0);
+    assert(rabinkarp64_digest(&r64) == 0x0000000000000001);
+    rabinkarp64_update(&r64, buf, 256);
+    assert(rabinkarp64_digest(&r64) == 0xb6cd667b5980a381);
+    for (i = 0; i < 128; i++)
+        rabinkarp64_rollout(&r64, buf[i]);      /* [128..255] */
+    assert(r64.count == 128);
+    assert(rabinkarp64_digest(&r64) == 0xbc3c4542a161f1c1);
     return 0;
 }
@@ -0,0 +1,129 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "librsync.h"
+
+#define MAX_LEN 20000
+
+static unsigned rnd_state = 1;
+
+static unsigned rnd(unsigned n)
+{
+    rnd_state = rnd_state * 1103515245 + 12345;
+    return (rnd_state >> 16) % n;
+}
+
+/* Run a job over the input in small pieces. Returns the output length. */
+static size_t run(rs_job_t *job, char *in, size_t in_len, char *out,
+                  size_t out_len)
+{
+    rs_buffers_t buf;
+    rs_result result;
+    size_t n;
+
+    buf.next_in = in;
+    buf.avail_in = 0;
+    buf.eof_in = 0;
+    buf.next_out = out;
+    buf.avail_out = out_len;
+    do {
+        n = 1 + rnd(100);
+        if (n >= in_len - (size_t)(buf.next_in - in) - buf.avail_in) {
+            buf.avail_in = in_len - (size_t)(buf.next_in - in);
+            buf.eof_in = 1;
+        } else {
+            buf.avail_in += n;
+        }
+        result = rs_job_iter(job, &buf);
+        assert(result == RS_DONE || result == RS_BLOCKED);
+    } while (result != RS_DONE);
+    return out_len - buf.avail_out;
+}
+
+static rs_result copy_cb(void *arg, rs_long_t pos, size_t *len, void **buf)
+{
+    const char *basis = arg;
+
+    if (pos + (rs_long_t)*len > MAX_LEN)
+        *len = pos < MAX_LEN ? (size_t)(MAX_LEN - pos) : 0;
+    memcpy(*buf, basis + pos, *len);
+    return RS_DONE;
+}
+
+int main(int argc, char **argv)
+{
+    char *old = malloc(MAX_LEN), *new = malloc(MAX_LEN),
+        *sig = malloc(MAX_LEN), *sig2 = malloc(MAX_LEN),
+        *delta = malloc(2 * MAX_LEN), *out = malloc(MAX_LEN);
+    size_t old_len, new_len, sig_len, delta_len, out_len, i;
+    rs_signature_t *sumset = NULL;
+    rs_job_t *job, *fresh;
+    int file;
+
+    /* One job is reused for every step of lots of differently sized files. */
+    job = rs_sig_begin(256, 8, RS_RK_BLAKE2_SIG_MAGIC);
+    for (file = 0; file < 50; file++) {
+        old_len = rnd(MAX_LEN);
+        for (i = 0; i < old_len; i++)
+            old[i] = (char)rnd(256);
+        /* The new file is the old file with a few bytes changed. */
+        new_len = old_len;
+        memcpy(new, old, old_len);
+        for (i = 0; i < 5 && new_len; i++)
+            new[rnd((unsigned)new_len)] = (char)rnd(256);
+
+        /* A signature from a reused job matches one from a new job. */
+        if (file)
+            assert(rs_sig_reset(job, 256, 8, RS_RK_BLAKE2_SIG_MAGIC) ==
+                   RS_DONE);
+        sig_len = run(job, old, old_len, sig, MAX_LEN);
+        fresh = rs_sig_begin(256, 8, RS_RK_BLAKE2_SIG_MAGIC);
+        assert(run(fresh, old, old_len, sig2, MAX_LEN) == sig_len);
+        rs_job_free(fresh);
+        assert(!memcmp(sig, sig2, sig_len));
+
+        /* Load the signature into the signature from the last file. */
+        assert(rs_loadsig_reset(job, &sumset) == RS_DONE);
+        assert(run(job, sig, sig_len, NULL, 0) == 0);
+        assert(rs_build_hash_table(sumset) == RS_DONE);
+
+        /* Delta and patch recreate the new file. */
+        assert(rs_delta_reset(job, sumset) == RS_DONE);
+        delta_len = run(job, new, new_len, delta, 2 * MAX_LEN);
+        assert(rs_patch_reset(job, copy_cb, old) == RS_DONE);
+        out_len = run(job, delta, delta_len, out, MAX_LEN);
+        assert(out_len == new_len);
+        assert(!memcmp(out, new, new_len));
+    }
+    rs_job_free(job);
+    rs_free_sumset(sumset);
+
+    free(old);
+    free(new);
+    free(sig);
+    free(sig2);
+    free(delta);
+    free(out);
+    return 0;
+}
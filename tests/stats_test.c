@@ -0,0 +1,261 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "librsync.h"
+
+#define OLD_LEN 500000
+#define OUT_LEN 1000000
+
+static unsigned rnd_state = 1;
+
+static unsigned rnd(unsigned n)
+{
+    rnd_state = rnd_state * 1103515245 + 12345;
+    return (rnd_state >> 16) % n;
+}
+
+/* Run a job with all the input at once, in small output chunks. */
+static size_t run(rs_job_t *job, char *in, size_t in_len, char *out)
+{
+    rs_buffers_t buf;
+    rs_result result;
+
+    buf.next_in = in;
+    buf.avail_in = in_len;
+    buf.eof_in = 1;
+    buf.next_out = out;
+    do {
+        buf.avail_out = out ? 4096 : 0;
+        result = rs_job_iter(job, &buf);
+        assert(result == RS_DONE || result == RS_BLOCKED);
+        if (out)
+            out += 4096 - buf.avail_out;
+    } while (result != RS_DONE);
+    return in_len - buf.avail_in;
+}
+
+static rs_result copy_cb(void *arg, rs_long_t pos, size_t *len, void **buf)
+{
+    const char *basis = arg;
+
+    if (pos + (rs_long_t)*len > OLD_LEN)
+        *len = pos < OLD_LEN ? (size_t)(OLD_LEN - pos) : 0;
+    *buf = (void *)(basis + pos);
+    return RS_DONE;
+}
+
+/* Get the total count in a histogram. */
+static rs_long_t hist_sum(const rs_long_t *hist, int len)
+{
+    rs_long_t n = 0;
+
+    while (len--)
+        n += hist[len];
+    return n;
+}
+
+/* Check the command length histograms match the command counts. */
+static void check_hists(const rs_stats_t *s, const rs_hists_t *h)
+{
+    assert(hist_sum(h->lit_hist, RS_STATS_HIST_LEN) == s->lit_cmds);
+    assert(hist_sum(h->copy_hist, RS_STATS_HIST_LEN) == s->copy_cmds);
+}
+
+/* Check the phase times add up to no more than the job's run time. */
+static void check_times(const rs_times_t *t)
+{
+    assert(t->start_ns > 0);
+    assert(t->end_ns >= t->start_ns);
+    assert(t->scan_ns >= 0 && t->strong_ns >= 0 && t->emit_ns >= 0
+           && t->io_ns >= 0);
+    assert(t->scan_ns + t->strong_ns + t->emit_ns + t->io_ns <=
+           t->end_ns - t->start_ns);
+}
+
+int main(int argc, char **argv)
+{
+    char *old = malloc(OLD_LEN), *new = malloc(OLD_LEN), *sig =
+        malloc(OUT_LEN), *delta = malloc(OUT_LEN), *out = malloc(OUT_LEN);
+    char str[1000];
+    const rs_stats_t *s;
+    const rs_times_t *t;
+    rs_stats_t old_stats;
+    rs_match_stats_t ms;
+    rs_signature_t *sumset;
+    rs_long_t loadsig_ns;
+    rs_buffers_t buf;
+    rs_job_t *job;
+    size_t sig_len, delta_len, i;
+
+    for (i = 0; i < OLD_LEN; i++)
+        old[i] = (char)rnd(256);
+    memcpy(new, old, OLD_LEN);
+    for (i = 0; i < OLD_LEN; i += 10000)
+        new[i] ^= 1;
+
+    /* A signature job times its scanning and strong sums. */
+    job = rs_sig_begin(2048, 0, RS_RK_BLAKE2_SIG_MAGIC);
+    s = rs_job_statistics(job);
+    t = rs_job_times(job);
+    assert(t->start_ns > 0 && !t->end_ns);
+    buf.next_in = old;
+    buf.avail_in = OLD_LEN;
+    buf.eof_in = 1;
+    buf.next_out = sig;
+    buf.avail_out = OUT_LEN;
+    assert(rs_job_iter(job, &buf) == RS_DONE);
+    sig_len = OUT_LEN - buf.avail_out;
+    check_times(t);
+    assert(t->strong_ns > 0);
+    assert(!t->loadsig_ns && !t->hashtable_ns);
+    rs_format_job_stats(job, str, sizeof str);
+    assert(strstr(str, " sec] time[") && strstr(str, "strong "));
+    /* rs_format_stats() only has the stats without the phase times. */
+    rs_format_stats(s, str, sizeof str);
+    assert(!strstr(str, "time["));
+    rs_job_free(job);
+
+    /* A loadsig job times loading, which is kept with the signature. */
+    job = rs_loadsig_begin(&sumset);
+    run(job, sig, sig_len, NULL);
+    s = rs_job_statistics(job);
+    t = rs_job_times(job);
+    check_times(t);
+    assert(t->loadsig_ns > 0);
+    assert(t->loadsig_ns <= t->end_ns - t->start_ns);
+    loadsig_ns = t->loadsig_ns;
+    rs_job_free(job);
+    assert(rs_build_hash_table(sumset) == RS_DONE);
+
+    /* A delta job includes the signature's load and hashtable times. */
+    job = rs_delta_begin(sumset);
+    buf.next_in = new;
+    buf.avail_in = OLD_LEN;
+    buf.eof_in = 1;
+    buf.next_out = delta;
+    buf.avail_out = OUT_LEN;
+    assert(rs_job_iter(job, &buf) == RS_DONE);
+    delta_len = OUT_LEN - buf.avail_out;
+    s = rs_job_statistics(job);
+    t = rs_job_times(job);
+    check_times(t);
+    assert(t->loadsig_ns == loadsig_ns);
+    assert(t->hashtable_ns > 0);
+    assert(t->strong_ns > 0);
+    assert(t->scan_ns > 0);
+    rs_format_job_stats(job, str, sizeof str);
+    assert(strstr(str, "time[loadsig ") && strstr(str, ", hashtable "));
+    /* Each changed byte makes its block literal data between copies. */
+    check_hists(s, rs_job_hists(job));
+    assert(s->lit_cmds == 50 && rs_job_hists(job)->lit_hist[11] == 50);
+    assert(s->copy_cmds == 50);
+    assert(!s->false_matches);
+    rs_job_free(job);
+
+    /* The signature has the match stats for the delta. */
+    assert(rs_signature_stats(sumset, &ms) == RS_DONE);
+    assert(ms.find_count > ms.match_count);
+    /* All but the 50 changed blocks of the 245 blocks match. */
+    assert(ms.match_count == 245 - 50);
+    assert(ms.strongcmp_count >= ms.match_count);
+    assert(ms.strongcalc_count <= ms.strongcmp_count);
+    assert(ms.weakcmp_count >= ms.strongcmp_count);
+    assert(ms.false_matches == ms.strongcmp_count - ms.match_count);
+    assert(hist_sum(ms.probe_hist, RS_MATCH_PROBE_HIST_LEN) == ms.find_count);
+    assert(ms.probe_hist[0] > 0);
+
+    /* A patch job times reading the basis and writing the output. */
+    job = rs_patch_begin(copy_cb, old);
+    assert(run(job, delta, delta_len, out) == delta_len);
+    s = rs_job_statistics(job);
+    t = rs_job_times(job);
+    check_times(t);
+    assert(!t->scan_ns && !t->strong_ns);
+    assert(t->io_ns > 0);
+    assert(!memcmp(out, new, OLD_LEN));
+    check_hists(s, rs_job_hists(job));
+    assert(s->lit_cmds == 50 && s->copy_cmds == 50);
+
+    /* Reloading into the signature used by the delta doesn't give negative
+       strong sum times or false matches. */
+    assert(rs_loadsig_reset(job, &sumset) == RS_DONE);
+    run(job, sig, sig_len, NULL);
+    s = rs_job_statistics(job);
+    t = rs_job_times(job);
+    check_times(t);
+    assert(s->false_matches >= 0);
+    rs_job_free(job);
+    rs_free_sumset(sumset);
+
+    /* Rollsums don't change if one byte goes up by one, the next down by two
+       and the next up by one, so a block changed like that is a weak sum
+       match with a different strong sum. */
+    memcpy(new, old, OLD_LEN);
+    memset(old + 4096, 100, 3);
+    memcpy(new + 4096, "\145\142\145", 3);
+    job = rs_sig_begin(2048, 0, RS_BLAKE2_SIG_MAGIC);
+    buf.next_in = old;
+    buf.avail_in = OLD_LEN;
+    buf.eof_in = 1;
+    buf.next_out = sig;
+    buf.avail_out = OUT_LEN;
+    assert(rs_job_iter(job, &buf) == RS_DONE);
+    sig_len = OUT_LEN - buf.avail_out;
+    rs_job_free(job);
+    job = rs_loadsig_begin(&sumset);
+    run(job, sig, sig_len, NULL);
+    rs_job_free(job);
+    assert(rs_build_hash_table(sumset) == RS_DONE);
+    assert(rs_signature_stats(sumset, &ms) == RS_DONE);
+    assert(!ms.find_count && !ms.false_matches);
+    job = rs_delta_begin(sumset);
+    run(job, new, OLD_LEN, delta);
+    s = rs_job_statistics(job);
+    t = rs_job_times(job);
+    assert(s->false_matches >= 1);
+    assert(rs_signature_stats(sumset, &ms) == RS_DONE);
+    assert(ms.false_matches == s->false_matches);
+    assert(ms.false_matches == ms.strongcmp_count - ms.match_count);
+    rs_format_stats(s, str, sizeof str);
+    assert(strstr(str, " false]"));
+    rs_job_free(job);
+
+    /* Stats without nanosecond times format with the second times. */
+    memset(&old_stats, 0, sizeof old_stats);
+    old_stats.op = "old";
+    old_stats.in_bytes = 2000000;
+    old_stats.end = 2;
+    rs_format_stats(&old_stats, str, sizeof str);
+    assert(strstr(str, "(1.0 MB/s) in"));
+    assert(strstr(str, "2.000 sec]"));
+    assert(!strstr(str, "time["));
+
+    rs_free_sumset(sumset);
+    free(old);
+    free(new);
+    free(sig);
+    free(delta);
+    free(out);
+    return 0;
+}
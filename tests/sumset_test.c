@@ -32,7 +32,7 @@ int main(int argc, char **argv)
 {
     rs_signature_t sig;
     rs_result res;
-    rs_weak_sum_t weak = 0x12345678;
+    rs_weak_sum64_t weak = 0x12345678;
     rs_strong_sum_t strong = "ABCDEF";
     int i;
     unsigned char buf[256];
@@ -135,6 +135,84 @@ int main(int argc, char **argv)
     assert(block_len == 1000);
     assert(strong_len == 8);
 
+    /* old_fsize=100000, magic=rk/xxh3, block_len=rec, strong_len=rec. */
+    magic = RS_RK_XXH3_SIG_MAGIC;
+    block_len = 0;
+    strong_len = 0;
+    res = rs_sig_args(1000000, &magic, &block_len, &strong_len);
+    assert(res == RS_DONE);
+    assert(magic == RS_RK_XXH3_SIG_MAGIC);
+    assert(block_len == 896);
+    assert(strong_len == 16);
+
+    /* old_fsize=100000, magic=rk64/b2, block_len=rec, strong_len=min. */
+    magic = RS_RK64_BLAKE2_SIG_MAGIC;
+    block_len = 0;
+    strong_len = -1;
+    res = rs_sig_args(1000000, &magic, &block_len, &strong_len);
+    assert(res == RS_DONE);
+    assert(magic == RS_RK64_BLAKE2_SIG_MAGIC);
+    assert(block_len == 896);
+    assert(strong_len == 7);
+
+    /* old_fsize=unknown, magic=crc/xxh3, block_len=rec, strong_len=max. */
+    magic = RS_CRC32C_XXH3_SIG_MAGIC;
+    block_len = 0;
+    strong_len = 0;
+    res = rs_sig_args(-1, &magic, &block_len, &strong_len);
+    assert(res == RS_DONE);
+    assert(magic == RS_CRC32C_XXH3_SIG_MAGIC);
+    assert(block_len == 2048);
+    assert(strong_len == 16);
+
+    /* old_fsize=unknown, magic=rs/b3, block_len=rec, strong_len=max. */
+    magic = RS_BLAKE3_SIG_MAGIC;
+    block_len = 0;
+    strong_len = 0;
+    res = rs_sig_args(-1, &magic, &block_len, &strong_len);
+    assert(res == RS_DONE);
+    assert(magic == RS_BLAKE3_SIG_MAGIC);
+    assert(block_len == 2048);
+    assert(strong_len == 32);
+
+    /* old_fsize=unknown, magic=cdc/b3, block_len=rec, strong_len=max. */
+    magic = RS_CDC_BLAKE3_SIG_MAGIC;
+    block_len = 0;
+    strong_len = 0;
+    res = rs_sig_args(-1, &magic, &block_len, &strong_len);
+    assert(res == RS_DONE);
+    assert(magic == RS_CDC_BLAKE3_SIG_MAGIC);
+    assert(block_len == 2048);
+    assert(strong_len == 32);
+
+    /* old_fsize=1000000, magic=v2 rk64/md4, block_len=rec, strong_len=max. */
+    magic = RS_SIG_V2_MAGIC(RS_RK64_MD4_SIG_MAGIC);
+    block_len = 0;
+    strong_len = 0;
+    res = rs_sig_args(1000000, &magic, &block_len, &strong_len);
+    assert(res == RS_DONE);
+    assert(magic == 0x72730456);
+    assert(block_len == 896);
+    assert(strong_len == 16);
+
+    /* Test rs_sig_weak_len(). */
+    assert(rs_sig_weak_len(RS_SIG_V2_MAGIC(RS_RK_BLAKE2_SIG_MAGIC), 2048, -1)
+           == 4);
+    assert(rs_sig_weak_len(RS_SIG_V2_MAGIC(RS_RK64_BLAKE2_SIG_MAGIC), 2048,
+                           -1) == 8);
+    assert(rs_sig_weak_len(RS_SIG_V2_MAGIC(RS_RK_BLAKE2_SIG_MAGIC), 256, 0)
+           == 2);
+    assert(rs_sig_weak_len(RS_SIG_V2_MAGIC(RS_BLAKE2_SIG_MAGIC), 1024,
+                           1000000) == 3);
+    assert(rs_sig_weak_len(RS_SIG_V2_MAGIC(RS_RK_BLAKE2_SIG_MAGIC), 16384,
+                           (rs_long_t)1 << 30) == 4);
+    assert(rs_sig_weak_len(RS_SIG_V2_MAGIC(RS_RK64_BLAKE2_SIG_MAGIC), 16384,
+                           (rs_long_t)1 << 30) == 5);
+    assert(rs_sig_weak_len(RS_SIG_V2_MAGIC(RS_CDC_BLAKE2_SIG_MAGIC), 2048, -1)
+           == 2);
+    assert(rs_sig_weak_len(RS_SIG_V2_MAGIC(RS_CDC_BLAKE2_SIG_MAGIC), 16384,
+                           -1) == 3);
+
     /* magic=bad. */
     magic = 1;
     block_len = 0;
@@ -163,6 +241,23 @@ int main(int argc, char **argv)
     strong_len = 17;
     res = rs_sig_args(-1, &magic, &block_len, &strong_len);
     assert(res == RS_PARAM_ERROR);
+    magic = RS_XXH3_SIG_MAGIC;
+    block_len = 0;
+    strong_len = 17;
+    res = rs_sig_args(-1, &magic, &block_len, &strong_len);
+    assert(res == RS_PARAM_ERROR);
+    magic = RS_RK_BLAKE3_SIG_MAGIC;
+    block_len = 0;
+    strong_len = 33;
+    res = rs_sig_args(-1, &magic, &block_len, &strong_len);
+    assert(res == RS_PARAM_ERROR);
+
+    /* block_len=bad for CDC chunk lengths. */
+    magic = RS_CDC_BLAKE2_SIG_MAGIC;
+    block_len = 0x40000000;
+    strong_len = 0;
+    res = rs_sig_args(-1, &magic, &block_len, &strong_len);
+    assert(res == RS_PARAM_ERROR);
 
     /* Test rs_signature_init() */
     /* magic=rec, block_len=rec, strong_len=max. */
@@ -254,6 +349,9 @@ int main(int argc, char **argv)
     assert(((rs_block_sig_t *)sig.block_sigs)->weak_sum == 0x12345678);
     assert(memcmp(((rs_block_sig_t *)sig.block_sigs)->strong_sum, &strong, 6)
            == 0);
+    /* 32 bit weak sums pack into 4 bytes with the strong sum aligned to 4. */
+    assert((char *)rs_signature_add_block(&sig, weak, &strong) -
+           (char *)sig.block_sigs == 12);
     rs_signature_done(&sig);
 
     /* Prepare rs_build_hash_table() and rs_signature_find_match() tests. */
@@ -280,5 +378,128 @@ int main(int argc, char **argv)
 #endif
     rs_signature_done(&sig);
 
+    /* Test rs_signature_find_match() with 64 bit weaksums. */
+    res = rs_signature_init(&sig, RS_RK64_BLAKE2_SIG_MAGIC, 16, 6, -1);
+    for (i = 0; i < 256; i += 16) {
+        weak = rs_signature_calc_weak_sum(&sig, &buf[i], 16);
+        rs_signature_calc_strong_sum(&sig, &buf[i], 16, &strong);
+        /* 64 bit weak sums keep their high 32 bits after the strong sum. */
+        assert((char *)rs_signature_add_block(&sig, weak, &strong) -
+               (char *)sig.block_sigs == i);
+    }
+    rs_build_hash_table(&sig);
+    assert(sig.hashtable->count == 16);
+    /* Same 32 bit hashtable key, different weak, so no strongsum calc. */
+    assert(rs_signature_find_match(&sig, weak ^ 0x0000000100000001, &buf[2],
+                                   16) == -1);
+#ifndef HASHTABLE_NSTATS
+    assert(sig.calc_strong_count == 0);
+#endif
+    /* Matching weak, matching block. */
+    assert(rs_signature_find_match(&sig, weak, &buf[15 * 16], 16) == 15 * 16);
+#ifndef HASHTABLE_NSTATS
+    assert(sig.calc_strong_count == 1);
+#endif
+    rs_signature_done(&sig);
+
+    /* Test rs_signature_find_match() with v2 2 byte rollsum weaksums. */
+    res = rs_signature_init(&sig, RS_SIG_V2_MAGIC(RS_BLAKE2_SIG_MAGIC), 16, 6,
+                            -1);
+    assert(rs_signature_is_v2(&sig));
+    assert(sig.weak_sum_len == 4);
+    sig.weak_sum_len = 2;
+    for (i = 0; i < 256; i += 16) {
+        weak = rs_signature_calc_weak_sum(&sig, &buf[i], 16);
+        /* The top 2 bytes of the mix32() rollsum are in the file. */
+        weak = rs_signature_file_weak_sum(&sig, weak);
+        assert(weak ==
+               mix32((unsigned)rs_signature_calc_weak_sum(&sig, &buf[i], 16))
+               >> 16);
+        rs_signature_calc_strong_sum(&sig, &buf[i], 16, &strong);
+        rs_signature_add_block(&sig, weak, &strong);
+    }
+    rs_build_hash_table(&sig);
+    assert(sig.hashtable->count == 16);
+    /* Matching weak digest, matching block. */
+    weak = mix32((unsigned)rs_signature_calc_weak_sum(&sig, &buf[15 * 16], 16));
+    assert(rs_signature_find_match(&sig, weak, &buf[15 * 16], 16) == 15 * 16);
+    /* Only the top 2 bytes of the weak digest are matched. */
+    assert(rs_signature_find_match(&sig, weak ^ 0xffff, &buf[15 * 16], 16) ==
+           15 * 16);
+    assert(rs_signature_find_match(&sig, weak ^ 0x10000, &buf[15 * 16], 16) ==
+           -1);
+    rs_signature_done(&sig);
+
+    /* Test rs_signature_find_chunk() with chunks of 8, 16, ..., 40 bytes. */
+    res = rs_signature_init(&sig, RS_CDC_BLAKE2_SIG_MAGIC, 16, 6, -1);
+    for (i = 0; i < 120; i += (int)weak) {
+        weak = (rs_weak_sum64_t)(sig.count + 1) * 8;
+        rs_signature_calc_strong_sum(&sig, &buf[i], weak, &strong);
+        rs_signature_add_block(&sig, weak, &strong);
+    }
+    assert(sig.count == 5);
+    /* The chunk end offsets are stored. */
+    assert(((rs_block_sig_t *)sig.block_sigs)->weak_sum == 8);
+    rs_build_hash_table(&sig);
+    assert(sig.hashtable->count == 5);
+    /* Matching chunks. */
+    assert(rs_signature_find_chunk(&sig, &buf[0], 8) == 0);
+    assert(rs_signature_find_chunk(&sig, &buf[8], 16) == 8);
+    assert(rs_signature_find_chunk(&sig, &buf[80], 40) == 80);
+    /* Different chunks. */
+    assert(rs_signature_find_chunk(&sig, &buf[1], 8) == -1);
+    assert(rs_signature_find_chunk(&sig, &buf[8], 15) == -1);
+#ifndef HASHTABLE_NSTATS
+    assert(sig.calc_strong_count == 5);
+#endif
+    rs_signature_done(&sig);
+
+    /* Test rs_merge_sumset() with 64 byte coarse blocks and 16 byte fine
+       blocks of the first 240 bytes. Coarse blocks 1 and 3 match. */
+    rs_signature_t coarse, unmatched;
+    res = rs_signature_init(&coarse, 0, 64, 6, -1);
+    for (i = 0; i < 240; i += 64) {
+        size_t len = i + 64 < 240 ? 64 : 240 - i;
+        weak = rs_signature_calc_weak_sum(&coarse, &buf[i], len);
+        rs_signature_calc_strong_sum(&coarse, &buf[i], len, &strong);
+        rs_signature_add_block(&coarse, weak, &strong);
+    }
+    assert(coarse.count == 4);
+    /* Fine block lengths that don't divide the coarse block length fail. */
+    assert(rs_signature_fine_init(&sig, &coarse, 24) == RS_PARAM_ERROR);
+    res = rs_signature_fine_init(&sig, &coarse, 16);
+    assert(res == RS_DONE);
+    assert(sig.magic == coarse.magic && sig.block_len == 16);
+    assert(sig.size == 16 && sig.count == 0);
+    rs_signature_add_coarse_match(&sig, 1, &buf[64], 64);
+    rs_signature_add_coarse_match(&sig, 3, &buf[192], 48);
+    assert(sig.coarse_matched[0] == 0x0a && sig.coarse_last == 3);
+    /* The unmatched signature has the fine blocks of coarse blocks 0 and 2,
+       but is missing one at first. */
+    res = rs_signature_init(&unmatched, 0, 16, 6, -1);
+    for (i = 0; i < 240; i += 16) {
+        if (i / 64 == 1 || i / 64 == 3 || i == 176)
+            continue;
+        weak = rs_signature_calc_weak_sum(&unmatched, &buf[i], 16);
+        rs_signature_calc_strong_sum(&unmatched, &buf[i], 16, &strong);
+        rs_signature_add_block(&unmatched, weak, &strong);
+    }
+    assert(unmatched.count == 7);
+    assert(rs_merge_sumset(&sig, &unmatched) == RS_CORRUPT);
+    weak = rs_signature_calc_weak_sum(&unmatched, &buf[176], 16);
+    rs_signature_calc_strong_sum(&unmatched, &buf[176], 16, &strong);
+    rs_signature_add_block(&unmatched, weak, &strong);
+    assert(rs_merge_sumset(&sig, &unmatched) == RS_DONE);
+    assert(sig.count == 15 && !sig.coarse_matched);
+    rs_build_hash_table(&sig);
+    /* Every fine block is found at its offset. */
+    for (i = 0; i < 240; i += 16) {
+        weak = rs_signature_calc_weak_sum(&sig, &buf[i], 16);
+        assert(rs_signature_find_match(&sig, weak, &buf[i], 16) == i);
+    }
+    rs_signature_done(&unmatched);
+    rs_signature_done(&sig);
+    rs_signature_done(&coarse);
+
     return 0;
 }